@@ -27,7 +27,9 @@ import android.support.annotation.NonNull;
 import android.support.annotation.Nullable;
 import android.util.Log;
 
+import java.io.FileDescriptor;
 import java.io.InputStream;
+import java.nio.ByteBuffer;
 import java.lang.annotation.Retention;
 import java.lang.annotation.RetentionPolicy;
 
@@ -36,7 +38,7 @@ public final class BitmapDecoder {
 
     private static final String LOG_TAG = BitmapDecoder.class.getSimpleName();
 
-    @IntDef({CONFIG_AUTO, CONFIG_RGB_565, CONFIG_RGBA_8888})
+    @IntDef({CONFIG_AUTO, CONFIG_RGB_565, CONFIG_RGBA_8888, CONFIG_GRAY_8})
     @Retention(RetentionPolicy.SOURCE)
     public @interface Config {}
 
@@ -53,6 +55,96 @@ public final class BitmapDecoder {
      * The same as {@link android.graphics.Bitmap.Config#ARGB_8888}.
      */
     public static final int CONFIG_RGBA_8888 = 2;
+    /**
+     * One byte luminance per pixel, decoded to
+     * {@link android.graphics.Bitmap.Config#ALPHA_8}. Color images are converted.
+     */
+    public static final int CONFIG_GRAY_8 = 3;
+
+    @IntDef({RESAMPLE_NEAREST, RESAMPLE_2X2, RESAMPLE_AREA, RESAMPLE_BILINEAR})
+    @Retention(RetentionPolicy.SOURCE)
+    public @interface Resample {}
+
+    /**
+     * Take the center pixel of each ratio x ratio block. Fastest, but aliasing.
+     * Ratio is rounded down to integer.
+     */
+    public static final int RESAMPLE_NEAREST = 0;
+    /**
+     * Average the center 2x2 pixels of each ratio x ratio block.
+     * Ratio is rounded down to integer.
+     */
+    public static final int RESAMPLE_2X2 = 1;
+    /**
+     * Average all pixels of each ratio x ratio block. Best quality for downscaling.
+     * Ratio is rounded down to integer.
+     */
+    public static final int RESAMPLE_AREA = 2;
+    /**
+     * Bilinear interpolation. Ratio could be non-integer.
+     */
+    public static final int RESAMPLE_BILINEAR = 3;
+
+    @IntDef({ORIENTATION_NORMAL, ORIENTATION_FLIP_HORIZONTAL, ORIENTATION_ROTATE_180,
+            ORIENTATION_FLIP_VERTICAL, ORIENTATION_TRANSPOSE, ORIENTATION_ROTATE_90,
+            ORIENTATION_TRANSVERSE, ORIENTATION_ROTATE_270})
+    @Retention(RetentionPolicy.SOURCE)
+    public @interface Orientation {}
+
+    // The same values as EXIF orientation tag, see ImageInfo.orientation
+
+    /**
+     * Keep the image as it is.
+     */
+    public static final int ORIENTATION_NORMAL = 1;
+    /**
+     * Mirror left and right.
+     */
+    public static final int ORIENTATION_FLIP_HORIZONTAL = 2;
+    /**
+     * Rotate 180 degrees.
+     */
+    public static final int ORIENTATION_ROTATE_180 = 3;
+    /**
+     * Mirror top and bottom.
+     */
+    public static final int ORIENTATION_FLIP_VERTICAL = 4;
+    /**
+     * Mirror across the top-left to bottom-right diagonal. Width and height are swapped.
+     */
+    public static final int ORIENTATION_TRANSPOSE = 5;
+    /**
+     * Rotate 90 degrees clockwise. Width and height are swapped.
+     */
+    public static final int ORIENTATION_ROTATE_90 = 6;
+    /**
+     * Mirror across the top-right to bottom-left diagonal. Width and height are swapped.
+     */
+    public static final int ORIENTATION_TRANSVERSE = 7;
+    /**
+     * Rotate 270 degrees clockwise. Width and height are swapped.
+     */
+    public static final int ORIENTATION_ROTATE_270 = 8;
+
+    @IntDef({QUALITY_FAST, QUALITY_DEFAULT, QUALITY_BEST})
+    @Retention(RetentionPolicy.SOURCE)
+    public @interface Quality {}
+
+    // Only JPEG takes it, other formats are decoded the same way
+
+    /**
+     * Faster integer IDCT with less precision, chroma replicated instead of
+     * interpolated. Colors might be a bit blocky on edges, good for thumbnails.
+     */
+    public static final int QUALITY_FAST = 0;
+    /**
+     * Accurate integer IDCT and smooth chroma upsampling.
+     */
+    public static final int QUALITY_DEFAULT = 1;
+    /**
+     * Float IDCT. Slightly more accurate than {@link #QUALITY_DEFAULT}, but slower.
+     */
+    public static final int QUALITY_BEST = 2;
 
     /**
      * Only decode image info.
@@ -69,36 +161,220 @@ public final class BitmapDecoder {
      * config is {@code CONFIG_AUTO}.
      * ratio is {@code 1}.
      *
-     * @see #decode(InputStream, int, int)
+     * @see #decode(InputStream, int, float, int)
      */
     @Nullable
     public static Bitmap decode(InputStream is) {
-        return nativeDecodeBitmap(is, CONFIG_AUTO, 1);
+        return nativeDecodeBitmap(is, CONFIG_AUTO, 1, RESAMPLE_2X2, ORIENTATION_NORMAL,
+                QUALITY_DEFAULT, null);
     }
 
     /**
      * ratio is {@code 1}.
      *
-     * @see #decode(InputStream, int, int)
+     * @see #decode(InputStream, int, float, int)
      */
     @Nullable
     public static Bitmap decode(InputStream is, @Config int config) {
-        return nativeDecodeBitmap(is, config, 1);
+        return nativeDecodeBitmap(is, config, 1, RESAMPLE_2X2, ORIENTATION_NORMAL,
+                QUALITY_DEFAULT, null);
+    }
+
+    /**
+     * resample is {@code RESAMPLE_2X2}.
+     *
+     * @see #decode(InputStream, int, float, int)
+     */
+    @Nullable
+    public static Bitmap decode(InputStream is, @Config int config, int ratio) {
+        return nativeDecodeBitmap(is, config, ratio, RESAMPLE_2X2, ORIENTATION_NORMAL,
+                QUALITY_DEFAULT, null);
+    }
+
+    /**
+     * orientation is {@code ORIENTATION_NORMAL}.
+     *
+     * @see #decode(InputStream, int, float, int, int)
+     */
+    @Nullable
+    public static Bitmap decode(InputStream is, @Config int config, float ratio, @Resample int resample) {
+        return nativeDecodeBitmap(is, config, ratio, resample, ORIENTATION_NORMAL,
+                QUALITY_DEFAULT, null);
     }
 
     /**
      * Decode bitmap from {@code InputStream}. Return {@code null} if out of memory.
      *
      * @param is The image source.
-     * @param config One of {@link #CONFIG_AUTO}, {@link #CONFIG_RGB_565} and {@link #CONFIG_RGBA_8888}
+     * @param config One of {@link #CONFIG_AUTO}, {@link #CONFIG_RGB_565},
+     *               {@link #CONFIG_RGBA_8888} and {@link #CONFIG_GRAY_8}
      * @param ratio If set to a value > 1, requests the decoder to subsample the original.
      *               image, returning a smaller image to save memory. Power of 2 is not necessary.
+     * @param resample One of {@link #RESAMPLE_NEAREST}, {@link #RESAMPLE_2X2},
+     *                 {@link #RESAMPLE_AREA} and {@link #RESAMPLE_BILINEAR}
+     * @param orientation One of {@code ORIENTATION_*}, applied while rows are written.
+     *                    Pass {@link ImageInfo#orientation} to follow EXIF.
      * @return The decoded bitmap, or null if the image data could not be
      *         decoded.
      */
     @Nullable
-    public static Bitmap decode(InputStream is, @Config int config, int ratio) {
-        return nativeDecodeBitmap(is, config, ratio);
+    public static Bitmap decode(InputStream is, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation) {
+        return nativeDecodeBitmap(is, config, ratio, resample, orientation, QUALITY_DEFAULT, null);
+    }
+
+    /**
+     * The same as {@link #decode(InputStream, int, float, int, int)},
+     * but counts I/O into {@code stats}.
+     */
+    @Nullable
+    public static Bitmap decode(InputStream is, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation, @Nullable IoStats stats) {
+        return nativeDecodeBitmap(is, config, ratio, resample, orientation, QUALITY_DEFAULT, stats);
+    }
+
+    /**
+     * The same as {@link #decode(InputStream, int, float, int, int, IoStats)},
+     * but trades accuracy of JPEG for speed or the other way.
+     *
+     * @param quality One of {@link #QUALITY_FAST}, {@link #QUALITY_DEFAULT}
+     *                and {@link #QUALITY_BEST}
+     */
+    @Nullable
+    public static Bitmap decode(InputStream is, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation, @Quality int quality,
+            @Nullable IoStats stats) {
+        return nativeDecodeBitmap(is, config, ratio, resample, orientation, quality, stats);
+    }
+
+    /**
+     * Only decode image info from a regular file.
+     *
+     * @see #decode(InputStream, ImageInfo)
+     */
+    public static boolean decode(@NonNull FileDescriptor fd, @NonNull ImageInfo info) {
+        return nativeDecodeInfoFd(fd, info);
+    }
+
+    /**
+     * config is {@code CONFIG_AUTO}.
+     * ratio is {@code 1}.
+     *
+     * @see #decode(FileDescriptor, int, float, int, int)
+     */
+    @Nullable
+    public static Bitmap decode(@NonNull FileDescriptor fd) {
+        return nativeDecodeBitmapFd(fd, CONFIG_AUTO, 1, RESAMPLE_2X2, ORIENTATION_NORMAL,
+                QUALITY_DEFAULT, null);
+    }
+
+    /**
+     * Decode bitmap from a regular file. The file is mapped into memory
+     * instead of read through an {@code InputStream}. The caller still owns {@code fd}.
+     *
+     * @see #decode(InputStream, int, float, int, int)
+     */
+    @Nullable
+    public static Bitmap decode(@NonNull FileDescriptor fd, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation) {
+        return nativeDecodeBitmapFd(fd, config, ratio, resample, orientation,
+                QUALITY_DEFAULT, null);
+    }
+
+    /**
+     * The same as {@link #decode(FileDescriptor, int, float, int, int)},
+     * but counts I/O into {@code stats}.
+     */
+    @Nullable
+    public static Bitmap decode(@NonNull FileDescriptor fd, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation, @Nullable IoStats stats) {
+        return nativeDecodeBitmapFd(fd, config, ratio, resample, orientation, QUALITY_DEFAULT,
+                stats);
+    }
+
+    /**
+     * The same as {@link #decode(FileDescriptor, int, float, int, int, IoStats)},
+     * but in {@code quality}.
+     *
+     * @see #decode(InputStream, int, float, int, int, int, IoStats)
+     */
+    @Nullable
+    public static Bitmap decode(@NonNull FileDescriptor fd, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation, @Quality int quality,
+            @Nullable IoStats stats) {
+        return nativeDecodeBitmapFd(fd, config, ratio, resample, orientation, quality, stats);
+    }
+
+    /**
+     * Only decode image info from a direct {@code ByteBuffer}.
+     *
+     * @see #decode(ByteBuffer, int, float, int, int)
+     */
+    public static boolean decode(@NonNull ByteBuffer buffer, @NonNull ImageInfo info) {
+        Image.checkDirect(buffer);
+        return nativeDecodeInfoBuffer(buffer, buffer.position(), buffer.remaining(), info);
+    }
+
+    /**
+     * config is {@code CONFIG_AUTO}.
+     * ratio is {@code 1}.
+     *
+     * @see #decode(ByteBuffer, int, float, int, int)
+     */
+    @Nullable
+    public static Bitmap decode(@NonNull ByteBuffer buffer) {
+        return decode(buffer, CONFIG_AUTO, 1, RESAMPLE_2X2, ORIENTATION_NORMAL);
+    }
+
+    /**
+     * Decode bitmap from bytes between {@code position()} and {@code limit()}
+     * of a direct {@code ByteBuffer}. The bytes are read in place, no copy and
+     * no call back to Java. The position of the buffer is unchanged.
+     *
+     * @throws IllegalArgumentException if the buffer isn't direct
+     * @see #decode(InputStream, int, float, int, int)
+     */
+    @Nullable
+    public static Bitmap decode(@NonNull ByteBuffer buffer, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation) {
+        return decode(buffer, config, ratio, resample, orientation, QUALITY_DEFAULT);
+    }
+
+    /**
+     * The same as {@link #decode(ByteBuffer, int, float, int, int)}, but in {@code quality}.
+     *
+     * @see #decode(InputStream, int, float, int, int, int, IoStats)
+     */
+    @Nullable
+    public static Bitmap decode(@NonNull ByteBuffer buffer, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation, @Quality int quality) {
+        Image.checkDirect(buffer);
+        return nativeDecodeBitmapBuffer(buffer, buffer.position(), buffer.remaining(),
+                config, ratio, resample, orientation, quality);
+    }
+
+    /**
+     * Decode bitmap from the bytes cached under {@code key} by
+     * {@link EncodedCache#put(String, InputStream)}, in place.
+     *
+     * @return {@code null} if the key isn't cached or the bytes can't be decoded.
+     * @see #decode(InputStream, int, float, int, int)
+     */
+    @Nullable
+    public static Bitmap decodeCached(@NonNull String key, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation) {
+        return decodeCached(key, config, ratio, resample, orientation, QUALITY_DEFAULT);
+    }
+
+    /**
+     * The same as {@link #decodeCached(String, int, float, int, int)}, but in {@code quality}.
+     *
+     * @see #decode(InputStream, int, float, int, int, int, IoStats)
+     */
+    @Nullable
+    public static Bitmap decodeCached(@NonNull String key, @Config int config, float ratio,
+            @Resample int resample, @Orientation int orientation, @Quality int quality) {
+        return nativeDecodeBitmapCached(key, config, ratio, resample, orientation, quality);
     }
 
     // For native code
@@ -112,6 +388,9 @@ public final class BitmapDecoder {
             case CONFIG_RGBA_8888:
                 conf = Bitmap.Config.ARGB_8888;
                 break;
+            case CONFIG_GRAY_8:
+                conf = Bitmap.Config.ALPHA_8;
+                break;
             default:
                 Log.e(LOG_TAG, "Can't convert this config to Bitmap.Config: " + config);
                 return null;
@@ -131,5 +410,20 @@ public final class BitmapDecoder {
 
     private static native boolean nativeDecodeInfo(InputStream is, ImageInfo info);
 
-    private static native Bitmap nativeDecodeBitmap(InputStream is, int config, int ratio);
+    private static native Bitmap nativeDecodeBitmap(InputStream is, int config, float ratio,
+            int resample, int orientation, int quality, IoStats stats);
+
+    private static native boolean nativeDecodeInfoFd(FileDescriptor fd, ImageInfo info);
+
+    private static native boolean nativeDecodeInfoBuffer(ByteBuffer buffer, int offset, int length,
+            ImageInfo info);
+
+    private static native Bitmap nativeDecodeBitmapBuffer(ByteBuffer buffer, int offset, int length,
+            int config, float ratio, int resample, int orientation, int quality);
+
+    private static native Bitmap nativeDecodeBitmapFd(FileDescriptor fd, int config, float ratio,
+            int resample, int orientation, int quality, IoStats stats);
+
+    private static native Bitmap nativeDecodeBitmapCached(String key, int config, float ratio,
+            int resample, int orientation, int quality);
 }
@@ -23,10 +23,16 @@ package com.hippo.image;
 import android.graphics.Bitmap;
 import android.graphics.Rect;
 import android.support.annotation.Keep;
+import android.support.annotation.NonNull;
 import android.support.annotation.Nullable;
 import android.util.Log;
 
+import java.io.FileDescriptor;
 import java.io.InputStream;
+import java.nio.ByteBuffer;
+import java.util.concurrent.locks.Lock;
+import java.util.concurrent.locks.ReadWriteLock;
+import java.util.concurrent.locks.ReentrantReadWriteLock;
 
 public final class BitmapRegionDecoder {
 
@@ -37,17 +43,23 @@ public final class BitmapRegionDecoder {
     private final int mHeight;
     private final int mFormat;
     private final boolean mOpaque;
+    private final int mOrientation;
+    // The direct buffer the native stream reads, keep it alive
+    private ByteBuffer mSource;
 
-    private final Object mNativeLock = new Object();
+    // Decodes share the read lock, they only read the native bytes.
+    // Recycle takes the write lock, it waits for running decodes.
+    private final ReadWriteLock mNativeLock = new ReentrantReadWriteLock();
 
     @Keep
     private BitmapRegionDecoder(long nativePtr, int width, int height,
-            int format, boolean opaque) {
+            int format, boolean opaque, int orientation) {
         mNativePtr = nativePtr;
         mWidth = width;
         mHeight = height;
         mFormat = format;
         mOpaque = opaque;
+        mOrientation = orientation;
     }
 
     /**
@@ -78,42 +90,97 @@ public final class BitmapRegionDecoder {
         return mOpaque;
     }
 
+    /**
+     * Return EXIF orientation of the original image, one of {@code BitmapDecoder.ORIENTATION_*}.
+     * Width and height are before orientation.
+     */
+    @BitmapDecoder.Orientation
+    public int getOrientation() {
+        return mOrientation;
+    }
+
     /**
      * config is {@code BitmapDecoder.CONFIG_AUTO}.
      * ratio is {@code 1}.
      *
-     * @see #decodeRegion(Rect, int, int)
+     * @see #decodeRegion(Rect, int, float, int)
      */
     @Nullable
     public Bitmap decodeRegion(Rect rect) {
-        return decodeRegion(rect, BitmapDecoder.CONFIG_AUTO, 1);
+        return decodeRegion(rect, BitmapDecoder.CONFIG_AUTO, 1, BitmapDecoder.RESAMPLE_2X2);
     }
 
     /**
      * ratio is {@code 1}.
      *
-     * @see #decodeRegion(Rect, int, int)
+     * @see #decodeRegion(Rect, int, float, int)
      */
     @Nullable
     public Bitmap decodeRegion(Rect rect, @BitmapDecoder.Config int config) {
-        return decodeRegion(rect, config, 1);
+        return decodeRegion(rect, config, 1, BitmapDecoder.RESAMPLE_2X2);
+    }
+
+    /**
+     * resample is {@code BitmapDecoder.RESAMPLE_2X2}.
+     *
+     * @see #decodeRegion(Rect, int, float, int)
+     */
+    @Nullable
+    public Bitmap decodeRegion(Rect rect, @BitmapDecoder.Config int config, int ratio) {
+        return decodeRegion(rect, config, ratio, BitmapDecoder.RESAMPLE_2X2);
+    }
+
+    /**
+     * orientation is {@code BitmapDecoder.ORIENTATION_NORMAL}.
+     *
+     * @see #decodeRegion(Rect, int, float, int, int)
+     */
+    @Nullable
+    public Bitmap decodeRegion(Rect rect, @BitmapDecoder.Config int config, float ratio,
+            @BitmapDecoder.Resample int resample) {
+        return decodeRegion(rect, config, ratio, resample, BitmapDecoder.ORIENTATION_NORMAL);
+    }
+
+    /**
+     * quality is {@code BitmapDecoder.QUALITY_DEFAULT}.
+     *
+     * @see #decodeRegion(Rect, int, float, int, int, int)
+     */
+    @Nullable
+    public Bitmap decodeRegion(Rect rect, @BitmapDecoder.Config int config, float ratio,
+            @BitmapDecoder.Resample int resample, @BitmapDecoder.Orientation int orientation) {
+        return decodeRegion(rect, config, ratio, resample, orientation,
+                BitmapDecoder.QUALITY_DEFAULT);
     }
 
     /**
      * Decodes a rectangle region in the image specified by rect.
+     * Several threads can decode regions at the same time, each of them
+     * reads the shared bytes with its own cursor.
      *
      * @param rect The rectangle that specified the region to be decode.
      *             Null for decode full image.
-     * @param config One of {@link BitmapDecoder#CONFIG_AUTO}, {@link BitmapDecoder#CONFIG_RGB_565}
-     *               and {@link BitmapDecoder#CONFIG_RGBA_8888}
+     * @param config One of {@link BitmapDecoder#CONFIG_AUTO}, {@link BitmapDecoder#CONFIG_RGB_565},
+     *               {@link BitmapDecoder#CONFIG_RGBA_8888} and {@link BitmapDecoder#CONFIG_GRAY_8}
      * @param ratio If set to a value > 1, requests the decoder to subsample the original.
      *               image, returning a smaller image to save memory. Power of 2 is not necessary.
+     * @param resample One of {@link BitmapDecoder#RESAMPLE_NEAREST}, {@link BitmapDecoder#RESAMPLE_2X2},
+     *                 {@link BitmapDecoder#RESAMPLE_AREA} and {@link BitmapDecoder#RESAMPLE_BILINEAR}
+     * @param orientation One of {@code BitmapDecoder.ORIENTATION_*}. rect is in the image
+     *                    before orientation, the bitmap is after orientation.
+     *                    Pass {@link #getOrientation()} to follow EXIF.
+     * @param quality One of {@link BitmapDecoder#QUALITY_FAST}, {@link BitmapDecoder#QUALITY_DEFAULT}
+     *                and {@link BitmapDecoder#QUALITY_BEST}
      * @return The decoded bitmap, or null if the image data could not be
      *         decoded.
      */
     @Nullable
-    public Bitmap decodeRegion(Rect rect, @BitmapDecoder.Config int config, int ratio) {
-        synchronized (mNativeLock) {
+    public Bitmap decodeRegion(Rect rect, @BitmapDecoder.Config int config, float ratio,
+            @BitmapDecoder.Resample int resample, @BitmapDecoder.Orientation int orientation,
+            @BitmapDecoder.Quality int quality) {
+        Lock lock = mNativeLock.readLock();
+        lock.lock();
+        try {
             if (mNativePtr == 0) {
                 Log.e(LOG_TAG, "This region decoder is recycled.");
                 return null;
@@ -126,15 +193,41 @@ public final class BitmapRegionDecoder {
 
             if (rect == null || (rect.left == 0 && rect.top == 0 && rect.right == mWidth && rect.bottom == mHeight)) {
                 // Requested full image, decode without regions
-                return nativeDecodeRegion(mNativePtr, 0, 0, 0, 0, config, ratio);
+                return nativeDecodeRegion(mNativePtr, 0, 0, 0, 0, config, ratio, resample, orientation, quality);
             } else {
                 if (rect.right <= 0 || rect.bottom <= 0 || rect.left >= mWidth || rect.top >= mHeight || rect.isEmpty()) {
                     Log.e(LOG_TAG, "The decode rect is invalid.");
                     return null;
                 } else {
-                    return nativeDecodeRegion(mNativePtr, rect.left, rect.top, rect.width(), rect.height(), config, ratio);
+                    return nativeDecodeRegion(mNativePtr, rect.left, rect.top, rect.width(), rect.height(), config, ratio, resample, orientation, quality);
                 }
             }
+        } finally {
+            lock.unlock();
+        }
+    }
+
+    /**
+     * Create another region decoder reading the same bytes, no copy.
+     * The bytes are freed after every region decoder sharing them is recycled.
+     *
+     * @return Null if this region decoder is recycled.
+     */
+    @Nullable
+    public BitmapRegionDecoder share() {
+        Lock lock = mNativeLock.readLock();
+        lock.lock();
+        try {
+            if (mNativePtr == 0) {
+                Log.e(LOG_TAG, "This region decoder is recycled.");
+                return null;
+            }
+            BitmapRegionDecoder decoder = new BitmapRegionDecoder(nativeRef(mNativePtr),
+                    mWidth, mHeight, mFormat, mOpaque, mOrientation);
+            decoder.mSource = mSource;
+            return decoder;
+        } finally {
+            lock.unlock();
         }
     }
 
@@ -143,11 +236,16 @@ public final class BitmapRegionDecoder {
      * It will return null if decodeRegion().
      */
     public void recycle() {
-        synchronized (mNativeLock) {
+        Lock lock = mNativeLock.writeLock();
+        lock.lock();
+        try {
             if (mNativePtr != 0) {
                 nativeRecycle(mNativePtr);
                 mNativePtr = 0;
+                mSource = null;
             }
+        } finally {
+            lock.unlock();
         }
     }
 
@@ -171,13 +269,67 @@ public final class BitmapRegionDecoder {
         return nativeNewInstance(is);
     }
 
+    /**
+     * Create a BitmapRegionDecoder from a regular file.
+     * The file is mapped into memory, no copy in native heap.
+     * The caller still owns {@code fd}, and the file must not be truncated
+     * until this BitmapRegionDecoder is recycled.
+     */
+    @Nullable
+    public static BitmapRegionDecoder newInstance(FileDescriptor fd) {
+        if (fd == null) {
+            return null;
+        }
+        return nativeNewInstanceFd(fd);
+    }
+
+    /**
+     * Create a BitmapRegionDecoder from bytes between {@code position()}
+     * and {@code limit()} of a direct {@code ByteBuffer}. No copy is made,
+     * the bytes must stay unchanged until this BitmapRegionDecoder is recycled.
+     *
+     * @throws IllegalArgumentException if the buffer isn't direct
+     */
+    @Nullable
+    public static BitmapRegionDecoder newInstance(ByteBuffer buffer) {
+        if (buffer == null) {
+            return null;
+        }
+        Image.checkDirect(buffer);
+        BitmapRegionDecoder decoder = nativeNewInstanceBuffer(buffer, buffer.position(), buffer.remaining());
+        if (decoder != null) {
+            decoder.mSource = buffer;
+        }
+        return decoder;
+    }
+
+    /**
+     * Create a BitmapRegionDecoder from the bytes cached under {@code key} by
+     * {@link EncodedCache#put(String, InputStream)}. No copy is made, the bytes
+     * stay until this BitmapRegionDecoder is recycled, even if they are evicted.
+     *
+     * @return {@code null} if the key isn't cached or the bytes can't be decoded.
+     */
+    @Nullable
+    public static BitmapRegionDecoder newInstanceCached(@NonNull String key) {
+        return nativeNewInstanceCached(key);
+    }
+
     static {
         System.loadLibrary("image");
     }
 
     private static native BitmapRegionDecoder nativeNewInstance(InputStream is);
 
-    private static native Bitmap nativeDecodeRegion(long nativePtr, int x, int y, int width, int height, int config, int ratio);
+    private static native BitmapRegionDecoder nativeNewInstanceBuffer(ByteBuffer buffer, int offset, int length);
+
+    private static native BitmapRegionDecoder nativeNewInstanceFd(FileDescriptor fd);
+
+    private static native BitmapRegionDecoder nativeNewInstanceCached(String key);
+
+    private static native Bitmap nativeDecodeRegion(long nativePtr, int x, int y, int width, int height, int config, float ratio, int resample, int orientation, int quality);
+
+    private static native long nativeRef(long nativePtr);
 
     private static native void nativeRecycle(long nativePtr);
 }
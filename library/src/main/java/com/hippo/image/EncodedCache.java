@@ -0,0 +1,108 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.image;
+
+import android.support.annotation.Keep;
+import android.support.annotation.NonNull;
+
+import java.io.InputStream;
+
+/**
+ * A native LRU of encoded image bytes with a byte budget. Cached bytes are
+ * decoded in place by {@link Image#decodeCached(String, boolean)},
+ * {@link BitmapDecoder#decodeCached(String, int, float, int, int)} and
+ * {@link BitmapRegionDecoder#newInstanceCached(String)}, without reading
+ * an {@code InputStream} again.
+ */
+public final class EncodedCache {
+    private EncodedCache() {}
+
+    @Keep
+    public static final class Stats {
+        public long hits;
+        public long misses;
+        public long evictions;
+        /**
+         * Bytes of cached images.
+         */
+        public long size;
+        public long maxSize;
+        public long count;
+
+        // For native code
+        private void set(long hits, long misses, long evictions,
+                long size, long maxSize, long count) {
+            this.hits = hits;
+            this.misses = misses;
+            this.evictions = evictions;
+            this.size = size;
+            this.maxSize = maxSize;
+            this.count = count;
+        }
+    }
+
+    /**
+     * Set the budget in bytes, the least recently used images are evicted
+     * to fit. It's {@code 0} by default, nothing is cached.
+     */
+    public static void setMaxSize(long maxSize) {
+        nativeSetMaxSize(Math.max(maxSize, 0));
+    }
+
+    /**
+     * Read all bytes of the {@code InputStream} into the cache, replacing
+     * the old bytes of the key. The {@code InputStream} will be closed.
+     *
+     * @return {@code false} if out of memory or larger than the budget.
+     */
+    public static boolean put(@NonNull String key, @NonNull InputStream is) {
+        return nativePut(key, is);
+    }
+
+    /**
+     * Return {@code true} if the key is cached. It isn't counted as a hit or a miss.
+     */
+    public static boolean contains(@NonNull String key) {
+        return nativeContains(key);
+    }
+
+    /**
+     * Evict the least recently used images until at most {@code size} bytes are cached.
+     * Images being decoded stay until they are done.
+     */
+    public static void trim(long size) {
+        nativeTrim(Math.max(size, 0));
+    }
+
+    public static void getStats(@NonNull Stats stats) {
+        nativeGetStats(stats);
+    }
+
+    static {
+        System.loadLibrary("image");
+    }
+
+    private static native void nativeSetMaxSize(long maxSize);
+
+    private static native boolean nativePut(String key, InputStream is);
+
+    private static native boolean nativeContains(String key);
+
+    private static native void nativeTrim(long size);
+
+    private static native void nativeGetStats(Stats stats);
+}
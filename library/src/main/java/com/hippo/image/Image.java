@@ -21,9 +21,14 @@ package com.hippo.image;
  */
 
 import android.graphics.Bitmap;
+import android.graphics.Color;
+import android.os.Build;
 import android.support.annotation.NonNull;
+import android.support.annotation.Nullable;
 
+import java.io.FileDescriptor;
 import java.io.InputStream;
+import java.nio.ByteBuffer;
 
 public final class Image {
 
@@ -68,7 +73,99 @@ public final class Image {
     }
 
     public static ImageData decode(@NonNull InputStream is, boolean partially) {
-        return nativeDecode(is, partially);
+        return nativeDecode(is, partially, BitmapDecoder.QUALITY_DEFAULT, null);
+    }
+
+    /**
+     * The same as {@link #decode(InputStream, boolean)}, but counts I/O into {@code stats}.
+     */
+    public static ImageData decode(@NonNull InputStream is, boolean partially,
+            @Nullable IoStats stats) {
+        return nativeDecode(is, partially, BitmapDecoder.QUALITY_DEFAULT, stats);
+    }
+
+    /**
+     * The same as {@link #decode(InputStream, boolean, IoStats)}, but JPEG is
+     * decoded in {@code quality}, one of {@code BitmapDecoder.QUALITY_*}.
+     */
+    public static ImageData decode(@NonNull InputStream is, boolean partially,
+            @BitmapDecoder.Quality int quality, @Nullable IoStats stats) {
+        return nativeDecode(is, partially, quality, stats);
+    }
+
+    public static ImageData decode(@NonNull FileDescriptor fd) {
+        return decode(fd, false);
+    }
+
+    /**
+     * Decode from a regular file. The file is mapped into memory instead of
+     * copied to native heap. The caller still owns {@code fd}.
+     */
+    public static ImageData decode(@NonNull FileDescriptor fd, boolean partially) {
+        return nativeDecodeFd(fd, partially, BitmapDecoder.QUALITY_DEFAULT, null);
+    }
+
+    /**
+     * The same as {@link #decode(FileDescriptor, boolean)}, but counts I/O into {@code stats}.
+     */
+    public static ImageData decode(@NonNull FileDescriptor fd, boolean partially,
+            @Nullable IoStats stats) {
+        return nativeDecodeFd(fd, partially, BitmapDecoder.QUALITY_DEFAULT, stats);
+    }
+
+    /**
+     * The same as {@link #decode(FileDescriptor, boolean, IoStats)}, but JPEG is
+     * decoded in {@code quality}, one of {@code BitmapDecoder.QUALITY_*}.
+     */
+    public static ImageData decode(@NonNull FileDescriptor fd, boolean partially,
+            @BitmapDecoder.Quality int quality, @Nullable IoStats stats) {
+        return nativeDecodeFd(fd, partially, quality, stats);
+    }
+
+    /**
+     * Decode bytes from {@code position()} to {@code limit()} of a direct
+     * {@code ByteBuffer} in place. Animated images are always decoded completely,
+     * so the buffer isn't used after it returns.
+     */
+    public static ImageData decode(@NonNull ByteBuffer buffer) {
+        return decode(buffer, BitmapDecoder.QUALITY_DEFAULT);
+    }
+
+    /**
+     * The same as {@link #decode(ByteBuffer)}, but JPEG is decoded in
+     * {@code quality}, one of {@code BitmapDecoder.QUALITY_*}.
+     */
+    public static ImageData decode(@NonNull ByteBuffer buffer,
+            @BitmapDecoder.Quality int quality) {
+        checkDirect(buffer);
+        return nativeDecodeBuffer(buffer, buffer.position(), buffer.remaining(), quality);
+    }
+
+    /**
+     * Decode the bytes cached under {@code key} by {@link EncodedCache#put(String, InputStream)}
+     * in place. A partially decoded animated image keeps the bytes after eviction.
+     *
+     * @return {@code null} if the key isn't cached or the bytes can't be decoded.
+     */
+    @Nullable
+    public static ImageData decodeCached(@NonNull String key, boolean partially) {
+        return decodeCached(key, partially, BitmapDecoder.QUALITY_DEFAULT);
+    }
+
+    /**
+     * The same as {@link #decodeCached(String, boolean)}, but JPEG is decoded in
+     * {@code quality}, one of {@code BitmapDecoder.QUALITY_*}.
+     */
+    @Nullable
+    public static ImageData decodeCached(@NonNull String key, boolean partially,
+            @BitmapDecoder.Quality int quality) {
+        return nativeDecodeCached(key, partially, quality);
+    }
+
+    static void checkDirect(ByteBuffer buffer) {
+        if (!buffer.isDirect()) {
+            throw new IllegalArgumentException("Only direct ByteBuffer is supported");
+        }
     }
 
     public static ImageData create(@NonNull Bitmap bitmap) {
@@ -102,6 +199,18 @@ public final class Image {
         return mBuffer;
     }
 
+    /**
+     * Whether rendering the image to the bitmap needs premultiplying.
+     * Opaque images and opaque fill color skip it.
+     * Bitmaps are always premultiplied before KitKat.
+     */
+    static boolean needPremultiply(ImageData image, Bitmap bitmap, boolean fillBlank, int fillColor) {
+        if (image.isOpaque() && (!fillBlank || Color.alpha(fillColor) == 0xff)) {
+            return false;
+        }
+        return Build.VERSION.SDK_INT < Build.VERSION_CODES.KITKAT || bitmap.isPremultiplied();
+    }
+
     /**
      * Return all supported image formats, exclude {@link #FORMAT_PLAIN} and {@link #FORMAT_UNKNOWN}
      */
@@ -135,7 +244,16 @@ public final class Image {
         System.loadLibrary("image");
     }
 
-    private static native ImageData nativeDecode(InputStream is, boolean partially);
+    private static native ImageData nativeDecode(InputStream is, boolean partially, int quality,
+            IoStats stats);
+
+    private static native ImageData nativeDecodeFd(FileDescriptor fd, boolean partially,
+            int quality, IoStats stats);
+
+    private static native ImageData nativeDecodeBuffer(ByteBuffer buffer, int offset, int length,
+            int quality);
+
+    private static native ImageData nativeDecodeCached(String key, boolean partially, int quality);
 
     private static native ImageData nativeCreate(Bitmap bitmap);
 
@@ -33,13 +33,21 @@ public final class ImageInfo {
      * -1 for unknown
      */
     public int frameCount;
+    /**
+     * One of {@code BitmapDecoder.ORIENTATION_*}, from EXIF of JPEG.
+     * {@link #width} and {@link #height} are before orientation.
+     */
+    @BitmapDecoder.Orientation
+    public int orientation;
 
     // For native code
-    private void set(int width, int height, int format, boolean opaque, int frameCount) {
+    private void set(int width, int height, int format, boolean opaque, int frameCount,
+            int orientation) {
         this.width = width;
         this.height = height;
         this.format = format;
         this.opaque = opaque;
         this.frameCount = frameCount;
+        this.orientation = orientation;
     }
 }
@@ -62,6 +62,34 @@ public interface ImageRenderer {
     void render(Bitmap bitmap, int dstX, int dstY, int srcX, int srcY,
             int width, int height, int ratio, boolean fillBlank, int fillColor);
 
+    /**
+     * Render image to Bitmap.
+     *
+     * @param width src width
+     * @param height src height
+     * @param ratio dst width = src width / ratio
+     * @param resample one of {@link BitmapDecoder#RESAMPLE_NEAREST}, {@link BitmapDecoder#RESAMPLE_2X2},
+     *                 {@link BitmapDecoder#RESAMPLE_AREA} and {@link BitmapDecoder#RESAMPLE_BILINEAR}
+     */
+    void render(Bitmap bitmap, int dstX, int dstY, int srcX, int srcY,
+            int width, int height, int ratio, @BitmapDecoder.Resample int resample,
+            boolean fillBlank, int fillColor);
+
+    /**
+     * Render image to Bitmap, rotated and flipped.
+     *
+     * @param width src width
+     * @param height src height
+     * @param ratio dst width = src width / ratio
+     * @param resample one of {@link BitmapDecoder#RESAMPLE_NEAREST}, {@link BitmapDecoder#RESAMPLE_2X2},
+     *                 {@link BitmapDecoder#RESAMPLE_AREA} and {@link BitmapDecoder#RESAMPLE_BILINEAR}
+     * @param orientation one of {@code BitmapDecoder.ORIENTATION_*},
+     *                    dstX and dstY are where the oriented area starts
+     */
+    void render(Bitmap bitmap, int dstX, int dstY, int srcX, int srcY,
+            int width, int height, int ratio, @BitmapDecoder.Resample int resample,
+            @BitmapDecoder.Orientation int orientation, boolean fillBlank, int fillColor);
+
     /**
      * Call glTexImage2D or glTexSubImage2D.
      *
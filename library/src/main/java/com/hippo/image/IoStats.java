@@ -0,0 +1,64 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.image;
+
+import android.support.annotation.Keep;
+
+/**
+ * I/O counters of one decode. Pass it to {@code Image.decode()} or
+ * {@code BitmapDecoder.decode()}, it's set after decoding.
+ * Nothing is counted if no {@code IoStats} is passed.
+ */
+@Keep
+public final class IoStats {
+
+    /**
+     * Bytes the decoder read.
+     */
+    public long readBytes;
+    /**
+     * Bytes the decoder looked at without reading, mostly to detect the format.
+     */
+    public long peekedBytes;
+    /**
+     * Bytes the decoder skipped, like metadata.
+     */
+    public long skippedBytes;
+    /**
+     * Reads of the source, like {@code InputStream.read()} and {@code skip()}.
+     */
+    public long sourceReads;
+    /**
+     * Calls from native code to Java.
+     */
+    public long jniCalls;
+    /**
+     * Nanoseconds the decoder waited for the source.
+     */
+    public long blockedNanos;
+
+    // For native code
+    private void set(long readBytes, long peekedBytes, long skippedBytes,
+            long sourceReads, long jniCalls, long blockedNanos) {
+        this.readBytes = readBytes;
+        this.peekedBytes = peekedBytes;
+        this.skippedBytes = skippedBytes;
+        this.sourceReads = sourceReads;
+        this.jniCalls = jniCalls;
+        this.blockedNanos = blockedNanos;
+    }
+}
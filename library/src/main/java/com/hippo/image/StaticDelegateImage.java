@@ -72,9 +72,25 @@ final class StaticDelegateImage implements ImageRenderer {
     @Override
     public void render(Bitmap bitmap, int dstX, int dstY, int srcX, int srcY,
             int width, int height, int ratio, boolean fillBlank, int fillColor) {
+        render(bitmap, dstX, dstY, srcX, srcY, width, height, ratio,
+                BitmapDecoder.RESAMPLE_2X2, fillBlank, fillColor);
+    }
+
+    @Override
+    public void render(Bitmap bitmap, int dstX, int dstY, int srcX, int srcY,
+            int width, int height, int ratio, int resample, boolean fillBlank, int fillColor) {
+        render(bitmap, dstX, dstY, srcX, srcY, width, height, ratio, resample,
+                BitmapDecoder.ORIENTATION_NORMAL, fillBlank, fillColor);
+    }
+
+    @Override
+    public void render(Bitmap bitmap, int dstX, int dstY, int srcX, int srcY,
+            int width, int height, int ratio, int resample, int orientation,
+            boolean fillBlank, int fillColor) {
         checkRecycled("Can't call render on recycled ImageRender");
-        nativeRender(mStaticImage.getNativePtr(), bitmap, dstX, dstY,
-                srcX, srcY, width, height, ratio, fillBlank, fillColor);
+        boolean premultiply = Image.needPremultiply(mStaticImage, bitmap, fillBlank, fillColor);
+        nativeRender(mStaticImage.getNativePtr(), bitmap, dstX, dstY, srcX, srcY, width, height,
+                ratio, resample, orientation, premultiply, fillBlank, fillColor);
     }
 
     @Override
@@ -97,7 +113,8 @@ final class StaticDelegateImage implements ImageRenderer {
 
     private static native void nativeRender(long nativePtr,
             Bitmap bitmap, int dstX, int dstY, int srcX, int srcY,
-            int width, int height, int ratio, boolean fillBlank, int fillColor);
+            int width, int height, int ratio, int resample, int orientation,
+            boolean premultiply, boolean fillBlank, int fillColor);
 
     private static native void nativeGlTex(long nativePtr, long bufferPtr,
             boolean init, int texW, int texH, int dstX, int dstY,
@@ -0,0 +1,587 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Decode benchmark over a directory of images.
+ *
+ * Usage: image-bench [-i iterations] [-w warmup] [-o output] <corpus dir>
+ *
+ * Every file in the corpus directory is benchmarked with decode_info(),
+ * decode() and decode_buffer(). decode_buffer() sweeps ratios, resample
+ * modes, configs and clip rectangles. JPEG sweeps decode qualities too.
+ * The result is written as JSON.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "image_core.h"
+#include "image.h"
+#include "utils.h"
+
+
+#define DEFAULT_ITERATIONS 20
+#define DEFAULT_WARMUP 2
+
+#define OP_DECODE_INFO 0
+#define OP_DECODE 1
+#define OP_DECODE_BUFFER 2
+
+#define CLIP_FULL 0
+#define CLIP_CENTER 1
+#define CLIP_TILE 2
+#define CLIP_COUNT 3
+
+#define TILE_SIZE 256
+
+
+typedef struct {
+  char* name;
+  void* buffer;
+  size_t length;
+  ImageInfo info;
+} CorpusFile;
+
+typedef struct {
+  int op;
+  uint32_t ratio;
+  int32_t resample;
+  int32_t config;
+  int32_t quality;
+  int clip;
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+} BenchCase;
+
+typedef struct {
+  bool ok;
+  uint64_t pixels;
+  double mpix_per_s;
+  double p50_us;
+  double p99_us;
+  long peak_rss_kb;
+} BenchResult;
+
+
+static const uint32_t RATIOS[] = { 1, 2, 4, 8, 16 };
+static const int32_t RESAMPLES[] = { IMAGE_RESAMPLE_NEAREST, IMAGE_RESAMPLE_2X2,
+    IMAGE_RESAMPLE_AREA, IMAGE_RESAMPLE_BILINEAR };
+static const int32_t CONFIGS[] = { IMAGE_CONFIG_RGB_565, IMAGE_CONFIG_RGBA_8888 };
+static const int32_t QUALITIES[] = { IMAGE_QUALITY_FAST, IMAGE_QUALITY_DEFAULT,
+    IMAGE_QUALITY_BEST };
+static const int32_t DEFAULT_QUALITIES[] = { IMAGE_QUALITY_DEFAULT };
+static const char* const CLIP_NAMES[CLIP_COUNT] = { "full", "center", "tile" };
+
+static int iterations = DEFAULT_ITERATIONS;
+static int warmup = DEFAULT_WARMUP;
+
+static uint8_t* dst = NULL;
+static size_t dst_size = 0;
+
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// Writing 5 to clear_refs resets VmHWM, it's fine if the kernel doesn't support it
+static void reset_peak_rss() {
+  FILE* file = fopen("/proc/self/clear_refs", "w");
+  if (file != NULL) {
+    fputs("5", file);
+    fclose(file);
+  }
+}
+
+static long get_peak_rss_kb() {
+  char line[128];
+  long kb = -1;
+
+  FILE* file = fopen("/proc/self/status", "r");
+  if (file != NULL) {
+    while (fgets(line, sizeof(line), file) != NULL) {
+      if (strncmp(line, "VmHWM:", 6) == 0) {
+        kb = strtol(line + 6, NULL, 10);
+        break;
+      }
+    }
+    fclose(file);
+  }
+
+  if (kb < 0) {
+    // Lifetime peak of the process
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    kb = usage.ru_maxrss;
+  }
+
+  return kb;
+}
+
+static int compare_uint64_t(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Nearest-rank percentile of sorted samples
+static uint64_t percentile(const uint64_t* samples, int count, int p) {
+  int rank = (p * count + 99) / 100;
+  return samples[MAX(rank, 1) - 1];
+}
+
+static const char* get_format_name(const ImageInfo* info) {
+  switch (info->format) {
+    case IMAGE_FORMAT_PLAIN:
+      return "plain";
+    case IMAGE_FORMAT_BMP:
+      return "bmp";
+    case IMAGE_FORMAT_JPEG:
+      return "jpeg";
+    case IMAGE_FORMAT_PNG:
+      return info->frame_count > 1 ? "apng" : "png";
+    case IMAGE_FORMAT_GIF:
+      return "gif";
+    default:
+      return "unknown";
+  }
+}
+
+static const char* get_config_name(int32_t config) {
+  switch (config) {
+    case IMAGE_CONFIG_RGB_565:
+      return "RGB_565";
+    case IMAGE_CONFIG_RGBA_8888:
+      return "RGBA_8888";
+    default:
+      return "AUTO";
+  }
+}
+
+static const char* get_resample_name(int32_t resample) {
+  switch (resample) {
+    case IMAGE_RESAMPLE_NEAREST:
+      return "nearest";
+    case IMAGE_RESAMPLE_AREA:
+      return "area";
+    case IMAGE_RESAMPLE_BILINEAR:
+      return "bilinear";
+    default:
+      return "2x2";
+  }
+}
+
+static const char* get_quality_name(int32_t quality) {
+  switch (quality) {
+    case IMAGE_QUALITY_FAST:
+      return "fast";
+    case IMAGE_QUALITY_BEST:
+      return "best";
+    default:
+      return "default";
+  }
+}
+
+static const char* get_op_name(int op) {
+  switch (op) {
+    case OP_DECODE_INFO:
+      return "decode_info";
+    case OP_DECODE:
+      return "decode";
+    default:
+      return "decode_buffer";
+  }
+}
+
+static bool run_once(Stream* stream, const BenchCase* bench_case, uint64_t* pixels) {
+  if (!stream_seek(stream, 0)) {
+    return false;
+  }
+
+  switch (bench_case->op) {
+    case OP_DECODE_INFO: {
+      ImageInfo info;
+      *pixels = 0;
+      return image_core_decode_info(stream, &info);
+    }
+    case OP_DECODE: {
+      bool animated = false;
+      void* image = image_core_decode(stream, false, bench_case->quality, &animated, NULL);
+      if (image == NULL) {
+        return false;
+      }
+      if (animated) {
+        AnimatedImage* animated_image = image;
+        *pixels = (uint64_t) animated_image->width * animated_image->height
+            * animated_image->get_frame_count(animated_image);
+      } else {
+        StaticImage* static_image = image;
+        *pixels = (uint64_t) static_image->width * static_image->height;
+      }
+      image_core_recycle(image, animated);
+      return true;
+    }
+    default: {
+      ImageCoreBitmap bitmap;
+      // Count the source pixels, so ratios are comparable
+      *pixels = (uint64_t) bench_case->width * bench_case->height;
+      return image_core_decode_buffer(stream, bench_case->clip != CLIP_FULL,
+          bench_case->x, bench_case->y, bench_case->width, bench_case->height,
+          bench_case->config, bench_case->ratio, bench_case->resample, IMAGE_ORIENTATION_NORMAL,
+          bench_case->quality,
+          // Premultiply like Android Bitmap
+          true, dst, dst_size, &bitmap, NULL);
+    }
+  }
+}
+
+static void run_case(Stream* stream, const BenchCase* bench_case, BenchResult* result) {
+  uint64_t* samples;
+  uint64_t pixels = 0;
+  uint64_t total = 0;
+  int i;
+
+  memset(result, 0, sizeof(BenchResult));
+
+  samples = malloc(sizeof(uint64_t) * iterations);
+  if (samples == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return;
+  }
+
+  reset_peak_rss();
+
+  for (i = 0; i < warmup; i++) {
+    if (!run_once(stream, bench_case, &pixels)) {
+      goto end;
+    }
+  }
+
+  for (i = 0; i < iterations; i++) {
+    uint64_t start = now_ns();
+    if (!run_once(stream, bench_case, &pixels)) {
+      goto end;
+    }
+    samples[i] = now_ns() - start;
+    total += samples[i];
+  }
+
+  qsort(samples, (size_t) iterations, sizeof(uint64_t), &compare_uint64_t);
+
+  result->ok = true;
+  result->pixels = pixels;
+  result->mpix_per_s = total == 0 ? 0.0 : (double) pixels * iterations * 1000.0 / total;
+  result->p50_us = percentile(samples, iterations, 50) / 1000.0;
+  result->p99_us = percentile(samples, iterations, 99) / 1000.0;
+
+end:
+  result->peak_rss_kb = get_peak_rss_kb();
+  free(samples);
+}
+
+static void print_json_string(FILE* out, const char* str) {
+  fputc('"', out);
+  for (; *str != '\0'; str++) {
+    unsigned char c = (unsigned char) *str;
+    if (c == '"' || c == '\\') {
+      fputc('\\', out);
+      fputc(c, out);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void print_result(FILE* out, bool* first, const CorpusFile* file,
+    const BenchCase* bench_case, const BenchResult* result) {
+  fputs(*first ? "\n    {" : ",\n    {", out);
+  *first = false;
+
+  fputs("\"file\": ", out);
+  print_json_string(out, file->name);
+  fprintf(out, ", \"format\": \"%s\", \"width\": %u, \"height\": %u, \"frame_count\": %u",
+      get_format_name(&file->info), file->info.width, file->info.height, file->info.frame_count);
+  fprintf(out, ", \"op\": \"%s\"", get_op_name(bench_case->op));
+  if (bench_case->op != OP_DECODE_INFO) {
+    fprintf(out, ", \"quality\": \"%s\"", get_quality_name(bench_case->quality));
+  }
+  if (bench_case->op == OP_DECODE_BUFFER) {
+    fprintf(out, ", \"ratio\": %u, \"resample\": \"%s\", \"config\": \"%s\", \"clip\": \"%s\""
+        ", \"x\": %u, \"y\": %u, \"clip_width\": %u, \"clip_height\": %u",
+        bench_case->ratio, get_resample_name(bench_case->resample), get_config_name(bench_case->config), CLIP_NAMES[bench_case->clip],
+        bench_case->x, bench_case->y, bench_case->width, bench_case->height);
+  }
+  fprintf(out, ", \"ok\": %s", result->ok ? "true" : "false");
+  if (result->ok) {
+    fprintf(out, ", \"pixels\": %llu, \"mpix_per_s\": %.3f, \"p50_us\": %.1f, \"p99_us\": %.1f",
+        (unsigned long long) result->pixels, result->mpix_per_s, result->p50_us, result->p99_us);
+  }
+  fprintf(out, ", \"peak_rss_kb\": %ld}", result->peak_rss_kb);
+}
+
+static void set_clip(BenchCase* bench_case, const ImageInfo* info, int clip) {
+  bench_case->clip = clip;
+  switch (clip) {
+    case CLIP_CENTER:
+      bench_case->x = info->width / 4;
+      bench_case->y = info->height / 4;
+      bench_case->width = MAX(info->width / 2, 1);
+      bench_case->height = MAX(info->height / 2, 1);
+      break;
+    case CLIP_TILE:
+      // A tile a region decoder would ask for
+      bench_case->width = MIN(TILE_SIZE, info->width);
+      bench_case->height = MIN(TILE_SIZE, info->height);
+      bench_case->x = MIN(info->width / 3, info->width - bench_case->width);
+      bench_case->y = MIN(info->height / 3, info->height - bench_case->height);
+      break;
+    default:
+      bench_case->x = 0;
+      bench_case->y = 0;
+      bench_case->width = info->width;
+      bench_case->height = info->height;
+      break;
+  }
+}
+
+static void bench_file(FILE* out, bool* first, CorpusFile* file) {
+  Stream* stream;
+  BenchCase bench_case;
+  BenchResult result;
+  size_t size;
+  const int32_t* qualities;
+  size_t quality_count;
+  size_t i, j, k, q;
+  int clip;
+
+  // The stream takes the buffer, keep it to free the stream later
+  stream = buffer_stream_new(file->buffer, file->length);
+  if (stream == NULL) {
+    free(file->buffer);
+    return;
+  }
+  file->buffer = NULL;
+
+  if (!image_core_decode_info(stream, &file->info)) {
+    fprintf(stderr, "Skip %s: unknown image\n", file->name);
+    goto end;
+  }
+  fprintf(stderr, "Bench %s\n", file->name);
+
+  memset(&bench_case, 0, sizeof(BenchCase));
+  set_clip(&bench_case, &file->info, CLIP_FULL);
+  bench_case.quality = IMAGE_QUALITY_DEFAULT;
+
+  bench_case.op = OP_DECODE_INFO;
+  run_case(stream, &bench_case, &result);
+  print_result(out, first, file, &bench_case, &result);
+
+  // Other formats decode the same in every quality
+  if (file->info.format == IMAGE_FORMAT_JPEG) {
+    qualities = QUALITIES;
+    quality_count = sizeof(QUALITIES) / sizeof(QUALITIES[0]);
+  } else {
+    qualities = DEFAULT_QUALITIES;
+    quality_count = 1;
+  }
+
+  bench_case.op = OP_DECODE;
+  for (q = 0; q < quality_count; q++) {
+    bench_case.quality = qualities[q];
+    run_case(stream, &bench_case, &result);
+    print_result(out, first, file, &bench_case, &result);
+  }
+
+  // GIF has no decode_buffer()
+  if (file->info.format == IMAGE_FORMAT_GIF) {
+    goto end;
+  }
+
+  size = (size_t) file->info.width * file->info.height * 4;
+  if (size > dst_size) {
+    free(dst);
+    dst = malloc(size);
+    dst_size = dst == NULL ? 0 : size;
+    if (dst == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      goto end;
+    }
+  }
+
+  bench_case.op = OP_DECODE_BUFFER;
+  for (i = 0; i < sizeof(RATIOS) / sizeof(RATIOS[0]); i++) {
+    for (k = 0; k < sizeof(RESAMPLES) / sizeof(RESAMPLES[0]); k++) {
+      // All resample modes are the same without scaling
+      if (RATIOS[i] == 1 && RESAMPLES[k] != IMAGE_RESAMPLE_2X2) {
+        continue;
+      }
+      for (j = 0; j < sizeof(CONFIGS) / sizeof(CONFIGS[0]); j++) {
+        for (clip = 0; clip < CLIP_COUNT; clip++) {
+          for (q = 0; q < quality_count; q++) {
+            bench_case.ratio = RATIOS[i];
+            bench_case.resample = RESAMPLES[k];
+            bench_case.config = CONFIGS[j];
+            bench_case.quality = qualities[q];
+            set_clip(&bench_case, &file->info, clip);
+            run_case(stream, &bench_case, &result);
+            print_result(out, first, file, &bench_case, &result);
+          }
+        }
+      }
+    }
+  }
+
+end:
+  stream->close(&stream);
+}
+
+static bool read_file(const char* path, CorpusFile* file) {
+  struct stat st;
+  FILE* fp;
+  bool result = false;
+
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    return false;
+  }
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  file->length = (size_t) st.st_size;
+  file->buffer = malloc(file->length);
+  if (file->buffer != NULL && fread(file->buffer, 1, file->length, fp) == file->length) {
+    result = true;
+  } else {
+    free(file->buffer);
+    file->buffer = NULL;
+  }
+
+  fclose(fp);
+  return result;
+}
+
+static int compare_name(const void* a, const void* b) {
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static void print_usage() {
+  fprintf(stderr, "Usage: image-bench [-i iterations] [-w warmup] [-o output] <corpus dir>\n");
+}
+
+int main(int argc, char** argv) {
+  const char* output = NULL;
+  const char* dir_path;
+  DIR* dir;
+  struct dirent* entry;
+  char** names = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  size_t i;
+  FILE* out;
+  bool first = true;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:w:o:")) != -1) {
+    switch (opt) {
+      case 'i':
+        iterations = atoi(optarg);
+        break;
+      case 'w':
+        warmup = atoi(optarg);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        print_usage();
+        return 1;
+    }
+  }
+  if (optind != argc - 1 || iterations <= 0 || warmup < 0) {
+    print_usage();
+    return 1;
+  }
+  dir_path = argv[optind];
+
+  dir = opendir(dir_path);
+  if (dir == NULL) {
+    fprintf(stderr, "Can't open %s: %s\n", dir_path, strerror(errno));
+    return 1;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = MAX(capacity * 2, 16);
+      names = realloc(names, sizeof(char*) * capacity);
+      if (names == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+      }
+    }
+    names[count++] = strdup(entry->d_name);
+  }
+  closedir(dir);
+  // Stable order makes results easy to diff
+  qsort(names, count, sizeof(char*), &compare_name);
+
+  out = output != NULL ? fopen(output, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "Can't open %s: %s\n", output, strerror(errno));
+    return 1;
+  }
+
+  image_core_init();
+
+  fprintf(out, "{\n  \"iterations\": %d,\n  \"warmup\": %d,\n  \"results\": [", iterations, warmup);
+  for (i = 0; i < count; i++) {
+    CorpusFile file;
+    char path[4096];
+
+    memset(&file, 0, sizeof(CorpusFile));
+    file.name = names[i];
+    snprintf(path, sizeof(path), "%s/%s", dir_path, names[i]);
+    if (read_file(path, &file)) {
+      bench_file(out, &first, &file);
+    }
+    free(names[i]);
+  }
+  fputs("\n  ]\n}\n", out);
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  free(names);
+  free(dst);
+  return 0;
+}
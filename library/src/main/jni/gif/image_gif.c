@@ -18,6 +18,7 @@
 
 #include "image.h"
 #include "image_gif.h"
+#include "image_decoder.h"
 #include "../log.h"
 
 
@@ -57,6 +58,9 @@ bool gif_init(ImageLibrary* library) {
   library->decode = gif_decode;
   library->decode_info = gif_decode_info;
   library->decode_buffer = NULL;
+  library->new_index = NULL;
+  library->decode_region = NULL;
+  library->delete_index = NULL;
   library->create = NULL;
   library->get_description = gif_get_description;
 
@@ -360,7 +364,8 @@ static void recycle(AnimatedImage** image) {
   *image = NULL;
 }
 
-AnimatedImage* gif_decode(Stream* stream, bool partially, bool* animated) {
+AnimatedImage* gif_decode(Stream* stream, bool partially, __unused int32_t quality,
+    bool* animated) {
   *animated = true;
 
   AnimatedImage* animated_image = NULL;
@@ -475,6 +480,7 @@ bool gif_decode_info(Stream* stream, ImageInfo* info) {
   info->format = IMAGE_FORMAT_GIF;
   info->opaque = false; // Can't get opaque state, set false
   info->frame_count = -1; // For gif, must decode all frame to get frame count.
+  info->orientation = IMAGE_ORIENTATION_NORMAL;
 
   DGifCloseFile(gif_file, &error_code);
   return true;
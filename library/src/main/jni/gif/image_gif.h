@@ -38,7 +38,7 @@ bool gif_is_magic(Stream* stream);
 
 const char* gif_get_description();
 
-AnimatedImage* gif_decode(Stream* stream, bool partially, bool* animated);
+AnimatedImage* gif_decode(Stream* stream, bool partially, int32_t quality, bool* animated);
 
 bool gif_decode_info(Stream* stream, ImageInfo* info);
 
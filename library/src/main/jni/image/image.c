@@ -18,6 +18,7 @@
 #include <malloc.h>
 
 #include "image.h"
+#include "image_convert.h"
 #include "../log.h"
 
 #ifdef IMAGE_SINGLE_SHARED_LIB
@@ -28,6 +29,11 @@
   #include "image_gif.h"
 #endif
 
+struct ImageIndex {
+  ImageLibrary* library;
+  void* data;
+};
+
 static ImageLibrary image_libraries[IMAGE_FORMAT_MAX_COUNT] = { 0 };
 
 #ifdef IMAGE_SINGLE_SHARED_LIB
@@ -72,6 +78,8 @@ static void load_library(const char* lib_name, const char* init_func_name, Image
 
 // Dynamically load any available decoders from their shared libraries
 void init_image_libraries() {
+  init_convert();
+
 #ifdef IMAGE_SINGLE_SHARED_LIB
   load_library_local("plain_init", plain_init, &image_libraries[IMAGE_FORMAT_PLAIN]);
   load_library_local("bmp_init",   NULL,       &image_libraries[IMAGE_FORMAT_BMP]);
@@ -123,7 +131,7 @@ static ImageLibrary* get_library_for_image(Stream* stream) {
   return NULL;
 }
 
-void decode(Stream* stream, bool partially, bool* animated, void** image) {
+void decode(Stream* stream, bool partially, int32_t quality, bool* animated, void** image) {
   ImageLibrary* library = get_library_for_image(stream);
   if (library == NULL || library->decode == NULL) {
     LOGE(MSG("No valid image decode could be found"));
@@ -131,7 +139,7 @@ void decode(Stream* stream, bool partially, bool* animated, void** image) {
     return;
   }
 
-  *image = library->decode(stream, partially, animated);
+  *image = library->decode(stream, partially, quality, animated);
 }
 
 bool decode_info(Stream* stream, ImageInfo* info) {
@@ -145,14 +153,64 @@ bool decode_info(Stream* stream, ImageInfo* info) {
 }
 
 bool decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32_t width,
-    uint32_t height, int32_t config, uint32_t ratio, BufferContainer* container) {
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container) {
   ImageLibrary* library = get_library_for_image(stream);
   if (library == NULL || library->decode_buffer == NULL) {
     LOGE(MSG("No valid image decode_buffer could be found"));
     return false;
   }
 
-  return library->decode_buffer(stream, clip, x, y, width, height, config, ratio, container);
+  return library->decode_buffer(stream, clip, x, y, width, height, config, ratio, resample,
+      orientation, quality, premultiply, container);
+}
+
+ImageIndex* image_index_new(Stream* stream) {
+  ImageLibrary* library = get_library_for_image(stream);
+  ImageIndex* index;
+  void* data;
+
+  if (library == NULL || library->new_index == NULL) {
+    return NULL;
+  }
+
+  data = library->new_index(stream);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  index = malloc(sizeof(ImageIndex));
+  if (index == NULL) {
+    WTF_OOM;
+    library->delete_index(data);
+    return NULL;
+  }
+
+  index->library = library;
+  index->data = data;
+  return index;
+}
+
+void image_index_delete(ImageIndex** index) {
+  if (index == NULL || *index == NULL) {
+    return;
+  }
+
+  (*index)->library->delete_index((*index)->data);
+  free(*index);
+  *index = NULL;
+}
+
+bool decode_region(ImageIndex* index, Stream* stream, uint32_t x, uint32_t y, uint32_t width,
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container) {
+  if (index == NULL) {
+    return decode_buffer(stream, true, x, y, width, height, config, ratio, resample,
+        orientation, quality, premultiply, container);
+  }
+
+  return index->library->decode_region(index->data, stream, x, y, width, height, config,
+      ratio, resample, orientation, quality, premultiply, container);
 }
 
 StaticImage* create(uint32_t width, uint32_t height, const uint8_t* data) {
@@ -20,7 +20,17 @@
 
 #include <stdbool.h>
 
-#include "com_hippo_image_Image.h"
+#ifdef IMAGE_HOST_BUILD
+// No javah on host, keep these the same as com.hippo.image.Image
+#  define com_hippo_image_Image_FORMAT_UNKNOWN -1L
+#  define com_hippo_image_Image_FORMAT_PLAIN 0L
+#  define com_hippo_image_Image_FORMAT_BMP 1L
+#  define com_hippo_image_Image_FORMAT_JPEG 2L
+#  define com_hippo_image_Image_FORMAT_PNG 3L
+#  define com_hippo_image_Image_FORMAT_GIF 4L
+#else
+#  include "com_hippo_image_Image.h"
+#endif
 #include "static_image.h"
 #include "image_info.h"
 #include "buffer_container.h"
@@ -41,14 +51,38 @@
 
 #define IMAGE_FORMAT_MAX_COUNT 5
 
+/**
+ * What a codec learned about an image to decode its regions faster.
+ */
+struct ImageIndex;
+typedef struct ImageIndex ImageIndex;
+
 void init_image_libraries();
 
-void decode(Stream* stream, bool partially, bool* animated, void** image);
+void decode(Stream* stream, bool partially, int32_t quality, bool* animated, void** image);
 
 bool decode_info(Stream* stream, ImageInfo* info);
 
 bool decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32_t width,
-    uint32_t height, int32_t config, uint32_t ratio, BufferContainer* container);
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container);
+
+/**
+ * Index the image once for decode_region().
+ *
+ * @return NULL if the codec has no index or the image doesn't need one.
+ */
+ImageIndex* image_index_new(Stream* stream);
+
+void image_index_delete(ImageIndex** index);
+
+/**
+ * The same as decode_buffer() with clip, but faster with an index of the same bytes.
+ * Threads can share the index. Without index, it's decode_buffer().
+ */
+bool decode_region(ImageIndex* index, Stream* stream, uint32_t x, uint32_t y, uint32_t width,
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container);
 
 StaticImage* create(uint32_t width, uint32_t height, const uint8_t* data);
 
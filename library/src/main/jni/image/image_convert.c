@@ -17,6 +17,9 @@
 #include "image_convert.h"
 #include "image_decoder.h"
 #include "image_utils.h"
+#include "image_resample.h"
+#include "image_orientation.h"
+#include "thread_pool.h"
 #include "../log.h"
 
 
@@ -26,190 +29,274 @@
 #  define IMAGE_CONVERT_SIMD_RGBA8888_TO_RGBA8888_ROW_INTERNAL_2 RGBA8888_to_RGBA8888_row_internal_2_neon
 #  define IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_1   RGBA8888_to_RGB565_row_internal_1_neon
 #  define IMAGE_CONVERT_SIMD_RGB565_TO_RGB565_ROW_INTERNAL_2     RGB565_to_RGB565_row_internal_2_neon
+#  define IMAGE_CONVERT_SIMD_PREMULTIPLY_RGBA8888_ROW            premultiply_RGBA8888_row_neon
+#elif IMAGE_CONVERT_X86
+#  include "image_convert_x86.h"
+// SSE2 kernels, init_convert() replaces them with AVX2 ones if possible
+#  define IMAGE_CONVERT_SIMD_CHECK is_support_sse2
+#  define IMAGE_CONVERT_SIMD_RGBA8888_TO_RGBA8888_ROW_INTERNAL_2 RGBA8888_to_RGBA8888_row_internal_2_sse2
+#  define IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_1   RGBA8888_to_RGB565_row_internal_1_sse2
+#  define IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_2   RGBA8888_to_RGB565_row_internal_2_sse2
+#  define IMAGE_CONVERT_SIMD_RGB565_TO_RGB565_ROW_INTERNAL_2     RGB565_to_RGB565_row_internal_2_sse2
+#  define IMAGE_CONVERT_SIMD_PREMULTIPLY_RGBA8888_ROW            premultiply_RGBA8888_row_sse2
 #endif
 
 
-#define RGB565_BLUE(c) ((c) & 0x1f)
-#define RGB565_GREEN(c1, c2) ((((c1) & 0xe0) >> 5) | (((c2) & 0x7) << 3))
-#define RGB565_REG(c) ((c) >> 3)
+// Pixel formats, each one describes how to load and store its channels.
+// Channels are kept in the precision of the format while averaging,
+// so RGB565 averages 5-6-5 bits, the same as the SIMD kernels.
+//
+//   <F>_CONFIG                 IMAGE_CONFIG_* of the format
+//   <F>_DEPTH                  Bytes per pixel
+//   <F>_CHANNELS               Channels in v[]
+//   <F>_LOAD(p, v)             Load channels of pixel p to v[]
+//   <F>_STORE(p, v)            Store channels in v[] to pixel p
+//   <F>_TO_RGBA(v, r, g, b, a) Expand channels to 8-bit RGBA
+//   <F>_FROM_RGBA(p, r, g, b, a) Store 8-bit RGBA to pixel p
+
+#define RGBA8888_CONFIG IMAGE_CONFIG_RGBA_8888
+#define RGBA8888_DEPTH 4
+#define RGBA8888_CHANNELS 4
+#define RGBA8888_LOAD(p, v) \
+    ((v)[0] = (p)[0], (v)[1] = (p)[1], (v)[2] = (p)[2], (v)[3] = (p)[3])
+#define RGBA8888_STORE(p, v) \
+    ((p)[0] = (uint8_t) (v)[0], (p)[1] = (uint8_t) (v)[1], \
+     (p)[2] = (uint8_t) (v)[2], (p)[3] = (uint8_t) (v)[3])
+#define RGBA8888_TO_RGBA(v, r, g, b, a) \
+    ((r) = (v)[0], (g) = (v)[1], (b) = (v)[2], (a) = (v)[3])
+#define RGBA8888_FROM_RGBA(p, r, g, b, a) \
+    ((p)[0] = (uint8_t) (r), (p)[1] = (uint8_t) (g), (p)[2] = (uint8_t) (b), (p)[3] = (uint8_t) (a))
+
+// Little-endian 5-6-5, v[] is r, g, b
+#define RGB565_CONFIG IMAGE_CONFIG_RGB_565
+#define RGB565_DEPTH 2
+#define RGB565_CHANNELS 3
+#define RGB565_LOAD(p, v) \
+    ((v)[0] = (uint32_t) (p)[1] >> 3, \
+     (v)[1] = (uint32_t) ((p)[0] >> 5) | ((uint32_t) ((p)[1] & 0x7) << 3), \
+     (v)[2] = (uint32_t) (p)[0] & 0x1f)
+#define RGB565_STORE(p, v) \
+    ((p)[0] = (uint8_t) ((v)[1] << 5 | (v)[2]), (p)[1] = (uint8_t) ((v)[0] << 3 | (v)[1] >> 3))
+#define RGB565_TO_RGBA(v, r, g, b, a) \
+    ((r) = (v)[0] << 3 | (v)[0] >> 2, (g) = (v)[1] << 2 | (v)[1] >> 4, \
+     (b) = (v)[2] << 3 | (v)[2] >> 2, (a) = 0xff)
+#define RGB565_FROM_RGBA(p, r, g, b, a) \
+    ((p)[0] = (uint8_t) (((g) >> 2) << 5 | (b) >> 3), \
+     (p)[1] = (uint8_t) (((r) >> 3) << 3 | ((g) >> 2) >> 3))
+
+#define GRAY8_CONFIG IMAGE_CONFIG_GRAY_8
+#define GRAY8_DEPTH 1
+#define GRAY8_CHANNELS 1
+#define GRAY8_LOAD(p, v) ((v)[0] = (p)[0])
+#define GRAY8_STORE(p, v) ((p)[0] = (uint8_t) (v)[0])
+#define GRAY8_TO_RGBA(v, r, g, b, a) ((r) = (g) = (b) = (v)[0], (a) = 0xff)
+#define GRAY8_FROM_RGBA(p, r, g, b, a) ((p)[0] = rgb_to_gray((r), (g), (b)))
+
+// Supported conversions, X(SRC, DST). A new format only needs
+// its description above and its lines here.
+#define FOR_EACH_CONVERSION(X) \
+    X(RGBA8888, RGBA8888) \
+    X(RGBA8888, RGB565) \
+    X(RGBA8888, GRAY8) \
+    X(RGB565, RGB565) \
+    X(GRAY8, RGBA8888) \
+    X(GRAY8, RGB565) \
+    X(GRAY8, GRAY8)
+
+// Store channels of SRC as DST, the same format skips RGBA.
+// The condition is constant, the compiler drops the other branch.
+#define STORE_PIXEL(SRC, DST, p, v)                \
+    do {                                           \
+      if (SRC##_CONFIG == DST##_CONFIG) {          \
+        DST##_STORE(p, v);                         \
+      } else {                                     \
+        uint32_t r_, g_, b_, a_;                   \
+        SRC##_TO_RGBA(v, r_, g_, b_, a_);          \
+        (void) a_;                                 \
+        DST##_FROM_RGBA(p, r_, g_, b_, a_);        \
+      }                                            \
+    } while (0)
+
+// Row functions of ratio classes. _1 converts, _2 averages adjacent 2x2 pixels,
+// _n averages the center 2x2 pixels of each ratio x ratio block.
+// A power-of-two ratio takes _n, the stride is computed once per row anyway.
+#define DEFINE_ROW_FUNCS(SRC, DST)                                                 \
+static void SRC##_to_##DST##_row_1(uint8_t* dst,                                    \
+    const uint8_t* src1, __unused const uint8_t* src2,                             \
+    uint32_t d_width, __unused uint32_t ratio) {                                   \
+  uint32_t v[4];                                                                   \
+  if (SRC##_CONFIG == DST##_CONFIG) {                                              \
+    memcpy(dst, src1, (size_t) d_width * SRC##_DEPTH);                             \
+    return;                                                                        \
+  }                                                                                \
+  for (uint32_t i = 0; i < d_width; i++) {                                         \
+    SRC##_LOAD(src1, v);                                                           \
+    STORE_PIXEL(SRC, DST, dst, v);                                                 \
+    src1 += SRC##_DEPTH;                                                           \
+    dst += DST##_DEPTH;                                                            \
+  }                                                                                \
+}                                                                                  \
+                                                                                   \
+static inline void SRC##_to_##DST##_2x2(uint8_t* dst,                              \
+    const uint8_t* src1, const uint8_t* src2,                                      \
+    uint32_t d_width, const uint32_t ratio) {                                      \
+  const uint32_t interval = ratio * SRC##_DEPTH;                                   \
+  uint32_t v[4];                                                                   \
+  uint32_t sum[4];                                                                 \
+  src1 += (ratio - 2) / 2 * SRC##_DEPTH;                                           \
+  src2 += (ratio - 2) / 2 * SRC##_DEPTH;                                           \
+  for (uint32_t i = 0; i < d_width; i++) {                                         \
+    SRC##_LOAD(src1, sum);                                                         \
+    SRC##_LOAD(src1 + SRC##_DEPTH, v);                                             \
+    for (uint32_t c = 0; c < SRC##_CHANNELS; c++) sum[c] += v[c];                  \
+    SRC##_LOAD(src2, v);                                                           \
+    for (uint32_t c = 0; c < SRC##_CHANNELS; c++) sum[c] += v[c];                  \
+    SRC##_LOAD(src2 + SRC##_DEPTH, v);                                             \
+    for (uint32_t c = 0; c < SRC##_CHANNELS; c++) v[c] = (sum[c] + v[c]) / 4;      \
+    STORE_PIXEL(SRC, DST, dst, v);                                                 \
+    src1 += interval;                                                              \
+    src2 += interval;                                                              \
+    dst += DST##_DEPTH;                                                            \
+  }                                                                                \
+}                                                                                  \
+                                                                                   \
+static void SRC##_to_##DST##_row_2(uint8_t* dst,                                    \
+    const uint8_t* src1, const uint8_t* src2,                                      \
+    uint32_t d_width, __unused uint32_t ratio) {                                   \
+  SRC##_to_##DST##_2x2(dst, src1, src2, d_width, 2);                               \
+}                                                                                  \
+                                                                                   \
+static void SRC##_to_##DST##_row_n(uint8_t* dst,                                    \
+    const uint8_t* src1, const uint8_t* src2,                                      \
+    uint32_t d_width, uint32_t ratio) {                                            \
+  SRC##_to_##DST##_2x2(dst, src1, src2, d_width, ratio);                           \
+}
 
+FOR_EACH_CONVERSION(DEFINE_ROW_FUNCS)
 
-void RGBA8888_to_RGBA8888_row_internal_2(
-    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio) {
-  uint32_t i;
-  uint32_t start = (ratio - 2) / 2 * 4;
-  uint32_t interval = ratio * 4;
-
-  src1 += start;
-  src2 += start;
-  for (i = 0; i < d_width; i++) {
-    register uint16_t r, g, b, a;
-    r = src1[0] + src2[0];
-    g = src1[1] + src2[1];
-    b = src1[2] + src2[2];
-    a = src1[3] + src2[3];
-    r += src1[4] + src2[4];
-    g += src1[5] + src2[5];
-    b += src1[6] + src2[6];
-    a += src1[7] + src2[7];
-
-    dst[0] = (uint8_t) (r / 4);
-    dst[1] = (uint8_t) (g / 4);
-    dst[2] = (uint8_t) (b / 4);
-    dst[3] = (uint8_t) (a / 4);
-
-    src1 += interval;
-    src2 += interval;
-    dst += 4;
-  }
+#define RATIO_CLASS_1 0
+#define RATIO_CLASS_2 1
+#define RATIO_CLASS_N 2
+#define RATIO_CLASS_COUNT 3
+
+// Configs are small positive integers
+#define CONFIG_SLOTS (IMAGE_CONFIG_GRAY_8 + 1)
+
+#define ROW_FUNCS_ENTRY(SRC, DST) \
+    [SRC##_CONFIG][DST##_CONFIG] = { \
+        &SRC##_to_##DST##_row_1, &SRC##_to_##DST##_row_2, &SRC##_to_##DST##_row_n },
+
+// Generic kernels, init_convert() puts SIMD ones in
+static RowFunc row_funcs[CONFIG_SLOTS][CONFIG_SLOTS][RATIO_CLASS_COUNT] = {
+    FOR_EACH_CONVERSION(ROW_FUNCS_ENTRY)
+};
+
+// Round c * a / 255
+static inline uint8_t premultiply_channel(uint32_t c, uint32_t a) {
+  uint32_t t = c * a + 128;
+  return (uint8_t) ((t + (t >> 8)) >> 8);
 }
 
-void RGBA8888_to_RGBA8888_row(uint8_t* dst,
-    const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio) {
-  if (ratio == 1) {
-    memcpy(dst, src1, d_width * 4);
-  } else {
-#ifdef IMAGE_CONVERT_SIMD_RGBA8888_TO_RGBA8888_ROW_INTERNAL_2
-#  ifdef IMAGE_CONVERT_SIMD_CHECK
-    if (IMAGE_CONVERT_SIMD_CHECK()) {
-#  endif
-      IMAGE_CONVERT_SIMD_RGBA8888_TO_RGBA8888_ROW_INTERNAL_2(dst, src1, src2, d_width, ratio);
-#  ifdef IMAGE_CONVERT_SIMD_CHECK
-    } else {
-      RGBA8888_to_RGBA8888_row_internal_2(dst, src1, src2, d_width, ratio);
+static void premultiply_RGBA8888_row_internal(uint8_t* row, uint32_t width) {
+  uint32_t i;
+  uint8_t a;
+
+  for (i = 0; i < width; i++, row += 4) {
+    a = row[3];
+    if (a != 0xff) {
+      row[0] = premultiply_channel(row[0], a);
+      row[1] = premultiply_channel(row[1], a);
+      row[2] = premultiply_channel(row[2], a);
     }
-#  endif
-#else
-    RGBA8888_to_RGBA8888_row_internal_2(dst, src1, src2, d_width, ratio);
-#endif
   }
 }
 
+static void (*premultiply_row_func)(uint8_t* row, uint32_t width) =
+    &premultiply_RGBA8888_row_internal;
 
-static void RGBA8888_to_RGB565_row_internal_1(
-    uint8_t* dst, const uint8_t* src, uint32_t width) {
-  uint32_t i;
-  for (i = 0; i < width; i++) {
-    register uint8_t r, g, b;
-    r = src[0] >> 3;
-    g = src[1] >> 2;
-    b = src[2] >> 3;
+void premultiply_RGBA8888_row(uint8_t* row, uint32_t width) {
+  premultiply_row_func(row, width);
+}
 
-    dst[0] = (uint8_t) (g << 5 | b);
-    dst[1] = (uint8_t) (r << 3 | g >> 3);
+#ifdef IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_1
+// Row function wrapper of the one-source-row kernel
+static void RGBA8888_to_RGB565_row_1_simd(uint8_t* dst,
+    const uint8_t* src1, __unused const uint8_t* src2,
+    uint32_t d_width, __unused uint32_t ratio) {
+  IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_1(dst, src1, d_width);
+}
+#endif
 
-    src += 4;
-    dst += 2;
-  }
+#if IMAGE_CONVERT_X86
+static void RGBA8888_to_RGB565_row_1_avx2(uint8_t* dst,
+    const uint8_t* src1, __unused const uint8_t* src2,
+    uint32_t d_width, __unused uint32_t ratio) {
+  RGBA8888_to_RGB565_row_internal_1_avx2(dst, src1, d_width);
 }
+#endif
 
-static void RGBA8888_to_RGB565_row_internal_2(
-    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio) {
-  uint32_t i;
-  uint32_t start = (ratio - 2) / 2 * 4;
-  uint32_t interval = ratio * 4;
-
-  src1 += start;
-  src2 += start;
-  for (i = 0; i < d_width; i++) {
-    register uint16_t r, g, b;
-    r = src1[0] + src2[0];
-    g = src1[1] + src2[1];
-    b = src1[2] + src2[2];
-    r += src1[4] + src2[4];
-    g += src1[5] + src2[5];
-    b += src1[6] + src2[6];
-    r = (uint16_t) ((r / 4) >> 3);
-    g = (uint16_t) ((g / 4) >> 2);
-    b = (uint16_t) ((b / 4) >> 3);
-
-    dst[0] = (uint8_t) (g << 5 | b);
-    dst[1] = (uint8_t) (r << 3 | g >> 3);
-
-    src1 += interval;
-    src2 += interval;
-    dst += 2;
+void init_convert() {
+#ifdef IMAGE_CONVERT_SIMD_CHECK
+  if (!IMAGE_CONVERT_SIMD_CHECK()) {
+    return;
   }
-}
 
-void RGBA8888_to_RGB565_row(uint8_t* dst,
-    const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio) {
-  if (ratio == 1) {
-#ifdef IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_1
-#  ifdef IMAGE_CONVERT_SIMD_CHECK
-    if (IMAGE_CONVERT_SIMD_CHECK()) {
+  // The 2x2 kernels take any ratio
+#  ifdef IMAGE_CONVERT_SIMD_RGBA8888_TO_RGBA8888_ROW_INTERNAL_2
+  row_funcs[RGBA8888_CONFIG][RGBA8888_CONFIG][RATIO_CLASS_2] =
+      &IMAGE_CONVERT_SIMD_RGBA8888_TO_RGBA8888_ROW_INTERNAL_2;
+  row_funcs[RGBA8888_CONFIG][RGBA8888_CONFIG][RATIO_CLASS_N] =
+      &IMAGE_CONVERT_SIMD_RGBA8888_TO_RGBA8888_ROW_INTERNAL_2;
 #  endif
-      IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_1(dst, src1, d_width);
-#  ifdef IMAGE_CONVERT_SIMD_CHECK
-    } else {
-      RGBA8888_to_RGB565_row_internal_1(dst, src1, d_width);
-    }
+#  ifdef IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_1
+  row_funcs[RGBA8888_CONFIG][RGB565_CONFIG][RATIO_CLASS_1] = &RGBA8888_to_RGB565_row_1_simd;
+#  endif
+#  ifdef IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_2
+  row_funcs[RGBA8888_CONFIG][RGB565_CONFIG][RATIO_CLASS_2] =
+      &IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_2;
+  row_funcs[RGBA8888_CONFIG][RGB565_CONFIG][RATIO_CLASS_N] =
+      &IMAGE_CONVERT_SIMD_RGBA8888_TO_RGB565_ROW_INTERNAL_2;
+#  endif
+#  ifdef IMAGE_CONVERT_SIMD_RGB565_TO_RGB565_ROW_INTERNAL_2
+  row_funcs[RGB565_CONFIG][RGB565_CONFIG][RATIO_CLASS_2] =
+      &IMAGE_CONVERT_SIMD_RGB565_TO_RGB565_ROW_INTERNAL_2;
+  row_funcs[RGB565_CONFIG][RGB565_CONFIG][RATIO_CLASS_N] =
+      &IMAGE_CONVERT_SIMD_RGB565_TO_RGB565_ROW_INTERNAL_2;
+#  endif
+#  ifdef IMAGE_CONVERT_SIMD_PREMULTIPLY_RGBA8888_ROW
+  premultiply_row_func = &IMAGE_CONVERT_SIMD_PREMULTIPLY_RGBA8888_ROW;
 #  endif
-#else
-    RGBA8888_to_RGB565_row_internal_1(dst, src1, d_width);
 #endif
-  } else {
-    RGBA8888_to_RGB565_row_internal_2(dst, src1, src2, d_width, ratio);
-  }
-}
-
 
-static void RGB565_to_RGB565_row_internal_2(
-    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio) {
-  uint32_t i;
-  uint32_t start = (ratio - 2) / 2 * 2;
-  uint32_t interval = ratio * 2;
-
-  src1 += start;
-  src2 += start;
-  for (i = 0; i < d_width; i++) {
-    register uint8_t r, g, b;
-
-    b = (uint8_t) RGB565_BLUE(src1[0]) + (uint8_t) RGB565_BLUE(src2[0]);
-    g = (uint8_t) RGB565_GREEN(src1[0], src1[1]) + (uint8_t) RGB565_GREEN(src2[0], src2[1]);
-    r = RGB565_REG(src1[1]) + RGB565_REG(src2[1]);
-    b += (uint8_t) RGB565_BLUE(src1[2]) + (uint8_t) RGB565_BLUE(src2[2]);
-    g += (uint8_t) RGB565_GREEN(src1[2], src1[3]) + (uint8_t) RGB565_GREEN(src2[2], src2[3]);
-    r += RGB565_REG(src1[3]) + RGB565_REG(src2[3]);
-
-    b /= 4;
-    g /= 4;
-    r /= 4;
-
-    dst[0] = b | g << 5;
-    dst[1] = g >> 3 | r << 3;
-
-    src1 += interval;
-    src2 += interval;
-    dst += 2;
+#if IMAGE_CONVERT_X86
+  if (get_x86_simd_level() < X86_SIMD_AVX2) {
+    return;
   }
-}
 
-void RGB565_to_RGB565_row(uint8_t* dst,
-    const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio) {
-  if (ratio == 1) {
-    memcpy(dst, src1, d_width * 2);
-  } else {
-#ifdef IMAGE_CONVERT_SIMD_RGB565_TO_RGB565_ROW_INTERNAL_2
-#  ifdef IMAGE_CONVERT_SIMD_CHECK
-    if (IMAGE_CONVERT_SIMD_CHECK()) {
-#  endif
-      IMAGE_CONVERT_SIMD_RGB565_TO_RGB565_ROW_INTERNAL_2(dst, src1, src2, d_width, ratio);
-#  ifdef IMAGE_CONVERT_SIMD_CHECK
-    } else {
-      RGB565_to_RGB565_row_internal_2(dst, src1, src2, d_width, ratio);
-    }
-#  endif
-#else
-    RGB565_to_RGB565_row_internal_2(dst, src1, src2, d_width, ratio);
+  row_funcs[RGBA8888_CONFIG][RGBA8888_CONFIG][RATIO_CLASS_2] =
+      &RGBA8888_to_RGBA8888_row_internal_2_avx2;
+  row_funcs[RGBA8888_CONFIG][RGBA8888_CONFIG][RATIO_CLASS_N] =
+      &RGBA8888_to_RGBA8888_row_internal_2_avx2;
+  row_funcs[RGBA8888_CONFIG][RGB565_CONFIG][RATIO_CLASS_1] = &RGBA8888_to_RGB565_row_1_avx2;
+  row_funcs[RGBA8888_CONFIG][RGB565_CONFIG][RATIO_CLASS_2] =
+      &RGBA8888_to_RGB565_row_internal_2_avx2;
+  row_funcs[RGBA8888_CONFIG][RGB565_CONFIG][RATIO_CLASS_N] =
+      &RGBA8888_to_RGB565_row_internal_2_avx2;
+  row_funcs[RGB565_CONFIG][RGB565_CONFIG][RATIO_CLASS_2] =
+      &RGB565_to_RGB565_row_internal_2_avx2;
+  row_funcs[RGB565_CONFIG][RGB565_CONFIG][RATIO_CLASS_N] =
+      &RGB565_to_RGB565_row_internal_2_avx2;
+  premultiply_row_func = &premultiply_RGBA8888_row_avx2;
 #endif
+}
+
+RowFunc get_row_func(int32_t src_config, int32_t dst_config, uint32_t ratio) {
+  if (src_config <= 0 || src_config >= CONFIG_SLOTS ||
+      dst_config <= 0 || dst_config >= CONFIG_SLOTS) {
+    return NULL;
   }
+  return row_funcs[src_config][dst_config][
+      ratio <= 1 ? RATIO_CLASS_1 : (ratio == 2 ? RATIO_CLASS_2 : RATIO_CLASS_N)];
 }
 
 
@@ -222,6 +309,153 @@ static void memset_color(uint8_t* dst, uint8_t* color, size_t depth, size_t size
   }
 }
 
+// Convert in one band if the dst area is smaller
+#define CONVERT_PARALLEL_THRESHOLD (256 * 256)
+#define CONVERT_BAND_HEIGHT_MIN 16
+// Bands for each thread, more bands balance better
+#define CONVERT_BANDS_PER_THREAD 4
+
+typedef struct {
+  uint8_t* dst; // The first dst line, including the blank of dst_x
+  int32_t dst_config;
+  uint32_t dst_w;
+  uint32_t dst_x;
+  uint32_t w;
+  uint32_t h;
+  const uint8_t* src; // The first src pixel of the area
+  int32_t src_config;
+  uint32_t src_w;
+  uint32_t ratio;
+  int32_t resample;
+  RowFunc row_func;
+  bool premultiply;
+  bool fill_blank;
+  uint8_t* fill_color;
+  // Rows go through an orienter unless it's IMAGE_ORIENTATION_NORMAL,
+  // dst_* are in the destination before orientation then
+  int32_t orientation;
+  uint32_t dst_y;
+  uint32_t dst_h;
+  uint8_t* oriented_dst;
+  size_t oriented_stride;
+  uint32_t band_count;
+  volatile bool failed;
+} ConvertJob;
+
+static uint32_t get_band_count(uint32_t w, uint32_t h) {
+  uint32_t count;
+
+  if ((uint64_t) w * h < CONVERT_PARALLEL_THRESHOLD) {
+    return 1;
+  }
+
+  count = thread_pool_get_thread_count() * CONVERT_BANDS_PER_THREAD;
+  if (count > h / CONVERT_BAND_HEIGHT_MIN) {
+    count = h / CONVERT_BAND_HEIGHT_MIN;
+  }
+  return count < 1 ? 1 : count;
+}
+
+// Convert dst rows [index * h / band_count, (index + 1) * h / band_count)
+static void convert_band(void* data, uint32_t index, uint32_t thread) {
+  ConvertJob* job = data;
+  const uint32_t src_depth = get_depth_for_config(job->src_config);
+  const uint32_t dst_depth = get_depth_for_config(job->dst_config);
+  const uint32_t ratio = job->ratio;
+  const uint32_t skip = ratio < 2 ? 0 : (ratio - 2) / 2;
+  const uint32_t y_start = (uint32_t) ((uint64_t) job->h * index / job->band_count);
+  const uint32_t y_end = (uint32_t) ((uint64_t) job->h * (index + 1) / job->band_count);
+  const uint32_t band_h = y_end - y_start;
+  const size_t src_stride = job->src_w * src_depth;
+  const size_t dst_stride = job->dst_w * dst_depth;
+  uint8_t* dst = job->dst + y_start * dst_stride;
+  const uint8_t* src = job->src + y_start * ratio * src_stride;
+  const uint8_t* line1;
+  const bool oriented = job->orientation != IMAGE_ORIENTATION_NORMAL;
+  Resampler* resampler = NULL;
+  Orienter* orienter = NULL;
+  uint8_t* scratch;
+  size_t resampler_size;
+  uint32_t len;
+  uint32_t row;
+
+  // Row functions only do 2x2, other resample modes are the same without scaling.
+  // The band covers whole ratio x ratio cells, so it resamples alone.
+  // The resampler also takes care of orientation.
+  if ((job->resample != IMAGE_RESAMPLE_2X2 && ratio > 1) || oriented) {
+    resampler_size = resampler_get_buffer_size(job->resample,
+        job->src_config, job->w * ratio, band_h * ratio, job->w, band_h);
+    scratch = thread_pool_get_scratch(thread, resampler_size +
+        (oriented ? orienter_get_buffer_size(job->orientation, job->dst_config, job->w) : 0));
+    if (scratch != NULL) {
+      resampler = resampler_init(scratch, job->resample, job->src_config, job->dst_config,
+          job->w * ratio, band_h * ratio, job->w, band_h,
+          dst + job->dst_x * dst_depth, dst_stride);
+    }
+    if (resampler == NULL) {
+      job->failed = true;
+      return;
+    }
+    resampler_set_premultiply(resampler, job->premultiply);
+    if (oriented) {
+      orienter = orienter_init(scratch + resampler_size, job->orientation, job->dst_config,
+          job->dst_x, job->dst_y + y_start, job->w, band_h, job->dst_w, job->dst_h,
+          job->oriented_dst, job->oriented_stride);
+      resampler_set_orienter(resampler, orienter);
+    }
+  }
+
+  for (uint32_t i = 0; i < band_h; ++i) {
+    // Fill line start blank
+    len = job->dst_x;
+    if (job->fill_blank && len > 0) {
+      memset_color(dst, job->fill_color, dst_depth, len);
+    }
+    dst += len * dst_depth;
+
+    // Convert
+    if (resampler == NULL) {
+      line1 = src + skip * src_stride;
+      job->row_func(dst, line1, line1 + src_stride, job->w, ratio);
+      if (job->premultiply) {
+        // The row is still in cache
+        premultiply_RGBA8888_row(dst, job->w);
+      }
+    }
+    dst += job->w * dst_depth;
+
+    // Fill line end blank
+    len = job->dst_w - job->dst_x - job->w;
+    if (job->fill_blank && len > 0) {
+      memset_color(dst, job->fill_color, dst_depth, len);
+    }
+    dst += len * dst_depth;
+
+    src += ratio * src_stride;
+  }
+
+  // Resample the band after blanks are filled
+  if (resampler != NULL) {
+    src = job->src + y_start * ratio * src_stride;
+    while ((row = resampler_next_row(resampler)) < band_h * ratio) {
+      resampler_push_row(resampler, src + row * src_stride);
+    }
+  }
+}
+
+// Fill dst except the area
+static void fill_blank_around(uint8_t* dst, uint32_t dst_depth, uint32_t dst_w, uint32_t dst_h,
+    uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t* fill_color) {
+  memset_color(dst, fill_color, dst_depth, (size_t) y * dst_w);
+  dst += (size_t) y * dst_w * dst_depth;
+  for (uint32_t i = 0; i < h; i++) {
+    memset_color(dst, fill_color, dst_depth, x);
+    memset_color(dst + (x + w) * dst_depth, fill_color, dst_depth, dst_w - x - w);
+    dst += dst_w * dst_depth;
+  }
+  memset_color(dst, fill_color, dst_depth, (size_t) (dst_h - y - h) * dst_w);
+}
+
 // Use int32_t instead of uint32_t to avoid
 // the type hide negative number.
 static bool convert_internal(
@@ -232,13 +466,27 @@ static bool convert_internal(
     int32_t src_w, int32_t src_h,
     int32_t src_x, int32_t src_y,
     int32_t width, int32_t height,
-    int32_t ratio, bool fill_blank, uint8_t* fill_color) {
+    int32_t ratio, int32_t resample, int32_t orientation,
+    bool premultiply, bool fill_blank, uint8_t* fill_color) {
 
   int32_t temp;
   uint32_t len;
-  uint8_t* line1;
-  uint8_t* line2;
   RowFunc row_func = NULL;
+  uint8_t* const oriented_dst = dst;
+  const uint32_t oriented_w = (uint32_t) dst_w;
+  const uint32_t oriented_h = (uint32_t) dst_h;
+  const bool oriented = orientation != IMAGE_ORIENTATION_NORMAL;
+  uint32_t area_w;
+  uint32_t area_h;
+
+  if (!is_valid_resample(resample)) {
+    LOGE(MSG("Invalid resample: %d"), resample);
+    return false;
+  }
+  if (!is_valid_orientation(orientation)) {
+    LOGE(MSG("Invalid orientation: %d"), orientation);
+    return false;
+  }
 
   // Make width and height is multiple of ratio
   width = floor_uint32_t((uint32_t) width, (uint32_t) ratio);
@@ -247,6 +495,21 @@ static bool convert_internal(
   // Avoid ratio is too big to render
   if (ratio > width || ratio > height) { return false; }
 
+  if (oriented) {
+    // Clip in the destination before orientation,
+    // dst_x and dst_y are where the oriented area starts
+    area_w = (uint32_t) (width / ratio);
+    area_h = (uint32_t) (height / ratio);
+    if (is_transposed_orientation(orientation)) {
+      temp = area_w, area_w = area_h, area_h = (uint32_t) temp;
+    }
+    orient_area(get_inverse_orientation(orientation), (uint32_t) dst_w, (uint32_t) dst_h,
+        &dst_x, &dst_y, &area_w, &area_h);
+    if (is_transposed_orientation(orientation)) {
+      temp = dst_w, dst_w = dst_h, dst_h = temp;
+    }
+  }
+
   // Make sure x >= 0
   if (src_x < 0) {
     temp = ceil_uint32_t((uint32_t) -src_x, (uint32_t) ratio);
@@ -304,29 +567,15 @@ static bool convert_internal(
   const uint32_t dst_depth = get_depth_for_config(dst_config);
 
   // Row function
-  if (src_config == IMAGE_CONFIG_RGBA_8888) {
-    if (dst_config == IMAGE_CONFIG_RGBA_8888) {
-      row_func = &RGBA8888_to_RGBA8888_row;
-    } else if (dst_config == IMAGE_CONFIG_RGB_565) {
-      row_func = &RGBA8888_to_RGB565_row;
-    } else {
-      LOGE("Invalid dst config: %d", dst_config);
-      return false;
-    }
-  } else if (src_config == IMAGE_CONFIG_RGB_565) {
-    if (dst_config == IMAGE_CONFIG_RGB_565) {
-      row_func = &RGB565_to_RGB565_row;
-    } else {
-      LOGE("Invalid dst config: %d", dst_config);
-      return false;
-    }
-  } else {
-    LOGE("Invalid src config: %d", dst_config);
+  row_func = get_row_func(src_config, dst_config, ratio);
+  if (row_func == NULL) {
+    LOGE("Can't convert config %d to %d", src_config, dst_config);
+    return false;
   }
 
   // Fill start blank lines
   len = (uint32_t) (dst_y * dst_w);
-  if (fill_blank && len > 0) {
+  if (fill_blank && !oriented && len > 0) {
     memset_color(dst, fill_color, dst_depth, len);
   }
   dst += len * dst_depth;
@@ -334,30 +583,48 @@ static bool convert_internal(
   // Copy lines
   const uint32_t w = (uint32_t) (width / ratio);
   const uint32_t h = (uint32_t) (height / ratio);
-  const uint32_t skip = (const uint32_t) ((ratio - 2) / 2);
-  src += src_y * src_w * src_depth;
-  for (uint32_t i = 0; i < h; ++i) {
-    // Fill line start blank
-    len = (uint32_t) dst_x;
-    if (fill_blank && len > 0) {
-      memset_color(dst, fill_color, dst_depth, len);
-    }
-    dst += len * dst_depth;
-
-    // Convert
-    line1 = src + ((skip * src_w + src_x) * src_depth);
-    line2 = line1 + (src_w * src_depth);
-    row_func(dst, line1, line2, w, (uint32_t) ratio);
-    dst += w * dst_depth;
-
-    // Fill line end blank
-    len = dst_w - dst_x - w;
-    if (fill_blank && len > 0) {
-      memset_color(dst, fill_color, dst_depth, len);
+  ConvertJob job = {
+      .dst = dst,
+      .dst_config = dst_config,
+      .dst_w = (uint32_t) dst_w,
+      .dst_x = (uint32_t) dst_x,
+      .w = w,
+      .h = h,
+      .src = src + (src_y * src_w + src_x) * src_depth,
+      .src_config = src_config,
+      .src_w = (uint32_t) src_w,
+      .ratio = (uint32_t) ratio,
+      .resample = resample,
+      .row_func = row_func,
+      // Only RGBA8888 source has alpha
+      .premultiply = premultiply && src_config == IMAGE_CONFIG_RGBA_8888 &&
+          dst_config == IMAGE_CONFIG_RGBA_8888,
+      .fill_blank = fill_blank && !oriented,
+      .fill_color = fill_color,
+      .orientation = orientation,
+      .dst_y = (uint32_t) dst_y,
+      .dst_h = (uint32_t) dst_h,
+      .oriented_dst = oriented_dst,
+      .oriented_stride = oriented_w * get_depth_for_config(dst_config),
+      .failed = false,
+  };
+  job.band_count = get_band_count(w, h);
+  thread_pool_run(&convert_band, &job, job.band_count);
+  if (job.failed) {
+    return false;
+  }
+  dst += h * dst_w * dst_depth;
+
+  if (oriented) {
+    // Fill blanks around the oriented area
+    if (fill_blank) {
+      area_w = w;
+      area_h = h;
+      orient_area(orientation, (uint32_t) dst_w, (uint32_t) dst_h, &dst_x, &dst_y, &area_w, &area_h);
+      fill_blank_around(oriented_dst, dst_depth, oriented_w, oriented_h,
+          (uint32_t) dst_x, (uint32_t) dst_y, area_w, area_h, fill_color);
     }
-    dst += len * dst_depth;
-
-    src += ratio * src_w * src_depth;
+    return true;
   }
 
   // Fill end blank lines
@@ -376,7 +643,8 @@ void convert(uint8_t* dst, int32_t dst_config,
     uint32_t src_w, uint32_t src_h,
     int32_t src_x, int32_t src_y,
     uint32_t width, uint32_t height,
-    uint32_t ratio, bool fill_blank, uint32_t fill_color) {
+    uint32_t ratio, int32_t resample, int32_t orientation,
+    bool premultiply, bool fill_blank, uint32_t fill_color) {
   // Can't convert for not explicit config
   if (!is_explicit_config(src_config) || !is_explicit_config(dst_config)) {
     return;
@@ -388,15 +656,21 @@ void convert(uint8_t* dst, int32_t dst_config,
 
   if (dst_config == IMAGE_CONFIG_RGBA_8888) {
     memcpy(color, &fill_color, 4);
+    if (premultiply) {
+      premultiply_RGBA8888_row(color, 1);
+    }
   } else if (dst_config == IMAGE_CONFIG_RGB_565) {
     uint8_t* p = (uint8_t *) &fill_color;
     color[0] = (uint8_t) ((p[1] >> 2) << 5 | (p[2] >> 3));
     color[1] = (uint8_t) ((p[0] >> 3) << 3 | (p[1] >> 2) >> 3);
+  } else if (dst_config == IMAGE_CONFIG_GRAY_8) {
+    uint8_t* p = (uint8_t *) &fill_color;
+    color[0] = rgb_to_gray(p[0], p[1], p[2]);
   }
 
   if (!convert_internal(dst, dst_config, dst_w, dst_h, dst_x, dst_y,
       src, src_config, src_w, src_h, src_x, src_y, width, height,
-      ratio, fill_blank, color) && fill_blank) {
+      ratio, resample, orientation, premultiply, fill_blank, color) && fill_blank) {
     memset_color(dst, color, color_depth, (size_t) (dst_w * dst_h));
   }
 }
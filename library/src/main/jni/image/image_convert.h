@@ -23,24 +23,43 @@
 #include <stdbool.h>
 
 
+// BT.601 luma, the same as libjpeg
+static inline uint8_t rgb_to_gray(uint32_t r, uint32_t g, uint32_t b) {
+  return (uint8_t) ((77 * r + 150 * g + 29 * b + 128) >> 8);
+}
+
+
 typedef void (*RowFunc)(uint8_t* dst,
     const uint8_t* src1, const uint8_t* src2,
     uint32_t d_width, uint32_t ratio);
 
 
-void RGBA8888_to_RGBA8888_row(uint8_t* dst,
-    const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio);
+/**
+ * Pick the fastest row functions the CPU supports. Call it once before
+ * any conversion, the generic ones are used until then.
+ */
+void init_convert();
 
-void RGBA8888_to_RGB565_row(uint8_t* dst,
-    const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio);
+/**
+ * Return the row function from src_config to dst_config for ratio,
+ * or NULL if not supported. The function only takes the same ratio,
+ * except that the ones for ratio > 2 take any ratio > 1.
+ */
+RowFunc get_row_func(int32_t src_config, int32_t dst_config, uint32_t ratio);
 
-void RGB565_to_RGB565_row(uint8_t* dst,
-    const uint8_t* src1, const uint8_t* src2,
-    uint32_t d_width, uint32_t ratio);
+/**
+ * Multiply color channels of RGBA8888 pixels by alpha in place, rounded.
+ * Android Bitmap keeps premultiplied pixels.
+ */
+void premultiply_RGBA8888_row(uint8_t* row, uint32_t width);
 
 
+/**
+ * Convert the src area to dst at (dst_x, dst_y), width and height are divided by ratio.
+ * With orientation other than IMAGE_ORIENTATION_NORMAL, the area is rotated
+ * and flipped while rows are written, dst_x and dst_y are where
+ * the oriented area starts.
+ */
 void convert(uint8_t* dst, int32_t dst_config,
     uint32_t dst_w, uint32_t dst_h,
     int32_t dst_x, int32_t dst_y,
@@ -48,7 +67,8 @@ void convert(uint8_t* dst, int32_t dst_config,
     uint32_t src_w, uint32_t src_h,
     int32_t src_x, int32_t src_y,
     uint32_t width, uint32_t height,
-    uint32_t ratio, bool fill_blank, uint32_t fill_color);
+    uint32_t ratio, int32_t resample, int32_t orientation,
+    bool premultiply, bool fill_blank, uint32_t fill_color);
 
 
 #endif //IMAGE_IMAGE_CONVERT_H
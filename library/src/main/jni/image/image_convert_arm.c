@@ -184,3 +184,22 @@ void RGB565_to_RGB565_row_internal_2_neon(
   }
 }
 
+void premultiply_RGBA8888_row_neon(uint8_t* row, uint32_t width) {
+  uint32_t i;
+
+  // align_width is multiple of 8
+  uint32_t align_width = (width >> 3) << 3;
+  premultiply_rgba8888_neon(row, align_width);
+  row += align_width * 4;
+
+  for (i = align_width; i < width; i++) {
+    uint32_t a = row[3];
+    if (a != 0xff) {
+      for (uint32_t c = 0; c < 3; c++) {
+        uint32_t t = row[c] * a + 128;
+        row[c] = (uint8_t) ((t + (t >> 8)) >> 8);
+      }
+    }
+    row += 4;
+  }
+}
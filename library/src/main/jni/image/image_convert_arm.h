@@ -37,6 +37,9 @@ void rgba8888_to_rgb565_neon(uint8_t* dst,
 void rgb565_to_rgb565_neon_2(uint8_t* dst,
     const uint8_t* src1, const uint8_t* src2, uint32_t count);
 
+// count should be a multiple of 8
+void premultiply_rgba8888_neon(uint8_t* row, uint32_t count);
+
 
 void RGBA8888_to_RGBA8888_row_internal_2_neon(
     uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
@@ -49,5 +52,7 @@ void RGB565_to_RGB565_row_internal_2_neon(
     uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
     uint32_t d_width, uint32_t ratio);
 
+void premultiply_RGBA8888_row_neon(uint8_t* row, uint32_t width);
+
 
 #endif //IMAGE_IMAGE_CONVERT_NEON_H
@@ -0,0 +1,607 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cpuid.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "image_convert_x86.h"
+#include "../log.h"
+
+
+#define RGB565_BLUE(c) ((c) & 0x1f)
+#define RGB565_GREEN(c1, c2) ((((c1) & 0xe0) >> 5) | (((c2) & 0x7) << 3))
+#define RGB565_REG(c) ((c) >> 3)
+
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+// Permutation of 64-bit lanes to undo the in-lane packing of AVX2: 0, 2, 1, 3
+#define AVX2_PACK_ORDER 0xd8
+
+
+static volatile int simd_level = -1;
+
+static int detect_simd_level() {
+  unsigned int eax, ebx, ecx, edx;
+  unsigned int xcr0_eax, xcr0_edx;
+  int level = X86_SIMD_NONE;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || (edx & bit_SSE2) == 0) {
+    return level;
+  }
+  level = X86_SIMD_SSE2;
+
+  // AVX2 also needs the OS to save YMM registers
+  if ((ecx & bit_OSXSAVE) == 0 || (ecx & bit_AVX) == 0 || __get_cpuid_max(0, NULL) < 7) {
+    return level;
+  }
+  __asm__ volatile ("xgetbv" : "=a" (xcr0_eax), "=d" (xcr0_edx) : "c" (0));
+  if ((xcr0_eax & 0x6) != 0x6) {
+    return level;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  if ((ebx & bit_AVX2) != 0) {
+    level = X86_SIMD_AVX2;
+  }
+
+  return level;
+}
+
+int get_x86_simd_level() {
+  if (simd_level < 0) {
+    simd_level = detect_simd_level();
+  }
+  return simd_level;
+}
+
+bool is_support_sse2() {
+  return get_x86_simd_level() >= X86_SIMD_SSE2;
+}
+
+
+static inline uint32_t load_u32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Two pixel pairs, the second one is interval bytes after the first one
+static inline __m128i load_rgba_pairs_sse2(const uint8_t* p, uint32_t interval) {
+  if (interval == 8) {
+    return _mm_loadu_si128((const __m128i*) p);
+  } else {
+    return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*) p),
+        _mm_loadl_epi64((const __m128i*) (p + interval)));
+  }
+}
+
+// Four pixel pairs, each one is interval bytes after the previous one
+static inline __m128i load_rgb565_pairs_sse2(const uint8_t* p, uint32_t interval) {
+  if (interval == 4) {
+    return _mm_loadu_si128((const __m128i*) p);
+  } else {
+    return _mm_set_epi32((int) load_u32(p + 3 * interval), (int) load_u32(p + 2 * interval),
+        (int) load_u32(p + interval), (int) load_u32(p));
+  }
+}
+
+// Average of 2x2 pixels, two pairs in each row. Result is two pixels in 16-bit lanes.
+static inline __m128i average_rgba_sse2(__m128i row1, __m128i row2) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row1, zero), _mm_unpacklo_epi8(row2, zero));
+  __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row1, zero), _mm_unpackhi_epi8(row2, zero));
+  __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+  return _mm_srli_epi16(sum, 2);
+}
+
+// RGBA8888 pixels to RGB565 values in 32-bit lanes
+static inline __m128i rgba_to_rgb565_sse2(__m128i px) {
+  __m128i r = _mm_slli_epi32(_mm_and_si128(px, _mm_set1_epi32(0xf8)), 8);
+  __m128i g = _mm_srli_epi32(_mm_and_si128(px, _mm_set1_epi32(0xfc00)), 5);
+  __m128i b = _mm_srli_epi32(_mm_and_si128(px, _mm_set1_epi32(0xf80000)), 19);
+  return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+// Average of 2x2 RGB565 pixels, four pairs in each row. Result is in 32-bit lanes.
+static inline __m128i average_rgb565_sse2(__m128i row1, __m128i row2) {
+  const __m128i mask_5 = _mm_set1_epi16(0x1f);
+  const __m128i mask_6 = _mm_set1_epi16(0x3f);
+  const __m128i one = _mm_set1_epi16(1);
+  __m128i b = _mm_add_epi16(_mm_and_si128(row1, mask_5), _mm_and_si128(row2, mask_5));
+  __m128i g = _mm_add_epi16(_mm_and_si128(_mm_srli_epi16(row1, 5), mask_6),
+      _mm_and_si128(_mm_srli_epi16(row2, 5), mask_6));
+  __m128i r = _mm_add_epi16(_mm_srli_epi16(row1, 11), _mm_srli_epi16(row2, 11));
+  // madd adds the two pixels of each pair
+  b = _mm_srli_epi32(_mm_madd_epi16(b, one), 2);
+  g = _mm_srli_epi32(_mm_madd_epi16(g, one), 2);
+  r = _mm_srli_epi32(_mm_madd_epi16(r, one), 2);
+  return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 11), _mm_slli_epi32(g, 5)), b);
+}
+
+// There is no unsigned 32-bit to 16-bit pack in SSE2, sign-extend to keep the low 16 bits
+static inline __m128i pack_u32_sse2(__m128i a, __m128i b) {
+  a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+  b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+  return _mm_packs_epi32(a, b);
+}
+
+// Multiply two RGBA pixels in 16-bit lanes by alpha, rounded c * a / 255
+static inline __m128i premultiply_sse2(__m128i px) {
+  const __m128i rgb_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+  const __m128i alpha_one = _mm_set_epi16(0xff, 0, 0, 0, 0xff, 0, 0, 0);
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xff), 0xff);
+  __m128i t = _mm_or_si128(_mm_and_si128(a, rgb_mask), alpha_one);
+  t = _mm_add_epi16(_mm_mullo_epi16(px, t), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+
+static inline __m256i load_rgba_pairs_avx2(const uint8_t* p, uint32_t interval) TARGET_AVX2;
+static inline __m256i load_rgba_pairs_avx2(const uint8_t* p, uint32_t interval) {
+  if (interval == 8) {
+    return _mm256_loadu_si256((const __m256i*) p);
+  } else {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(load_rgba_pairs_sse2(p, interval)),
+        load_rgba_pairs_sse2(p + 2 * interval, interval), 1);
+  }
+}
+
+static inline __m256i load_rgb565_pairs_avx2(const uint8_t* p, uint32_t interval) TARGET_AVX2;
+static inline __m256i load_rgb565_pairs_avx2(const uint8_t* p, uint32_t interval) {
+  if (interval == 4) {
+    return _mm256_loadu_si256((const __m256i*) p);
+  } else {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(load_rgb565_pairs_sse2(p, interval)),
+        load_rgb565_pairs_sse2(p + 4 * interval, interval), 1);
+  }
+}
+
+// Result is pixel 0, 1 in low lane and pixel 2, 3 in high lane
+static inline __m256i average_rgba_avx2(__m256i row1, __m256i row2) TARGET_AVX2;
+static inline __m256i average_rgba_avx2(__m256i row1, __m256i row2) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(row1, zero), _mm256_unpacklo_epi8(row2, zero));
+  __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(row1, zero), _mm256_unpackhi_epi8(row2, zero));
+  __m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+  return _mm256_srli_epi16(sum, 2);
+}
+
+// Pack two results of average_rgba_avx2() to eight RGBA8888 pixels in order
+static inline __m256i pack_rgba_avx2(__m256i a, __m256i b) TARGET_AVX2;
+static inline __m256i pack_rgba_avx2(__m256i a, __m256i b) {
+  return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), AVX2_PACK_ORDER);
+}
+
+static inline __m256i rgba_to_rgb565_avx2(__m256i px) TARGET_AVX2;
+static inline __m256i rgba_to_rgb565_avx2(__m256i px) {
+  __m256i r = _mm256_slli_epi32(_mm256_and_si256(px, _mm256_set1_epi32(0xf8)), 8);
+  __m256i g = _mm256_srli_epi32(_mm256_and_si256(px, _mm256_set1_epi32(0xfc00)), 5);
+  __m256i b = _mm256_srli_epi32(_mm256_and_si256(px, _mm256_set1_epi32(0xf80000)), 19);
+  return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+static inline __m256i average_rgb565_avx2(__m256i row1, __m256i row2) TARGET_AVX2;
+static inline __m256i average_rgb565_avx2(__m256i row1, __m256i row2) {
+  const __m256i mask_5 = _mm256_set1_epi16(0x1f);
+  const __m256i mask_6 = _mm256_set1_epi16(0x3f);
+  const __m256i one = _mm256_set1_epi16(1);
+  __m256i b = _mm256_add_epi16(_mm256_and_si256(row1, mask_5), _mm256_and_si256(row2, mask_5));
+  __m256i g = _mm256_add_epi16(_mm256_and_si256(_mm256_srli_epi16(row1, 5), mask_6),
+      _mm256_and_si256(_mm256_srli_epi16(row2, 5), mask_6));
+  __m256i r = _mm256_add_epi16(_mm256_srli_epi16(row1, 11), _mm256_srli_epi16(row2, 11));
+  b = _mm256_srli_epi32(_mm256_madd_epi16(b, one), 2);
+  g = _mm256_srli_epi32(_mm256_madd_epi16(g, one), 2);
+  r = _mm256_srli_epi32(_mm256_madd_epi16(r, one), 2);
+  return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 11), _mm256_slli_epi32(g, 5)), b);
+}
+
+static inline __m256i pack_u32_avx2(__m256i a, __m256i b) TARGET_AVX2;
+static inline __m256i pack_u32_avx2(__m256i a, __m256i b) {
+  a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+  b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+  return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), AVX2_PACK_ORDER);
+}
+
+static inline __m256i premultiply_avx2(__m256i px) TARGET_AVX2;
+static inline __m256i premultiply_avx2(__m256i px) {
+  const __m256i rgb_mask = _mm256_set1_epi64x(0x0000ffffffffffffLL);
+  const __m256i alpha_one = _mm256_set1_epi64x(0x00ff000000000000LL);
+  __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, 0xff), 0xff);
+  __m256i t = _mm256_or_si256(_mm256_and_si256(a, rgb_mask), alpha_one);
+  t = _mm256_add_epi16(_mm256_mullo_epi16(px, t), _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+
+// Each kernel handles a multiple of its step and returns the count of handled pixels.
+// src1 and src2 already point to the first pixel pair, interval is in bytes.
+
+static uint32_t rgba_to_rgba_2_sse2(uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t interval) {
+  uint32_t i;
+  for (i = 0; i + 4 <= d_width; i += 4) {
+    __m128i a = average_rgba_sse2(load_rgba_pairs_sse2(src1, interval),
+        load_rgba_pairs_sse2(src2, interval));
+    __m128i b = average_rgba_sse2(load_rgba_pairs_sse2(src1 + 2 * interval, interval),
+        load_rgba_pairs_sse2(src2 + 2 * interval, interval));
+    _mm_storeu_si128((__m128i*) dst, _mm_packus_epi16(a, b));
+    src1 += 4 * interval;
+    src2 += 4 * interval;
+    dst += 4 * 4;
+  }
+  return i;
+}
+
+static uint32_t rgba_to_rgb565_1_sse2(uint8_t* dst, const uint8_t* src, uint32_t width) {
+  uint32_t i;
+  for (i = 0; i + 8 <= width; i += 8) {
+    __m128i a = rgba_to_rgb565_sse2(_mm_loadu_si128((const __m128i*) src));
+    __m128i b = rgba_to_rgb565_sse2(_mm_loadu_si128((const __m128i*) (src + 16)));
+    _mm_storeu_si128((__m128i*) dst, pack_u32_sse2(a, b));
+    src += 8 * 4;
+    dst += 8 * 2;
+  }
+  return i;
+}
+
+static uint32_t rgba_to_rgb565_2_sse2(uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t interval) {
+  uint32_t i;
+  for (i = 0; i + 8 <= d_width; i += 8) {
+    __m128i p[4];
+    for (int j = 0; j < 4; j++) {
+      p[j] = average_rgba_sse2(load_rgba_pairs_sse2(src1 + 2 * j * interval, interval),
+          load_rgba_pairs_sse2(src2 + 2 * j * interval, interval));
+    }
+    __m128i a = rgba_to_rgb565_sse2(_mm_packus_epi16(p[0], p[1]));
+    __m128i b = rgba_to_rgb565_sse2(_mm_packus_epi16(p[2], p[3]));
+    _mm_storeu_si128((__m128i*) dst, pack_u32_sse2(a, b));
+    src1 += 8 * interval;
+    src2 += 8 * interval;
+    dst += 8 * 2;
+  }
+  return i;
+}
+
+static uint32_t rgb565_to_rgb565_2_sse2(uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t interval) {
+  uint32_t i;
+  for (i = 0; i + 8 <= d_width; i += 8) {
+    __m128i a = average_rgb565_sse2(load_rgb565_pairs_sse2(src1, interval),
+        load_rgb565_pairs_sse2(src2, interval));
+    __m128i b = average_rgb565_sse2(load_rgb565_pairs_sse2(src1 + 4 * interval, interval),
+        load_rgb565_pairs_sse2(src2 + 4 * interval, interval));
+    _mm_storeu_si128((__m128i*) dst, pack_u32_sse2(a, b));
+    src1 += 8 * interval;
+    src2 += 8 * interval;
+    dst += 8 * 2;
+  }
+  return i;
+}
+
+static uint32_t premultiply_rgba_sse2(uint8_t* row, uint32_t width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha_mask = _mm_set1_epi32((int) 0xff000000);
+  uint32_t i;
+  for (i = 0; i + 4 <= width; i += 4) {
+    __m128i px = _mm_loadu_si128((const __m128i*) row);
+    // Skip opaque pixels
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(px, alpha_mask), alpha_mask)) != 0xffff) {
+      __m128i lo = premultiply_sse2(_mm_unpacklo_epi8(px, zero));
+      __m128i hi = premultiply_sse2(_mm_unpackhi_epi8(px, zero));
+      _mm_storeu_si128((__m128i*) row, _mm_packus_epi16(lo, hi));
+    }
+    row += 4 * 4;
+  }
+  return i;
+}
+
+TARGET_AVX2
+static uint32_t rgba_to_rgba_2_avx2(uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t interval) {
+  uint32_t i;
+  for (i = 0; i + 8 <= d_width; i += 8) {
+    __m256i a = average_rgba_avx2(load_rgba_pairs_avx2(src1, interval),
+        load_rgba_pairs_avx2(src2, interval));
+    __m256i b = average_rgba_avx2(load_rgba_pairs_avx2(src1 + 4 * interval, interval),
+        load_rgba_pairs_avx2(src2 + 4 * interval, interval));
+    _mm256_storeu_si256((__m256i*) dst, pack_rgba_avx2(a, b));
+    src1 += 8 * interval;
+    src2 += 8 * interval;
+    dst += 8 * 4;
+  }
+  return i;
+}
+
+TARGET_AVX2
+static uint32_t rgba_to_rgb565_1_avx2(uint8_t* dst, const uint8_t* src, uint32_t width) {
+  uint32_t i;
+  for (i = 0; i + 16 <= width; i += 16) {
+    __m256i a = rgba_to_rgb565_avx2(_mm256_loadu_si256((const __m256i*) src));
+    __m256i b = rgba_to_rgb565_avx2(_mm256_loadu_si256((const __m256i*) (src + 32)));
+    _mm256_storeu_si256((__m256i*) dst, pack_u32_avx2(a, b));
+    src += 16 * 4;
+    dst += 16 * 2;
+  }
+  return i;
+}
+
+TARGET_AVX2
+static uint32_t rgba_to_rgb565_2_avx2(uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t interval) {
+  uint32_t i;
+  for (i = 0; i + 16 <= d_width; i += 16) {
+    __m256i p[4];
+    for (int j = 0; j < 4; j++) {
+      p[j] = average_rgba_avx2(load_rgba_pairs_avx2(src1 + 4 * j * interval, interval),
+          load_rgba_pairs_avx2(src2 + 4 * j * interval, interval));
+    }
+    __m256i a = rgba_to_rgb565_avx2(pack_rgba_avx2(p[0], p[1]));
+    __m256i b = rgba_to_rgb565_avx2(pack_rgba_avx2(p[2], p[3]));
+    _mm256_storeu_si256((__m256i*) dst, pack_u32_avx2(a, b));
+    src1 += 16 * interval;
+    src2 += 16 * interval;
+    dst += 16 * 2;
+  }
+  return i;
+}
+
+TARGET_AVX2
+static uint32_t rgb565_to_rgb565_2_avx2(uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t interval) {
+  uint32_t i;
+  for (i = 0; i + 16 <= d_width; i += 16) {
+    __m256i a = average_rgb565_avx2(load_rgb565_pairs_avx2(src1, interval),
+        load_rgb565_pairs_avx2(src2, interval));
+    __m256i b = average_rgb565_avx2(load_rgb565_pairs_avx2(src1 + 8 * interval, interval),
+        load_rgb565_pairs_avx2(src2 + 8 * interval, interval));
+    _mm256_storeu_si256((__m256i*) dst, pack_u32_avx2(a, b));
+    src1 += 16 * interval;
+    src2 += 16 * interval;
+    dst += 16 * 2;
+  }
+  return i;
+}
+
+TARGET_AVX2
+static uint32_t premultiply_rgba_avx2(uint8_t* row, uint32_t width) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i alpha_mask = _mm256_set1_epi32((int) 0xff000000);
+  uint32_t i;
+  for (i = 0; i + 8 <= width; i += 8) {
+    __m256i px = _mm256_loadu_si256((const __m256i*) row);
+    // Skip opaque pixels
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(px, alpha_mask), alpha_mask)) != -1) {
+      // Unpack and pack are both in-lane, pixels stay in order
+      __m256i lo = premultiply_avx2(_mm256_unpacklo_epi8(px, zero));
+      __m256i hi = premultiply_avx2(_mm256_unpackhi_epi8(px, zero));
+      _mm256_storeu_si256((__m256i*) row, _mm256_packus_epi16(lo, hi));
+    }
+    row += 8 * 4;
+  }
+  return i;
+}
+
+
+// The SIMD part of a row, returns how many pixels it did
+typedef uint32_t (*Kernel1)(uint8_t* dst, const uint8_t* src, uint32_t width);
+typedef uint32_t (*Kernel2)(uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t interval);
+typedef uint32_t (*KernelPremultiply)(uint8_t* row, uint32_t width);
+
+// Every public entry inlines a kernel and the scalar tail, so picking
+// SSE2 or AVX2 is done once by init_convert(), not per row
+static inline __attribute__((always_inline)) void rgba_to_rgba_row_2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio, Kernel2 kernel) {
+  uint32_t i;
+  uint32_t start = (ratio - 2) / 2 * 4;
+  uint32_t interval = ratio * 4;
+
+  src1 += start;
+  src2 += start;
+  i = kernel(dst, src1, src2, d_width, interval);
+  src1 += i * interval;
+  src2 += i * interval;
+  dst += i * 4;
+
+  for (; i < d_width; i++) {
+    uint16_t r, g, b, a;
+    r = src1[0] + src2[0];
+    g = src1[1] + src2[1];
+    b = src1[2] + src2[2];
+    a = src1[3] + src2[3];
+    r += src1[4] + src2[4];
+    g += src1[5] + src2[5];
+    b += src1[6] + src2[6];
+    a += src1[7] + src2[7];
+
+    dst[0] = (uint8_t) (r / 4);
+    dst[1] = (uint8_t) (g / 4);
+    dst[2] = (uint8_t) (b / 4);
+    dst[3] = (uint8_t) (a / 4);
+
+    src1 += interval;
+    src2 += interval;
+    dst += 4;
+  }
+}
+
+static inline __attribute__((always_inline)) void rgba_to_rgb565_row_1(
+    uint8_t* dst, const uint8_t* src, uint32_t width, Kernel1 kernel) {
+  uint32_t i;
+
+  i = kernel(dst, src, width);
+  src += i * 4;
+  dst += i * 2;
+
+  for (; i < width; i++) {
+    uint8_t r, g, b;
+    r = src[0] >> 3;
+    g = src[1] >> 2;
+    b = src[2] >> 3;
+    dst[0] = (uint8_t) (g << 5 | b);
+    dst[1] = (uint8_t) (r << 3 | g >> 3);
+    src += 4;
+    dst += 2;
+  }
+}
+
+static inline __attribute__((always_inline)) void rgba_to_rgb565_row_2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio, Kernel2 kernel) {
+  uint32_t i;
+  uint32_t start = (ratio - 2) / 2 * 4;
+  uint32_t interval = ratio * 4;
+
+  src1 += start;
+  src2 += start;
+  i = kernel(dst, src1, src2, d_width, interval);
+  src1 += i * interval;
+  src2 += i * interval;
+  dst += i * 2;
+
+  for (; i < d_width; i++) {
+    uint16_t r, g, b;
+    r = src1[0] + src2[0];
+    g = src1[1] + src2[1];
+    b = src1[2] + src2[2];
+    r += src1[4] + src2[4];
+    g += src1[5] + src2[5];
+    b += src1[6] + src2[6];
+    r = (uint16_t) ((r / 4) >> 3);
+    g = (uint16_t) ((g / 4) >> 2);
+    b = (uint16_t) ((b / 4) >> 3);
+
+    dst[0] = (uint8_t) (g << 5 | b);
+    dst[1] = (uint8_t) (r << 3 | g >> 3);
+
+    src1 += interval;
+    src2 += interval;
+    dst += 2;
+  }
+}
+
+static inline __attribute__((always_inline)) void rgb565_to_rgb565_row_2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio, Kernel2 kernel) {
+  uint32_t i;
+  uint32_t start = (ratio - 2) / 2 * 2;
+  uint32_t interval = ratio * 2;
+
+  src1 += start;
+  src2 += start;
+  i = kernel(dst, src1, src2, d_width, interval);
+  src1 += i * interval;
+  src2 += i * interval;
+  dst += i * 2;
+
+  for (; i < d_width; i++) {
+    uint8_t r, g, b;
+
+    b = (uint8_t) RGB565_BLUE(src1[0]) + (uint8_t) RGB565_BLUE(src2[0]);
+    g = (uint8_t) RGB565_GREEN(src1[0], src1[1]) + (uint8_t) RGB565_GREEN(src2[0], src2[1]);
+    r = RGB565_REG(src1[1]) + RGB565_REG(src2[1]);
+    b += (uint8_t) RGB565_BLUE(src1[2]) + (uint8_t) RGB565_BLUE(src2[2]);
+    g += (uint8_t) RGB565_GREEN(src1[2], src1[3]) + (uint8_t) RGB565_GREEN(src2[2], src2[3]);
+    r += RGB565_REG(src1[3]) + RGB565_REG(src2[3]);
+
+    b /= 4;
+    g /= 4;
+    r /= 4;
+
+    dst[0] = b | g << 5;
+    dst[1] = g >> 3 | r << 3;
+
+    src1 += interval;
+    src2 += interval;
+    dst += 2;
+  }
+}
+
+static inline __attribute__((always_inline)) void premultiply_rgba_row(
+    uint8_t* row, uint32_t width, KernelPremultiply kernel) {
+  uint32_t i;
+
+  i = kernel(row, width);
+  row += i * 4;
+
+  for (; i < width; i++) {
+    uint32_t a = row[3];
+    if (a != 0xff) {
+      for (uint32_t c = 0; c < 3; c++) {
+        uint32_t t = row[c] * a + 128;
+        row[c] = (uint8_t) ((t + (t >> 8)) >> 8);
+      }
+    }
+    row += 4;
+  }
+}
+
+void RGBA8888_to_RGBA8888_row_internal_2_sse2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio) {
+  rgba_to_rgba_row_2(dst, src1, src2, d_width, ratio, rgba_to_rgba_2_sse2);
+}
+
+void RGBA8888_to_RGBA8888_row_internal_2_avx2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio) {
+  rgba_to_rgba_row_2(dst, src1, src2, d_width, ratio, rgba_to_rgba_2_avx2);
+}
+
+void RGBA8888_to_RGB565_row_internal_1_sse2(
+    uint8_t* dst, const uint8_t* src, uint32_t width) {
+  rgba_to_rgb565_row_1(dst, src, width, rgba_to_rgb565_1_sse2);
+}
+
+void RGBA8888_to_RGB565_row_internal_1_avx2(
+    uint8_t* dst, const uint8_t* src, uint32_t width) {
+  rgba_to_rgb565_row_1(dst, src, width, rgba_to_rgb565_1_avx2);
+}
+
+void RGBA8888_to_RGB565_row_internal_2_sse2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio) {
+  rgba_to_rgb565_row_2(dst, src1, src2, d_width, ratio, rgba_to_rgb565_2_sse2);
+}
+
+void RGBA8888_to_RGB565_row_internal_2_avx2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio) {
+  rgba_to_rgb565_row_2(dst, src1, src2, d_width, ratio, rgba_to_rgb565_2_avx2);
+}
+
+void RGB565_to_RGB565_row_internal_2_sse2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio) {
+  rgb565_to_rgb565_row_2(dst, src1, src2, d_width, ratio, rgb565_to_rgb565_2_sse2);
+}
+
+void RGB565_to_RGB565_row_internal_2_avx2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio) {
+  rgb565_to_rgb565_row_2(dst, src1, src2, d_width, ratio, rgb565_to_rgb565_2_avx2);
+}
+
+void premultiply_RGBA8888_row_sse2(uint8_t* row, uint32_t width) {
+  premultiply_rgba_row(row, width, premultiply_rgba_sse2);
+}
+
+void premultiply_RGBA8888_row_avx2(uint8_t* row, uint32_t width) {
+  premultiply_rgba_row(row, width, premultiply_rgba_avx2);
+}
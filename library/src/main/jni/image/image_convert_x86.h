@@ -0,0 +1,76 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_IMAGE_CONVERT_X86_H
+#define IMAGE_IMAGE_CONVERT_X86_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define X86_SIMD_NONE 0
+#define X86_SIMD_SSE2 1
+#define X86_SIMD_AVX2 2
+
+
+/**
+ * The best instruction set supported by both the CPU and the OS, checked by CPUID.
+ */
+int get_x86_simd_level();
+
+bool is_support_sse2();
+
+
+// Every kernel has an SSE2 and an AVX2 version, init_convert() picks one.
+// The results are the same as the scalar versions.
+
+void RGBA8888_to_RGBA8888_row_internal_2_sse2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio);
+
+void RGBA8888_to_RGB565_row_internal_1_sse2(
+    uint8_t* dst, const uint8_t* src, uint32_t width);
+
+void RGBA8888_to_RGB565_row_internal_2_sse2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio);
+
+void RGB565_to_RGB565_row_internal_2_sse2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio);
+
+void premultiply_RGBA8888_row_sse2(uint8_t* row, uint32_t width);
+
+void RGBA8888_to_RGBA8888_row_internal_2_avx2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio);
+
+void RGBA8888_to_RGB565_row_internal_1_avx2(
+    uint8_t* dst, const uint8_t* src, uint32_t width);
+
+void RGBA8888_to_RGB565_row_internal_2_avx2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio);
+
+void RGB565_to_RGB565_row_internal_2_avx2(
+    uint8_t* dst, const uint8_t* src1, const uint8_t* src2,
+    uint32_t d_width, uint32_t ratio);
+
+void premultiply_RGBA8888_row_avx2(uint8_t* row, uint32_t width);
+
+
+#endif //IMAGE_IMAGE_CONVERT_X86_H
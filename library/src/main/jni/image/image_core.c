@@ -0,0 +1,191 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+
+#include "image_core.h"
+#include "image.h"
+#include "../log.h"
+
+
+typedef struct {
+  void* dst;
+  size_t dst_size;
+  ImageCoreBitmap* bitmap;
+} CallerContainerData;
+
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void* create_buffer(BufferContainer* container, uint32_t width, uint32_t height, int32_t config) {
+  CallerContainerData* data = container->data;
+  size_t stride = (size_t) width * get_depth_for_config(config);
+  size_t size = stride * height;
+
+  if (size == 0 || size > data->dst_size) {
+    LOGE(MSG("Need %zu bytes for %ux%u pixels, but buffer size is %zu"),
+        size, width, height, data->dst_size);
+    return NULL;
+  }
+
+  data->bitmap->width = width;
+  data->bitmap->height = height;
+  data->bitmap->config = config;
+  data->bitmap->stride = stride;
+
+  return data->dst;
+}
+
+static void release_buffer(__unused BufferContainer* container, __unused void* buffer) {
+  // The caller owns the buffer
+}
+
+void image_core_init() {
+  pthread_once(&init_once, &init_image_libraries);
+}
+
+void* image_core_decode(Stream* stream, bool partially, int32_t quality, bool* animated,
+    StreamCounters* counters) {
+  StreamCounters* counters_bak = stream->counters;
+  void* image = NULL;
+
+  if (counters != NULL) {
+    stream_set_counters(stream, counters);
+  }
+  decode(stream, partially, quality, animated, &image);
+  if (counters != NULL) {
+    // A partially decoded image might keep the stream
+    stream->counters = counters_bak;
+  }
+
+  return image;
+}
+
+bool image_core_decode_info(Stream* stream, ImageInfo* info) {
+  return decode_info(stream, info);
+}
+
+// Decode a region with index if it isn't NULL
+static bool decode_to_caller(ImageIndex* index, Stream* stream, bool clip, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, void* dst, size_t dst_size,
+    ImageCoreBitmap* bitmap, StreamCounters* counters) {
+  StreamCounters* counters_bak = stream->counters;
+  CallerContainerData data;
+  BufferContainer container;
+  bool result;
+
+  if (dst == NULL || bitmap == NULL) {
+    LOGE(MSG("Invalid parameter"));
+    return false;
+  }
+
+  data.dst = dst;
+  data.dst_size = dst_size;
+  data.bitmap = bitmap;
+
+  container.data = &data;
+  container.create_buffer = &create_buffer;
+  container.release_buffer = &release_buffer;
+
+  if (counters != NULL) {
+    stream_set_counters(stream, counters);
+  }
+  if (index != NULL) {
+    result = decode_region(index, stream, x, y, width, height, config,
+        ratio < 1.0f ? 1.0f : ratio, resample, orientation, quality, premultiply,
+        &container);
+  } else {
+    result = decode_buffer(stream, clip, x, y, width, height, config,
+        ratio < 1.0f ? 1.0f : ratio, resample, orientation, quality, premultiply,
+        &container);
+  }
+  if (counters != NULL) {
+    stream->counters = counters_bak;
+  }
+
+  return result;
+}
+
+bool image_core_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, void* dst, size_t dst_size,
+    ImageCoreBitmap* bitmap, StreamCounters* counters) {
+  return decode_to_caller(NULL, stream, clip, x, y, width, height, config, ratio, resample,
+      orientation, quality, premultiply, dst, dst_size, bitmap, counters);
+}
+
+ImageIndex* image_core_index_new(Stream* stream) {
+  return image_index_new(stream);
+}
+
+void image_core_index_delete(ImageIndex** index) {
+  image_index_delete(index);
+}
+
+bool image_core_decode_region(ImageIndex* index, Stream* stream, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, void* dst, size_t dst_size,
+    ImageCoreBitmap* bitmap, StreamCounters* counters) {
+  return decode_to_caller(index, stream, true, x, y, width, height, config, ratio, resample,
+      orientation, quality, premultiply, dst, dst_size, bitmap, counters);
+}
+
+bool image_core_decode_info_memory(const void* data, size_t size, ImageInfo* info) {
+  Stream* stream;
+  bool result;
+
+  stream = buffer_stream_wrap(data, size);
+  if (stream == NULL) {
+    return false;
+  }
+
+  result = decode_info(stream, info);
+  stream->close(&stream);
+  return result;
+}
+
+bool image_core_decode_buffer_memory(const void* data, size_t size, bool clip,
+    uint32_t x, uint32_t y, uint32_t width, uint32_t height, int32_t config,
+    float ratio, int32_t resample, int32_t orientation, int32_t quality, bool premultiply,
+    void* dst, size_t dst_size, ImageCoreBitmap* bitmap) {
+  Stream* stream;
+  bool result;
+
+  stream = buffer_stream_wrap(data, size);
+  if (stream == NULL) {
+    return false;
+  }
+
+  result = image_core_decode_buffer(stream, clip, x, y, width, height, config,
+      ratio, resample, orientation, quality, premultiply, dst, dst_size, bitmap, NULL);
+  stream->close(&stream);
+  return result;
+}
+
+void image_core_recycle(void* image, bool animated) {
+  if (image == NULL) {
+    return;
+  }
+
+  if (animated) {
+    AnimatedImage* animated_image = image;
+    animated_image->recycle(&animated_image);
+  } else {
+    StaticImage* static_image = image;
+    static_image_delete(&static_image);
+  }
+}
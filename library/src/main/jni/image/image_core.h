@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_IMAGE_CORE_H
+#define IMAGE_IMAGE_CORE_H
+
+/**
+ * The JNI-free C API of image-core.
+ *
+ * Streams come from stream.h, for example buffer_stream_new(),
+ * buffer_stream_wrap(), which reads caller memory in place, or
+ * file_stream_new(), which maps a file instead of reading it into memory.
+ * byte_source_open() gives cursors on bytes shared by many decodes and threads.
+ * The caller keeps the ownership of every stream passed in,
+ * except for the one kept by a partially decoded AnimatedImage.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+#include "image_info.h"
+#include "image_decoder.h"
+#include "static_image.h"
+#include "animated_image.h"
+#include "stream.h"
+#include "buffer_stream.h"
+#include "file_stream.h"
+#include "prefetch_stream.h"
+#include "byte_source.h"
+#include "source_cache.h"
+
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  int32_t config;
+  /**
+   * Bytes per row, always width * depth of config.
+   */
+  size_t stride;
+} ImageCoreBitmap;
+
+
+/**
+ * Load all codecs. It's safe to call it more than once or from several threads.
+ */
+void image_core_init();
+
+/**
+ * Decode the stream to a StaticImage or an AnimatedImage.
+ *
+ * @param stream The image source.
+ * @param partially Only decode the first frame of an animated image.
+ * @param quality IMAGE_QUALITY_*, speed against accuracy of JPEG IDCT and upsampling.
+ * @param animated Set to true if the result is an AnimatedImage.
+ * @param counters If not NULL, set to the I/O counters of the stream while decoding.
+ *                 Later reads of a partially decoded AnimatedImage aren't counted.
+ * @return The image, or NULL if failed. Recycle it with image_core_recycle().
+ */
+void* image_core_decode(Stream* stream, bool partially, int32_t quality, bool* animated,
+    StreamCounters* counters);
+
+/**
+ * Only decode image info.
+ *
+ * @return True if info is assigned.
+ */
+bool image_core_decode_info(Stream* stream, ImageInfo* info);
+
+/**
+ * Decode the stream into a caller-owned buffer.
+ *
+ * The arguments before dst are the same as decode_buffer() in image.h.
+ * The decoded pixels are packed rows of bitmap->stride bytes.
+ *
+ * @param orientation IMAGE_ORIENTATION_*, the area is in the image before orientation,
+ *                    bitmap gets the size after orientation.
+ * @param quality IMAGE_QUALITY_*, IMAGE_QUALITY_FAST trades accuracy of JPEG for speed.
+ * @param premultiply Multiply color by alpha for RGBA_8888 output, like Android Bitmap.
+ * @param dst The destination, must be large enough to hold the decoded pixels.
+ * @param dst_size The size of dst in bytes.
+ * @param bitmap Set to the size and config of the decoded pixels.
+ * @param counters If not NULL, set to the I/O counters of the stream while decoding.
+ * @return False if decoding failed or dst is too small.
+ */
+bool image_core_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, void* dst, size_t dst_size,
+    ImageCoreBitmap* bitmap, StreamCounters* counters);
+
+/**
+ * Index the stream once, so image_core_decode_region() decodes from the last
+ * MCU row above the region instead of the start of the image. JPEG only.
+ * A progressive or arithmetic JPEG is decoded from the start for its first
+ * region, its coefficients are transcoded to an indexed baseline copy on
+ * the second one.
+ *
+ * @return NULL if the image doesn't need an index or out of memory.
+ */
+ImageIndex* image_core_index_new(Stream* stream);
+
+void image_core_index_delete(ImageIndex** index);
+
+/**
+ * The same as image_core_decode_buffer() with clip. index is from the same bytes
+ * as stream, stream is at their start. Threads can share index, it can be NULL.
+ */
+bool image_core_decode_region(ImageIndex* index, Stream* stream, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, void* dst, size_t dst_size,
+    ImageCoreBitmap* bitmap, StreamCounters* counters);
+
+/**
+ * The same as image_core_decode_info(), but reads size bytes of data in place.
+ */
+bool image_core_decode_info_memory(const void* data, size_t size, ImageInfo* info);
+
+/**
+ * The same as image_core_decode_buffer(), but reads size bytes of data in place,
+ * no stream and no copy, nothing to count.
+ */
+bool image_core_decode_buffer_memory(const void* data, size_t size, bool clip,
+    uint32_t x, uint32_t y, uint32_t width, uint32_t height, int32_t config,
+    float ratio, int32_t resample, int32_t orientation, int32_t quality, bool premultiply,
+    void* dst, size_t dst_size, ImageCoreBitmap* bitmap);
+
+/**
+ * Free the image returned by image_core_decode().
+ */
+void image_core_recycle(void* image, bool animated);
+
+
+#endif //IMAGE_IMAGE_CORE_H
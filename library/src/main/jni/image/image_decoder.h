@@ -18,17 +18,89 @@
 #define IMAGE_IMAGE_DECODER_H
 
 
-#include "com_hippo_image_BitmapDecoder.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef IMAGE_HOST_BUILD
+// No javah on host, keep these the same as com.hippo.image.BitmapDecoder
+#  define com_hippo_image_BitmapDecoder_CONFIG_AUTO 0L
+#  define com_hippo_image_BitmapDecoder_CONFIG_RGB_565 1L
+#  define com_hippo_image_BitmapDecoder_CONFIG_RGBA_8888 2L
+#  define com_hippo_image_BitmapDecoder_CONFIG_GRAY_8 3L
+#  define com_hippo_image_BitmapDecoder_RESAMPLE_NEAREST 0L
+#  define com_hippo_image_BitmapDecoder_RESAMPLE_2X2 1L
+#  define com_hippo_image_BitmapDecoder_RESAMPLE_AREA 2L
+#  define com_hippo_image_BitmapDecoder_RESAMPLE_BILINEAR 3L
+#  define com_hippo_image_BitmapDecoder_ORIENTATION_NORMAL 1L
+#  define com_hippo_image_BitmapDecoder_ORIENTATION_FLIP_HORIZONTAL 2L
+#  define com_hippo_image_BitmapDecoder_ORIENTATION_ROTATE_180 3L
+#  define com_hippo_image_BitmapDecoder_ORIENTATION_FLIP_VERTICAL 4L
+#  define com_hippo_image_BitmapDecoder_ORIENTATION_TRANSPOSE 5L
+#  define com_hippo_image_BitmapDecoder_ORIENTATION_ROTATE_90 6L
+#  define com_hippo_image_BitmapDecoder_ORIENTATION_TRANSVERSE 7L
+#  define com_hippo_image_BitmapDecoder_ORIENTATION_ROTATE_270 8L
+#  define com_hippo_image_BitmapDecoder_QUALITY_FAST 0L
+#  define com_hippo_image_BitmapDecoder_QUALITY_DEFAULT 1L
+#  define com_hippo_image_BitmapDecoder_QUALITY_BEST 2L
+#else
+#  include "com_hippo_image_BitmapDecoder.h"
+#endif
 
 
 #define IMAGE_CONFIG_INVALID   -1;
 #define IMAGE_CONFIG_AUTO      com_hippo_image_BitmapDecoder_CONFIG_AUTO
 #define IMAGE_CONFIG_RGB_565   com_hippo_image_BitmapDecoder_CONFIG_RGB_565
 #define IMAGE_CONFIG_RGBA_8888 com_hippo_image_BitmapDecoder_CONFIG_RGBA_8888
+// One byte luminance per pixel, it's ALPHA_8 in Android Bitmap
+#define IMAGE_CONFIG_GRAY_8    com_hippo_image_BitmapDecoder_CONFIG_GRAY_8
+
+#define IMAGE_RESAMPLE_NEAREST  com_hippo_image_BitmapDecoder_RESAMPLE_NEAREST
+#define IMAGE_RESAMPLE_2X2      com_hippo_image_BitmapDecoder_RESAMPLE_2X2
+#define IMAGE_RESAMPLE_AREA     com_hippo_image_BitmapDecoder_RESAMPLE_AREA
+#define IMAGE_RESAMPLE_BILINEAR com_hippo_image_BitmapDecoder_RESAMPLE_BILINEAR
+
+// The same values as EXIF orientation tag
+#define IMAGE_ORIENTATION_NORMAL          com_hippo_image_BitmapDecoder_ORIENTATION_NORMAL
+#define IMAGE_ORIENTATION_FLIP_HORIZONTAL com_hippo_image_BitmapDecoder_ORIENTATION_FLIP_HORIZONTAL
+#define IMAGE_ORIENTATION_ROTATE_180      com_hippo_image_BitmapDecoder_ORIENTATION_ROTATE_180
+#define IMAGE_ORIENTATION_FLIP_VERTICAL   com_hippo_image_BitmapDecoder_ORIENTATION_FLIP_VERTICAL
+#define IMAGE_ORIENTATION_TRANSPOSE       com_hippo_image_BitmapDecoder_ORIENTATION_TRANSPOSE
+#define IMAGE_ORIENTATION_ROTATE_90       com_hippo_image_BitmapDecoder_ORIENTATION_ROTATE_90
+#define IMAGE_ORIENTATION_TRANSVERSE      com_hippo_image_BitmapDecoder_ORIENTATION_TRANSVERSE
+#define IMAGE_ORIENTATION_ROTATE_270      com_hippo_image_BitmapDecoder_ORIENTATION_ROTATE_270
+
+// Speed against accuracy of JPEG IDCT and upsampling, other formats ignore it
+#define IMAGE_QUALITY_FAST    com_hippo_image_BitmapDecoder_QUALITY_FAST
+#define IMAGE_QUALITY_DEFAULT com_hippo_image_BitmapDecoder_QUALITY_DEFAULT
+#define IMAGE_QUALITY_BEST    com_hippo_image_BitmapDecoder_QUALITY_BEST
 
 
 static inline bool is_explicit_config(int32_t config) {
-  return config == IMAGE_CONFIG_RGB_565 || config == IMAGE_CONFIG_RGBA_8888;
+  return config == IMAGE_CONFIG_RGB_565 || config == IMAGE_CONFIG_RGBA_8888 ||
+      config == IMAGE_CONFIG_GRAY_8;
+}
+
+
+static inline bool is_valid_resample(int32_t resample) {
+  return resample == IMAGE_RESAMPLE_NEAREST || resample == IMAGE_RESAMPLE_2X2 ||
+      resample == IMAGE_RESAMPLE_AREA || resample == IMAGE_RESAMPLE_BILINEAR;
+}
+
+
+static inline bool is_valid_orientation(int32_t orientation) {
+  return orientation >= IMAGE_ORIENTATION_NORMAL && orientation <= IMAGE_ORIENTATION_ROTATE_270;
+}
+
+
+static inline bool is_valid_quality(int32_t quality) {
+  return quality == IMAGE_QUALITY_FAST || quality == IMAGE_QUALITY_DEFAULT ||
+      quality == IMAGE_QUALITY_BEST;
+}
+
+
+// Width and height are swapped
+static inline bool is_transposed_orientation(int32_t orientation) {
+  return orientation >= IMAGE_ORIENTATION_TRANSPOSE && orientation <= IMAGE_ORIENTATION_ROTATE_270;
 }
 
 
@@ -38,6 +110,8 @@ static inline uint32_t get_depth_for_config(int32_t config) {
       return 2;
     case IMAGE_CONFIG_RGBA_8888:
       return 4;
+    case IMAGE_CONFIG_GRAY_8:
+      return 1;
     default:
       return 0;
   }
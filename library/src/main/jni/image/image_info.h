@@ -28,6 +28,8 @@ typedef struct {
   int32_t format;
   bool opaque;
   int32_t frame_count;
+  // IMAGE_ORIENTATION_*, width and height are before orientation
+  int32_t orientation;
 } ImageInfo;
 
 
@@ -24,10 +24,17 @@ typedef struct ImageLibrary ImageLibrary;
 
 typedef bool (*ImageLibraryInitFunc)(ImageLibrary* library);
 typedef bool (*ImageLibraryIsMagic)(Stream* stream);
-typedef void* (*ImageLibraryDecodeFunc)(Stream* stream, bool partially, bool* animated);
+typedef void* (*ImageLibraryDecodeFunc)(Stream* stream, bool partially, int32_t quality,
+    bool* animated);
 typedef bool (*ImageLibraryDecodeInfoFunc)(Stream* stream, ImageInfo* info);
 typedef bool (*ImageLibraryDecodeBufferFunc)(Stream* stream, bool clip, uint32_t x, uint32_t y,
-    uint32_t width, uint32_t height, int32_t config, uint32_t ratio, BufferContainer* container);
+    uint32_t width, uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container);
+typedef void* (*ImageLibraryNewIndexFunc)(Stream* stream);
+typedef bool (*ImageLibraryDecodeRegionFunc)(void* index, Stream* stream, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container);
+typedef void (*ImageLibraryDeleteIndexFunc)(void* index);
 typedef StaticImage* (*ImageLibraryCreateFunc)(uint32_t width, uint32_t height, const uint8_t* data);
 typedef const char* (*ImageLibraryGetDescription)(void);
 
@@ -38,6 +45,10 @@ struct ImageLibrary {
   ImageLibraryDecodeFunc decode;
   ImageLibraryDecodeInfoFunc decode_info;
   ImageLibraryDecodeBufferFunc decode_buffer;
+  // Optional, NULL if regions are decoded by decode_buffer
+  ImageLibraryNewIndexFunc new_index;
+  ImageLibraryDecodeRegionFunc decode_region;
+  ImageLibraryDeleteIndexFunc delete_index;
   ImageLibraryCreateFunc create;
   ImageLibraryGetDescription get_description;
 };
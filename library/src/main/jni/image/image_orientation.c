@@ -0,0 +1,316 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <string.h>
+
+#include "image_orientation.h"
+#include "image_decoder.h"
+#include "../log.h"
+
+
+// A transposed strip row becomes a column in destination. Each strip flush
+// writes this many bytes to every destination row it touches, a cache line.
+#define STRIP_BYTES 64
+
+#define ALIGN_8(size) (((size) + 7) & ~((size_t) 7))
+
+
+struct ORIENTER {
+  int32_t orientation;
+  uint32_t depth;
+  // The area in the unoriented image
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+  // The unoriented image
+  uint32_t full_width;
+  uint32_t full_height;
+  uint8_t* dst;
+  size_t dst_stride;
+
+  // Transposed orientations only
+  uint8_t* strip;
+  size_t strip_stride;
+  uint32_t strip_height;
+  // The area row of the first strip row
+  uint32_t strip_y;
+};
+
+
+int32_t get_inverse_orientation(int32_t orientation) {
+  // Rotations by 90 and 270 undo each other, the others undo themselves
+  switch (orientation) {
+    case IMAGE_ORIENTATION_ROTATE_90:
+      return IMAGE_ORIENTATION_ROTATE_270;
+    case IMAGE_ORIENTATION_ROTATE_270:
+      return IMAGE_ORIENTATION_ROTATE_90;
+    default:
+      return orientation;
+  }
+}
+
+void orient_area(int32_t orientation, uint32_t full_width, uint32_t full_height,
+    int32_t* x, int32_t* y, uint32_t* width, uint32_t* height) {
+  const int32_t fw = (int32_t) full_width;
+  const int32_t fh = (int32_t) full_height;
+  const int32_t ax = *x;
+  const int32_t ay = *y;
+  const int32_t aw = (int32_t) *width;
+  const int32_t ah = (int32_t) *height;
+
+  switch (orientation) {
+    case IMAGE_ORIENTATION_FLIP_HORIZONTAL:
+      *x = fw - ax - aw;
+      break;
+    case IMAGE_ORIENTATION_ROTATE_180:
+      *x = fw - ax - aw;
+      *y = fh - ay - ah;
+      break;
+    case IMAGE_ORIENTATION_FLIP_VERTICAL:
+      *y = fh - ay - ah;
+      break;
+    case IMAGE_ORIENTATION_TRANSPOSE:
+      *x = ay;
+      *y = ax;
+      break;
+    case IMAGE_ORIENTATION_ROTATE_90:
+      *x = fh - ay - ah;
+      *y = ax;
+      break;
+    case IMAGE_ORIENTATION_TRANSVERSE:
+      *x = fh - ay - ah;
+      *y = fw - ax - aw;
+      break;
+    case IMAGE_ORIENTATION_ROTATE_270:
+      *x = ay;
+      *y = fw - ax - aw;
+      break;
+    default:
+      break;
+  }
+
+  if (is_transposed_orientation(orientation)) {
+    *width = (uint32_t) ah;
+    *height = (uint32_t) aw;
+  }
+}
+
+size_t orienter_get_buffer_size(int32_t orientation, int32_t config, uint32_t width) {
+  const uint32_t depth = get_depth_for_config(config);
+  size_t size = ALIGN_8(sizeof(Orienter));
+  if (is_transposed_orientation(orientation)) {
+    size += (STRIP_BYTES / depth) * ALIGN_8((size_t) width * depth);
+  }
+  return size;
+}
+
+Orienter* orienter_init(void* buffer, int32_t orientation, int32_t config,
+    uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+    uint32_t full_width, uint32_t full_height, uint8_t* dst, size_t dst_stride) {
+  Orienter* orienter = (Orienter*) buffer;
+  const uint32_t depth = get_depth_for_config(config);
+
+  orienter->orientation = orientation;
+  orienter->depth = depth;
+  orienter->x = x;
+  orienter->y = y;
+  orienter->width = width;
+  orienter->height = height;
+  orienter->full_width = full_width;
+  orienter->full_height = full_height;
+  orienter->dst = dst;
+  orienter->dst_stride = dst_stride;
+
+  if (is_transposed_orientation(orientation)) {
+    orienter->strip = (uint8_t*) buffer + ALIGN_8(sizeof(Orienter));
+    orienter->strip_stride = ALIGN_8((size_t) width * depth);
+    orienter->strip_height = STRIP_BYTES / depth;
+  } else {
+    orienter->strip = NULL;
+    orienter->strip_stride = 0;
+    orienter->strip_height = 0;
+  }
+  orienter->strip_y = 0;
+
+  return orienter;
+}
+
+Orienter* orienter_new(int32_t orientation, int32_t config,
+    uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+    uint32_t full_width, uint32_t full_height, uint8_t* dst, size_t dst_stride) {
+  void* buffer;
+
+  if (!is_valid_orientation(orientation) || get_depth_for_config(config) == 0) {
+    LOGE(MSG("Invalid orientation %d or config %d"), orientation, config);
+    return NULL;
+  }
+
+  buffer = malloc(orienter_get_buffer_size(orientation, config, width));
+  if (buffer == NULL) {
+    WTF_OOM;
+    return NULL;
+  }
+
+  return orienter_init(buffer, orientation, config, x, y, width, height,
+      full_width, full_height, dst, dst_stride);
+}
+
+uint8_t* orienter_get_row(Orienter* orienter, uint32_t y) {
+  const int32_t orientation = orienter->orientation;
+  uint32_t dst_x;
+  uint32_t dst_y;
+
+  if (orienter->strip != NULL) {
+    return orienter->strip + (y - orienter->strip_y) * orienter->strip_stride;
+  }
+
+  dst_x = orienter->x;
+  dst_y = orienter->y + y;
+  if (orientation == IMAGE_ORIENTATION_FLIP_HORIZONTAL ||
+      orientation == IMAGE_ORIENTATION_ROTATE_180) {
+    dst_x = orienter->full_width - orienter->x - orienter->width;
+  }
+  if (orientation == IMAGE_ORIENTATION_ROTATE_180 ||
+      orientation == IMAGE_ORIENTATION_FLIP_VERTICAL) {
+    dst_y = orienter->full_height - 1 - dst_y;
+  }
+
+  return orienter->dst + dst_y * orienter->dst_stride + dst_x * orienter->depth;
+}
+
+static inline void reverse_row(uint8_t* row, uint32_t width, const uint32_t depth) {
+  uint8_t* left = row;
+  uint8_t* right = row + (width - 1) * depth;
+  uint8_t pixel[4];
+
+  while (left < right) {
+    memcpy(pixel, left, depth);
+    memcpy(left, right, depth);
+    memcpy(right, pixel, depth);
+    left += depth;
+    right -= depth;
+  }
+}
+
+// Strip column i goes to destination row i, strip rows go in pixel_step.
+// Strip rows are read column by column, the cache lines of every strip row
+// stay in cache for the next column, and each destination row gets
+// STRIP_BYTES contiguous bytes.
+static inline void transpose_strip(const uint8_t* strip, size_t strip_stride,
+    uint32_t width, uint32_t count, uint8_t* dst, ptrdiff_t row_step,
+    ptrdiff_t pixel_step, const uint32_t depth) {
+  const uint8_t* src;
+  uint8_t* d;
+
+  for (uint32_t i = 0; i < width; i++) {
+    src = strip + i * depth;
+    d = dst;
+    for (uint32_t j = 0; j < count; j++) {
+      memcpy(d, src, depth);
+      src += strip_stride;
+      d += pixel_step;
+    }
+    dst += row_step;
+  }
+}
+
+static void flush_strip(Orienter* orienter, uint32_t count) {
+  const int32_t orientation = orienter->orientation;
+  const uint32_t depth = orienter->depth;
+  const uint32_t y = orienter->y + orienter->strip_y;
+  uint32_t dst_x;
+  uint32_t dst_y;
+  ptrdiff_t row_step;
+  ptrdiff_t pixel_step;
+  uint8_t* dst;
+
+  // Unoriented (x, y) goes to
+  // TRANSPOSE: (y, x), ROTATE_90: (H - 1 - y, x),
+  // TRANSVERSE: (H - 1 - y, W - 1 - x), ROTATE_270: (y, W - 1 - x)
+  if (orientation == IMAGE_ORIENTATION_TRANSPOSE || orientation == IMAGE_ORIENTATION_ROTATE_270) {
+    dst_x = y;
+    pixel_step = depth;
+  } else {
+    dst_x = orienter->full_height - 1 - y;
+    pixel_step = -(ptrdiff_t) depth;
+  }
+  if (orientation == IMAGE_ORIENTATION_TRANSPOSE || orientation == IMAGE_ORIENTATION_ROTATE_90) {
+    dst_y = orienter->x;
+    row_step = orienter->dst_stride;
+  } else {
+    dst_y = orienter->full_width - 1 - orienter->x;
+    row_step = -(ptrdiff_t) orienter->dst_stride;
+  }
+  dst = orienter->dst + dst_y * orienter->dst_stride + dst_x * depth;
+
+  // Constant depth lets the compiler turn memcpy into a single move
+  switch (depth) {
+    case 1:
+      transpose_strip(orienter->strip, orienter->strip_stride, orienter->width,
+          count, dst, row_step, pixel_step, 1);
+      break;
+    case 2:
+      transpose_strip(orienter->strip, orienter->strip_stride, orienter->width,
+          count, dst, row_step, pixel_step, 2);
+      break;
+    case 4:
+      transpose_strip(orienter->strip, orienter->strip_stride, orienter->width,
+          count, dst, row_step, pixel_step, 4);
+      break;
+    default:
+      break;
+  }
+}
+
+void orienter_finish_row(Orienter* orienter, uint32_t y) {
+  const int32_t orientation = orienter->orientation;
+
+  if (orienter->strip != NULL) {
+    if (y + 1 - orienter->strip_y == orienter->strip_height || y + 1 == orienter->height) {
+      flush_strip(orienter, y + 1 - orienter->strip_y);
+      orienter->strip_y = y + 1;
+    }
+  } else if (orientation == IMAGE_ORIENTATION_FLIP_HORIZONTAL ||
+      orientation == IMAGE_ORIENTATION_ROTATE_180) {
+    // The row is still in cache
+    uint8_t* row = orienter_get_row(orienter, y);
+    switch (orienter->depth) {
+      case 1:
+        reverse_row(row, orienter->width, 1);
+        break;
+      case 2:
+        reverse_row(row, orienter->width, 2);
+        break;
+      case 4:
+        reverse_row(row, orienter->width, 4);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void orienter_delete(Orienter** orienter) {
+  if (orienter == NULL || *orienter == NULL) {
+    return;
+  }
+
+  // The strip is in the same block
+  free(*orienter);
+  *orienter = NULL;
+}
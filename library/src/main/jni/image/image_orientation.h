@@ -0,0 +1,93 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_IMAGE_ORIENTATION_H
+#define IMAGE_IMAGE_ORIENTATION_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Orienter writes rows of an unoriented image into an oriented destination.
+ *
+ * The unoriented image is full_width x full_height, the oriented destination
+ * is full_height x full_width for transposed orientations. Rows of area
+ * [x, x + width) x [y, y + height) are written one by one:
+ *
+ *   uint8_t* row = orienter_get_row(orienter, i);
+ *   // Fill width pixels of row
+ *   orienter_finish_row(orienter, i);
+ *
+ * Rows must be written in ascending order. Flipped rows are written into
+ * the destination directly. Transposed rows are kept in a strip of a few rows,
+ * the strip is transposed into the destination block by block when it's full.
+ */
+struct ORIENTER;
+typedef struct ORIENTER Orienter;
+
+
+/**
+ * Return the orientation which undoes the orientation.
+ */
+int32_t get_inverse_orientation(int32_t orientation);
+
+/**
+ * Map an area of the unoriented full_width x full_height image
+ * to the area in the oriented image.
+ */
+void orient_area(int32_t orientation, uint32_t full_width, uint32_t full_height,
+    int32_t* x, int32_t* y, uint32_t* width, uint32_t* height);
+
+/**
+ * @param dst The first row of the oriented destination.
+ * @param dst_stride Bytes between two destination rows.
+ * @return NULL if out of memory.
+ */
+Orienter* orienter_new(int32_t orientation, int32_t config,
+    uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+    uint32_t full_width, uint32_t full_height, uint8_t* dst, size_t dst_stride);
+
+/**
+ * Return the buffer size orienter_init() needs.
+ */
+size_t orienter_get_buffer_size(int32_t orientation, int32_t config, uint32_t width);
+
+/**
+ * The same as orienter_new(), but the orienter lives in buffer, so no allocation.
+ * buffer must be 8-byte aligned and at least orienter_get_buffer_size() bytes.
+ * Don't call orienter_delete() on it.
+ */
+Orienter* orienter_init(void* buffer, int32_t orientation, int32_t config,
+    uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+    uint32_t full_width, uint32_t full_height, uint8_t* dst, size_t dst_stride);
+
+/**
+ * Return the buffer of row y of the area.
+ */
+uint8_t* orienter_get_row(Orienter* orienter, uint32_t y);
+
+/**
+ * Tell the orienter that row y of the area is filled.
+ */
+void orienter_finish_row(Orienter* orienter, uint32_t y);
+
+void orienter_delete(Orienter** orienter);
+
+
+#endif //IMAGE_IMAGE_ORIENTATION_H
@@ -19,6 +19,7 @@
 
 #include "image.h"
 #include "image_plain.h"
+#include "image_decoder.h"
 #include "image_library.h"
 #include "../log.h"
 
@@ -29,6 +30,9 @@ bool plain_init(ImageLibrary* library) {
   library->decode = NULL;
   library->decode_info = NULL;
   library->decode_buffer = NULL;
+  library->new_index = NULL;
+  library->decode_region = NULL;
+  library->delete_index = NULL;
   library->create = plain_create;
   library->get_description = NULL;
 
@@ -38,7 +42,7 @@ bool plain_init(ImageLibrary* library) {
 StaticImage* plain_create(uint32_t width, uint32_t height, const uint8_t* buffer) {
   StaticImage* image;
 
-  image = static_image_new(width, height);
+  image = static_image_new(width, height, IMAGE_CONFIG_RGBA_8888);
   if (image == NULL) { WTF_OOM; return NULL; }
 
   memcpy(image->buffer, buffer, width * height * 4);
@@ -0,0 +1,725 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <string.h>
+
+#include "image_resample.h"
+#include "image_convert.h"
+#include "image_decoder.h"
+#include "image_orientation.h"
+#include "image_utils.h"
+#include "../log.h"
+
+
+// Fixed-point weights of bilinear, 1.0 is 256
+#define WEIGHT_BITS 8
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+#define NO_ROW UINT32_MAX
+
+
+struct RESAMPLER {
+  int32_t resample;
+  int32_t src_config;
+  int32_t dst_config;
+  uint32_t src_width;
+  uint32_t src_height;
+  uint32_t dst_width;
+  uint32_t dst_height;
+  uint8_t* dst;
+  size_t dst_stride;
+
+  uint32_t ratio;
+  // Values per pixel while resampling,
+  // 4 for RGBA8888, 3 for RGB565 which is kept in 5-6-5 bits, 1 for GRAY8
+  uint32_t channels;
+
+  // The next destination row
+  uint32_t dst_y;
+  // Rows pushed for the current destination row
+  uint32_t pushed;
+  // The caller keeps the last pushed row until next push
+  bool rows_kept;
+  // Premultiply alpha of finished destination rows
+  bool premultiply;
+  // Destination rows go through it if not NULL
+  Orienter* orienter;
+
+  // IMAGE_RESAMPLE_2X2
+  RowFunc row_func;
+  uint8_t* line;
+  const uint8_t* first_row;
+
+  // IMAGE_RESAMPLE_AREA, running column sums of the current cell
+  uint32_t* sums;
+  uint8_t* values;
+
+  // IMAGE_RESAMPLE_BILINEAR
+  uint32_t* x_index;
+  uint16_t* x_weight;
+  uint32_t* y_index;
+  uint16_t* y_weight;
+  uint16_t* rows[2];
+  uint32_t row_index[2];
+};
+
+
+static inline uint32_t get_channels(int32_t config) {
+  switch (config) {
+    case IMAGE_CONFIG_RGBA_8888:
+      return 4;
+    case IMAGE_CONFIG_RGB_565:
+      return 3;
+    default:
+      return 1;
+  }
+}
+
+static inline void unpack_pixel(const uint8_t* src, int32_t config, uint8_t* values) {
+  if (config == IMAGE_CONFIG_RGBA_8888) {
+    values[0] = src[0];
+    values[1] = src[1];
+    values[2] = src[2];
+    values[3] = src[3];
+  } else if (config == IMAGE_CONFIG_GRAY_8) {
+    values[0] = src[0];
+  } else {
+    uint16_t c = (uint16_t) (src[0] | src[1] << 8);
+    values[0] = (uint8_t) (c >> 11);
+    values[1] = (uint8_t) ((c >> 5) & 0x3f);
+    values[2] = (uint8_t) (c & 0x1f);
+  }
+}
+
+static inline void pack_pixel(const uint8_t* values, int32_t src_config, int32_t dst_config, uint8_t* dst) {
+  uint8_t r, g, b, a;
+
+  if (src_config == IMAGE_CONFIG_RGB_565) {
+    // RGB565 only goes to RGB565, values are 5-6-5 bits
+    dst[0] = (uint8_t) (values[1] << 5 | values[2]);
+    dst[1] = (uint8_t) (values[0] << 3 | values[1] >> 3);
+    return;
+  }
+
+  if (src_config == IMAGE_CONFIG_GRAY_8) {
+    r = g = b = values[0];
+    a = 0xff;
+  } else {
+    r = values[0];
+    g = values[1];
+    b = values[2];
+    a = values[3];
+  }
+
+  switch (dst_config) {
+    case IMAGE_CONFIG_RGBA_8888:
+      dst[0] = r;
+      dst[1] = g;
+      dst[2] = b;
+      dst[3] = a;
+      break;
+    case IMAGE_CONFIG_RGB_565:
+      dst[0] = (uint8_t) ((g >> 2) << 5 | b >> 3);
+      dst[1] = (uint8_t) ((r >> 3) << 3 | (g >> 2) >> 3);
+      break;
+    case IMAGE_CONFIG_GRAY_8:
+      dst[0] = src_config == IMAGE_CONFIG_GRAY_8 ? values[0] : rgb_to_gray(r, g, b);
+      break;
+    default:
+      break;
+  }
+}
+
+static inline uint8_t* get_dst_row(Resampler* resampler, uint32_t y) {
+  if (resampler->orienter != NULL) {
+    return orienter_get_row(resampler->orienter, y);
+  }
+  return resampler->dst + y * resampler->dst_stride;
+}
+
+static inline uint8_t* get_dst_line(Resampler* resampler) {
+  return get_dst_row(resampler, resampler->dst_y);
+}
+
+// Finish the destination row just written while it's still in cache.
+// Bilinear upscaling writes several rows in a push, and a transposing
+// orienter only has room for the rows of a strip, so finish every row
+// before the next one is taken.
+static inline void finish_dst_line(Resampler* resampler) {
+  if (resampler->premultiply) {
+    premultiply_RGBA8888_row(get_dst_line(resampler), resampler->dst_width);
+  }
+  if (resampler->orienter != NULL) {
+    orienter_finish_row(resampler->orienter, resampler->dst_y);
+  }
+  resampler->dst_y++;
+}
+
+
+////////////////////////////////
+// IMAGE_RESAMPLE_NEAREST
+////////////////////////////////
+
+static void push_row_nearest(Resampler* resampler, const uint8_t* row) {
+  const uint32_t src_depth = get_depth_for_config(resampler->src_config);
+  const uint32_t dst_depth = get_depth_for_config(resampler->dst_config);
+  const size_t interval = resampler->ratio * src_depth;
+  uint8_t* dst = get_dst_line(resampler);
+  uint8_t values[4];
+  uint32_t i;
+
+  row += (resampler->ratio - 1) / 2 * src_depth;
+  if (resampler->src_config == resampler->dst_config) {
+    for (i = 0; i < resampler->dst_width; i++) {
+      memcpy(dst, row, dst_depth);
+      row += interval;
+      dst += dst_depth;
+    }
+  } else {
+    for (i = 0; i < resampler->dst_width; i++) {
+      unpack_pixel(row, resampler->src_config, values);
+      pack_pixel(values, resampler->src_config, resampler->dst_config, dst);
+      row += interval;
+      dst += dst_depth;
+    }
+  }
+
+  finish_dst_line(resampler);
+}
+
+
+////////////////////////////////
+// IMAGE_RESAMPLE_2X2
+////////////////////////////////
+
+static void push_row_2x2(Resampler* resampler, const uint8_t* row) {
+  if (resampler->ratio == 1) {
+    resampler->row_func(get_dst_line(resampler), row, NULL, resampler->dst_width, 1);
+    finish_dst_line(resampler);
+  } else if (resampler->pushed == 0) {
+    // Keep the first row of the pair
+    if (resampler->rows_kept) {
+      resampler->first_row = row;
+    } else {
+      memcpy(resampler->line, row, resampler->src_width * get_depth_for_config(resampler->src_config));
+      resampler->first_row = resampler->line;
+    }
+    resampler->pushed = 1;
+  } else {
+    resampler->row_func(get_dst_line(resampler), resampler->first_row, row,
+        resampler->dst_width, resampler->ratio);
+    resampler->pushed = 0;
+    finish_dst_line(resampler);
+  }
+}
+
+
+////////////////////////////////
+// IMAGE_RESAMPLE_AREA
+////////////////////////////////
+
+static void push_row_area(Resampler* resampler, const uint8_t* row) {
+  const uint32_t channels = resampler->channels;
+  const uint32_t ratio = resampler->ratio;
+  const size_t count = (size_t) resampler->src_width * channels;
+  uint32_t* sums = resampler->sums;
+  uint32_t i, j, c;
+
+  // Add the row to column sums
+  if (resampler->src_config != IMAGE_CONFIG_RGB_565) {
+    for (i = 0; i < count; i++) {
+      sums[i] += row[i];
+    }
+  } else {
+    uint8_t* values = resampler->values;
+    for (i = 0; i < resampler->src_width; i++) {
+      unpack_pixel(row + i * 2, IMAGE_CONFIG_RGB_565, values + i * 3);
+    }
+    for (i = 0; i < count; i++) {
+      sums[i] += values[i];
+    }
+  }
+
+  if (++resampler->pushed < ratio) {
+    return;
+  }
+
+  // The cell is complete, sum columns of each cell
+  const uint32_t area = ratio * ratio;
+  const uint32_t dst_depth = get_depth_for_config(resampler->dst_config);
+  uint8_t* dst = get_dst_line(resampler);
+  uint8_t values[4];
+
+  for (i = 0; i < resampler->dst_width; i++) {
+    for (c = 0; c < channels; c++) {
+      uint32_t sum = 0;
+      const uint32_t* p = sums + i * ratio * channels + c;
+      for (j = 0; j < ratio; j++) {
+        sum += *p;
+        p += channels;
+      }
+      values[c] = (uint8_t) ((sum + area / 2) / area);
+    }
+    pack_pixel(values, resampler->src_config, resampler->dst_config, dst);
+    dst += dst_depth;
+  }
+
+  memset(sums, 0, count * sizeof(uint32_t));
+  resampler->pushed = 0;
+  finish_dst_line(resampler);
+}
+
+
+////////////////////////////////
+// IMAGE_RESAMPLE_BILINEAR
+////////////////////////////////
+
+// Map the center of each dst pixel to src
+static void init_bilinear_map(uint32_t src_size, uint32_t dst_size, uint32_t* index, uint16_t* weight) {
+  const int64_t den = 2 * (int64_t) dst_size;
+  uint32_t i;
+
+  for (i = 0; i < dst_size; i++) {
+    // (i + 0.5) * src_size / dst_size - 0.5
+    int64_t num = (2 * (int64_t) i + 1) * src_size - dst_size;
+    uint32_t x = 0;
+    uint32_t w = 0;
+
+    if (num > 0) {
+      x = (uint32_t) (num / den);
+      w = (uint32_t) (((num % den) * WEIGHT_ONE + den / 2) / den);
+      if (w == WEIGHT_ONE) {
+        x++;
+        w = 0;
+      }
+    }
+    if (x >= src_size - 1) {
+      x = src_size - 1;
+      w = 0;
+    }
+
+    index[i] = x;
+    weight[i] = (uint16_t) w;
+  }
+}
+
+static inline uint32_t get_bilinear_row_1(Resampler* resampler, uint32_t dst_y) {
+  return resampler->y_weight[dst_y] == 0 ?
+      resampler->y_index[dst_y] : resampler->y_index[dst_y] + 1;
+}
+
+static inline bool is_bilinear_row_cached(Resampler* resampler, uint32_t y) {
+  return resampler->row_index[0] == y || resampler->row_index[1] == y;
+}
+
+static inline uint16_t* get_bilinear_row(Resampler* resampler, uint32_t y) {
+  return resampler->row_index[0] == y ? resampler->rows[0] : resampler->rows[1];
+}
+
+static uint32_t next_row_bilinear(Resampler* resampler) {
+  uint32_t y0 = resampler->y_index[resampler->dst_y];
+  uint32_t y1 = get_bilinear_row_1(resampler, resampler->dst_y);
+
+  if (!is_bilinear_row_cached(resampler, y0)) {
+    return y0;
+  } else {
+    return y1;
+  }
+}
+
+static void emit_row_bilinear(Resampler* resampler) {
+  const uint32_t channels = resampler->channels;
+  const uint32_t dst_depth = get_depth_for_config(resampler->dst_config);
+  const uint32_t y = resampler->dst_y;
+  const uint32_t w1 = resampler->y_weight[y];
+  const uint32_t w0 = WEIGHT_ONE - w1;
+  const uint16_t* row0 = get_bilinear_row(resampler, resampler->y_index[y]);
+  const uint16_t* row1 = get_bilinear_row(resampler, get_bilinear_row_1(resampler, y));
+  uint8_t* dst = get_dst_line(resampler);
+  uint8_t values[4];
+  uint32_t i, c;
+
+  for (i = 0; i < resampler->dst_width; i++) {
+    for (c = 0; c < channels; c++) {
+      values[c] = (uint8_t) ((row0[c] * w0 + row1[c] * w1 + (1 << (2 * WEIGHT_BITS - 1))) >> (2 * WEIGHT_BITS));
+    }
+    pack_pixel(values, resampler->src_config, resampler->dst_config, dst);
+    row0 += channels;
+    row1 += channels;
+    dst += dst_depth;
+  }
+
+  finish_dst_line(resampler);
+}
+
+static void push_row_bilinear(Resampler* resampler, const uint8_t* row) {
+  const uint32_t channels = resampler->channels;
+  const uint32_t src_depth = get_depth_for_config(resampler->src_config);
+  const uint32_t y = next_row_bilinear(resampler);
+  const uint32_t y0 = resampler->y_index[resampler->dst_y];
+  uint8_t values0[4];
+  uint8_t values1[4];
+  uint16_t* h_row;
+  uint32_t slot;
+  uint32_t i, c;
+
+  // Overwrite the row which is not needed any more
+  slot = resampler->row_index[0] == y0 ? 1 : 0;
+  resampler->row_index[slot] = y;
+  h_row = resampler->rows[slot];
+
+  // Horizontal pass, keep the fraction
+  for (i = 0; i < resampler->dst_width; i++) {
+    const uint32_t x = resampler->x_index[i];
+    const uint32_t w1 = resampler->x_weight[i];
+    const uint32_t w0 = WEIGHT_ONE - w1;
+    unpack_pixel(row + x * src_depth, resampler->src_config, values0);
+    if (w1 != 0) {
+      unpack_pixel(row + (x + 1) * src_depth, resampler->src_config, values1);
+    } else {
+      memcpy(values1, values0, sizeof(values1));
+    }
+    for (c = 0; c < channels; c++) {
+      h_row[c] = (uint16_t) (values0[c] * w0 + values1[c] * w1);
+    }
+    h_row += channels;
+  }
+
+  // Emit all rows which are ready, upscaling emits a row more than once
+  while (resampler->dst_y < resampler->dst_height &&
+      is_bilinear_row_cached(resampler, resampler->y_index[resampler->dst_y]) &&
+      is_bilinear_row_cached(resampler, get_bilinear_row_1(resampler, resampler->dst_y))) {
+    emit_row_bilinear(resampler);
+  }
+}
+
+
+////////////////////////////////
+// Resampler
+////////////////////////////////
+
+void resample_get_size(int32_t resample, float ratio, uint32_t* width, uint32_t* height,
+    uint32_t* dst_width, uint32_t* dst_height) {
+  if (!(ratio >= 1.0f)) {
+    ratio = 1.0f;
+  }
+
+  if (resample == IMAGE_RESAMPLE_BILINEAR) {
+    *dst_width = (uint32_t) (*width / (double) ratio + 0.5);
+    *dst_height = (uint32_t) (*height / (double) ratio + 0.5);
+  } else {
+    uint32_t int_ratio = (uint32_t) ratio;
+    *width = floor_uint32_t(*width, int_ratio);
+    *height = floor_uint32_t(*height, int_ratio);
+    *dst_width = *width / int_ratio;
+    *dst_height = *height / int_ratio;
+  }
+}
+
+// Sizes of the arrays after the struct, each one is 8-byte aligned
+typedef struct {
+  size_t line;
+  size_t sums;
+  size_t values;
+  size_t x_index;
+  size_t x_weight;
+  size_t y_index;
+  size_t y_weight;
+  size_t row;
+} ResamplerLayout;
+
+#define ALIGN_8(size) (((size) + 7) & ~((size_t) 7))
+
+static bool check_resampler_args(int32_t resample, int32_t src_config, int32_t dst_config,
+    uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height) {
+  if (src_width == 0 || src_height == 0 || dst_width == 0 || dst_height == 0) {
+    LOGE(MSG("Invalid size: %ux%u to %ux%u"), src_width, src_height, dst_width, dst_height);
+    return false;
+  }
+  if (get_row_func(src_config, dst_config, 1) == NULL) {
+    LOGE(MSG("Can't resample config %d to %d"), src_config, dst_config);
+    return false;
+  }
+  if (!is_valid_resample(resample)) {
+    LOGE(MSG("Invalid resample: %d"), resample);
+    return false;
+  }
+  if (resample != IMAGE_RESAMPLE_BILINEAR && (src_width % dst_width != 0 ||
+      src_width / dst_width != src_height / dst_height || src_height % dst_height != 0)) {
+    LOGE(MSG("Resample %d needs an integer ratio: %ux%u to %ux%u"),
+        resample, src_width, src_height, dst_width, dst_height);
+    return false;
+  }
+  return true;
+}
+
+// All resample modes are plain conversion without scaling, row functions do it best
+static inline int32_t get_actual_resample(int32_t resample, uint32_t src_width,
+    uint32_t src_height, uint32_t dst_width, uint32_t dst_height) {
+  return src_width == dst_width && src_height == dst_height ? IMAGE_RESAMPLE_2X2 : resample;
+}
+
+static size_t get_resampler_layout(int32_t resample, int32_t src_config, uint32_t src_width,
+    uint32_t src_height, uint32_t dst_width, uint32_t dst_height, ResamplerLayout* layout) {
+  const size_t channels = get_channels(src_config);
+
+  memset(layout, 0, sizeof(ResamplerLayout));
+  switch (get_actual_resample(resample, src_width, src_height, dst_width, dst_height)) {
+    case IMAGE_RESAMPLE_2X2:
+      if (src_width != dst_width) {
+        layout->line = ALIGN_8((size_t) src_width * get_depth_for_config(src_config));
+      }
+      break;
+    case IMAGE_RESAMPLE_AREA:
+      layout->sums = ALIGN_8((size_t) src_width * channels * sizeof(uint32_t));
+      if (src_config == IMAGE_CONFIG_RGB_565) {
+        layout->values = ALIGN_8((size_t) src_width * channels);
+      }
+      break;
+    case IMAGE_RESAMPLE_BILINEAR:
+      layout->x_index = ALIGN_8(dst_width * sizeof(uint32_t));
+      layout->x_weight = ALIGN_8(dst_width * sizeof(uint16_t));
+      layout->y_index = ALIGN_8(dst_height * sizeof(uint32_t));
+      layout->y_weight = ALIGN_8(dst_height * sizeof(uint16_t));
+      layout->row = ALIGN_8((size_t) dst_width * channels * sizeof(uint16_t));
+      break;
+    default:
+      break;
+  }
+
+  return ALIGN_8(sizeof(Resampler)) + layout->line + layout->sums + layout->values +
+      layout->x_index + layout->x_weight + layout->y_index + layout->y_weight + 2 * layout->row;
+}
+
+size_t resampler_get_buffer_size(int32_t resample, int32_t src_config,
+    uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height) {
+  ResamplerLayout layout;
+  return get_resampler_layout(resample, src_config, src_width, src_height,
+      dst_width, dst_height, &layout);
+}
+
+Resampler* resampler_init(void* buffer, int32_t resample, int32_t src_config, int32_t dst_config,
+    uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height,
+    uint8_t* dst, size_t dst_stride) {
+  Resampler* resampler = buffer;
+  ResamplerLayout layout;
+  uint8_t* p;
+
+  if (!check_resampler_args(resample, src_config, dst_config,
+      src_width, src_height, dst_width, dst_height)) {
+    return NULL;
+  }
+
+  resample = get_actual_resample(resample, src_width, src_height, dst_width, dst_height);
+  get_resampler_layout(resample, src_config, src_width, src_height, dst_width, dst_height, &layout);
+  memset(resampler, 0, sizeof(Resampler));
+  p = (uint8_t*) buffer + ALIGN_8(sizeof(Resampler));
+
+  resampler->resample = resample;
+  resampler->src_config = src_config;
+  resampler->dst_config = dst_config;
+  resampler->src_width = src_width;
+  resampler->src_height = src_height;
+  resampler->dst_width = dst_width;
+  resampler->dst_height = dst_height;
+  resampler->dst = dst;
+  resampler->dst_stride = dst_stride;
+  resampler->ratio = src_width / dst_width;
+  resampler->channels = get_channels(src_config);
+
+  switch (resample) {
+    case IMAGE_RESAMPLE_NEAREST:
+      break;
+    case IMAGE_RESAMPLE_2X2:
+      resampler->row_func = get_row_func(src_config, dst_config, resampler->ratio);
+      if (layout.line != 0) {
+        resampler->line = p;
+      }
+      break;
+    case IMAGE_RESAMPLE_AREA:
+      resampler->sums = (uint32_t*) p;
+      memset(resampler->sums, 0, layout.sums);
+      p += layout.sums;
+      if (layout.values != 0) {
+        resampler->values = p;
+      }
+      break;
+    case IMAGE_RESAMPLE_BILINEAR:
+      resampler->x_index = (uint32_t*) p;
+      p += layout.x_index;
+      resampler->x_weight = (uint16_t*) p;
+      p += layout.x_weight;
+      resampler->y_index = (uint32_t*) p;
+      p += layout.y_index;
+      resampler->y_weight = (uint16_t*) p;
+      p += layout.y_weight;
+      resampler->rows[0] = (uint16_t*) p;
+      p += layout.row;
+      resampler->rows[1] = (uint16_t*) p;
+      resampler->row_index[0] = NO_ROW;
+      resampler->row_index[1] = NO_ROW;
+      init_bilinear_map(src_width, dst_width, resampler->x_index, resampler->x_weight);
+      init_bilinear_map(src_height, dst_height, resampler->y_index, resampler->y_weight);
+      break;
+    default:
+      break;
+  }
+
+  return resampler;
+}
+
+Resampler* resampler_new(int32_t resample, int32_t src_config, int32_t dst_config,
+    uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height,
+    uint8_t* dst, size_t dst_stride) {
+  void* buffer;
+  Resampler* resampler;
+
+  if (!check_resampler_args(resample, src_config, dst_config,
+      src_width, src_height, dst_width, dst_height)) {
+    return NULL;
+  }
+
+  buffer = malloc(resampler_get_buffer_size(resample, src_config,
+      src_width, src_height, dst_width, dst_height));
+  if (buffer == NULL) {
+    WTF_OOM;
+    return NULL;
+  }
+
+  resampler = resampler_init(buffer, resample, src_config, dst_config,
+      src_width, src_height, dst_width, dst_height, dst, dst_stride);
+  if (resampler == NULL) {
+    free(buffer);
+  }
+  return resampler;
+}
+
+bool resampler_is_row_needed(Resampler* resampler, uint32_t y) {
+  const uint32_t ratio = resampler->ratio;
+  uint32_t offset;
+
+  if (y >= resampler->src_height) {
+    return false;
+  }
+
+  switch (resampler->resample) {
+    case IMAGE_RESAMPLE_NEAREST:
+      return y % ratio == (ratio - 1) / 2;
+    case IMAGE_RESAMPLE_2X2:
+      if (ratio == 1) {
+        return true;
+      }
+      offset = y % ratio;
+      return offset == (ratio - 2) / 2 || offset == (ratio - 2) / 2 + 1;
+    case IMAGE_RESAMPLE_AREA:
+      return true;
+    case IMAGE_RESAMPLE_BILINEAR: {
+      // y_index is ascending, find the first dst row whose y_index >= y - 1
+      uint32_t low = 0;
+      uint32_t high = resampler->dst_height;
+      while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (resampler->y_index[mid] + 1 < y) {
+          low = mid + 1;
+        } else {
+          high = mid;
+        }
+      }
+      for (; low < resampler->dst_height && resampler->y_index[low] <= y; low++) {
+        if (resampler->y_index[low] == y || get_bilinear_row_1(resampler, low) == y) {
+          return true;
+        }
+      }
+      return false;
+    }
+    default:
+      return false;
+  }
+}
+
+uint32_t resampler_next_row(Resampler* resampler) {
+  const uint32_t ratio = resampler->ratio;
+  const uint32_t dst_y = resampler->dst_y;
+
+  if (dst_y >= resampler->dst_height) {
+    return resampler->src_height;
+  }
+
+  switch (resampler->resample) {
+    case IMAGE_RESAMPLE_NEAREST:
+      return dst_y * ratio + (ratio - 1) / 2;
+    case IMAGE_RESAMPLE_2X2:
+      if (ratio == 1) {
+        return dst_y;
+      }
+      return dst_y * ratio + (ratio - 2) / 2 + resampler->pushed;
+    case IMAGE_RESAMPLE_AREA:
+      return dst_y * ratio + resampler->pushed;
+    case IMAGE_RESAMPLE_BILINEAR:
+      return next_row_bilinear(resampler);
+    default:
+      return resampler->src_height;
+  }
+}
+
+void resampler_set_rows_kept(Resampler* resampler, bool rows_kept) {
+  resampler->rows_kept = rows_kept;
+}
+
+void resampler_set_premultiply(Resampler* resampler, bool premultiply) {
+  // Only RGBA8888 to RGBA8888 carries alpha
+  resampler->premultiply = premultiply &&
+      resampler->src_config == IMAGE_CONFIG_RGBA_8888 &&
+      resampler->dst_config == IMAGE_CONFIG_RGBA_8888;
+}
+
+void resampler_set_orienter(Resampler* resampler, Orienter* orienter) {
+  resampler->orienter = orienter;
+}
+
+void resampler_push_row(Resampler* resampler, const uint8_t* row) {
+  if (resampler->dst_y >= resampler->dst_height) {
+    return;
+  }
+
+  switch (resampler->resample) {
+    case IMAGE_RESAMPLE_NEAREST:
+      push_row_nearest(resampler, row);
+      break;
+    case IMAGE_RESAMPLE_2X2:
+      push_row_2x2(resampler, row);
+      break;
+    case IMAGE_RESAMPLE_AREA:
+      push_row_area(resampler, row);
+      break;
+    case IMAGE_RESAMPLE_BILINEAR:
+      push_row_bilinear(resampler, row);
+      break;
+    default:
+      break;
+  }
+}
+
+void resampler_delete(Resampler** resampler) {
+  if (resampler == NULL || *resampler == NULL) {
+    return;
+  }
+
+  // Arrays are in the same block
+  free(*resampler);
+  *resampler = NULL;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_IMAGE_RESAMPLE_H
+#define IMAGE_IMAGE_RESAMPLE_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image_orientation.h"
+
+
+/**
+ * Resampler scales source rows to destination rows, one row at a time,
+ * so decoders can feed it while decoding.
+ *
+ * Usage:
+ *   while ((y = resampler_next_row(resampler)) < src_height) {
+ *     // Skip rows before y, then read row y
+ *     resampler_push_row(resampler, row);
+ *   }
+ *
+ * Source rows are asked in ascending order, each one at most once.
+ * IMAGE_RESAMPLE_NEAREST, IMAGE_RESAMPLE_2X2 and IMAGE_RESAMPLE_AREA need
+ * src_width == dst_width * ratio and src_height == dst_height * ratio.
+ * IMAGE_RESAMPLE_BILINEAR takes any size.
+ */
+struct RESAMPLER;
+typedef struct RESAMPLER Resampler;
+
+
+/**
+ * Get the destination size of a source area.
+ * IMAGE_RESAMPLE_BILINEAR rounds width / ratio, the others take the integer part
+ * of ratio and floor width and height to multiple of it. ratio less than 1 is 1.
+ * Destination size might be 0 if ratio is too large.
+ */
+void resample_get_size(int32_t resample, float ratio, uint32_t* width, uint32_t* height,
+    uint32_t* dst_width, uint32_t* dst_height);
+
+/**
+ * @param dst The first destination row.
+ * @param dst_stride Bytes between two destination rows.
+ * @return NULL if the arguments are invalid or out of memory.
+ */
+Resampler* resampler_new(int32_t resample, int32_t src_config, int32_t dst_config,
+    uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height,
+    uint8_t* dst, size_t dst_stride);
+
+/**
+ * Return the buffer size resampler_init() needs.
+ */
+size_t resampler_get_buffer_size(int32_t resample, int32_t src_config,
+    uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height);
+
+/**
+ * The same as resampler_new(), but the resampler lives in buffer, so no allocation.
+ * buffer must be 8-byte aligned and at least resampler_get_buffer_size() bytes.
+ * Don't call resampler_delete() on it.
+ */
+Resampler* resampler_init(void* buffer, int32_t resample, int32_t src_config, int32_t dst_config,
+    uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height,
+    uint8_t* dst, size_t dst_stride);
+
+/**
+ * Return true if source row y is needed. Useful to decoders which can't
+ * decode rows in order, for example interlaced PNG.
+ */
+bool resampler_is_row_needed(Resampler* resampler, uint32_t y);
+
+/**
+ * Return the index of next source row to push,
+ * or src_height if all destination rows are done.
+ */
+uint32_t resampler_next_row(Resampler* resampler);
+
+/**
+ * Tell the resampler that the caller keeps every pushed row unchanged
+ * until the next push, so it doesn't copy rows it still needs.
+ * Decoders can get it by reading rows into two buffers by turns.
+ */
+void resampler_set_rows_kept(Resampler* resampler, bool rows_kept);
+
+/**
+ * Premultiply alpha of destination rows. It only works from RGBA8888 to RGBA8888.
+ */
+void resampler_set_premultiply(Resampler* resampler, bool premultiply);
+
+/**
+ * Write destination rows through the orienter instead of dst.
+ * The orienter area must be dst_width x dst_height. Set it before the first push.
+ */
+void resampler_set_orienter(Resampler* resampler, Orienter* orienter);
+
+/**
+ * Push the source row resampler_next_row() asked for.
+ * The row starts from the first pixel of the source area.
+ */
+void resampler_push_row(Resampler* resampler, const uint8_t* row);
+
+void resampler_delete(Resampler** resampler);
+
+
+#endif //IMAGE_IMAGE_RESAMPLE_H
@@ -15,6 +15,8 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
 #include <android/bitmap.h>
 #include <GLES2/gl2.h>
 
@@ -25,6 +27,7 @@
 #include "com_hippo_image_AnimatedDelegateImage.h"
 #include "com_hippo_image_BitmapDecoder.h"
 #include "com_hippo_image_BitmapRegionDecoder.h"
+#include "com_hippo_image_EncodedCache.h"
 #include "image.h"
 #include "image_convert.h"
 #include "image_decoder.h"
@@ -32,6 +35,10 @@
 #include "bitmap_container.h"
 #include "java_stream.h"
 #include "buffer_stream.h"
+#include "file_stream.h"
+#include "prefetch_stream.h"
+#include "byte_source.h"
+#include "source_cache.h"
 #include "../log.h"
 
 
@@ -80,14 +87,24 @@ static int32_t bitmap_format_to_config(int32_t format) {
       return IMAGE_CONFIG_RGBA_8888;
     case ANDROID_BITMAP_FORMAT_RGB_565:
       return IMAGE_CONFIG_RGB_565;
+    case ANDROID_BITMAP_FORMAT_A_8:
+      return IMAGE_CONFIG_GRAY_8;
     default:
       return IMAGE_CONFIG_INVALID;
   }
 }
 
 
+// The ring size of InputStream prefetching
+#define PREFETCH_WINDOW (256 * 1024)
+// InputStream.available() below it isn't worth an I/O thread
+#define PREFETCH_MIN_SIZE (64 * 1024)
+
+
 static bool INIT_SUCCEED = false;
 
+static JavaVM* VM = NULL;
+
 static jclass CLASS_STATIC_IMAGE = NULL;
 static jclass CLASS_ANIMATED_IMAGE = NULL;
 static jclass CLASS_BITMAP_DECODER = NULL;
@@ -99,14 +116,76 @@ static jmethodID CONSTRUCTOR_BITMAP_REGION_DECODER = NULL;
 
 static jmethodID METHOD_ANIMATED_IMAGE_ON_COMPLETE = NULL;
 static jmethodID METHOD_IMAGE_INFO_SET = NULL;
+static jmethodID METHOD_IO_STATS_SET = NULL;
+static jmethodID METHOD_ENCODED_CACHE_STATS_SET = NULL;
 static jmethodID METHOD_BITMAP_DECODER_CREATE_BITMAP = NULL;
 static jmethodID METHOD_BITMAP_RECYCLE = NULL;
 
+// NULL if FileDescriptor hides it, then every *Fd native fails
+static jfieldID FIELD_FILE_DESCRIPTOR_DESCRIPTOR = NULL;
+
+// Nothing is cached until EncodedCache.setMaxSize()
+static SourceCache* CACHE = NULL;
+
+
+// The native object of BitmapRegionDecoder, shared by share()
+typedef struct {
+  atomic_size_t refs;
+  ByteSource* source;
+  // NULL if the image isn't indexed
+  ImageIndex* index;
+} RegionDecoder;
+
+// Take source and index it, source is released if failed
+static RegionDecoder* region_decoder_new(ByteSource* source) {
+  RegionDecoder* decoder;
+  Stream* stream;
+
+  decoder = malloc(sizeof(RegionDecoder));
+  if (decoder == NULL) {
+    WTF_OOM;
+    byte_source_unref(&source);
+    return NULL;
+  }
+
+  atomic_init(&decoder->refs, 1);
+  decoder->source = source;
+  decoder->index = NULL;
+
+  // Only once, every region decodes faster then
+  stream = byte_source_open(source);
+  if (stream != NULL) {
+    decoder->index = image_index_new(stream);
+    stream->close(&stream);
+  }
+
+  return decoder;
+}
+
+static RegionDecoder* region_decoder_ref(RegionDecoder* decoder) {
+  atomic_fetch_add_explicit(&decoder->refs, 1, memory_order_relaxed);
+  return decoder;
+}
+
+static void region_decoder_unref(RegionDecoder** decoder) {
+  if (decoder == NULL || *decoder == NULL) {
+    return;
+  }
+
+  if (atomic_fetch_sub_explicit(&(*decoder)->refs, 1, memory_order_acq_rel) == 1) {
+    image_index_delete(&(*decoder)->index);
+    byte_source_unref(&(*decoder)->source);
+    free(*decoder);
+  }
+  *decoder = NULL;
+}
+
 
 static jobject static_image_object_new(JNIEnv* env, StaticImage* image) {
   return (*env)->NewObject(env, CLASS_STATIC_IMAGE, CONSTRUCTOR_STATIC_IMAGE,
       (jlong) image, (jint) image->width, (jint) image->height, (jint) image->format,
-      (jboolean) image->opaque, (jint) (image->width * image->height * 4));
+      (jboolean) image->opaque,
+      (jint) (image->width * image->height * get_depth_for_config(image->config)));
 }
 
 static jobject animated_image_object_new(JNIEnv* env, AnimatedImage* image) {
@@ -115,10 +194,137 @@ static jobject animated_image_object_new(JNIEnv* env, AnimatedImage* image) {
       (jint) image->format, (jboolean) image->opaque);
 }
 
-static jobject bitmap_region_decoder_object_new(JNIEnv* env, Stream* stream, ImageInfo* info) {
+static jobject bitmap_region_decoder_object_new(JNIEnv* env, RegionDecoder* decoder, ImageInfo* info) {
   return (*env)->NewObject(env, CLASS_BITMAP_REGION_DECODER, CONSTRUCTOR_BITMAP_REGION_DECODER,
-      (jlong) stream, (jint) info->width, (jint) info->height,
-      (jint) info->format, (jboolean) info->opaque);
+      (jlong) decoder, (jint) info->width, (jint) info->height,
+      (jint) info->format, (jboolean) info->opaque, (jint) info->orientation);
+}
+
+static bool attach_io_thread(Stream* inner) {
+  JNIEnv* env;
+
+  if ((*VM)->AttachCurrentThread(VM, &env, NULL) != JNI_OK) {
+    LOGE(MSG("Can't attach I/O thread"));
+    return false;
+  }
+
+  java_stream_set_env(inner, env);
+  return true;
+}
+
+static void detach_io_thread() {
+  (*VM)->DetachCurrentThread(VM);
+}
+
+/**
+ * Create a java stream read on an I/O thread, so InputStream.read()
+ * runs while decoding. Fall back to the plain java stream.
+ *
+ * A partially decoded image keeps its stream, it would keep the I/O thread
+ * too, so it and small streams are read on the caller.
+ */
+static Stream* java_stream_new_prefetched(JNIEnv* env, jobject is, bool partially) {
+  Stream* stream;
+  Stream* prefetch_stream;
+
+  stream = java_stream_new(env, is, true);
+  if (stream == NULL) {
+    return NULL;
+  }
+
+  if (partially || java_stream_get_available(stream) < PREFETCH_MIN_SIZE) {
+    return stream;
+  }
+
+  prefetch_stream = prefetch_stream_new(stream, PREFETCH_WINDOW);
+  return prefetch_stream != NULL ? prefetch_stream : stream;
+}
+
+// Get the cached source of the String key, NULL on a miss.
+// Modified UTF-8 has no zero byte, strlen() is the size.
+static ByteSource* get_cached_source(JNIEnv* env, jstring key) {
+  const char* chars;
+  ByteSource* source;
+
+  chars = (*env)->GetStringUTFChars(env, key, NULL);
+  if (chars == NULL) {
+    return NULL;
+  }
+  source = source_cache_get(CACHE, chars, strlen(chars));
+  (*env)->ReleaseStringUTFChars(env, key, chars);
+
+  return source;
+}
+
+static bool put_cached_source(JNIEnv* env, jstring key, ByteSource* source) {
+  const char* chars;
+  bool result;
+
+  chars = (*env)->GetStringUTFChars(env, key, NULL);
+  if (chars == NULL) {
+    return false;
+  }
+  result = source_cache_put(CACHE, chars, strlen(chars), source);
+  (*env)->ReleaseStringUTFChars(env, key, chars);
+
+  return result;
+}
+
+// Return the int fd of the FileDescriptor, -1 if it can't be read
+static int get_fd(JNIEnv* env, jobject fd) {
+  if (fd == NULL || FIELD_FILE_DESCRIPTOR_DESCRIPTOR == NULL) {
+    return -1;
+  }
+  return (*env)->GetIntField(env, fd, FIELD_FILE_DESCRIPTOR_DESCRIPTOR);
+}
+
+static Stream* file_stream_new_from_object(JNIEnv* env, jobject fd) {
+  int n = get_fd(env, fd);
+  if (n < 0) {
+    return NULL;
+  }
+  return file_stream_new(n);
+}
+
+// Return the address of offset in the direct buffer, NULL if out of bounds
+static uint8_t* get_direct_buffer_address(JNIEnv* env, jobject buffer, jint offset, jint length) {
+  uint8_t* address;
+  jlong capacity;
+
+  if (buffer == NULL) {
+    return NULL;
+  }
+
+  address = (*env)->GetDirectBufferAddress(env, buffer);
+  capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+  if (address == NULL || offset < 0 || length < 0 || (jlong) offset + length > capacity) {
+    LOGE(MSG("Not a direct buffer or out of bounds: offset %d, length %d"), offset, length);
+    return NULL;
+  }
+
+  return address + offset;
+}
+
+// Read the direct buffer in place, no copy and no JNI call while decoding
+static Stream* buffer_stream_new_from_object(JNIEnv* env, jobject buffer, jint offset, jint length) {
+  uint8_t* address = get_direct_buffer_address(env, buffer, offset, length);
+  return address != NULL ? buffer_stream_wrap(address, (size_t) length) : NULL;
+}
+
+// Count I/O of stream if stats isn't NULL
+static void io_stats_start(Stream* stream, jobject stats, StreamCounters* counters) {
+  if (stats != NULL) {
+    stream_set_counters(stream, counters);
+  }
+}
+
+static void io_stats_object_set(JNIEnv* env, jobject stats, StreamCounters* counters) {
+  if (stats != NULL) {
+    (*env)->CallVoidMethod(env, stats, METHOD_IO_STATS_SET,
+        (jlong) counters->read_bytes, (jlong) counters->peeked_bytes,
+        (jlong) counters->skipped_bytes, (jlong) counters->source_reads,
+        (jlong) counters->jni_calls, (jlong) counters->blocked_ns);
+  }
 }
 
 static void animated_image_object_on_complete(JNIEnv* env, jobject obj, AnimatedImage* image) {
@@ -146,31 +352,29 @@ static void animated_image_object_on_complete(JNIEnv* env, jobject obj, Animated
 // Image
 ////////////////////////////////
 
-JNIEXPORT jobject JNICALL
-Java_com_hippo_image_Image_nativeDecode(JNIEnv* env, __unused jclass clazz, jobject is, jboolean partially) {
+// Decode from stream, then close it, unless an uncompleted animated image keeps it
+static jobject decode_image_object(JNIEnv* env, Stream* stream, jboolean partially, jint quality,
+    jobject stats) {
+  StreamCounters counters;
   bool animated;
   void* image = NULL;
-  Stream* stream = NULL;
   jobject obj;
 
-  if (!INIT_SUCCEED) {
-    return NULL;
-  }
-
-  stream = java_stream_new(env, is, true);
-  if (stream == NULL) {
-    LOGE(MSG("Can't create java stream"));
-    return NULL;
-  }
+  io_stats_start(stream, stats, &counters);
 
   // Decode
-  decode(stream, partially, &animated, &image);
+  decode(stream, partially, (int32_t) quality, &animated, &image);
 
   // Close stream is necessary
   if (image == NULL || !animated || ((AnimatedImage*) image)->completed) {
     stream->close(&stream);
+  } else {
+    // The image keeps reading it later
+    stream_set_counters(stream, NULL);
   }
 
+  io_stats_object_set(env, stats, &counters);
+
   if (image != NULL) {
     if (!animated) {
       obj = static_image_object_new(env, image);
@@ -187,6 +391,86 @@ Java_com_hippo_image_Image_nativeDecode(JNIEnv* env, __unused jclass clazz, jobj
   return obj;
 }
 
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_Image_nativeDecode(JNIEnv* env, __unused jclass clazz, jobject is,
+    jboolean partially, jint quality, jobject stats) {
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  stream = java_stream_new_prefetched(env, is, partially);
+  if (stream == NULL) {
+    LOGE(MSG("Can't create java stream"));
+    return NULL;
+  }
+
+  return decode_image_object(env, stream, partially, quality, stats);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_Image_nativeDecodeFd(JNIEnv* env, __unused jclass clazz, jobject fd,
+    jboolean partially, jint quality, jobject stats) {
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  stream = file_stream_new_from_object(env, fd);
+  if (stream == NULL) {
+    LOGE(MSG("Can't create file stream"));
+    return NULL;
+  }
+
+  return decode_image_object(env, stream, partially, quality, stats);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_Image_nativeDecodeBuffer(JNIEnv* env, __unused jclass clazz,
+    jobject buffer, jint offset, jint length, jint quality) {
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  stream = buffer_stream_new_from_object(env, buffer, offset, length);
+  if (stream == NULL) {
+    LOGE(MSG("Can't create buffer stream"));
+    return NULL;
+  }
+
+  // Not partially, nothing keeps the stream after the buffer is gone
+  return decode_image_object(env, stream, false, quality, NULL);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_Image_nativeDecodeCached(JNIEnv* env, __unused jclass clazz, jstring key,
+    jboolean partially, jint quality) {
+  ByteSource* source;
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  source = get_cached_source(env, key);
+  if (source == NULL) {
+    return NULL;
+  }
+
+  // The cursor keeps the bytes for a partially decoded image
+  stream = byte_source_open(source);
+  byte_source_unref(&source);
+  if (stream == NULL) {
+    return NULL;
+  }
+
+  return decode_image_object(env, stream, partially, quality, NULL);
+}
+
 JNIEXPORT jobject JNICALL
 Java_com_hippo_image_Image_nativeCreate(JNIEnv* env, __unused jclass clazz, jobject bitmap) {
 #ifdef IMAGE_SUPPORT_PLAIN
@@ -277,7 +561,8 @@ Java_com_hippo_image_StaticImage_nativeRecycle(__unused JNIEnv* env, __unused jc
 JNIEXPORT void JNICALL
 Java_com_hippo_image_StaticDelegateImage_nativeRender(JNIEnv* env, __unused jclass clazz,
     jlong ptr, jobject bitmap, jint dst_x, jint dst_y, jint src_x, jint src_y,
-    jint width, jint height, jint ratio, jboolean fill_blank, jint fill_color) {
+    jint width, jint height, jint ratio, jint resample, jint orientation,
+    jboolean premultiply, jboolean fill_blank, jint fill_color) {
   AndroidBitmapInfo info;
   void *pixels = NULL;
   StaticImage* image = (StaticImage *) ptr;
@@ -292,12 +577,12 @@ Java_com_hippo_image_StaticDelegateImage_nativeRender(JNIEnv* env, __unused jcla
   convert(pixels, bitmap_format_to_config(info.format),
       info.width, info.height,
       dst_x, dst_y,
-      image->buffer, IMAGE_CONFIG_RGBA_8888,
+      image->buffer, image->config,
       image->width, image->height,
       src_x, src_y,
       (uint32_t) width, (uint32_t) height,
-      ratio < 1 ? 1 : (uint32_t) ratio,
-      fill_blank, j_color_to_rgba8888(fill_color));
+      ratio < 1 ? 1 : (uint32_t) ratio, (int32_t) resample, (int32_t) orientation,
+      premultiply, fill_blank, j_color_to_rgba8888(fill_color));
 
   AndroidBitmap_unlockPixels(env, bitmap);
 
@@ -314,12 +599,12 @@ Java_com_hippo_image_StaticDelegateImage_nativeGlTex(__unused JNIEnv* env, __unu
   convert(buffer, IMAGE_CONFIG_RGBA_8888,
       (uint32_t) tex_w, (uint32_t) tex_h,
       dst_x, dst_y,
-      image->buffer, IMAGE_CONFIG_RGBA_8888,
+      image->buffer, image->config,
       (int) image->width, (int) image->height,
       src_x, src_y,
       (uint32_t) width, (uint32_t) height,
-      ratio < 1 ? 1 : (uint32_t) ratio,
-      false, 0);
+      ratio < 1 ? 1 : (uint32_t) ratio, IMAGE_RESAMPLE_2X2, IMAGE_ORIENTATION_NORMAL,
+      false, false, 0);
 
   if (init) {
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_w, tex_h,
@@ -393,8 +678,8 @@ Java_com_hippo_image_AnimatedDelegateImage_nativeGetCurrentDelay(
 
 JNIEXPORT void JNICALL Java_com_hippo_image_AnimatedDelegateImage_nativeRender(
     JNIEnv* env, __unused jclass clazz, jlong ptr, jobject bitmap, jint dst_x, jint dst_y,
-    jint src_x, jint src_y, jint width, jint height, jint ratio,
-    jboolean fill_blank, jint fill_color) {
+    jint src_x, jint src_y, jint width, jint height, jint ratio, jint resample,
+    jint orientation, jboolean premultiply, jboolean fill_blank, jint fill_color) {
   AndroidBitmapInfo info;
   void *pixels = NULL;
   DelegateImage* image = (DelegateImage *) ptr;
@@ -413,8 +698,8 @@ JNIEXPORT void JNICALL Java_com_hippo_image_AnimatedDelegateImage_nativeRender(
       image->width, image->height,
       src_x, src_y,
       (uint32_t) width, (uint32_t) height,
-      ratio < 1 ? 1 : (uint32_t) ratio,
-      fill_blank, j_color_to_rgba8888(fill_color));
+      ratio < 1 ? 1 : (uint32_t) ratio, (int32_t) resample, (int32_t) orientation,
+      premultiply, fill_blank, j_color_to_rgba8888(fill_color));
 
   AndroidBitmap_unlockPixels(env, bitmap);
 
@@ -435,8 +720,8 @@ JNIEXPORT void JNICALL Java_com_hippo_image_AnimatedDelegateImage_nativeGlTex(
       (int) image->width, (int) image->height,
       src_x, src_y,
       (uint32_t) width, (uint32_t) height,
-      ratio < 1 ? 1 : (uint32_t) ratio,
-      false, 0);
+      ratio < 1 ? 1 : (uint32_t) ratio, IMAGE_RESAMPLE_2X2, IMAGE_ORIENTATION_NORMAL,
+      false, false, 0);
 
   if (init) {
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_w, tex_h,
@@ -473,12 +758,27 @@ JNIEXPORT void JNICALL Java_com_hippo_image_AnimatedDelegateImage_nativeReset(
 // BitmapDecoder
 ////////////////////////////////
 
-JNIEXPORT jboolean JNICALL
-Java_com_hippo_image_BitmapDecoder_nativeDecodeInfo(JNIEnv* env, __unused jclass clazz, jobject is, jobject info) {
-  Stream* stream = NULL;
+// Decode from stream, then close it
+static jboolean decode_info_object(JNIEnv* env, Stream* stream, jobject info) {
   ImageInfo iInfo;
   bool result;
 
+  result = decode_info(stream, &iInfo);
+
+  if (result) {
+    (*env)->CallVoidMethod(env, info, METHOD_IMAGE_INFO_SET, iInfo.width, iInfo.height,
+        iInfo.format, iInfo.opaque, iInfo.frame_count, iInfo.orientation);
+  }
+
+  stream->close(&stream);
+
+  return (jboolean) result;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_hippo_image_BitmapDecoder_nativeDecodeInfo(JNIEnv* env, __unused jclass clazz, jobject is, jobject info) {
+  Stream* stream;
+
   if (!INIT_SUCCEED) {
     return false;
   }
@@ -489,35 +789,52 @@ Java_com_hippo_image_BitmapDecoder_nativeDecodeInfo(JNIEnv* env, __unused jclass
     return false;
   }
 
-  result = decode_info(stream, &iInfo);
+  return decode_info_object(env, stream, info);
+}
 
-  if (result) {
-    (*env)->CallVoidMethod(env, info, METHOD_IMAGE_INFO_SET, iInfo.width, iInfo.height,
-        iInfo.format, iInfo.opaque, iInfo.frame_count);
+JNIEXPORT jboolean JNICALL
+Java_com_hippo_image_BitmapDecoder_nativeDecodeInfoFd(JNIEnv* env, __unused jclass clazz, jobject fd, jobject info) {
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return false;
   }
 
-  stream->close(&stream);
+  stream = file_stream_new_from_object(env, fd);
+  if (stream == NULL) {
+    LOGE(MSG("Can't create file stream"));
+    return false;
+  }
 
-  return (jboolean) result;
+  return decode_info_object(env, stream, info);
 }
 
-JNIEXPORT jobject JNICALL
-Java_com_hippo_image_BitmapDecoder_nativeDecodeBitmap(JNIEnv* env, __unused jclass clazz, jobject is, jint config, jint ratio) {
+JNIEXPORT jboolean JNICALL
+Java_com_hippo_image_BitmapDecoder_nativeDecodeInfoBuffer(JNIEnv* env, __unused jclass clazz,
+    jobject buffer, jint offset, jint length, jobject info) {
   Stream* stream;
-  BufferContainer* container;
-  jobject bitmap;
-  bool result;
 
   if (!INIT_SUCCEED) {
     return false;
   }
 
-  stream = java_stream_new(env, is, true);
+  stream = buffer_stream_new_from_object(env, buffer, offset, length);
   if (stream == NULL) {
-    LOGE(MSG("Can't create java stream"));
-    return NULL;
+    LOGE(MSG("Can't create buffer stream"));
+    return false;
   }
 
+  return decode_info_object(env, stream, info);
+}
+
+// Decode from stream, then close it
+static jobject decode_bitmap_object(JNIEnv* env, Stream* stream,
+    jint config, jfloat ratio, jint resample, jint orientation, jint quality, jobject stats) {
+  StreamCounters counters;
+  BufferContainer* container;
+  jobject bitmap;
+  bool result;
+
   container = bitmap_container_new(env, CLASS_BITMAP_DECODER, METHOD_BITMAP_DECODER_CREATE_BITMAP);
   if (container == NULL) {
     LOGE(MSG("Can't create bitmap container"));
@@ -525,10 +842,15 @@ Java_com_hippo_image_BitmapDecoder_nativeDecodeBitmap(JNIEnv* env, __unused jcla
     return NULL;
   }
 
-  result = decode_buffer(stream, false, 0, 0, 0, 0, (int32_t) config, ratio < 1 ? 1 : (uint32_t) ratio, container);
+  io_stats_start(stream, stats, &counters);
+  result = decode_buffer(stream, false, 0, 0, 0, 0, (int32_t) config,
+      ratio < 1.0f ? 1.0f : ratio, (int32_t) resample, (int32_t) orientation, (int32_t) quality,
+      // Bitmaps from createBitmap() are premultiplied
+      true, container);
   bitmap = bitmap_container_fetch_bitmap(container);
   bitmap_container_recycle(&container);
   stream->close(&stream);
+  io_stats_object_set(env, stats, &counters);
 
   if (!result && bitmap != NULL) {
     // Decode failed and the bitmap is not NULL
@@ -540,60 +862,227 @@ Java_com_hippo_image_BitmapDecoder_nativeDecodeBitmap(JNIEnv* env, __unused jcla
   return bitmap;
 }
 
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_BitmapDecoder_nativeDecodeBitmap(JNIEnv* env, __unused jclass clazz, jobject is,
+    jint config, jfloat ratio, jint resample, jint orientation, jint quality, jobject stats) {
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  stream = java_stream_new_prefetched(env, is, false);
+  if (stream == NULL) {
+    LOGE(MSG("Can't create java stream"));
+    return NULL;
+  }
+
+  return decode_bitmap_object(env, stream, config, ratio, resample, orientation, quality, stats);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_BitmapDecoder_nativeDecodeBitmapFd(JNIEnv* env, __unused jclass clazz, jobject fd,
+    jint config, jfloat ratio, jint resample, jint orientation, jint quality, jobject stats) {
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  stream = file_stream_new_from_object(env, fd);
+  if (stream == NULL) {
+    LOGE(MSG("Can't create file stream"));
+    return NULL;
+  }
+
+  return decode_bitmap_object(env, stream, config, ratio, resample, orientation, quality, stats);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_BitmapDecoder_nativeDecodeBitmapBuffer(JNIEnv* env, __unused jclass clazz,
+    jobject buffer, jint offset, jint length, jint config, jfloat ratio, jint resample, jint orientation,
+    jint quality) {
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  stream = buffer_stream_new_from_object(env, buffer, offset, length);
+  if (stream == NULL) {
+    LOGE(MSG("Can't create buffer stream"));
+    return NULL;
+  }
+
+  return decode_bitmap_object(env, stream, config, ratio, resample, orientation, quality, NULL);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_BitmapDecoder_nativeDecodeBitmapCached(JNIEnv* env, __unused jclass clazz, jstring key,
+    jint config, jfloat ratio, jint resample, jint orientation, jint quality) {
+  ByteSource* source;
+  Stream* stream;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  source = get_cached_source(env, key);
+  if (source == NULL) {
+    return NULL;
+  }
+
+  stream = byte_source_open(source);
+  byte_source_unref(&source);
+  if (stream == NULL) {
+    return NULL;
+  }
+
+  return decode_bitmap_object(env, stream, config, ratio, resample, orientation, quality, NULL);
+}
+
 
 ////////////////////////////////
 // BitmapRegionDecoder
 ////////////////////////////////
 
-JNIEXPORT jobject JNICALL
-Java_com_hippo_image_BitmapRegionDecoder_nativeNewInstance(JNIEnv* env, __unused jclass clazz, jobject is) {
-  Stream* java_stream = NULL;
-  Stream* buffer_stream = NULL;
-  void* buffer = NULL;
-  size_t buffer_size;
+// Decode image info from source, then create the java object which takes source
+static jobject bitmap_region_decoder_object_new_from_source(JNIEnv* env, ByteSource* source) {
+  RegionDecoder* decoder = NULL;
+  Stream* stream;
   ImageInfo info;
   jobject obj = NULL;
+  bool result;
+
+  stream = byte_source_open(source);
+  if (stream == NULL) { goto end; }
+  result = decode_info(stream, &info);
+  stream->close(&stream);
+  if (!result) { goto end; }
+
+  decoder = region_decoder_new(source);
+  source = NULL;
+  if (decoder == NULL) { goto end; }
+
+  obj = bitmap_region_decoder_object_new(env, decoder, &info);
+
+end:
+  // Only release source if create BitmapRegionDecoder failed
+  if (obj == NULL) {
+    byte_source_unref(&source);
+    region_decoder_unref(&decoder);
+  }
+
+  return obj;
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_BitmapRegionDecoder_nativeNewInstance(JNIEnv* env, __unused jclass clazz, jobject is) {
+  Stream* java_stream;
+  ByteSource* source;
 
   if (!INIT_SUCCEED) {
     return NULL;
   }
 
   java_stream = java_stream_new(env, is, false);
-  if (java_stream == NULL) { goto end; }
-  buffer = stream_read_all(java_stream, &buffer_size);
-  if (buffer == NULL) { goto end; }
-  buffer_stream = buffer_stream_new(buffer, buffer_size);
-  if (buffer_stream == NULL) { goto end; }
-  // Clear buffer to avoid free twice
-  buffer = NULL;
+  if (java_stream == NULL) {
+    LOGE(MSG("Can't create java stream"));
+    return NULL;
+  }
 
-  // Decode image info
-  if (!decode_info(buffer_stream, &info)) { goto end; }
+  // One block if available() tells the size, chunks otherwise
+  source = byte_source_new_from_stream(java_stream, java_stream_get_available(java_stream));
+  java_stream->close(&java_stream);
+  if (source == NULL) {
+    return NULL;
+  }
+
+  return bitmap_region_decoder_object_new_from_source(env, source);
+}
 
-  // Create java object
-  obj = bitmap_region_decoder_object_new(env, buffer_stream, &info);
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_BitmapRegionDecoder_nativeNewInstanceFd(JNIEnv* env, __unused jclass clazz, jobject fd) {
+  ByteSource* source;
+  int n;
 
-end:
-  if (java_stream != NULL) {
-    java_stream->close(&java_stream);
+  if (!INIT_SUCCEED) {
+    return NULL;
   }
-  // Only close buffer stream if create BitmapRegionDecoder failed
-  if (obj == NULL && buffer_stream != NULL) {
-    buffer_stream->close(&buffer_stream);
+
+  n = get_fd(env, fd);
+  if (n < 0) {
+    return NULL;
   }
-  free(buffer);
-  return obj;
+
+  // The file is mapped, no copy needed
+  source = byte_source_new_from_fd(n);
+  if (source == NULL) {
+    LOGE(MSG("Can't create file source"));
+    return NULL;
+  }
+
+  return bitmap_region_decoder_object_new_from_source(env, source);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_BitmapRegionDecoder_nativeNewInstanceBuffer(JNIEnv* env, __unused jclass clazz,
+    jobject buffer, jint offset, jint length) {
+  ByteSource* source;
+  uint8_t* address;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  // The java object keeps the buffer
+  address = get_direct_buffer_address(env, buffer, offset, length);
+  if (address == NULL) {
+    return NULL;
+  }
+  source = byte_source_wrap(address, (size_t) length);
+  if (source == NULL) {
+    return NULL;
+  }
+
+  return bitmap_region_decoder_object_new_from_source(env, source);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_hippo_image_BitmapRegionDecoder_nativeNewInstanceCached(JNIEnv* env, __unused jclass clazz, jstring key) {
+  ByteSource* source;
+
+  if (!INIT_SUCCEED) {
+    return NULL;
+  }
+
+  // Evicting doesn't free the bytes, the java object keeps this reference
+  source = get_cached_source(env, key);
+  if (source == NULL) {
+    return NULL;
+  }
+
+  return bitmap_region_decoder_object_new_from_source(env, source);
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_hippo_image_BitmapRegionDecoder_nativeRef(__unused JNIEnv* env, __unused jclass clazz, jlong ptr) {
+  return (jlong) region_decoder_ref((RegionDecoder*) ptr);
 }
 
 JNIEXPORT jobject JNICALL
 Java_com_hippo_image_BitmapRegionDecoder_nativeDecodeRegion(JNIEnv* env, __unused jclass clazz, jlong ptr,
-    jint x, jint y , jint width, jint height, jint config, jint ratio) {
+    jint x, jint y , jint width, jint height, jint config, jfloat ratio, jint resample,
+    jint orientation, jint quality) {
+  RegionDecoder* decoder = (RegionDecoder*) ptr;
   BufferContainer* container = NULL;
   Stream* stream = NULL;
   jobject bitmap = NULL;
   bool result;
 
-  stream = (Stream *) ptr;
+  // Every request reads its own cursor, only the bytes and the index are shared
+  stream = byte_source_open(decoder->source);
+  if (stream == NULL) { goto end; }
 
   container = bitmap_container_new(env, CLASS_BITMAP_DECODER, METHOD_BITMAP_DECODER_CREATE_BITMAP);
   if (container == NULL) { goto end; }
@@ -602,9 +1091,17 @@ Java_com_hippo_image_BitmapRegionDecoder_nativeDecodeRegion(JNIEnv* env, __unuse
   bool clip = width != 0 && height != 0;
 
   // Decode
-  buffer_stream_reset(stream);
-  result = decode_buffer(stream, clip, (uint32_t) x, (uint32_t) y,
-      (uint32_t) width, (uint32_t) height, (int32_t) config, ratio < 1 ? 1 : (uint32_t) ratio, container);
+  if (clip) {
+    result = decode_region(decoder->index, stream, (uint32_t) x, (uint32_t) y,
+        (uint32_t) width, (uint32_t) height, (int32_t) config,
+        ratio < 1.0f ? 1.0f : ratio, (int32_t) resample, (int32_t) orientation, (int32_t) quality,
+        // Bitmaps from createBitmap() are premultiplied
+        true, container);
+  } else {
+    result = decode_buffer(stream, false, 0, 0, 0, 0, (int32_t) config,
+        ratio < 1.0f ? 1.0f : ratio, (int32_t) resample, (int32_t) orientation, (int32_t) quality,
+        true, container);
+  }
   bitmap = bitmap_container_fetch_bitmap(container);
 
   if (!result && bitmap != NULL) {
@@ -618,13 +1115,96 @@ end:
   if (container != NULL) {
     bitmap_container_recycle(&container);
   }
+  if (stream != NULL) {
+    stream->close(&stream);
+  }
   return bitmap;
 }
 
 JNIEXPORT void JNICALL
 Java_com_hippo_image_BitmapRegionDecoder_nativeRecycle(__unused JNIEnv* env, __unused jclass clazz, jlong ptr) {
-  Stream* stream = (Stream *) ptr;
-  stream->close(&stream);
+  RegionDecoder* decoder = (RegionDecoder*) ptr;
+  region_decoder_unref(&decoder);
+}
+
+
+////////////////////////////////
+// EncodedCache
+////////////////////////////////
+
+JNIEXPORT void JNICALL
+Java_com_hippo_image_EncodedCache_nativeSetMaxSize(__unused JNIEnv* env, __unused jclass clazz, jlong max_size) {
+  if (INIT_SUCCEED) {
+    source_cache_set_max_size(CACHE, (size_t) max_size);
+  }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_hippo_image_EncodedCache_nativePut(JNIEnv* env, __unused jclass clazz, jstring key, jobject is) {
+  Stream* java_stream;
+  ByteSource* source;
+  bool result;
+
+  if (!INIT_SUCCEED) {
+    return false;
+  }
+
+  java_stream = java_stream_new(env, is, false);
+  if (java_stream == NULL) {
+    LOGE(MSG("Can't create java stream"));
+    return false;
+  }
+
+  source = byte_source_new_from_stream(java_stream, java_stream_get_available(java_stream));
+  java_stream->close(&java_stream);
+  if (source == NULL) {
+    return false;
+  }
+
+  result = put_cached_source(env, key, source);
+  byte_source_unref(&source);
+
+  return (jboolean) result;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_hippo_image_EncodedCache_nativeContains(JNIEnv* env, __unused jclass clazz, jstring key) {
+  const char* chars;
+  bool result;
+
+  if (!INIT_SUCCEED) {
+    return false;
+  }
+
+  chars = (*env)->GetStringUTFChars(env, key, NULL);
+  if (chars == NULL) {
+    return false;
+  }
+  result = source_cache_contains(CACHE, chars, strlen(chars));
+  (*env)->ReleaseStringUTFChars(env, key, chars);
+
+  return (jboolean) result;
+}
+
+JNIEXPORT void JNICALL
+Java_com_hippo_image_EncodedCache_nativeTrim(__unused JNIEnv* env, __unused jclass clazz, jlong size) {
+  if (INIT_SUCCEED) {
+    source_cache_trim(CACHE, (size_t) size);
+  }
+}
+
+JNIEXPORT void JNICALL
+Java_com_hippo_image_EncodedCache_nativeGetStats(JNIEnv* env, __unused jclass clazz, jobject stats) {
+  SourceCacheStats s;
+
+  if (!INIT_SUCCEED) {
+    return;
+  }
+
+  source_cache_get_stats(CACHE, &s);
+  (*env)->CallVoidMethod(env, stats, METHOD_ENCODED_CACHE_STATS_SET,
+      (jlong) s.hits, (jlong) s.misses, (jlong) s.evictions,
+      (jlong) s.size, (jlong) s.max_size, (jlong) s.count);
 }
 
 
@@ -633,7 +1213,10 @@ JNIEXPORT jint JNICALL
 JNI_OnLoad(JavaVM *vm, __unused void* reserved) {
   JNIEnv* env = NULL;
   jclass class_image_info;
+  jclass class_io_stats;
+  jclass class_encoded_cache_stats;
   jclass class_bitmap;
+  jclass class_file_descriptor;
 
   if ((*vm)->GetEnv(vm, (void**) &env, JNI_VERSION_1_6) != JNI_OK) {
     LOGE(MSG("Can't get env in JNI_OnLoad."));
@@ -666,7 +1249,7 @@ JNI_OnLoad(JavaVM *vm, __unused void* reserved) {
 
   class_image_info = (*env)->FindClass(env, "com/hippo/image/ImageInfo");
   if (class_image_info != NULL) {
-    METHOD_IMAGE_INFO_SET = (*env)->GetMethodID(env, class_image_info, "set", "(IIIZI)V");
+    METHOD_IMAGE_INFO_SET = (*env)->GetMethodID(env, class_image_info, "set", "(IIIZII)V");
   }
   if (class_image_info == NULL || METHOD_IMAGE_INFO_SET == NULL) {
     LOGE(MSG("Can't find ImageInfo or its set()."));
@@ -674,6 +1257,26 @@ JNI_OnLoad(JavaVM *vm, __unused void* reserved) {
     return JNI_VERSION_1_6;
   }
 
+  class_io_stats = (*env)->FindClass(env, "com/hippo/image/IoStats");
+  if (class_io_stats != NULL) {
+    METHOD_IO_STATS_SET = (*env)->GetMethodID(env, class_io_stats, "set", "(JJJJJJ)V");
+  }
+  if (class_io_stats == NULL || METHOD_IO_STATS_SET == NULL) {
+    LOGE(MSG("Can't find IoStats or its set()."));
+    INIT_SUCCEED = false;
+    return JNI_VERSION_1_6;
+  }
+
+  class_encoded_cache_stats = (*env)->FindClass(env, "com/hippo/image/EncodedCache$Stats");
+  if (class_encoded_cache_stats != NULL) {
+    METHOD_ENCODED_CACHE_STATS_SET = (*env)->GetMethodID(env, class_encoded_cache_stats, "set", "(JJJJJJ)V");
+  }
+  if (class_encoded_cache_stats == NULL || METHOD_ENCODED_CACHE_STATS_SET == NULL) {
+    LOGE(MSG("Can't find EncodedCache.Stats or its set()."));
+    INIT_SUCCEED = false;
+    return JNI_VERSION_1_6;
+  }
+
   CLASS_BITMAP_DECODER = (*env)->FindClass(env, "com/hippo/image/BitmapDecoder");
   CLASS_BITMAP_DECODER = (*env)->NewGlobalRef(env, CLASS_BITMAP_DECODER);
   if (CLASS_BITMAP_DECODER != NULL) {
@@ -688,7 +1291,7 @@ JNI_OnLoad(JavaVM *vm, __unused void* reserved) {
   CLASS_BITMAP_REGION_DECODER = (*env)->FindClass(env, "com/hippo/image/BitmapRegionDecoder");
   CLASS_BITMAP_REGION_DECODER = (*env)->NewGlobalRef(env, CLASS_BITMAP_REGION_DECODER);
   if (CLASS_BITMAP_REGION_DECODER != NULL) {
-    CONSTRUCTOR_BITMAP_REGION_DECODER = (*env)->GetMethodID(env, CLASS_BITMAP_REGION_DECODER, "<init>", "(JIIIZ)V");
+    CONSTRUCTOR_BITMAP_REGION_DECODER = (*env)->GetMethodID(env, CLASS_BITMAP_REGION_DECODER, "<init>", "(JIIIZI)V");
   }
   if (CLASS_BITMAP_REGION_DECODER == NULL || CONSTRUCTOR_BITMAP_REGION_DECODER == NULL) {
     LOGE(MSG("Can't find BitmapRegionDecoder or its constructor."));
@@ -706,7 +1309,26 @@ JNI_OnLoad(JavaVM *vm, __unused void* reserved) {
     return JNI_VERSION_1_6;
   }
 
+  // The field is private, only FileDescriptor decoding needs it
+  class_file_descriptor = (*env)->FindClass(env, "java/io/FileDescriptor");
+  if (class_file_descriptor != NULL) {
+    FIELD_FILE_DESCRIPTOR_DESCRIPTOR = (*env)->GetFieldID(env, class_file_descriptor, "descriptor", "I");
+  }
+  if (class_file_descriptor == NULL || FIELD_FILE_DESCRIPTOR_DESCRIPTOR == NULL) {
+    LOGE(MSG("Can't find FileDescriptor or its descriptor, FileDescriptor can't be decoded."));
+    (*env)->ExceptionClear(env);
+    FIELD_FILE_DESCRIPTOR_DESCRIPTOR = NULL;
+  }
+
+  CACHE = source_cache_new(0);
+  if (CACHE == NULL) {
+    INIT_SUCCEED = false;
+    return JNI_VERSION_1_6;
+  }
+
   java_stream_init(env);
+  VM = vm;
+  prefetch_stream_set_thread_funcs(&attach_io_thread, &detach_io_thread);
   init_image_libraries();
 
   INIT_SUCCEED = true;
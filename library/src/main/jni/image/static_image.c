@@ -17,12 +17,13 @@
 #include <malloc.h>
 
 #include "static_image.h"
+#include "image_decoder.h"
 #include "../log.h"
 
 
-StaticImage* static_image_new(uint32_t width, uint32_t height) {
+StaticImage* static_image_new(uint32_t width, uint32_t height, int32_t config) {
   StaticImage* image = malloc(sizeof(StaticImage));
-  uint8_t* buffer = malloc(width * height * 4);
+  uint8_t* buffer = malloc((size_t) width * height * get_depth_for_config(config));
   if (image == NULL || buffer == NULL) {
     WTF_OOM;
     free(image);
@@ -32,6 +33,7 @@ StaticImage* static_image_new(uint32_t width, uint32_t height) {
 
   image->width = width;
   image->height = height;
+  image->config = config;
   image->buffer = buffer;
 
   return image;
@@ -27,11 +27,13 @@ typedef struct {
   uint32_t height;
   int32_t format;
   bool opaque;
+  // IMAGE_CONFIG_RGBA_8888 or IMAGE_CONFIG_GRAY_8
+  int32_t config;
   uint8_t* buffer;
 } StaticImage;
 
 
-StaticImage* static_image_new(uint32_t width, uint32_t height);
+StaticImage* static_image_new(uint32_t width, uint32_t height, int32_t config);
 
 void static_image_delete(StaticImage** image);
 
@@ -23,12 +23,35 @@
 #include "log.h"
 #include "utils.h"
 
+// Copy size bytes between the ring and a linear block, wrapping at the end of the ring
+static void ring_copy_out(const Buffer* buffer, size_t offset, void* dst, size_t size) {
+  size_t first;
+
+  offset &= buffer->capacity - 1;
+  first = MIN(size, buffer->capacity - offset);
+  memcpy(dst, buffer->raw + offset, first);
+  memcpy(dst + first, buffer->raw, size - first);
+}
+
+static void ring_copy_in(Buffer* buffer, size_t offset, const void* src, size_t size) {
+  size_t first;
+
+  offset &= buffer->capacity - 1;
+  first = MIN(size, buffer->capacity - offset);
+  memcpy(buffer->raw + offset, src, first);
+  memcpy(buffer->raw, src + first, size - first);
+}
+
 size_t buffer_read(Buffer* buffer, void* dst, size_t size) {
   size_t remain = buffer->length - buffer->position;
   size_t read = MIN(remain, size);
 
   if (read != 0) {
-    memcpy(dst, buffer->raw + buffer->position, read);
+    if (buffer->ring) {
+      ring_copy_out(buffer, buffer->position, dst, read);
+    } else {
+      memcpy(dst, buffer->raw + buffer->position, read);
+    }
     buffer->position += read;
   }
 
@@ -36,12 +59,22 @@ size_t buffer_read(Buffer* buffer, void* dst, size_t size) {
 }
 
 size_t buffer_write(Buffer* buffer, const void* src, size_t size) {
-  size_t remain = buffer->capacity - buffer->length;
-
+  size_t remain;
   size_t write;
   size_t new_capacity;
   void* new_raw;
 
+  if (buffer->ring) {
+    // Bytes before position are free
+    write = MIN(size, buffer->capacity - (buffer->length - buffer->position));
+    if (write != 0) {
+      ring_copy_in(buffer, buffer->length, src, write);
+      buffer->length += write;
+    }
+    return write;
+  }
+
+  remain = buffer->capacity - buffer->length;
   if (remain >= size) {
     write = size;
   } else if (!buffer->extendable) {
@@ -68,12 +101,76 @@ size_t buffer_write(Buffer* buffer, const void* src, size_t size) {
 }
 
 size_t buffer_seek(Buffer* buffer, size_t position) {
-  buffer->position = MIN(position, buffer->length);
+  position = MIN(position, buffer->length);
+  if (buffer->ring && buffer->length - position > buffer->capacity) {
+    // Older bytes are overwritten
+    position = buffer->length - buffer->capacity;
+  }
+  buffer->position = position;
   return buffer->position;
 }
 
+void* buffer_get_read_segment(Buffer* buffer, size_t* size) {
+  size_t offset;
+
+  if (buffer->ring) {
+    offset = buffer->position & (buffer->capacity - 1);
+    *size = MIN(buffer->length - buffer->position, buffer->capacity - offset);
+    return buffer->raw + offset;
+  } else {
+    *size = buffer->length - buffer->position;
+    return buffer->raw + buffer->position;
+  }
+}
+
+const void* buffer_borrow(Buffer* buffer, size_t size, size_t* borrowed) {
+  const void* bytes = buffer_get_read_segment(buffer, borrowed);
+  *borrowed = MIN(*borrowed, size);
+  return bytes;
+}
+
+size_t buffer_commit(Buffer* buffer, size_t size) {
+  size = MIN(size, buffer->length - buffer->position);
+  buffer->position += size;
+  return size;
+}
+
+void* buffer_get_write_segment(Buffer* buffer, size_t* size) {
+  size_t offset;
+
+  if (buffer->ring) {
+    offset = buffer->length & (buffer->capacity - 1);
+    *size = MIN(buffer->capacity - (buffer->length - buffer->position), buffer->capacity - offset);
+    return buffer->raw + offset;
+  } else {
+    *size = buffer->capacity - buffer->length;
+    return buffer->raw + buffer->length;
+  }
+}
+
+size_t buffer_commit_write(Buffer* buffer, size_t size) {
+  size_t remain;
+
+  if (buffer->ring) {
+    remain = buffer->capacity - (buffer->length - buffer->position);
+  } else {
+    remain = buffer->capacity - buffer->length;
+  }
+
+  size = MIN(size, remain);
+  buffer->length += size;
+  return size;
+}
+
 void buffer_shrink(Buffer* buffer) {
-  if (buffer->position == 0) {
+  size_t base;
+
+  if (buffer->ring) {
+    // Keep every byte at the same offset of the memory block
+    base = buffer->position & ~(buffer->capacity - 1);
+    buffer->position -= base;
+    buffer->length -= base;
+  } else if (buffer->position == 0) {
     // No data has been read, no need to shrink
   } else {
     buffer->length = buffer->length - buffer->position;
@@ -118,6 +215,23 @@ Buffer* buffer_new(size_t capacity, bool extendable) {
   return buffer_new_from_raw(raw, 0, 0, capacity, extendable);
 }
 
+Buffer* buffer_new_ring(size_t capacity) {
+  Buffer* buffer;
+
+  if (capacity == 0) {
+    LOGE(MSG("Invalid buffer capacity: 0"));
+    return NULL;
+  }
+
+  // next_pow2_size_t() doesn't take 1
+  buffer = buffer_new(capacity > 1 ? next_pow2_size_t(capacity) : 1, false);
+  if (buffer != NULL) {
+    buffer->ring = true;
+  }
+
+  return buffer;
+}
+
 Buffer* buffer_new_from_raw(void* raw, size_t position, size_t length, size_t capacity, bool extendable) {
   Buffer* buffer;
 
@@ -139,6 +253,7 @@ Buffer* buffer_new_from_raw(void* raw, size_t position, size_t length, size_t ca
   buffer->length = length;
   buffer->capacity = capacity;
   buffer->extendable = extendable;
+  buffer->ring = false;
 
   return buffer;
 }
@@ -28,6 +28,11 @@ typedef struct BUFFER Buffer;
  * The memory looks like this.
  * |-------|-----------|---------|
  * 0    position    length    capacity
+ *
+ * In ring mode, position and length count bytes from the start and keep
+ * growing, byte i is at i % capacity. Writes wrap around to the bytes
+ * before position, so nothing is moved and the capacity never changes.
+ * length - position is still the number of bytes to read.
  */
 struct BUFFER {
   /**
@@ -55,6 +60,11 @@ struct BUFFER {
    * Read-only.
    */
   bool extendable;
+  /**
+   * Whether the buffer is in ring mode. The capacity is a power of 2 then.
+   * Read-only.
+   */
+  bool ring;
 };
 
 /**
@@ -78,6 +88,14 @@ Buffer* buffer_new(size_t capacity, bool extendable);
  */
 Buffer* buffer_new_from_raw(void* raw, size_t position, size_t length, size_t capacity, bool extendable);
 
+/**
+ * Create a buffer in ring mode, it's never extended.
+ *
+ * @param capacity The size of the memory block, rounded up to a power of 2.
+ * @return A buffer, or NULL if capacity is zero or OOM.
+ */
+Buffer* buffer_new_ring(size_t capacity);
+
 /**
  * Read bytes from the memory block to dst. The starting point of the memory block is position.
  * Position moves toward while reading. At most size bytes can be read,
@@ -107,12 +125,65 @@ size_t buffer_write(Buffer* buffer, const void* src, size_t size);
  *
  * @param buffer The buffer to seek.
  * @param position The new position. If it's bigger than length. The new position is length.
+ *                 In ring mode, it can't go back to bytes overwritten, length - capacity at most.
  * @return The actual position after seek. It's always between 0 and length.
  */
 size_t buffer_seek(Buffer* buffer, size_t position);
 
+/**
+ * Borrow at most size bytes from position in place, no copy. In ring mode, only
+ * the contiguous ones. They stay valid until the next write.
+ * Call buffer_commit() to move position past the bytes used.
+ *
+ * @param buffer The buffer to read.
+ * @param size The maximum number of bytes to borrow.
+ * @param borrowed Set to the number of bytes borrowed.
+ * @return The first byte borrowed.
+ */
+const void* buffer_borrow(Buffer* buffer, size_t size, size_t* borrowed);
+
+/**
+ * Move position toward after using borrowed bytes.
+ *
+ * @param buffer The buffer borrowed.
+ * @param size The number of bytes used.
+ * @return How many bytes are committed, at most length - position.
+ */
+size_t buffer_commit(Buffer* buffer, size_t size);
+
+/**
+ * Get the contiguous bytes from position, they can be read in place.
+ * In ring mode, the bytes after the end of the memory block are in the next segment.
+ * Move position with buffer_seek() after reading.
+ *
+ * @param buffer The buffer to read.
+ * @param size Set to the number of bytes in the segment.
+ * @return The first byte of the segment.
+ */
+void* buffer_get_read_segment(Buffer* buffer, size_t* size);
+
+/**
+ * Get the contiguous free space from length, it can be written in place.
+ * The buffer isn't extended. Call buffer_commit_write() after writing.
+ *
+ * @param buffer The buffer to write.
+ * @param size Set to the number of bytes in the segment.
+ * @return The first byte of the segment.
+ */
+void* buffer_get_write_segment(Buffer* buffer, size_t* size);
+
+/**
+ * Move length toward after writing to the write segment.
+ *
+ * @param buffer The buffer written.
+ * @param size The number of bytes written.
+ * @return How many bytes are committed, at most the free space.
+ */
+size_t buffer_commit_write(Buffer* buffer, size_t size);
+
 /**
  * Discard bytes from 0 to position and move bytes from position to length ahead.
+ * In ring mode, no byte is moved, only position and length are made small.
  *
  * @param buffer The buffer to buffer.
  */
@@ -26,9 +26,10 @@ typedef struct {
   size_t length;
   void* pos;
   size_t read;
+  // Free buffer on close
+  bool owned;
 } BufferStreamData;
 
-
 static size_t read(Stream* stream, void* dst, size_t size) {
   BufferStreamData* data = (BufferStreamData*) stream->data;
   size_t remain = data->length - data->read;
@@ -37,29 +38,78 @@ static size_t read(Stream* stream, void* dst, size_t size) {
   memcpy(dst, data->pos, len);
   data->pos += len;
   data->read += len;
+  STREAM_COUNT(stream, read_bytes, len);
 
   return len;
 }
 
 static size_t peek(Stream* stream, void* dst, size_t size) {
   BufferStreamData* data = (BufferStreamData*) stream->data;
-  void* pos_bak = data->pos;
-  size_t read_bak = data->read;
+  size_t len = MIN(size, data->length - data->read);
+
+  memcpy(dst, data->pos, len);
+  STREAM_COUNT(stream, peeked_bytes, len);
 
-  size_t len = read(stream, dst, size);
-  data->pos = pos_bak;
-  data->read = read_bak;
+  return len;
+}
+
+// Move forward at most size bytes, return how many bytes are moved
+static size_t move(BufferStreamData* data, size_t size) {
+  size_t len = MIN(size, data->length - data->read);
+
+  data->pos += len;
+  data->read += len;
 
   return len;
 }
 
+static size_t skip(Stream* stream, size_t size) {
+  size_t len = move(stream->data, size);
+  STREAM_COUNT(stream, skipped_bytes, len);
+  return len;
+}
+
+static bool seek(Stream* stream, size_t position) {
+  BufferStreamData* data = (BufferStreamData*) stream->data;
+
+  if (position > data->length) {
+    return false;
+  }
+
+  data->pos = data->buffer + position;
+  data->read = position;
+
+  return true;
+}
+
+static const void* borrow(Stream* stream, size_t size, size_t* borrowed) {
+  BufferStreamData* data = (BufferStreamData*) stream->data;
+  const void* bytes = data->pos;
+
+  // The whole buffer stays until close
+  *borrowed = move(data, size);
+  STREAM_COUNT(stream, read_bytes, *borrowed);
+
+  return bytes;
+}
+
+static size_t tell(Stream* stream) {
+  return ((BufferStreamData*) stream->data)->read;
+}
+
+static size_t size(Stream* stream) {
+  return ((BufferStreamData*) stream->data)->length;
+}
+
 static void close(Stream** stream) {
   if (stream == NULL || *stream == NULL) {
     return;
   }
 
   BufferStreamData* data = (*stream)->data;
-  free(data->buffer);
+  if (data->owned) {
+    free(data->buffer);
+  }
   data->buffer = NULL;
   data->pos = NULL;
   free(data);
@@ -68,7 +118,7 @@ static void close(Stream** stream) {
   *stream = NULL;
 }
 
-Stream* buffer_stream_new(void* buffer, size_t length) {
+static Stream* buffer_stream_new_internal(void* buffer, size_t length, bool owned) {
   Stream* stream;
   BufferStreamData* data;
 
@@ -85,17 +135,27 @@ Stream* buffer_stream_new(void* buffer, size_t length) {
   data->length = length;
   data->pos = buffer;
   data->read = 0;
+  data->owned = owned;
 
   stream->data = data;
   stream->read = read;
   stream->peek = peek;
   stream->close = close;
+  stream->skip = skip;
+  stream->seek = seek;
+  stream->tell = tell;
+  stream->size = size;
+  stream->borrow = borrow;
+  stream->counters = NULL;
 
   return stream;
 }
 
-void buffer_stream_reset(Stream* stream) {
-  BufferStreamData* data = stream->data;
-  data->pos = data->buffer;
-  data->read = 0;
+Stream* buffer_stream_new(void* buffer, size_t length) {
+  return buffer_stream_new_internal(buffer, length, true);
+}
+
+Stream* buffer_stream_wrap(const void* buffer, size_t length) {
+  // Never written, only read
+  return buffer_stream_new_internal((void*) buffer, length, false);
 }
@@ -23,9 +23,16 @@
 #include "stream.h"
 
 
+/**
+ * The stream takes buffer, it's freed on close.
+ */
 Stream* buffer_stream_new(void* buffer, size_t length);
 
-void buffer_stream_reset(Stream* stream);
+/**
+ * The stream reads buffer in place and never frees it.
+ * buffer must stay unchanged until the stream is closed.
+ */
+Stream* buffer_stream_wrap(const void* buffer, size_t length);
 
 
 #endif //IMAGE_BUFFER_STREAM_H
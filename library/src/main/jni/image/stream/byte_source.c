@@ -0,0 +1,420 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "byte_source.h"
+#include "file_stream.h"
+#include "../log.h"
+
+
+// Chunks of a stream with unknown size grow with the total size, in this range
+#define MIN_CHUNK_SIZE (16 * 1024)
+#define MAX_CHUNK_SIZE (1024 * 1024)
+
+#define SOURCE_HEAP 0
+#define SOURCE_MAP 1
+#define SOURCE_WRAP 2
+
+
+struct BYTE_SOURCE {
+  atomic_size_t refs;
+  // The end offset of every chunk
+  const uint8_t** chunks;
+  size_t* ends;
+  size_t count;
+  // chunks and ends point to them if there is only one chunk
+  const uint8_t* block;
+  size_t size;
+  // SOURCE_*, how to release the chunks
+  int kind;
+};
+
+typedef struct {
+  ByteSource* source;
+  // The chunk of next byte
+  size_t index;
+  size_t read;
+} CursorData;
+
+
+static ByteSource* byte_source_new_block(const void* block, size_t size, int kind) {
+  ByteSource* source = malloc(sizeof(ByteSource));
+  if (source == NULL) {
+    WTF_OOM;
+    return NULL;
+  }
+
+  atomic_init(&source->refs, 1);
+  source->block = block;
+  source->size = size;
+  source->chunks = &source->block;
+  source->ends = &source->size;
+  // No chunk for no byte
+  source->count = size != 0 ? 1 : 0;
+  source->kind = kind;
+
+  return source;
+}
+
+static void free_chunks(const uint8_t** chunks, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free((void*) chunks[i]);
+  }
+}
+
+ByteSource* byte_source_new_from_stream(Stream* stream, size_t size_hint) {
+  const uint8_t** chunks = NULL;
+  size_t* ends = NULL;
+  size_t count = 0;
+  size_t limit = 0;
+  size_t total = 0;
+  size_t chunk_size;
+  size_t len;
+  size_t n;
+  uint8_t* chunk;
+  void* bak;
+  ByteSource* source = NULL;
+
+  // The stream knows better
+  if (stream->size != NULL && stream->tell != NULL) {
+    size_hint = stream->size(stream) - stream->tell(stream);
+  }
+
+  for (;;) {
+    // The first chunk holds all bytes if the hint is right,
+    // the next one only checks the end then
+    if (count == 0 && size_hint != 0) {
+      chunk_size = size_hint;
+    } else if (count == 1 && size_hint != 0) {
+      chunk_size = MIN_CHUNK_SIZE;
+    } else {
+      chunk_size = MIN(MAX(total, MIN_CHUNK_SIZE), MAX_CHUNK_SIZE);
+    }
+
+    if (count == limit) {
+      limit = limit == 0 ? 8 : limit * 2;
+      bak = chunks;
+      chunks = realloc(chunks, limit * sizeof(uint8_t*));
+      if (chunks == NULL) { chunks = bak; WTF_OOM; goto end; }
+      bak = ends;
+      ends = realloc(ends, limit * sizeof(size_t));
+      if (ends == NULL) { ends = bak; WTF_OOM; goto end; }
+    }
+
+    chunk = malloc(chunk_size);
+    // The hint may be too large to take at once, grow from the smallest chunk then
+    if (chunk == NULL && count == 0 && chunk_size > MIN_CHUNK_SIZE) {
+      size_hint = 0;
+      chunk_size = MIN_CHUNK_SIZE;
+      chunk = malloc(chunk_size);
+    }
+    if (chunk == NULL) { WTF_OOM; goto end; }
+
+    len = 0;
+    while (len < chunk_size) {
+      n = stream->read(stream, chunk + len, chunk_size - len);
+      if (n == 0) {
+        break;
+      }
+      len += n;
+    }
+
+    if (len == 0) {
+      free(chunk);
+      break;
+    }
+    if (len < chunk_size) {
+      // The last chunk, give back the rest. Shrinking doesn't move it mostly.
+      bak = realloc(chunk, len);
+      if (bak != NULL) {
+        chunk = bak;
+      }
+    }
+
+    total += len;
+    chunks[count] = chunk;
+    ends[count] = total;
+    ++count;
+
+    if (len < chunk_size) {
+      break;
+    }
+  }
+
+  if (count <= 1) {
+    // All bytes in one block
+    source = byte_source_new_block(count == 1 ? chunks[0] : NULL, total, SOURCE_HEAP);
+  } else {
+    source = malloc(sizeof(ByteSource));
+    if (source == NULL) { WTF_OOM; goto end; }
+    atomic_init(&source->refs, 1);
+    source->chunks = chunks;
+    source->ends = ends;
+    source->count = count;
+    source->block = NULL;
+    source->size = total;
+    source->kind = SOURCE_HEAP;
+  }
+
+end:
+  if (source == NULL) {
+    if (chunks != NULL) {
+      free_chunks(chunks, count);
+    }
+    free(chunks);
+    free(ends);
+  } else if (count <= 1) {
+    free(chunks);
+    free(ends);
+  }
+  return source;
+}
+
+ByteSource* byte_source_new_from_fd(int fd) {
+  ByteSource* source = NULL;
+  Stream* stream;
+  struct stat st;
+  void* map;
+
+  if (fstat(fd, &st) != 0) {
+    LOGE(MSG("Can't stat fd %d: %s"), fd, strerror(errno));
+    return NULL;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size < 0 || (uint64_t) st.st_size > SIZE_MAX) {
+    LOGE(MSG("Not a regular file or too large: fd %d"), fd);
+    return NULL;
+  }
+
+  // mmap() fails on empty files
+  if (st.st_size != 0) {
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      source = byte_source_new_block(map, (size_t) st.st_size, SOURCE_MAP);
+      if (source == NULL) {
+        munmap(map, (size_t) st.st_size);
+      }
+      return source;
+    }
+  }
+
+  // Read it into memory
+  stream = file_stream_new(fd);
+  if (stream != NULL) {
+    source = byte_source_new_from_stream(stream, 0);
+    stream->close(&stream);
+  }
+  return source;
+}
+
+ByteSource* byte_source_wrap(const void* data, size_t size) {
+  return byte_source_new_block(data, size, SOURCE_WRAP);
+}
+
+ByteSource* byte_source_ref(ByteSource* source) {
+  atomic_fetch_add_explicit(&source->refs, 1, memory_order_relaxed);
+  return source;
+}
+
+void byte_source_unref(ByteSource** source) {
+  ByteSource* s;
+
+  if (source == NULL || *source == NULL) {
+    return;
+  }
+
+  s = *source;
+  *source = NULL;
+
+  // Make reads of other owners happen before free
+  if (atomic_fetch_sub_explicit(&s->refs, 1, memory_order_acq_rel) != 1) {
+    return;
+  }
+
+  switch (s->kind) {
+    case SOURCE_HEAP:
+      free_chunks(s->chunks, s->count);
+      if (s->chunks != &s->block) {
+        free(s->chunks);
+        free(s->ends);
+      }
+      break;
+    case SOURCE_MAP:
+      munmap((void*) s->block, s->size);
+      break;
+    default:
+      // The caller owns the bytes
+      break;
+  }
+  free(s);
+}
+
+size_t byte_source_get_size(ByteSource* source) {
+  return source->size;
+}
+
+static size_t chunk_start(ByteSource* source, size_t index) {
+  return index == 0 ? 0 : source->ends[index - 1];
+}
+
+// Move forward at most size bytes, copy them to dst if it isn't NULL
+static size_t cursor_move(CursorData* data, void* dst, size_t size) {
+  ByteSource* source = data->source;
+  size_t done = 0;
+  size_t len;
+
+  while (done < size && data->index < source->count) {
+    len = MIN(size - done, source->ends[data->index] - data->read);
+    if (dst != NULL) {
+      memcpy(dst + done, source->chunks[data->index] +
+          (data->read - chunk_start(source, data->index)), len);
+    }
+    done += len;
+    data->read += len;
+    if (data->read == source->ends[data->index]) {
+      data->index++;
+    }
+  }
+
+  return done;
+}
+
+static size_t cursor_read(Stream* stream, void* dst, size_t size) {
+  size_t len = cursor_move(stream->data, dst, size);
+  STREAM_COUNT(stream, read_bytes, len);
+  return len;
+}
+
+static size_t cursor_peek(Stream* stream, void* dst, size_t size) {
+  CursorData* data = stream->data;
+  size_t index_bak = data->index;
+  size_t read_bak = data->read;
+
+  size_t len = cursor_move(data, dst, size);
+  data->index = index_bak;
+  data->read = read_bak;
+  STREAM_COUNT(stream, peeked_bytes, len);
+
+  return len;
+}
+
+static size_t cursor_skip(Stream* stream, size_t size) {
+  size_t len = cursor_move(stream->data, NULL, size);
+  STREAM_COUNT(stream, skipped_bytes, len);
+  return len;
+}
+
+static bool cursor_seek(Stream* stream, size_t position) {
+  CursorData* data = stream->data;
+  ByteSource* source = data->source;
+  size_t low = 0;
+  size_t high = source->count;
+  size_t mid;
+
+  if (position > source->size) {
+    return false;
+  }
+
+  // The first chunk ending after position
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    if (source->ends[mid] <= position) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  data->index = low;
+  data->read = position;
+
+  return true;
+}
+
+static size_t cursor_tell(Stream* stream) {
+  return ((CursorData*) stream->data)->read;
+}
+
+static size_t cursor_size(Stream* stream) {
+  return ((CursorData*) stream->data)->source->size;
+}
+
+// At most the rest of the current chunk
+static const void* cursor_borrow(Stream* stream, size_t size, size_t* borrowed) {
+  CursorData* data = stream->data;
+  ByteSource* source = data->source;
+  const void* bytes;
+
+  if (data->index == source->count) {
+    *borrowed = 0;
+    return NULL;
+  }
+
+  bytes = source->chunks[data->index] + (data->read - chunk_start(source, data->index));
+  *borrowed = cursor_move(data, NULL, MIN(size, source->ends[data->index] - data->read));
+  STREAM_COUNT(stream, read_bytes, *borrowed);
+
+  return bytes;
+}
+
+static void cursor_close(Stream** stream) {
+  if (stream == NULL || *stream == NULL) {
+    return;
+  }
+
+  CursorData* data = (*stream)->data;
+  byte_source_unref(&data->source);
+  free(data);
+  (*stream)->data = NULL;
+  free(*stream);
+  *stream = NULL;
+}
+
+Stream* byte_source_open(ByteSource* source) {
+  Stream* stream;
+  CursorData* data;
+
+  stream = malloc(sizeof(Stream));
+  data = malloc(sizeof(CursorData));
+  if (stream == NULL || data == NULL) {
+    WTF_OOM;
+    free(stream);
+    free(data);
+    return NULL;
+  }
+
+  data->source = byte_source_ref(source);
+  data->index = 0;
+  data->read = 0;
+
+  stream->data = data;
+  stream->read = cursor_read;
+  stream->peek = cursor_peek;
+  stream->close = cursor_close;
+  stream->skip = cursor_skip;
+  stream->seek = cursor_seek;
+  stream->tell = cursor_tell;
+  stream->size = cursor_size;
+  stream->borrow = cursor_borrow;
+  stream->counters = NULL;
+
+  return stream;
+}
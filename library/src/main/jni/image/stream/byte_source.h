@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_BYTE_SOURCE_H
+#define IMAGE_BYTE_SOURCE_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "stream.h"
+
+
+/**
+ * Immutable encoded bytes shared by cursor streams. It's reference counted,
+ * each cursor keeps a reference, so the bytes stay until the last one is gone.
+ * Cursors on one source can be used on different threads at the same time,
+ * nothing is locked.
+ */
+struct BYTE_SOURCE;
+typedef struct BYTE_SOURCE ByteSource;
+
+
+/**
+ * Read the rest of stream into a new source. The caller still owns stream.
+ *
+ * The bytes are read into one block if the size is known, from the size of
+ * stream or size_hint, for example InputStream.available(). Otherwise they
+ * are kept in a list of chunks, never coalesced.
+ *
+ * @param size_hint The expected number of bytes, 0 if unknown.
+ * @return NULL if out of memory.
+ */
+ByteSource* byte_source_new_from_stream(Stream* stream, size_t size_hint);
+
+/**
+ * Map a regular file. The mapping stays after fd is closed, the file must not
+ * be truncated before the source is released. The file is read into memory
+ * if it can't be mapped.
+ *
+ * @return NULL if fd isn't a regular file or can't be read.
+ */
+ByteSource* byte_source_new_from_fd(int fd);
+
+/**
+ * Read size bytes of data in place, data must stay unchanged until
+ * the source is released.
+ */
+ByteSource* byte_source_wrap(const void* data, size_t size);
+
+/**
+ * Take another reference of source.
+ */
+ByteSource* byte_source_ref(ByteSource* source);
+
+/**
+ * Drop a reference of source and set it to NULL, the last one frees the bytes.
+ */
+void byte_source_unref(ByteSource** source);
+
+/**
+ * Return the number of bytes.
+ */
+size_t byte_source_get_size(ByteSource* source);
+
+/**
+ * Create a cursor stream from the first byte of source. It keeps a reference
+ * of source until it's closed. It can skip, seek, tell, tell size and borrow,
+ * borrowed bytes stay valid until it's closed.
+ *
+ * @return NULL if out of memory.
+ */
+Stream* byte_source_open(ByteSource* source);
+
+
+#endif //IMAGE_BYTE_SOURCE_H
@@ -0,0 +1,230 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "file_stream.h"
+#include "../log.h"
+
+
+typedef struct {
+  // The mapped file, NULL if reading with pread()
+  uint8_t* map;
+  // The duplicated fd for pread(), -1 if mapped
+  int fd;
+  size_t length;
+  size_t pos;
+} FileStreamData;
+
+
+static size_t pread_fully(Stream* stream, uint8_t* dst, size_t size, size_t offset) {
+  FileStreamData* data = (FileStreamData*) stream->data;
+  uint64_t start = STREAM_CLOCK(stream);
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < size) {
+    n = pread(data->fd, dst + done, size - done, (off_t) (offset + done));
+    STREAM_COUNT(stream, source_reads, 1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOGE(MSG("Can't read file: %s"), strerror(errno));
+      break;
+    }
+    if (n == 0) {
+      // The file is truncated
+      break;
+    }
+    done += n;
+  }
+
+  STREAM_COUNT_BLOCKED(stream, start);
+
+  return done;
+}
+
+// Copy at most size bytes at pos to dst, pos isn't moved
+static size_t file_copy(Stream* stream, void* dst, size_t size) {
+  FileStreamData* data = (FileStreamData*) stream->data;
+  size_t len = MIN(size, data->length - data->pos);
+
+  if (data->map != NULL) {
+    memcpy(dst, data->map + data->pos, len);
+    return len;
+  } else {
+    return pread_fully(stream, dst, len, data->pos);
+  }
+}
+
+// Move forward at most size bytes, return how many bytes are moved
+static size_t file_move(FileStreamData* data, size_t size) {
+  size_t len = MIN(size, data->length - data->pos);
+  data->pos += len;
+  return len;
+}
+
+static size_t file_peek(Stream* stream, void* dst, size_t size) {
+  size_t len = file_copy(stream, dst, size);
+  STREAM_COUNT(stream, peeked_bytes, len);
+  return len;
+}
+
+static size_t file_read(Stream* stream, void* dst, size_t size) {
+  FileStreamData* data = (FileStreamData*) stream->data;
+  size_t len = file_copy(stream, dst, size);
+  data->pos += len;
+  STREAM_COUNT(stream, read_bytes, len);
+  return len;
+}
+
+static size_t file_skip(Stream* stream, size_t size) {
+  size_t len = file_move(stream->data, size);
+  STREAM_COUNT(stream, skipped_bytes, len);
+  return len;
+}
+
+static bool file_seek(Stream* stream, size_t position) {
+  FileStreamData* data = (FileStreamData*) stream->data;
+  if (position > data->length) {
+    return false;
+  }
+  data->pos = position;
+  return true;
+}
+
+// Only for mapped files
+static const void* file_borrow(Stream* stream, size_t size, size_t* borrowed) {
+  FileStreamData* data = (FileStreamData*) stream->data;
+  const void* bytes = data->map + data->pos;
+
+  *borrowed = file_move(data, size);
+  STREAM_COUNT(stream, read_bytes, *borrowed);
+
+  return bytes;
+}
+
+static size_t file_tell(Stream* stream) {
+  return ((FileStreamData*) stream->data)->pos;
+}
+
+static size_t file_size(Stream* stream) {
+  return ((FileStreamData*) stream->data)->length;
+}
+
+static void file_close(Stream** stream) {
+  if (stream == NULL || *stream == NULL) {
+    return;
+  }
+
+  FileStreamData* data = (*stream)->data;
+  if (data->map != NULL) {
+    munmap(data->map, data->length);
+    data->map = NULL;
+  }
+  if (data->fd != -1) {
+    close(data->fd);
+    data->fd = -1;
+  }
+  free(data);
+  (*stream)->data = NULL;
+  free(*stream);
+  *stream = NULL;
+}
+
+Stream* file_stream_new(int fd) {
+  Stream* stream;
+  FileStreamData* data;
+  struct stat st;
+  void* map;
+
+  if (fstat(fd, &st) != 0) {
+    LOGE(MSG("Can't stat fd %d: %s"), fd, strerror(errno));
+    return NULL;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size < 0 || (uint64_t) st.st_size > SIZE_MAX) {
+    LOGE(MSG("Not a regular file or too large: fd %d"), fd);
+    return NULL;
+  }
+
+  stream = malloc(sizeof(Stream));
+  data = malloc(sizeof(FileStreamData));
+  if (stream == NULL || data == NULL) {
+    WTF_OOM;
+    free(stream);
+    free(data);
+    return NULL;
+  }
+
+  data->map = NULL;
+  data->fd = -1;
+  data->length = (size_t) st.st_size;
+  data->pos = 0;
+
+  // The mapping stays after fd is closed. mmap() fails on empty files.
+  if (data->length != 0) {
+    map = mmap(NULL, data->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      data->map = map;
+    }
+  }
+  if (data->map == NULL && data->length != 0) {
+    data->fd = dup(fd);
+    if (data->fd == -1) {
+      LOGE(MSG("Can't dup fd %d: %s"), fd, strerror(errno));
+      free(stream);
+      free(data);
+      return NULL;
+    }
+  }
+
+  stream->data = data;
+  stream->read = file_read;
+  stream->peek = file_peek;
+  stream->close = file_close;
+  stream->skip = file_skip;
+  stream->seek = file_seek;
+  stream->tell = file_tell;
+  stream->size = file_size;
+  stream->borrow = data->map != NULL ? file_borrow : NULL;
+  stream->counters = NULL;
+
+  return stream;
+}
+
+Stream* file_stream_new_from_path(const char* path) {
+  Stream* stream;
+  int fd;
+
+  do {
+    fd = open(path, O_RDONLY);
+  } while (fd == -1 && errno == EINTR);
+  if (fd == -1) {
+    LOGE(MSG("Can't open %s: %s"), path, strerror(errno));
+    return NULL;
+  }
+
+  stream = file_stream_new(fd);
+  close(fd);
+  return stream;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_FILE_STREAM_H
+#define IMAGE_FILE_STREAM_H
+
+
+#include "stream.h"
+
+
+/**
+ * Create a stream of a regular file. The file is mapped into memory,
+ * so the bytes stay in page cache instead of native heap. If it can't
+ * be mapped, the stream reads it with pread().
+ *
+ * The caller still owns fd and may close it. A mapped file doesn't need
+ * fd any more, otherwise the stream reads a duplicate of fd.
+ * The stream reads from the start of the file, whatever the offset of fd is.
+ *
+ * @return NULL if fd isn't a regular file or out of memory.
+ */
+Stream* file_stream_new(int fd);
+
+/**
+ * The same as file_stream_new(), but opens the file of path.
+ */
+Stream* file_stream_new_from_path(const char* path);
+
+
+#endif //IMAGE_FILE_STREAM_H
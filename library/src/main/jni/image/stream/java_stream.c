@@ -23,58 +23,172 @@
 #include "image_utils.h"
 #include "log.h"
 
+// InputStream.read() asks for DEFAULT_BUFFER_SIZE first. The chunk doubles
+// while the stream keeps filling it, so large files take few JNI calls.
+#define MAX_CHUNK_SIZE (256 * 1024)
+
 static bool INIT_SUCCEED = false;
 
 static jmethodID METHOD_READ = NULL;
+static jmethodID METHOD_SKIP = NULL;
+static jmethodID METHOD_AVAILABLE = NULL;
 static jmethodID METHOD_CLOSE = NULL;
 
 struct JAVA_STREAM_DATA;
 typedef struct JAVA_STREAM_DATA JavaStreamData;
 
 struct JAVA_STREAM_DATA {
+  // For counters
+  Stream* stream;
   JNIEnv* env;
   jobject is;
   jbyteArray j_buffer;
+  // The size of j_buffer
+  size_t chunk_size;
 
   Buffer* buffer;
 
   size_t (*read_internal)(JavaStreamData* data, void* dst, size_t size);
 
   Buffer* backup;
+
+  // Bytes read or skipped
+  size_t position;
+
+  // Calls of InputStream.read() and skip(), and bytes read() returned
+  size_t read_calls;
+  size_t read_bytes;
 };
 
 
-static size_t read_internal_with_buffer(JavaStreamData* data, void* dst, size_t size) {
+// Double j_buffer after a read filled it. Keep the old one if out of memory.
+static void grow_chunk(JavaStreamData* data) {
+  JNIEnv* env = data->env;
+  size_t size = data->chunk_size * 2;
+  jbyteArray j_buffer;
+  jobject local;
+
+  if (size > MAX_CHUNK_SIZE) {
+    return;
+  }
+
+  j_buffer = (*env)->NewByteArray(env, (jsize) size);
+  if (j_buffer == NULL) {
+    (*env)->ExceptionClear(env);
+    return;
+  }
+  local = j_buffer;
+  j_buffer = (*env)->NewGlobalRef(env, local);
+  (*env)->DeleteLocalRef(env, local);
+  if (j_buffer == NULL) {
+    return;
+  }
+
+  (*env)->DeleteGlobalRef(env, data->j_buffer);
+  data->j_buffer = j_buffer;
+  data->chunk_size = size;
+}
+
+static bool check_exception(JNIEnv* env) {
+  if ((*env)->ExceptionCheck(env)) {
+    LOGE(MSG("Catch exception"));
+    (*env)->ExceptionDescribe(env);
+    (*env)->ExceptionClear(env);
+    return true;
+  }
+  return false;
+}
+
+// Read at most size bytes from java InputStream to j_buffer, size is limited to chunk_size.
+// Return 0 for the end of stream or exception.
+static size_t read_java(JavaStreamData* data, size_t size) {
+  JNIEnv* env = data->env;
+  uint64_t start = STREAM_CLOCK(data->stream);
+  int len;
+
+  size = MIN(size, data->chunk_size);
+  len = (*env)->CallIntMethod(env, data->is, METHOD_READ, data->j_buffer, 0, (jint) size);
+  data->read_calls++;
+  STREAM_COUNT(data->stream, jni_calls, 1);
+  STREAM_COUNT(data->stream, source_reads, 1);
+  STREAM_COUNT_BLOCKED(data->stream, start);
+  if (check_exception(env)) {
+    len = -1;
+  }
+
+  // end of the stream or catch exception
+  if (len <= 0) { return 0; }
+
+  data->read_bytes += len;
+
+  return (size_t) len;
+}
+
+// Read at most size bytes from java InputStream to dst, size is limited to chunk_size.
+// Return 0 for the end of stream or exception.
+static size_t read_chunk(JavaStreamData* data, void* dst, size_t size) {
   JNIEnv* env = data->env;
+  size_t len;
+
+  len = read_java(data, size);
+  if (len == 0) { return 0; }
+
+  // Copy from java buffer to c buffer
+  (*env)->GetByteArrayRegion(env, data->j_buffer, 0, (jsize) len, (jbyte *) dst);
+
+  if (len == data->chunk_size) {
+    grow_chunk(data);
+  }
+
+  return len;
+}
+
+// Refill the empty c buffer from java InputStream, return 0 for the end
+static size_t fill_buffer(JavaStreamData* data) {
+  Buffer* buffer = data->buffer;
+  size_t len;
+
+  // Follow the chunk size, the c buffer is empty now
+  if (buffer->capacity < data->chunk_size) {
+    Buffer* bigger = buffer_new(data->chunk_size, false);
+    if (bigger != NULL) {
+      buffer_close(&data->buffer);
+      buffer = data->buffer = bigger;
+    }
+  }
+
+  // Read from java InputStream to c buffer
+  len = read_chunk(data, buffer->raw, buffer->capacity);
+  buffer->position = 0;
+  buffer->length = len;
+
+  return len;
+}
+
+static size_t read_internal_with_buffer(JavaStreamData* data, void* dst, size_t size) {
   Buffer* buffer = data->buffer;
   size_t remain = size;
   size_t read = 0;
-  int len;
+  size_t len;
 
   while (remain > 0) {
     if (buffer->position == buffer->length) {
-      // Read from java InputStream to java buffer
-      // Always read DEFAULT_BUFFER_SIZE
-      len = (*env)->CallIntMethod(env, data->is, METHOD_READ, data->j_buffer, 0, DEFAULT_BUFFER_SIZE);
-      if ((*env)->ExceptionCheck(env)) {
-        LOGE(MSG("Catch exception"));
-        (*env)->ExceptionDescribe(env);
-        (*env)->ExceptionClear(env);
-        len = -1;
+      if (remain >= data->chunk_size) {
+        // Large request, skip the c buffer
+        len = read_chunk(data, dst, remain);
+        if (len == 0) { break; }
+        remain -= len;
+        read += len;
+        dst += len;
+        continue;
       }
 
-      // end of the stream or catch exception
-      if (len <= 0) { break; }
-
-      // Copy bytes to buffer
-      // TODO Buffer can't  handle jbyteArray directly. Add a new method like buffer_write_jbyteArray()?
-      (*env)->GetByteArrayRegion(env, data->j_buffer, 0, len, (jbyte *) (buffer->raw));
-      buffer->position = 0;
-      buffer->length = (size_t) len;
+      if (fill_buffer(data) == 0) { break; }
+      buffer = data->buffer;
     }
 
     // Copy from c buffer to target buffer
-    len = (int) buffer_read(buffer, dst, remain);
+    len = buffer_read(buffer, dst, remain);
 
     // Update parameters
     remain -= len;
@@ -86,27 +200,13 @@ static size_t read_internal_with_buffer(JavaStreamData* data, void* dst, size_t
 }
 
 static size_t read_internal_without_buffer(JavaStreamData* data, void* dst, size_t size) {
-  JNIEnv* env = data->env;
   size_t remain = size;
   size_t read = 0;
-  int len;
+  size_t len;
 
   while (remain > 0) {
-    // Read from java InputStream to java buffer
-    len = MIN(DEFAULT_BUFFER_SIZE, (int) remain);
-    len = (*env)->CallIntMethod(env, data->is, METHOD_READ, data->j_buffer, 0, len);
-    if ((*env)->ExceptionCheck(env)) {
-      LOGE(MSG("Catch exception"));
-      (*env)->ExceptionDescribe(env);
-      (*env)->ExceptionClear(env);
-      len = -1;
-    }
-
-    // end of the stream or catch exception
-    if (len <= 0) { break; }
-
-    // Copy from java buffer to c buffer
-    (*env)->GetByteArrayRegion(env, data->j_buffer, 0, len, (jbyte *) dst);
+    len = read_chunk(data, dst, remain);
+    if (len == 0) { break; }
 
     // Update parameters
     remain -= len;
@@ -117,7 +217,8 @@ static size_t read_internal_without_buffer(JavaStreamData* data, void* dst, size
   return read;
 }
 
-static size_t read(Stream* stream, void* dst, size_t size) {
+// Read from backup, then from java InputStream
+static size_t take(Stream* stream, void* dst, size_t size) {
   JavaStreamData* data = stream->data;
   size_t read = 0;
 
@@ -129,24 +230,31 @@ static size_t read(Stream* stream, void* dst, size_t size) {
     read += buffer_read(data->backup, dst, size);
     dst += read;
     size -= read;
-
-    if (size == 0) {
-      return read;
-    }
   }
 
   // Read from stream
-  read += data->read_internal(stream->data, dst, size);
+  if (size != 0) {
+    read += data->read_internal(stream->data, dst, size);
+  }
+
+  data->position += read;
 
   return read;
 }
 
+static size_t read(Stream* stream, void* dst, size_t size) {
+  size_t len = take(stream, dst, size);
+  STREAM_COUNT(stream, read_bytes, len);
+  return len;
+}
+
 size_t peek(Stream* stream, void* dst, size_t size) {
   JavaStreamData* data = stream->data;
   Buffer* backup = data->backup;
   size_t backup_read = 0;
   size_t stream_read = 0;
   size_t backup_write = 0;
+  size_t write;
 
   if (backup != NULL) {
     backup_read = buffer_read(backup, dst, size);
@@ -156,36 +264,123 @@ size_t peek(Stream* stream, void* dst, size_t size) {
     if (size == 0) {
       // Just peek backup
       buffer_seek(backup, backup->position - backup_read);
+      STREAM_COUNT(stream, peeked_bytes, backup_read);
       return backup_read;
     }
   }
 
-  stream_read = read(stream, dst, size);
+  stream_read = take(stream, dst, size);
+  // Peek doesn't move
+  data->position -= stream_read;
 
-  if (backup != NULL) {
+  if (backup != NULL && backup->capacity - backup_read >= stream_read) {
+    // The ring has space after peeked bytes, nothing is moved
     buffer_seek(backup, backup->position - backup_read);
-    // Only shrink the backup if it needs more space
-    if (backup->capacity - backup->length < stream_read) {
-      buffer_shrink(backup);
+    write = stream_read;
+  } else if (stream_read != 0) {
+    // Peeked bytes are at the start of dst too, put all to a bigger ring
+    if (backup != NULL) {
+      buffer_close(&data->backup);
     }
-  } else {
-    // Create a backup
-    backup = data->backup = buffer_new(next_pow2_size_t(stream_read), true);
+    backup = data->backup = buffer_new_ring(backup_read + stream_read);
     if (backup == NULL) {
       LOGE(MSG("Can't create backup for java stream."));
     }
+    dst -= backup_read;
+    write = backup_read + stream_read;
+  } else {
+    // Nothing to back up
+    if (backup != NULL) {
+      buffer_seek(backup, backup->position - backup_read);
+    }
+    write = 0;
   }
 
-  if (backup != NULL) {
-    backup_write = buffer_write(backup, dst, stream_read);
-    if (backup_write != stream_read) {
+  if (backup != NULL && write != 0) {
+    backup_write = buffer_write(backup, dst, write);
+    if (backup_write != write) {
       LOGE(MSG("Can't write bytes to backup."));
     }
   }
 
+  STREAM_COUNT(stream, peeked_bytes, backup_read + stream_read);
+
   return backup_read + stream_read;
 }
 
+// Only for streams with c buffer
+static const void* borrow(Stream* stream, size_t size, size_t* borrowed) {
+  JavaStreamData* data = stream->data;
+  Buffer* buffer;
+  const void* bytes;
+
+  // Peeked bytes first
+  if (data->backup != NULL && data->backup->position != data->backup->length) {
+    buffer = data->backup;
+  } else {
+    buffer = data->buffer;
+    if (buffer->position == buffer->length) {
+      fill_buffer(data);
+      buffer = data->buffer;
+    }
+  }
+
+  bytes = buffer_borrow(buffer, size, borrowed);
+  buffer_commit(buffer, *borrowed);
+  data->position += *borrowed;
+  STREAM_COUNT(stream, read_bytes, *borrowed);
+
+  return bytes;
+}
+
+static size_t skip(Stream* stream, size_t size) {
+  JavaStreamData* data = stream->data;
+  JNIEnv* env = data->env;
+  size_t skipped = 0;
+  size_t position;
+  uint64_t start;
+  jlong len;
+
+  // Peeked bytes, then bytes in c buffer
+  if (data->backup != NULL) {
+    position = data->backup->position;
+    skipped += buffer_seek(data->backup, position + size) - position;
+  }
+  if (data->buffer != NULL && skipped < size) {
+    position = data->buffer->position;
+    skipped += buffer_seek(data->buffer, position + size - skipped) - position;
+  }
+
+  while (skipped < size) {
+    start = STREAM_CLOCK(stream);
+    len = (*env)->CallLongMethod(env, data->is, METHOD_SKIP, (jlong) (size - skipped));
+    data->read_calls++;
+    STREAM_COUNT(stream, jni_calls, 1);
+    STREAM_COUNT(stream, source_reads, 1);
+    STREAM_COUNT_BLOCKED(stream, start);
+    if (check_exception(env)) {
+      break;
+    }
+    if (len <= 0) {
+      // InputStream.skip() might skip nothing before the end, read to know
+      len = (jlong) read_java(data, size - skipped);
+      if (len == 0) {
+        break;
+      }
+    }
+    skipped += (size_t) len;
+  }
+
+  data->position += skipped;
+  STREAM_COUNT(stream, skipped_bytes, skipped);
+
+  return skipped;
+}
+
+static size_t tell(Stream* stream) {
+  return ((JavaStreamData*) stream->data)->position;
+}
+
 static void close(Stream** stream) {
   if (stream == NULL || *stream == NULL) {
     return;
@@ -196,6 +391,7 @@ static void close(Stream** stream) {
 
   // Close java InputStream
   (*env)->CallVoidMethod(env, data->is, METHOD_CLOSE);
+  STREAM_COUNT(*stream, jni_calls, 1);
   if ((*env)->ExceptionCheck(env)) {
     LOGE(MSG("Catch exception"));
     (*env)->ExceptionDescribe(env);
@@ -207,8 +403,9 @@ static void close(Stream** stream) {
   (*env)->DeleteGlobalRef(env, data->j_buffer);
 
   // Free
-  free(data->buffer);
-  data->buffer = NULL;
+  if (data->buffer != NULL) {
+    buffer_close(&data->buffer);
+  }
   if (data->backup != NULL) {
     buffer_close(&data->backup);
   }
@@ -223,8 +420,11 @@ void java_stream_init(JNIEnv* env) {
 
   if (CLAZZ != NULL) {
     METHOD_READ = (*env)->GetMethodID(env, CLAZZ, "read", "([BII)I");
+    METHOD_SKIP = (*env)->GetMethodID(env, CLAZZ, "skip", "(J)J");
+    METHOD_AVAILABLE = (*env)->GetMethodID(env, CLAZZ, "available", "()I");
     METHOD_CLOSE = (*env)->GetMethodID(env, CLAZZ, "close", "()V");
-    INIT_SUCCEED = METHOD_READ != NULL && METHOD_CLOSE != NULL;
+    INIT_SUCCEED = METHOD_READ != NULL && METHOD_SKIP != NULL &&
+        METHOD_AVAILABLE != NULL && METHOD_CLOSE != NULL;
   } else {
     INIT_SUCCEED = false;
   }
@@ -256,9 +456,11 @@ Stream* java_stream_new(JNIEnv* env, jobject* is, bool with_buffer) {
   j_buffer = (*env)->NewGlobalRef(env, j_buffer);
   if (j_buffer == NULL) { LOGE(MSG("Can't create buffer")); goto fail; }
 
+  data->stream = stream;
   data->env = env;
   data->is = (*env)->NewGlobalRef(env, is);
   data->j_buffer = j_buffer;
+  data->chunk_size = DEFAULT_BUFFER_SIZE;
 
   data->buffer = buffer;
 
@@ -266,20 +468,64 @@ Stream* java_stream_new(JNIEnv* env, jobject* is, bool with_buffer) {
 
   data->backup = NULL;
 
+  data->position = 0;
+  data->read_calls = 0;
+  data->read_bytes = 0;
+
   stream->data = data;
   stream->read = read;
   stream->peek = peek;
   stream->close = close;
+  stream->skip = skip;
+  stream->seek = NULL;
+  stream->tell = tell;
+  stream->size = NULL;
+  stream->borrow = with_buffer ? borrow : NULL;
+  stream->counters = NULL;
 
   return stream;
 
 fail:
   free(stream);
   free(data);
-  free(buffer);
+  if (buffer != NULL) {
+    buffer_close(&buffer);
+  }
   return NULL;
 }
 
 void java_stream_set_env(Stream* stream, JNIEnv* env) {
-  ((JavaStreamData*) stream->data)->env = env;
+  // Other streams don't keep env
+  if (stream->close == &close) {
+    ((JavaStreamData*) stream->data)->env = env;
+  }
+}
+
+size_t java_stream_get_available(Stream* stream) {
+  JavaStreamData* data = stream->data;
+  JNIEnv* env = data->env;
+  size_t available = 0;
+  jint len;
+
+  // Bytes kept in c
+  if (data->backup != NULL) {
+    available += data->backup->length - data->backup->position;
+  }
+  if (data->buffer != NULL) {
+    available += data->buffer->length - data->buffer->position;
+  }
+
+  len = (*env)->CallIntMethod(env, data->is, METHOD_AVAILABLE);
+  STREAM_COUNT(stream, jni_calls, 1);
+  if (!check_exception(env) && len > 0) {
+    available += (size_t) len;
+  }
+
+  return available;
+}
+
+void java_stream_get_counters(Stream* stream, size_t* read_calls, size_t* read_bytes) {
+  JavaStreamData* data = stream->data;
+  *read_calls = data->read_calls;
+  *read_bytes = data->read_bytes;
 }
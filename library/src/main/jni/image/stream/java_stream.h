@@ -27,7 +27,21 @@ void java_stream_init(JNIEnv* env);
 
 Stream* java_stream_new(JNIEnv* env, jobject* is, bool with_buffer);
 
+/**
+ * Set the env of a java stream for another thread. Other streams are ignored.
+ */
 void java_stream_set_env(Stream* stream, JNIEnv* env);
 
+/**
+ * Get bytes which can be read without blocking, InputStream.available() plus
+ * bytes buffered in c. It's only a hint of the size.
+ */
+size_t java_stream_get_available(Stream* stream);
+
+/**
+ * Get calls of InputStream.read() and bytes they returned so far.
+ */
+void java_stream_get_counters(Stream* stream, size_t* read_calls, size_t* read_bytes);
+
 
 #endif //IMAGE_JAVA_STREAM_H
@@ -0,0 +1,365 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "prefetch_stream.h"
+#include "image_utils.h"
+#include "../log.h"
+
+
+#define MIN_WINDOW DEFAULT_BUFFER_SIZE
+
+
+typedef struct {
+  // Only used by the I/O thread until it's joined
+  Stream* inner;
+
+  // Single-producer single-consumer ring, capacity is a power of 2.
+  // head is only written by the I/O thread, tail only by the reader.
+  // They count bytes from the start, head - tail bytes are ready.
+  uint8_t* ring;
+  size_t capacity;
+  size_t chunk_size;
+  atomic_size_t head;
+  atomic_size_t tail;
+  // No more bytes after head
+  atomic_bool end;
+  // Set by close
+  atomic_bool stop;
+
+  // Only for sleeping, the ring itself is lock-free.
+  // A side sets its flag before the last check and sleeps,
+  // the other side only takes the mutex if the flag is set.
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  atomic_bool writer_waiting;
+  atomic_bool reader_waiting;
+
+  pthread_t thread;
+
+  // Counters of inner, only used by the I/O thread.
+  // It publishes them to the atomics, the reader adds them to its counters.
+  StreamCounters inner_counters;
+  _Atomic uint64_t source_reads;
+  _Atomic uint64_t jni_calls;
+  uint64_t counted_source_reads;
+  uint64_t counted_jni_calls;
+} PrefetchStreamData;
+
+
+static PrefetchAttachFunc attach_func = NULL;
+static PrefetchDetachFunc detach_func = NULL;
+
+
+void prefetch_stream_set_thread_funcs(PrefetchAttachFunc attach, PrefetchDetachFunc detach) {
+  attach_func = attach;
+  detach_func = detach;
+}
+
+// Wake up the other side if it's waiting. The changed atomic is stored
+// before it, both are sequentially consistent, so either the waiter sees
+// the change or this sees the flag.
+static void notify(atomic_bool* waiting, PrefetchStreamData* data) {
+  if (atomic_load(waiting)) {
+    pthread_mutex_lock(&data->mutex);
+    pthread_cond_broadcast(&data->cond);
+    pthread_mutex_unlock(&data->mutex);
+  }
+}
+
+static void publish_counters(PrefetchStreamData* data) {
+  atomic_store_explicit(&data->source_reads, data->inner_counters.source_reads, memory_order_relaxed);
+  atomic_store_explicit(&data->jni_calls, data->inner_counters.jni_calls, memory_order_relaxed);
+}
+
+static void* run(void* arg) {
+  PrefetchStreamData* data = arg;
+  Stream* inner = data->inner;
+  const size_t mask = data->capacity - 1;
+  size_t head = 0;
+  size_t offset;
+  size_t size;
+  size_t read;
+
+  if (attach_func != NULL && !attach_func(inner)) {
+    // The reader closes inner
+    atomic_store(&data->end, true);
+    notify(&data->reader_waiting, data);
+    return NULL;
+  }
+
+  // A few additions per chunk, always count
+  stream_set_counters(inner, &data->inner_counters);
+
+  while (!atomic_load_explicit(&data->stop, memory_order_acquire)) {
+    size = data->capacity - (head - atomic_load_explicit(&data->tail, memory_order_acquire));
+    if (size == 0) {
+      // Full, wait for the reader
+      pthread_mutex_lock(&data->mutex);
+      atomic_store(&data->writer_waiting, true);
+      while (head - atomic_load(&data->tail) == data->capacity && !atomic_load(&data->stop)) {
+        pthread_cond_wait(&data->cond, &data->mutex);
+      }
+      atomic_store(&data->writer_waiting, false);
+      pthread_mutex_unlock(&data->mutex);
+      continue;
+    }
+
+    // Read into the contiguous free space, at most a chunk
+    offset = head & mask;
+    size = MIN(MIN(size, data->capacity - offset), data->chunk_size);
+    read = inner->read(inner, data->ring + offset, size);
+    if (read == 0) {
+      break;
+    }
+
+    head += read;
+    publish_counters(data);
+    atomic_store(&data->head, head);
+    notify(&data->reader_waiting, data);
+  }
+
+  atomic_store(&data->end, true);
+  notify(&data->reader_waiting, data);
+
+  // Release inner as soon as possible
+  inner->close(&inner);
+  data->inner = NULL;
+  publish_counters(data);
+  if (detach_func != NULL) {
+    detach_func();
+  }
+
+  return NULL;
+}
+
+// Wait until at least size bytes are ready or the end, return ready bytes
+static size_t wait_for(Stream* stream, size_t tail, size_t size) {
+  PrefetchStreamData* data = stream->data;
+  uint64_t start;
+  size_t ready;
+
+  ready = atomic_load_explicit(&data->head, memory_order_acquire) - tail;
+  if (ready >= size) {
+    return ready;
+  }
+
+  start = STREAM_CLOCK(stream);
+  pthread_mutex_lock(&data->mutex);
+  atomic_store(&data->reader_waiting, true);
+  for (;;) {
+    // Check end first, head is final after it
+    if (atomic_load(&data->end)) {
+      ready = atomic_load(&data->head) - tail;
+      break;
+    }
+    ready = atomic_load(&data->head) - tail;
+    if (ready >= size) {
+      break;
+    }
+    pthread_cond_wait(&data->cond, &data->mutex);
+  }
+  atomic_store(&data->reader_waiting, false);
+  pthread_mutex_unlock(&data->mutex);
+  STREAM_COUNT_BLOCKED(stream, start);
+
+  return ready;
+}
+
+// Copy size bytes from the ring at tail, size must be ready
+static void copy_out(PrefetchStreamData* data, size_t tail, uint8_t* dst, size_t size) {
+  const size_t offset = tail & (data->capacity - 1);
+  const size_t first = MIN(size, data->capacity - offset);
+
+  memcpy(dst, data->ring + offset, first);
+  memcpy(dst + first, data->ring, size - first);
+}
+
+static void consume(PrefetchStreamData* data, size_t tail) {
+  atomic_store(&data->tail, tail);
+  notify(&data->writer_waiting, data);
+}
+
+// Add reads of inner since the last call to the counters of stream
+static void count_inner(Stream* stream) {
+  PrefetchStreamData* data = stream->data;
+  uint64_t source_reads;
+  uint64_t jni_calls;
+
+  if (stream->counters == NULL) {
+    return;
+  }
+
+  source_reads = atomic_load_explicit(&data->source_reads, memory_order_relaxed);
+  jni_calls = atomic_load_explicit(&data->jni_calls, memory_order_relaxed);
+  STREAM_COUNT(stream, source_reads, source_reads - data->counted_source_reads);
+  STREAM_COUNT(stream, jni_calls, jni_calls - data->counted_jni_calls);
+  data->counted_source_reads = source_reads;
+  data->counted_jni_calls = jni_calls;
+}
+
+// Move forward at most size bytes, copy them to dst if it isn't NULL
+static size_t move(Stream* stream, void* dst, size_t size) {
+  PrefetchStreamData* data = stream->data;
+  size_t tail = atomic_load_explicit(&data->tail, memory_order_relaxed);
+  size_t done = 0;
+  size_t ready;
+  size_t n;
+
+  while (done < size) {
+    // Take whatever is ready, don't wait for the whole ring
+    ready = wait_for(stream, tail, 1);
+    if (ready == 0) {
+      break;
+    }
+
+    n = MIN(ready, size - done);
+    if (dst != NULL) {
+      copy_out(data, tail, (uint8_t*) dst + done, n);
+    }
+    tail += n;
+    done += n;
+    consume(data, tail);
+  }
+
+  count_inner(stream);
+
+  return done;
+}
+
+static size_t read(Stream* stream, void* dst, size_t size) {
+  size_t len = move(stream, dst, size);
+  STREAM_COUNT(stream, read_bytes, len);
+  return len;
+}
+
+static size_t peek(Stream* stream, void* dst, size_t size) {
+  PrefetchStreamData* data = stream->data;
+  size_t tail = atomic_load_explicit(&data->tail, memory_order_relaxed);
+  size_t ready;
+
+  // The ring can't hold more
+  size = MIN(size, data->capacity);
+
+  ready = MIN(wait_for(stream, tail, size), size);
+  copy_out(data, tail, dst, ready);
+  count_inner(stream);
+  STREAM_COUNT(stream, peeked_bytes, ready);
+
+  return ready;
+}
+
+static size_t skip(Stream* stream, size_t size) {
+  // Skipped bytes are dropped without copy
+  size_t len = move(stream, NULL, size);
+  STREAM_COUNT(stream, skipped_bytes, len);
+  return len;
+}
+
+static size_t tell(Stream* stream) {
+  PrefetchStreamData* data = stream->data;
+  return atomic_load_explicit(&data->tail, memory_order_relaxed);
+}
+
+static void close(Stream** stream) {
+  PrefetchStreamData* data;
+
+  if (stream == NULL || *stream == NULL) {
+    return;
+  }
+
+  data = (*stream)->data;
+
+  atomic_store(&data->stop, true);
+  notify(&data->writer_waiting, data);
+  pthread_join(data->thread, NULL);
+
+  // The I/O thread didn't take inner
+  if (data->inner != NULL) {
+    data->inner->close(&data->inner);
+  }
+
+  pthread_cond_destroy(&data->cond);
+  pthread_mutex_destroy(&data->mutex);
+  free(data->ring);
+  free(data);
+  free(*stream);
+  *stream = NULL;
+}
+
+Stream* prefetch_stream_new(Stream* inner, size_t window) {
+  Stream* stream = NULL;
+  PrefetchStreamData* data = NULL;
+  uint8_t* ring = NULL;
+  size_t capacity;
+
+  capacity = next_pow2_size_t(MAX(window, MIN_WINDOW));
+
+  stream = malloc(sizeof(Stream));
+  data = malloc(sizeof(PrefetchStreamData));
+  ring = malloc(capacity);
+  if (stream == NULL || data == NULL || ring == NULL) { WTF_OOM; goto fail; }
+
+  data->inner = inner;
+  data->ring = ring;
+  data->capacity = capacity;
+  // Small reads keep the reader fed, big reads save calls to inner
+  data->chunk_size = capacity / 4;
+  atomic_init(&data->head, 0);
+  atomic_init(&data->tail, 0);
+  atomic_init(&data->end, false);
+  atomic_init(&data->stop, false);
+  atomic_init(&data->writer_waiting, false);
+  atomic_init(&data->reader_waiting, false);
+  pthread_mutex_init(&data->mutex, NULL);
+  pthread_cond_init(&data->cond, NULL);
+  memset(&data->inner_counters, 0, sizeof(StreamCounters));
+  atomic_init(&data->source_reads, 0);
+  atomic_init(&data->jni_calls, 0);
+  data->counted_source_reads = 0;
+  data->counted_jni_calls = 0;
+
+  if (pthread_create(&data->thread, NULL, &run, data) != 0) {
+    LOGE(MSG("Can't start I/O thread"));
+    pthread_cond_destroy(&data->cond);
+    pthread_mutex_destroy(&data->mutex);
+    goto fail;
+  }
+
+  stream->data = data;
+  stream->read = read;
+  stream->peek = peek;
+  stream->close = close;
+  stream->skip = skip;
+  stream->seek = NULL;
+  stream->tell = tell;
+  stream->size = NULL;
+  // Bytes in the ring are overwritten as soon as they are consumed
+  stream->borrow = NULL;
+  stream->counters = NULL;
+
+  return stream;
+
+fail:
+  free(stream);
+  free(data);
+  free(ring);
+  return NULL;
+}
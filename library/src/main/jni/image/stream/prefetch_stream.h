@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_PREFETCH_STREAM_H
+#define IMAGE_PREFETCH_STREAM_H
+
+
+#include <stdbool.h>
+
+#include "stream.h"
+
+
+/**
+ * Called on the I/O thread before the first read of inner.
+ * Return false to close the prefetch stream without reading.
+ */
+typedef bool (*PrefetchAttachFunc)(Stream* inner);
+
+/**
+ * Called on the I/O thread after inner is closed.
+ */
+typedef void (*PrefetchDetachFunc)();
+
+
+/**
+ * Set the functions every I/O thread calls. Java streams need them to
+ * attach the thread to the VM. Set them before the first prefetch stream.
+ */
+void prefetch_stream_set_thread_funcs(PrefetchAttachFunc attach, PrefetchDetachFunc detach);
+
+/**
+ * Create a stream which reads inner on its own I/O thread, into a ring of
+ * window bytes, so decoding and reading overlap.
+ *
+ * The I/O thread is the only thread using inner, it closes inner after
+ * the end of inner or when the prefetch stream is closed.
+ * The prefetch stream can skip and tell, but not seek.
+ * Its counters get reads and java calls of inner, blocked_ns is the time
+ * waiting for the I/O thread.
+ *
+ * @return NULL if out of memory or the thread can't start,
+ *         inner is still owned by the caller then.
+ */
+Stream* prefetch_stream_new(Stream* inner, size_t window);
+
+
+#endif //IMAGE_PREFETCH_STREAM_H
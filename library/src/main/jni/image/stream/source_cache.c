@@ -0,0 +1,320 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "source_cache.h"
+#include "../log.h"
+
+
+#define MIN_BUCKET_COUNT 16
+
+#define HASH_SEED 0x9e3779b97f4a7c15ULL
+#define HASH_PRIME 0x100000001b3ULL
+
+
+struct ENTRY;
+typedef struct ENTRY Entry;
+
+struct ENTRY {
+  uint64_t hash;
+  ByteSource* source;
+  size_t size;
+  // The LRU list, the most recently used first
+  Entry* prev;
+  Entry* next;
+  // The next entry in the bucket
+  Entry* chain;
+  // The key is compared too, a hash isn't proof
+  size_t key_size;
+  uint8_t key[];
+};
+
+struct SOURCE_CACHE {
+  pthread_mutex_t mutex;
+  // A power of 2
+  Entry** buckets;
+  size_t bucket_count;
+  Entry* head;
+  Entry* tail;
+  size_t size;
+  size_t max_size;
+  size_t count;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+static uint64_t mix_word(uint64_t hash, const uint8_t* bytes) {
+  uint64_t word;
+  memcpy(&word, bytes, sizeof(word));
+  hash = (hash ^ word) * HASH_PRIME;
+  return hash ^ (hash >> 32);
+}
+
+static uint64_t hash_key(const void* data, size_t size) {
+  const uint8_t* bytes = data;
+  uint8_t tail[8] = { 0 };
+  uint64_t hash = HASH_SEED;
+  size_t n;
+
+  for (n = size; n >= 8; bytes += 8, n -= 8) {
+    hash = mix_word(hash, bytes);
+  }
+  // Zero padding, the size tells it apart
+  memcpy(tail, bytes, n);
+  hash = mix_word(hash, tail) ^ size;
+
+  // Mix all bits, from splitmix64
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  return hash ^ (hash >> 31);
+}
+
+static bool entry_matches(Entry* entry, uint64_t hash, const void* key, size_t key_size) {
+  return entry->hash == hash && entry->key_size == key_size &&
+      memcmp(entry->key, key, key_size) == 0;
+}
+
+static Entry** find_slot(SourceCache* cache, uint64_t hash, const void* key, size_t key_size) {
+  Entry** slot = &cache->buckets[hash & (cache->bucket_count - 1)];
+  while (*slot != NULL && !entry_matches(*slot, hash, key, key_size)) {
+    slot = &(*slot)->chain;
+  }
+  return slot;
+}
+
+static void unlink_lru(SourceCache* cache, Entry* entry) {
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    cache->head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+}
+
+static void push_lru(SourceCache* cache, Entry* entry) {
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if (cache->head != NULL) {
+    cache->head->prev = entry;
+  } else {
+    cache->tail = entry;
+  }
+  cache->head = entry;
+}
+
+static void remove_entry(SourceCache* cache, Entry* entry) {
+  Entry** slot = find_slot(cache, entry->hash, entry->key, entry->key_size);
+  *slot = entry->chain;
+  unlink_lru(cache, entry);
+  cache->size -= entry->size;
+  cache->count--;
+  byte_source_unref(&entry->source);
+  free(entry);
+}
+
+static void evict(SourceCache* cache, size_t size) {
+  while (cache->size > size && cache->tail != NULL) {
+    remove_entry(cache, cache->tail);
+    cache->evictions++;
+  }
+}
+
+// Double buckets if there are more entries than buckets, keep them if out of memory
+static void grow_buckets(SourceCache* cache) {
+  size_t count = cache->bucket_count * 2;
+  Entry** buckets;
+  Entry* entry;
+  Entry* next;
+  size_t i;
+
+  if (cache->count < cache->bucket_count) {
+    return;
+  }
+
+  buckets = calloc(count, sizeof(Entry*));
+  if (buckets == NULL) {
+    return;
+  }
+
+  for (i = 0; i < cache->bucket_count; i++) {
+    for (entry = cache->buckets[i]; entry != NULL; entry = next) {
+      next = entry->chain;
+      entry->chain = buckets[entry->hash & (count - 1)];
+      buckets[entry->hash & (count - 1)] = entry;
+    }
+  }
+
+  free(cache->buckets);
+  cache->buckets = buckets;
+  cache->bucket_count = count;
+}
+
+// Must hold the mutex
+static bool put_locked(SourceCache* cache, uint64_t hash,
+    const void* key, size_t key_size, ByteSource* source) {
+  size_t size = byte_source_get_size(source);
+  Entry* entry;
+
+  entry = *find_slot(cache, hash, key, key_size);
+  if (entry != NULL) {
+    remove_entry(cache, entry);
+  }
+
+  if (size > cache->max_size) {
+    return false;
+  }
+
+  entry = malloc(sizeof(Entry) + key_size);
+  if (entry == NULL) {
+    WTF_OOM;
+    return false;
+  }
+
+  // Make room first, the new one is the most recently used
+  evict(cache, cache->max_size - size);
+
+  entry->hash = hash;
+  entry->source = byte_source_ref(source);
+  entry->size = size;
+  entry->key_size = key_size;
+  memcpy(entry->key, key, key_size);
+  entry->chain = cache->buckets[hash & (cache->bucket_count - 1)];
+  cache->buckets[hash & (cache->bucket_count - 1)] = entry;
+  push_lru(cache, entry);
+  cache->size += size;
+  cache->count++;
+
+  grow_buckets(cache);
+
+  return true;
+}
+
+SourceCache* source_cache_new(size_t max_size) {
+  SourceCache* cache;
+  Entry** buckets;
+
+  cache = malloc(sizeof(SourceCache));
+  buckets = calloc(MIN_BUCKET_COUNT, sizeof(Entry*));
+  if (cache == NULL || buckets == NULL) {
+    WTF_OOM;
+    free(cache);
+    free(buckets);
+    return NULL;
+  }
+
+  pthread_mutex_init(&cache->mutex, NULL);
+  cache->buckets = buckets;
+  cache->bucket_count = MIN_BUCKET_COUNT;
+  cache->head = NULL;
+  cache->tail = NULL;
+  cache->size = 0;
+  cache->max_size = max_size;
+  cache->count = 0;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+
+  return cache;
+}
+
+void source_cache_delete(SourceCache** cache) {
+  if (cache == NULL || *cache == NULL) {
+    return;
+  }
+
+  SourceCache* c = *cache;
+  while (c->head != NULL) {
+    remove_entry(c, c->head);
+  }
+  pthread_mutex_destroy(&c->mutex);
+  free(c->buckets);
+  free(c);
+  *cache = NULL;
+}
+
+void source_cache_set_max_size(SourceCache* cache, size_t max_size) {
+  pthread_mutex_lock(&cache->mutex);
+  cache->max_size = max_size;
+  evict(cache, max_size);
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+ByteSource* source_cache_get(SourceCache* cache, const void* key, size_t key_size) {
+  uint64_t hash = hash_key(key, key_size);
+  ByteSource* source = NULL;
+  Entry* entry;
+
+  pthread_mutex_lock(&cache->mutex);
+  entry = *find_slot(cache, hash, key, key_size);
+  if (entry != NULL) {
+    unlink_lru(cache, entry);
+    push_lru(cache, entry);
+    source = byte_source_ref(entry->source);
+    cache->hits++;
+  } else {
+    cache->misses++;
+  }
+  pthread_mutex_unlock(&cache->mutex);
+
+  return source;
+}
+
+bool source_cache_contains(SourceCache* cache, const void* key, size_t key_size) {
+  uint64_t hash = hash_key(key, key_size);
+  bool result;
+
+  pthread_mutex_lock(&cache->mutex);
+  result = *find_slot(cache, hash, key, key_size) != NULL;
+  pthread_mutex_unlock(&cache->mutex);
+
+  return result;
+}
+
+bool source_cache_put(SourceCache* cache, const void* key, size_t key_size, ByteSource* source) {
+  uint64_t hash = hash_key(key, key_size);
+  bool result;
+
+  pthread_mutex_lock(&cache->mutex);
+  result = put_locked(cache, hash, key, key_size, source);
+  pthread_mutex_unlock(&cache->mutex);
+
+  return result;
+}
+
+void source_cache_trim(SourceCache* cache, size_t size) {
+  pthread_mutex_lock(&cache->mutex);
+  evict(cache, size);
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+void source_cache_get_stats(SourceCache* cache, SourceCacheStats* stats) {
+  pthread_mutex_lock(&cache->mutex);
+  stats->hits = cache->hits;
+  stats->misses = cache->misses;
+  stats->evictions = cache->evictions;
+  stats->size = cache->size;
+  stats->max_size = cache->max_size;
+  stats->count = cache->count;
+  pthread_mutex_unlock(&cache->mutex);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_SOURCE_CACHE_H
+#define IMAGE_SOURCE_CACHE_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "byte_source.h"
+
+
+/**
+ * A byte-budgeted LRU of ByteSources, keyed by bytes of the caller. It's thread-safe.
+ * A cached source is shared, not copied, it stays alive after eviction
+ * until the last cursor on it is closed.
+ */
+struct SOURCE_CACHE;
+typedef struct SOURCE_CACHE SourceCache;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  // Bytes of cached sources
+  size_t size;
+  size_t max_size;
+  size_t count;
+} SourceCacheStats;
+
+
+/**
+ * @param max_size The budget in bytes, 0 caches nothing.
+ * @return NULL if out of memory.
+ */
+SourceCache* source_cache_new(size_t max_size);
+
+/**
+ * Drop every cached source and free the cache.
+ */
+void source_cache_delete(SourceCache** cache);
+
+/**
+ * Change the budget, evict the least recently used sources to fit.
+ */
+void source_cache_set_max_size(SourceCache* cache, size_t max_size);
+
+/**
+ * Return a new reference of the source of key_size bytes of key and mark it
+ * recently used, or NULL if it isn't cached. Counted as a hit or a miss.
+ */
+ByteSource* source_cache_get(SourceCache* cache, const void* key, size_t key_size);
+
+/**
+ * Return true if key is cached, not counted and not marked.
+ */
+bool source_cache_contains(SourceCache* cache, const void* key, size_t key_size);
+
+/**
+ * Cache source under a copy of key, replacing the old one. The cache takes
+ * a new reference.
+ *
+ * @return False if source is larger than the budget.
+ */
+bool source_cache_put(SourceCache* cache, const void* key, size_t key_size, ByteSource* source);
+
+/**
+ * Evict the least recently used sources until at most size bytes are cached.
+ */
+void source_cache_trim(SourceCache* cache, size_t size);
+
+void source_cache_get_stats(SourceCache* cache, SourceCacheStats* stats);
+
+
+#endif //IMAGE_SOURCE_CACHE_H
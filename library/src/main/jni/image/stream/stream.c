@@ -15,52 +15,46 @@
  */
 
 #include <malloc.h>
+#include <string.h>
+#include <time.h>
 
 #include "stream.h"
 #include "../log.h"
 
 
-void* stream_read_all(Stream* stream, size_t* size) {
-  size_t len = 0;
-  size_t limit = DEFAULT_BUFFER_SIZE;
+size_t stream_skip(Stream* stream, size_t size) {
+  uint8_t buffer[DEFAULT_BUFFER_SIZE];
+  size_t skipped = 0;
   size_t read;
-  void* buffer = NULL;
-  void* buffer_bak = NULL;
 
-  buffer = malloc(limit);
-  if (buffer == NULL) {
-    WTF_OOM;
-    return NULL;
+  if (stream->skip != NULL) {
+    return stream->skip(stream, size);
   }
 
-  for (;;) {
-    // Read from stream
-    read = stream->read(stream, buffer + len, limit - len);
-    len += read;
-    // Check stream end
-    if (len < limit) {
-      // Get the end, shrink the buffer
-      buffer_bak = buffer;
-      buffer = realloc(buffer, len);
-      if (buffer == NULL) {
-        LOGE("Failed to shrink the buffer");
-        free(buffer_bak);
-        return NULL;
-      } else {
-        if (size != NULL) {
-          *size = len;
-        }
-        return buffer;
-      }
-    }
-    // Extent buffer
-    limit *= 2;
-    buffer_bak = buffer;
-    buffer = realloc(buffer, limit);
-    if (buffer == NULL) {
-      WTF_OOM;
-      free(buffer_bak);
-      return NULL;
+  while (skipped < size) {
+    read = stream->read(stream, buffer, MIN(size - skipped, sizeof(buffer)));
+    if (read == 0) {
+      break;
     }
+    skipped += read;
   }
+
+  return skipped;
+}
+
+bool stream_seek(Stream* stream, size_t position) {
+  return stream->seek != NULL && stream->seek(stream, position);
+}
+
+void stream_set_counters(Stream* stream, StreamCounters* counters) {
+  if (counters != NULL) {
+    memset(counters, 0, sizeof(StreamCounters));
+  }
+  stream->counters = counters;
+}
+
+uint64_t stream_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
 }
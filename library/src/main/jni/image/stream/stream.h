@@ -19,6 +19,7 @@
 
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -28,22 +29,102 @@
 struct STREAM;
 typedef struct STREAM Stream;
 
+/**
+ * I/O counters of a stream, see stream_set_counters().
+ */
+typedef struct {
+  // Bytes returned by read() and borrow()
+  uint64_t read_bytes;
+  // Bytes returned by peek()
+  uint64_t peeked_bytes;
+  // Bytes moved over by skip()
+  uint64_t skipped_bytes;
+  // Reads of the underlying source, like pread() or InputStream.read() and skip()
+  uint64_t source_reads;
+  // Calls from native to java
+  uint64_t jni_calls;
+  // Nanoseconds waiting for the underlying source
+  uint64_t blocked_ns;
+} StreamCounters;
+
 typedef size_t (*StreamReadFunc) (Stream* stream, void* dst, size_t size);
 typedef size_t (*StreamPeekFunc) (Stream* stream, void* dst, size_t size);
 typedef void   (*StreamCloseFunc)(Stream** stream);
+typedef size_t (*StreamSkipFunc) (Stream* stream, size_t size);
+typedef bool   (*StreamSeekFunc) (Stream* stream, size_t position);
+typedef size_t (*StreamTellFunc) (Stream* stream);
+typedef size_t (*StreamSizeFunc) (Stream* stream);
+typedef const void* (*StreamBorrowFunc)(Stream* stream, size_t size, size_t* borrowed);
 
 struct STREAM {
   void* data;
   StreamReadFunc  read;
   StreamPeekFunc peek;
   StreamCloseFunc close;
+
+  // Optional, NULL if the stream can't
+  // Move forward at most size bytes, return how many bytes are skipped
+  StreamSkipFunc skip;
+  // Move to position, position can't be beyond the size
+  StreamSeekFunc seek;
+  // Return the position of next byte to read
+  StreamTellFunc tell;
+  // Return the total number of bytes
+  StreamSizeFunc size;
+  // Return at most size bytes in place and move forward past them, no copy.
+  // They stay valid until the next call to the stream. The stream sets borrowed
+  // to the number of bytes, less than size doesn't mean the end, 0 does.
+  StreamBorrowFunc borrow;
+
+  // Updated by the stream if not NULL, owned by the caller
+  StreamCounters* counters;
 };
 
 
+#ifdef IMAGE_NO_STREAM_COUNTERS
+#define STREAM_COUNT(stream, field, n) do {} while (0)
+#define STREAM_CLOCK(stream) ((uint64_t) 0)
+#else
+// Add n to a counter of stream if it's counting
+#define STREAM_COUNT(stream, field, n)                    \
+  do {                                                    \
+    if ((stream)->counters != NULL) {                     \
+      (stream)->counters->field += (n);                   \
+    }                                                     \
+  } while (0)
+// The start of blocked time, 0 if stream isn't counting
+#define STREAM_CLOCK(stream) ((stream)->counters != NULL ? stream_clock() : 0)
+#endif
+// Add the time since start to blocked_ns
+#define STREAM_COUNT_BLOCKED(stream, start) \
+  STREAM_COUNT(stream, blocked_ns, stream_clock() - (start))
+
+
+/**
+ * Move forward at most size bytes. Streams without skip read and drop them.
+ *
+ * @return How many bytes are skipped, less than size only at the end.
+ */
+size_t stream_skip(Stream* stream, size_t size);
+
+/**
+ * Move to position.
+ *
+ * @return False if the stream can't seek or position is invalid.
+ */
+bool stream_seek(Stream* stream, size_t position);
+
+/**
+ * Start counting I/O of stream into counters, or stop if counters is NULL.
+ * counters is zeroed and must stay valid until counting stops.
+ * Define IMAGE_NO_STREAM_COUNTERS to compile counting out.
+ */
+void stream_set_counters(Stream* stream, StreamCounters* counters);
+
 /**
- * Read all data from this stream.
+ * Monotonic clock in nanoseconds.
  */
-void* stream_read_all(Stream* stream, size_t* size);
+uint64_t stream_clock();
 
 
 #endif //IMAGE_STREAM_H
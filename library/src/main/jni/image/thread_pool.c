@@ -0,0 +1,311 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "../log.h"
+
+
+#define MAX_THREAD_COUNT 8
+
+
+typedef struct {
+  void* data;
+  size_t size;
+} Scratch;
+
+typedef struct {
+  // Task range [begin, end) of this thread
+  pthread_mutex_t mutex;
+  uint32_t begin;
+  uint32_t end;
+
+  Scratch scratch;
+} Slot;
+
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static uint32_t thread_count = 1;
+static Slot slots[MAX_THREAD_COUNT];
+
+// Scratch of THREAD_POOL_CALLER, one per calling thread
+static pthread_key_t caller_scratch_key;
+
+// Held by the caller thread while a job is running
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Guard the fields below
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t generation = 0;
+static uint32_t running = 0;
+static ThreadPoolFunc job_func = NULL;
+static void* job_data = NULL;
+
+
+static bool pop_task(uint32_t thread, uint32_t* index) {
+  Slot* slot = slots + thread;
+  bool result = false;
+
+  pthread_mutex_lock(&slot->mutex);
+  if (slot->begin < slot->end) {
+    *index = slot->begin++;
+    result = true;
+  }
+  pthread_mutex_unlock(&slot->mutex);
+
+  return result;
+}
+
+static bool steal_task(uint32_t thread, uint32_t* index) {
+  uint32_t victim;
+  uint32_t size;
+  uint32_t max_size;
+  uint32_t begin;
+  uint32_t end;
+
+  for (;;) {
+    // Find the largest range
+    victim = thread;
+    max_size = 0;
+    for (uint32_t i = 0; i < thread_count; i++) {
+      if (i == thread) {
+        continue;
+      }
+      pthread_mutex_lock(&slots[i].mutex);
+      size = slots[i].end - slots[i].begin;
+      pthread_mutex_unlock(&slots[i].mutex);
+      if (size > max_size) {
+        victim = i;
+        max_size = size;
+      }
+    }
+    if (max_size == 0) {
+      return false;
+    }
+
+    // Take the back half, the victim keeps working on the front
+    pthread_mutex_lock(&slots[victim].mutex);
+    size = slots[victim].end - slots[victim].begin;
+    end = slots[victim].end;
+    begin = end - (size + 1) / 2;
+    slots[victim].end = begin;
+    pthread_mutex_unlock(&slots[victim].mutex);
+    if (size == 0) {
+      // Done by others in the meantime
+      continue;
+    }
+
+    pthread_mutex_lock(&slots[thread].mutex);
+    slots[thread].begin = begin + 1;
+    slots[thread].end = end;
+    pthread_mutex_unlock(&slots[thread].mutex);
+
+    *index = begin;
+    return true;
+  }
+}
+
+static void run_tasks(ThreadPoolFunc func, void* data, uint32_t thread) {
+  uint32_t index;
+  while (pop_task(thread, &index) || steal_task(thread, &index)) {
+    func(data, index, thread);
+  }
+}
+
+static void* worker_main(void* arg) {
+  const uint32_t thread = (uint32_t) (uintptr_t) arg;
+  uint32_t seen = 0;
+  ThreadPoolFunc func;
+  void* data;
+
+  pthread_mutex_lock(&state_mutex);
+  for (;;) {
+    while (generation == seen) {
+      pthread_cond_wait(&start_cond, &state_mutex);
+    }
+    seen = generation;
+    func = job_func;
+    data = job_data;
+    pthread_mutex_unlock(&state_mutex);
+
+    run_tasks(func, data, thread);
+
+    pthread_mutex_lock(&state_mutex);
+    if (--running == 0) {
+      pthread_cond_signal(&done_cond);
+    }
+  }
+
+  return NULL;
+}
+
+static void free_caller_scratch(void* value) {
+  Scratch* scratch = value;
+  free(scratch->data);
+  free(scratch);
+}
+
+static void init_thread_pool() {
+  pthread_attr_t attr;
+  pthread_t thread;
+  long cores;
+
+  for (uint32_t i = 0; i < MAX_THREAD_COUNT; i++) {
+    pthread_mutex_init(&slots[i].mutex, NULL);
+  }
+  pthread_key_create(&caller_scratch_key, &free_caller_scratch);
+
+  cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores > MAX_THREAD_COUNT) {
+    cores = MAX_THREAD_COUNT;
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  while (thread_count < cores) {
+    if (pthread_create(&thread, &attr, &worker_main, (void*) (uintptr_t) thread_count) != 0) {
+      LOGE(MSG("Can't create worker thread %u"), thread_count);
+      break;
+    }
+    thread_count++;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+uint32_t thread_pool_get_thread_count() {
+  pthread_once(&init_once, &init_thread_pool);
+  return thread_count;
+}
+
+// Run the job on the pool, job_mutex is held
+static void run_job(ThreadPoolFunc func, void* data, uint32_t count) {
+  uint32_t threads;
+
+  // Split tasks into contiguous ranges, neighbours are likely to share memory
+  threads = count < thread_count ? count : thread_count;
+  for (uint32_t i = 0; i < thread_count; i++) {
+    pthread_mutex_lock(&slots[i].mutex);
+    if (i < threads) {
+      slots[i].begin = (uint32_t) ((uint64_t) count * i / threads);
+      slots[i].end = (uint32_t) ((uint64_t) count * (i + 1) / threads);
+    } else {
+      slots[i].begin = 0;
+      slots[i].end = 0;
+    }
+    pthread_mutex_unlock(&slots[i].mutex);
+  }
+
+  if (threads > 1) {
+    pthread_mutex_lock(&state_mutex);
+    job_func = func;
+    job_data = data;
+    running = thread_count - 1;
+    generation++;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&state_mutex);
+  }
+
+  run_tasks(func, data, 0);
+
+  if (threads > 1) {
+    // Workers might still be stealing
+    pthread_mutex_lock(&state_mutex);
+    while (running > 0) {
+      pthread_cond_wait(&done_cond, &state_mutex);
+    }
+    pthread_mutex_unlock(&state_mutex);
+  }
+}
+
+void thread_pool_run(ThreadPoolFunc func, void* data, uint32_t count) {
+  pthread_once(&init_once, &init_thread_pool);
+
+  if (count == 0) {
+    return;
+  }
+
+  if (count == 1 || !thread_pool_try_run(func, data, count)) {
+    // Waiting for the pool takes longer than running alone
+    for (uint32_t i = 0; i < count; i++) {
+      func(data, i, THREAD_POOL_CALLER);
+    }
+  }
+}
+
+bool thread_pool_try_run(ThreadPoolFunc func, void* data, uint32_t count) {
+  pthread_once(&init_once, &init_thread_pool);
+
+  if (count == 0) {
+    return true;
+  }
+
+  if (pthread_mutex_trylock(&job_mutex) != 0) {
+    return false;
+  }
+  run_job(func, data, count);
+  pthread_mutex_unlock(&job_mutex);
+  return true;
+}
+
+static Scratch* get_caller_scratch() {
+  Scratch* scratch = pthread_getspecific(caller_scratch_key);
+
+  if (scratch == NULL) {
+    scratch = calloc(1, sizeof(Scratch));
+    if (scratch == NULL) {
+      WTF_OOM;
+      return NULL;
+    }
+    if (pthread_setspecific(caller_scratch_key, scratch) != 0) {
+      free(scratch);
+      return NULL;
+    }
+  }
+
+  return scratch;
+}
+
+void* thread_pool_get_scratch(uint32_t thread, size_t size) {
+  Scratch* scratch;
+
+  if (thread == THREAD_POOL_CALLER) {
+    scratch = get_caller_scratch();
+    if (scratch == NULL) {
+      return NULL;
+    }
+  } else {
+    scratch = &slots[thread].scratch;
+  }
+
+  if (scratch->size < size) {
+    free(scratch->data);
+    scratch->data = malloc(size);
+    if (scratch->data == NULL) {
+      WTF_OOM;
+      scratch->size = 0;
+      return NULL;
+    }
+    scratch->size = size;
+  }
+
+  return scratch->data;
+}
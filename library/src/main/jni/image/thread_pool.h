@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_THREAD_POOL_H
+#define IMAGE_THREAD_POOL_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * A process-wide work-stealing thread pool, one worker per core
+ * besides the caller thread. It is started at the first run.
+ *
+ * Task indices of a job are split into contiguous ranges, one range per
+ * thread. A thread takes tasks from the front of its own range. When it runs
+ * out, it steals the back half of the largest range left.
+ *
+ * A job holds the pool until its last task is done. Jobs of other threads
+ * run on their callers alone meanwhile, so a long job, like decoding a whole
+ * image, leaves everyone else a single thread for its whole time.
+ */
+
+/**
+ * The thread of tasks run by their caller alone, outside the pool.
+ */
+#define THREAD_POOL_CALLER UINT32_MAX
+
+/**
+ * @param index The task index, [0, count).
+ * @param thread The thread running the task, [0, thread_pool_get_thread_count()).
+ *               The caller thread is 0 if the job runs on the pool,
+ *               THREAD_POOL_CALLER if it runs alone.
+ */
+typedef void (*ThreadPoolFunc)(void* data, uint32_t index, uint32_t thread);
+
+/**
+ * Return the number of threads running a job, including the caller thread.
+ */
+uint32_t thread_pool_get_thread_count();
+
+/**
+ * Run func for every index in [0, count), return after all of them are done.
+ * The caller thread runs tasks too. A job of one task, or a job which finds
+ * the pool running a job of another thread, runs on the caller alone,
+ * so small jobs never wait. func must not call thread_pool_run().
+ */
+void thread_pool_run(ThreadPoolFunc func, void* data, uint32_t count);
+
+/**
+ * The same as thread_pool_run(), but return false at once without running
+ * any task if the pool is running a job of another thread. For jobs which
+ * are slower alone than what the caller would do without the pool.
+ */
+bool thread_pool_try_run(ThreadPoolFunc func, void* data, uint32_t count);
+
+/**
+ * Return a scratch buffer of at least size bytes for the thread.
+ * It is only valid in ThreadPoolFunc, and it is kept for next jobs,
+ * so steady-state jobs don't allocate. The buffer is 8-byte aligned.
+ * THREAD_POOL_CALLER gets the buffer of the calling thread, it's freed
+ * when the thread exits.
+ *
+ * @return NULL if out of memory.
+ */
+void* thread_pool_get_scratch(uint32_t thread, size_t size);
+
+
+#endif //IMAGE_THREAD_POOL_H
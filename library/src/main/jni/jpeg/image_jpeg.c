@@ -14,15 +14,21 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
 #include <setjmp.h>
+#include <stdint.h>
 #include <malloc.h>
 #include <string.h>
 
 #include "image.h"
 #include "image_jpeg.h"
+#include "jerror.h"
+#include "jpeg_index.h"
+#include "buffer_stream.h"
 #include "image_decoder.h"
-#include "image_convert.h"
+#include "image_resample.h"
 #include "image_utils.h"
+#include "thread_pool.h"
 #include "../log.h"
 
 
@@ -33,6 +39,35 @@ struct my_error_mgr {
 
 typedef struct my_error_mgr * my_error_ptr;
 
+// What jpeg_new_index() returns
+typedef struct {
+  // NULL until the coefficients are transcoded if the stream can't be indexed
+  JpegIndex* index;
+  // The coefficients of a progressive JPEG in a baseline one, the index is
+  // of them instead of the stream. NULL if the stream is indexed.
+  uint8_t* coefficients;
+  size_t coefficients_size;
+  // A region request reads index and coefficients under it
+  pthread_mutex_t lock;
+  uint32_t requests;
+} RegionIndex;
+
+// A decode in bands on the thread pool
+typedef struct {
+  // Takes out_color_space, scaling, crop and other output parameters from it
+  j_decompress_ptr master;
+  const JpegIndex* index;
+  const uint8_t* data;
+  size_t size;
+  // Band i is output rows [starts[i], starts[i + 1])
+  uint32_t* starts;
+  uint32_t band_count;
+  // The first row of the image
+  uint8_t* dst;
+  size_t stride;
+  volatile bool failed;
+} DecodeJob;
+
 
 static char emsg[JMSG_LENGTH_MAX];
 
@@ -43,9 +78,280 @@ static void my_error_exit(j_common_ptr cinfo) {
   longjmp(myerr->setjmp_buffer, 1);
 }
 
-static size_t custom_read(void * custom_stuff, unsigned char * buffer, size_t size) {
-  Stream* stream = (Stream*) custom_stuff;
-  return stream->read(stream, buffer, size);
+// The same as the buffer size of libjpeg stdio source
+#define INPUT_BUFFER_SIZE 4096
+
+// Each thread of a parallel decode takes a few bands, so a slow one is stolen from
+#define DECODE_BANDS_PER_THREAD 2
+// A band decodes an MCU row more than its rows, not worth it for fewer pixels
+#define DECODE_BAND_PIXELS_MIN (256 * 1024)
+
+// Only the start of APP1 is kept, orientation is in IFD0 right after the TIFF header.
+// The rest, like the thumbnail, is skipped.
+#define EXIF_SAVE_LIMIT 4096
+
+typedef struct {
+  struct jpeg_source_mgr pub;
+  Stream* stream;
+  JOCTET buffer[INPUT_BUFFER_SIZE];
+} StreamSource;
+
+static void init_source(__unused j_decompress_ptr cinfo) {}
+
+static boolean fill_input_buffer(j_decompress_ptr cinfo) {
+  StreamSource* src = (StreamSource*) cinfo->src;
+  Stream* stream = src->stream;
+  const JOCTET* bytes;
+  size_t read;
+
+  if (stream->borrow != NULL) {
+    // libjpeg reads bytes in place, as many as the stream has.
+    // They are used up before the next call to the stream.
+    bytes = stream->borrow(stream, SIZE_MAX, &read);
+    if (read != 0) {
+      src->pub.next_input_byte = bytes;
+      src->pub.bytes_in_buffer = read;
+      return TRUE;
+    }
+  } else {
+    read = stream->read(stream, src->buffer, INPUT_BUFFER_SIZE);
+  }
+
+  if (read == 0) {
+    // Insert a fake EOI marker, the same as libjpeg stdio source
+    src->buffer[0] = (JOCTET) 0xFF;
+    src->buffer[1] = (JOCTET) JPEG_EOI;
+    read = 2;
+  }
+
+  src->pub.next_input_byte = src->buffer;
+  src->pub.bytes_in_buffer = read;
+
+  return TRUE;
+}
+
+// Skipped markers never get read if the stream can skip
+static void skip_input_data(j_decompress_ptr cinfo, long num_bytes) {
+  StreamSource* src = (StreamSource*) cinfo->src;
+
+  if (num_bytes <= 0) {
+    return;
+  }
+
+  if ((size_t) num_bytes <= src->pub.bytes_in_buffer) {
+    src->pub.next_input_byte += num_bytes;
+    src->pub.bytes_in_buffer -= num_bytes;
+  } else {
+    stream_skip(src->stream, (size_t) num_bytes - src->pub.bytes_in_buffer);
+    // Fill at next read, a fake EOI if it's the end
+    src->pub.next_input_byte = src->buffer;
+    src->pub.bytes_in_buffer = 0;
+  }
+}
+
+static void term_source(__unused j_decompress_ptr cinfo) {}
+
+static void jpeg_stream_src(j_decompress_ptr cinfo, Stream* stream) {
+  StreamSource* src = (StreamSource*) (*cinfo->mem->alloc_small)(
+      (j_common_ptr) cinfo, JPOOL_PERMANENT, sizeof(StreamSource));
+
+  src->pub.init_source = init_source;
+  src->pub.fill_input_buffer = fill_input_buffer;
+  src->pub.skip_input_data = skip_input_data;
+  src->pub.resync_to_restart = jpeg_resync_to_restart;
+  src->pub.term_source = term_source;
+  src->pub.next_input_byte = NULL;
+  src->pub.bytes_in_buffer = 0;
+  src->stream = stream;
+
+  cinfo->src = &src->pub;
+}
+
+// All bytes of stream if it lends them in one block. Such a stream is in
+// memory, bytes it lent stay until it's closed. It's back where it was after it.
+static const uint8_t* borrow_all(Stream* stream, size_t* size) {
+  const uint8_t* bytes;
+  size_t borrowed;
+  size_t position;
+
+  if (stream->borrow == NULL || stream->size == NULL || stream->tell == NULL) {
+    return NULL;
+  }
+  position = stream->tell(stream);
+  if (!stream_seek(stream, 0)) {
+    return NULL;
+  }
+
+  *size = stream->size(stream);
+  bytes = stream->borrow(stream, *size, &borrowed);
+  stream_seek(stream, position);
+
+  return borrowed == *size ? bytes : NULL;
+}
+
+// Index the restart markers of stream for a parallel decode.
+// NULL if it has none or it isn't in memory.
+static JpegIndex* new_restart_index(Stream* stream, const uint8_t** data, size_t* size) {
+  Stream* bytes;
+  JpegIndex* index;
+
+  *data = borrow_all(stream, size);
+  if (*data == NULL) {
+    return NULL;
+  }
+
+  bytes = buffer_stream_wrap(*data, *size);
+  if (bytes == NULL) {
+    return NULL;
+  }
+  index = jpeg_index_new(bytes, true);
+  bytes->close(&bytes);
+  return index;
+}
+
+// Bands don't touch emsg, their rows are decoded again if they fail
+static void band_error_exit(j_common_ptr cinfo) {
+  longjmp(((my_error_ptr) cinfo->err)->setjmp_buffer, 1);
+}
+
+// Decode rows of band index from the point an MCU row above it
+static void decode_band(void* data, uint32_t index, __unused uint32_t thread) {
+  DecodeJob* job = data;
+  j_decompress_ptr master = job->master;
+  const uint32_t start = job->starts[index];
+  const uint32_t end = job->starts[index + 1];
+  struct jpeg_decompress_struct cinfo;
+  struct my_error_mgr jerr;
+  Stream* stream = NULL;
+  const JpegIndexPoint* point = NULL;
+  uint32_t first_row = 0;
+  JDIMENSION crop_x;
+  JDIMENSION crop_width;
+  uint8_t* line;
+  bool result = false;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = band_error_exit;
+  if (setjmp(jerr.setjmp_buffer)) { goto end; }
+  jpeg_create_decompress(&cinfo);
+
+  stream = buffer_stream_wrap(job->data, job->size);
+  if (stream == NULL) { goto end; }
+  if (start != 0) {
+    point = jpeg_index_find(job->index, start * master->scale_denom);
+    if (point == NULL) { goto end; }
+    first_row = jpeg_index_src(&cinfo, job->index, point, stream) / master->scale_denom;
+  } else {
+    jpeg_stream_src(&cinfo, stream);
+  }
+  jpeg_read_header(&cinfo, TRUE);
+
+  cinfo.out_color_space = master->out_color_space;
+  cinfo.dither_mode = master->dither_mode;
+  cinfo.scale_num = master->scale_num;
+  cinfo.scale_denom = master->scale_denom;
+  cinfo.dct_method = master->dct_method;
+  cinfo.do_fancy_upsampling = master->do_fancy_upsampling;
+  cinfo.do_block_smoothing = master->do_block_smoothing;
+  jpeg_start_decompress(&cinfo);
+  if (cinfo.output_width != master->output_width) {
+    // The master is cropped from x 0
+    crop_x = 0;
+    crop_width = master->output_width;
+    jpeg_crop_scanline(&cinfo, &crop_x, &crop_width);
+  }
+
+  // Rows above the band are only for upsampling, read them into its first row
+  line = job->dst + start * job->stride;
+  for (uint32_t row = first_row; row < start; row++) {
+    jpeg_read_scanlines(&cinfo, &line, 1);
+  }
+  for (uint32_t row = start; row < end; row++) {
+    line = job->dst + row * job->stride;
+    jpeg_read_scanlines(&cinfo, &line, 1);
+  }
+
+  // Warnings of broken data might differ from a decode from the start
+  result = jerr.pub.num_warnings == 0;
+
+end:
+  if (!result) {
+    job->failed = true;
+  }
+  jpeg_destroy_decompress(&cinfo);
+  if (stream != NULL) {
+    stream->close(&stream);
+  }
+}
+
+// Split the first height rows of a started decode into bands at restart
+// markers and decode them on the thread pool. master only gives output
+// parameters, nothing is read from it. Rows are whole or cropped from x 0.
+//
+// @return False if the JPEG has no restart markers, isn't in memory, it's
+//         too small, the pool is busy or a band failed.
+//         master should decode all rows then.
+static bool decode_parallel(j_decompress_ptr master, Stream* stream, uint32_t height,
+    uint8_t* dst, size_t stride) {
+  JpegIndex* index = NULL;
+  const JpegIndexPoint* point;
+  uint32_t* starts = NULL;
+  uint32_t count;
+  uint32_t mcu_rows;
+  uint32_t start;
+  DecodeJob job;
+  bool result = false;
+
+  if (thread_pool_get_thread_count() < 2) {
+    return false;
+  }
+  count = thread_pool_get_thread_count() * DECODE_BANDS_PER_THREAD;
+  count = (uint32_t) MIN(count, (uint64_t) master->image_width * master->image_height / DECODE_BAND_PIXELS_MIN);
+  if (count < 2) {
+    return false;
+  }
+
+  job.master = master;
+  index = new_restart_index(stream, &job.data, &job.size);
+  if (index == NULL) {
+    return false;
+  }
+
+  starts = malloc((count + 1) * sizeof(uint32_t));
+  if (starts == NULL) { WTF_OOM; goto end; }
+
+  // Each band starts an MCU row below the point it's decoded from,
+  // there are fewer bands if points are sparse
+  mcu_rows = (master->image_height + index->mcu_height - 1) / index->mcu_height;
+  starts[0] = 0;
+  job.band_count = 1;
+  for (uint32_t i = 1; i < count; i++) {
+    point = jpeg_index_find(index, (uint32_t) ((uint64_t) mcu_rows * i / count) * index->mcu_height);
+    if (point == NULL) {
+      continue;
+    }
+    start = (point->y + index->mcu_height) / master->scale_denom;
+    if (start > starts[job.band_count - 1] && start < height) {
+      starts[job.band_count++] = start;
+    }
+  }
+  starts[job.band_count] = height;
+  if (job.band_count < 2) {
+    goto end;
+  }
+
+  job.index = index;
+  job.starts = starts;
+  job.dst = dst;
+  job.stride = stride;
+  job.failed = false;
+  // Bands on one thread are slower than master, which decodes each row once
+  result = thread_pool_try_run(&decode_band, &job, job.band_count) && !job.failed;
+
+end:
+  free(starts);
+  jpeg_index_delete(&index);
+  return result;
 }
 
 LIBRARY_EXPORT
@@ -55,6 +361,9 @@ bool jpeg_init(ImageLibrary* library) {
     library->decode = jpeg_decode;
     library->decode_info = jpeg_decode_info;
     library->decode_buffer = jpeg_decode_buffer;
+    library->new_index = jpeg_new_index;
+    library->decode_region = jpeg_decode_region;
+    library->delete_index = jpeg_delete_index;
     library->create = NULL;
     library->get_description = jpeg_get_description;
 
@@ -77,7 +386,31 @@ const char* jpeg_get_description() {
     return IMAGE_JPEG_DECODER_DESCRIPTION;
 }
 
-StaticImage* jpeg_decode(Stream* stream, bool unused1, bool* animated) {
+// IMAGE_QUALITY_FAST takes the integer IDCT with less precision, merged
+// upsampling, which replicates chroma instead of interpolating it, and no
+// smoothing of blocks while a progressive JPEG misses its last scans.
+// IMAGE_QUALITY_BEST takes the float IDCT. Must be called before
+// jpeg_start_decompress().
+static bool set_quality(j_decompress_ptr cinfo, int32_t quality) {
+  switch (quality) {
+    case IMAGE_QUALITY_FAST:
+      cinfo->dct_method = JDCT_IFAST;
+      cinfo->do_fancy_upsampling = FALSE;
+      cinfo->do_block_smoothing = FALSE;
+      return true;
+    case IMAGE_QUALITY_DEFAULT:
+      return true;
+    case IMAGE_QUALITY_BEST:
+      cinfo->dct_method = JDCT_FLOAT;
+      return true;
+    default:
+      LOGE("Invalid quality: %d", quality);
+      return false;
+  }
+}
+
+StaticImage* jpeg_decode(Stream* stream, bool unused1, int32_t quality,
+    bool* animated) {
   *animated = false;
 
   StaticImage* image = NULL;
@@ -87,6 +420,7 @@ StaticImage* jpeg_decode(Stream* stream, bool unused1, bool* animated) {
   size_t stride;
   uint8_t* line_buffer_array[3];
   uint32_t read_lines;
+  int32_t config;
   bool result = false;
 
   // Init
@@ -94,30 +428,42 @@ StaticImage* jpeg_decode(Stream* stream, bool unused1, bool* animated) {
   jerr.pub.error_exit = my_error_exit;
   if (setjmp(jerr.setjmp_buffer)) { LOGE(MSG("%s"), emsg); goto end; }
   jpeg_create_decompress(&cinfo);
-  jpeg_custom_src(&cinfo, &custom_read, stream);
+  jpeg_stream_src(&cinfo, stream);
   jpeg_read_header(&cinfo, TRUE);
 
+  // Keep grayscale jpeg in one byte per pixel
+  if (cinfo.jpeg_color_space == JCS_GRAYSCALE) {
+    cinfo.out_color_space = JCS_GRAYSCALE;
+    config = IMAGE_CONFIG_GRAY_8;
+  } else {
+    cinfo.out_color_space = JCS_EXT_RGBA;
+    config = IMAGE_CONFIG_RGBA_8888;
+  }
+
+  if (!set_quality(&cinfo, quality)) { goto end; }
+
   // Start decompress
-  cinfo.out_color_space = JCS_EXT_RGBA;
   jpeg_start_decompress(&cinfo);
 
   // New static image
-  image = static_image_new(cinfo.output_width, cinfo.output_height);
+  image = static_image_new(cinfo.output_width, cinfo.output_height, config);
   if (image == NULL) { goto end; }
 
   // Set buffer to image->buffer
   buffer = image->buffer;
 
-  // Copy to buffer
+  // Copy to buffer, on the thread pool if possible
   stride = cinfo.output_components * cinfo.output_width;
-  line_buffer_array[0] = buffer;
-  line_buffer_array[1] = line_buffer_array[0] + stride;
-  line_buffer_array[2] = line_buffer_array[1] + stride;
-  while (cinfo.output_scanline < cinfo.output_height) {
-    read_lines = jpeg_read_scanlines(&cinfo, line_buffer_array, 3);
-    line_buffer_array[0] += stride * read_lines;
+  if (!decode_parallel(&cinfo, stream, cinfo.output_height, buffer, stride)) {
+    line_buffer_array[0] = buffer;
     line_buffer_array[1] = line_buffer_array[0] + stride;
     line_buffer_array[2] = line_buffer_array[1] + stride;
+    while (cinfo.output_scanline < cinfo.output_height) {
+      read_lines = jpeg_read_scanlines(&cinfo, line_buffer_array, 3);
+      line_buffer_array[0] += stride * read_lines;
+      line_buffer_array[1] = line_buffer_array[0] + stride;
+      line_buffer_array[2] = line_buffer_array[1] + stride;
+    }
   }
 
   // It's not necessary to call jpeg_finish_decompress().
@@ -138,6 +484,66 @@ end:
   return image;
 }
 
+static inline uint32_t read_exif_uint16(const uint8_t* data, bool little_endian) {
+  return little_endian ? data[0] | (data[1] << 8) : (data[0] << 8) | data[1];
+}
+
+static inline uint32_t read_exif_uint32(const uint8_t* data, bool little_endian) {
+  return little_endian ?
+      read_exif_uint16(data, true) | (read_exif_uint16(data + 2, true) << 16) :
+      (read_exif_uint16(data, false) << 16) | read_exif_uint16(data + 2, false);
+}
+
+// Find orientation tag in IFD0 of EXIF APP1 marker
+static int32_t read_exif_orientation(j_decompress_ptr cinfo) {
+  jpeg_saved_marker_ptr marker;
+  const uint8_t* tiff;
+  uint32_t length;
+  uint32_t offset;
+  uint32_t count;
+  bool little_endian;
+  int32_t orientation;
+
+  for (marker = cinfo->marker_list; marker != NULL; marker = marker->next) {
+    // "Exif\0\0", then TIFF header and IFD0 entry count
+    if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 16 ||
+        memcmp(marker->data, "Exif\0\0", 6) != 0) {
+      continue;
+    }
+    tiff = marker->data + 6;
+    length = marker->data_length - 6;
+
+    if (tiff[0] == 'I' && tiff[1] == 'I') {
+      little_endian = true;
+    } else if (tiff[0] == 'M' && tiff[1] == 'M') {
+      little_endian = false;
+    } else {
+      continue;
+    }
+    if (read_exif_uint16(tiff + 2, little_endian) != 42) {
+      continue;
+    }
+
+    offset = read_exif_uint32(tiff + 4, little_endian);
+    if (offset > length - 2) {
+      continue;
+    }
+    count = read_exif_uint16(tiff + offset, little_endian);
+    offset += 2;
+
+    // Entries are 12 bytes: tag, type, count, value
+    for (uint32_t i = 0; i < count && offset <= length - 12; i++, offset += 12) {
+      if (read_exif_uint16(tiff + offset, little_endian) == 0x0112) {
+        // SHORT value is in the first two bytes of the value field
+        orientation = read_exif_uint16(tiff + offset + 8, little_endian);
+        return is_valid_orientation(orientation) ? orientation : IMAGE_ORIENTATION_NORMAL;
+      }
+    }
+  }
+
+  return IMAGE_ORIENTATION_NORMAL;
+}
+
 bool jpeg_decode_info(Stream* stream, ImageInfo* info) {
   struct jpeg_decompress_struct cinfo;
   struct my_error_mgr jerr;
@@ -148,7 +554,9 @@ bool jpeg_decode_info(Stream* stream, ImageInfo* info) {
   jerr.pub.error_exit = my_error_exit;
   if (setjmp(jerr.setjmp_buffer)) { LOGE(MSG("%s"), emsg); goto end; }
   jpeg_create_decompress(&cinfo);
-  jpeg_custom_src(&cinfo, &custom_read, stream);
+  jpeg_stream_src(&cinfo, stream);
+  // Keep APP1 for EXIF
+  jpeg_save_markers(&cinfo, JPEG_APP0 + 1, EXIF_SAVE_LIMIT);
   jpeg_read_header(&cinfo, TRUE);
 
   // Assign image info
@@ -157,6 +565,7 @@ bool jpeg_decode_info(Stream* stream, ImageInfo* info) {
   info->format = IMAGE_FORMAT_JPEG;
   info->opaque = true;
   info->frame_count = 1;
+  info->orientation = read_exif_orientation(&cinfo);
 
   // Done
   result = true;
@@ -166,18 +575,26 @@ end:
   return result;
 }
 
-bool jpeg_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32_t width,
-    uint32_t height, int32_t config, uint32_t ratio, BufferContainer* container) {
+// JPEG is opaque, nothing to premultiply.
+// With index, decoding starts at the last point above the area.
+static bool decode_area(const JpegIndex* index, Stream* stream, bool clip, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, BufferContainer* container) {
   struct jpeg_decompress_struct cinfo;
   struct my_error_mgr jerr;
+  const JpegIndexPoint* point;
+  // The row in the image of the first row libjpeg decodes
+  uint32_t first_row = 0;
   bool too_small;
   bool result = false;
-  uint32_t i;
+  uint32_t row;
+  uint32_t next_row;
 
   // r_xxx the values of target rect in decoded image.
   // jpeg_crop_scanline() can't crop precisely,
   // ur_x is deserve x, r_x is actual x.
   uint32_t ur_x;
+  uint32_t ur_width;
   uint32_t r_x;
   uint32_t r_y;
   uint32_t r_width;
@@ -187,32 +604,46 @@ bool jpeg_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint3
   uint32_t d_height;
 
   uint32_t components;
+  bool gray_of_color = false;
 
-  uint32_t soft_scale;
+  // The scale done by libjpeg
+  uint32_t dct_scale;
 
   uint32_t r_stride;
   uint32_t r_start_stride;
   uint32_t d_stride;
+  size_t d_size;
+  // The stride of d_buffer, rows after orientation
+  uint32_t o_stride;
 
-  uint8_t* r_line_1 = NULL;
-  uint8_t* r_line_2 = NULL;
+  // Two lines, read rows into them by turns
+  uint8_t* r_buffer = NULL;
+  uint8_t* r_line;
   uint8_t* d_buffer = NULL;
-  uint8_t* d_line = NULL;
 
-  RowFunc row_func = NULL;
+  Resampler* resampler = NULL;
+  Orienter* orienter = NULL;
 
   // Init
   cinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = my_error_exit;
   if (setjmp(jerr.setjmp_buffer)) { LOGE(MSG("%s"), emsg); goto end; }
   jpeg_create_decompress(&cinfo);
-  jpeg_custom_src(&cinfo, &custom_read, stream);
+  point = index != NULL && clip ? jpeg_index_find(index, y) : NULL;
+  if (point != NULL) {
+    first_row = jpeg_index_src(&cinfo, index, point, stream);
+  } else {
+    jpeg_stream_src(&cinfo, stream);
+  }
   jpeg_read_header(&cinfo, TRUE);
 
   // Set clip info
   if (!clip) {
     // Decode full image
     x = 0; y = 0; width = cinfo.image_width; height = cinfo.image_height;
+  } else {
+    // Rows above first_row aren't in cinfo
+    y -= first_row;
   }
 
   // Set out color space
@@ -223,28 +654,46 @@ bool jpeg_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint3
   if (config == IMAGE_CONFIG_RGBA_8888) {
     cinfo.out_color_space = JCS_EXT_RGBA;
     components = 4;
-    row_func = &RGBA8888_to_RGBA8888_row;
   } else if (config == IMAGE_CONFIG_RGB_565) {
     config = IMAGE_CONFIG_RGB_565;
     cinfo.out_color_space = JCS_RGB565;
     // Disable rgb565 dithering, it make the color really different
     cinfo.dither_mode = JDITHER_NONE;
     components = 2;
-    row_func = &RGB565_to_RGB565_row;
+  } else if (config == IMAGE_CONFIG_GRAY_8) {
+    // libjpeg takes Y of color jpeg
+    cinfo.out_color_space = JCS_GRAYSCALE;
+    components = 1;
+    gray_of_color = cinfo.jpeg_color_space != JCS_GRAYSCALE;
   } else {
     LOGE("Invalid config: %d", config);
     goto end;
   }
 
+  if (!is_valid_resample(resample)) {
+    LOGE("Invalid resample: %d", resample);
+    goto end;
+  }
+  if (!is_valid_orientation(orientation)) {
+    LOGE("Invalid orientation: %d", orientation);
+    goto end;
+  }
+  if (!set_quality(&cinfo, quality)) {
+    goto end;
+  }
+
   // Fix width and height
-  width = floor_uint32_t(width, ratio);
-  height = floor_uint32_t(height, ratio);
-  d_width = width / ratio;
-  d_height = height / ratio;
+  resample_get_size(resample, ratio, &width, &height, &d_width, &d_height);
   too_small = d_width == 0 || d_height == 0;
 
-  // Create buffer
-  d_buffer = container->create_buffer(container, MAX(d_width, 1), MAX(d_height, 1), config);
+  // Create buffer, it's in the size after orientation
+  if (is_transposed_orientation(orientation)) {
+    d_buffer = container->create_buffer(container, MAX(d_height, 1), MAX(d_width, 1), config);
+    o_stride = d_height * components;
+  } else {
+    d_buffer = container->create_buffer(container, MAX(d_width, 1), MAX(d_height, 1), config);
+    o_stride = d_width * components;
+  }
   if (d_buffer == NULL) { goto end; }
 
   // Check image ratio too large
@@ -256,28 +705,25 @@ bool jpeg_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint3
     goto end;
   }
 
-  // Assign read info
-
-#define TEST_RATIO(test_ratio)        \
-  if (ratio % test_ratio == 0) {      \
-    soft_scale = ratio / test_ratio;  \
-    cinfo.scale_num = 1;              \
-    cinfo.scale_denom = test_ratio;   \
-    r_x = ur_x = x / test_ratio;      \
-    r_y = y / test_ratio;             \
-    r_width = width / test_ratio;     \
-    r_height = height / test_ratio;   \
-  }
-
-  TEST_RATIO(8)
-  else TEST_RATIO(4)
-  else TEST_RATIO(2)
-  else {
-    soft_scale = ratio;
-    r_x = ur_x = x, r_y = y, r_width = width, r_height = height;
+  // Let libjpeg do as much scaling as possible, it's fast and good.
+  // For integer ratio, the scale must be a factor of the ratio.
+  if (resample == IMAGE_RESAMPLE_BILINEAR) {
+    dct_scale = ratio >= 8 ? 8 : (ratio >= 4 ? 4 : (ratio >= 2 ? 2 : 1));
+    // The destination size is rounded, the scaled size is floored.
+    // Never leave fewer rows or columns than the destination, it would upscale.
+    while (dct_scale > 1 && (width / dct_scale < d_width || height / dct_scale < d_height)) {
+      dct_scale /= 2;
+    }
+  } else {
+    uint32_t int_ratio = width / d_width;
+    dct_scale = int_ratio % 8 == 0 ? 8 : (int_ratio % 4 == 0 ? 4 : (int_ratio % 2 == 0 ? 2 : 1));
   }
-
-#undef TEST_RATIO
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = dct_scale;
+  r_x = ur_x = x / dct_scale;
+  r_y = y / dct_scale;
+  r_width = ur_width = width / dct_scale;
+  r_height = height / dct_scale;
 
   // Start decompress
   jpeg_start_decompress(&cinfo);
@@ -288,40 +734,61 @@ bool jpeg_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint3
   r_start_stride = (ur_x - r_x) * components;
   d_stride = d_width * components;
 
-  if (soft_scale == 1) {
-    r_line_1 = malloc(r_stride);
-    if (r_line_1 == NULL) { WTF_OOM; goto end; }
-
-    // Read lines
-    d_line = d_buffer;
-    for (i = 0; i < r_height; ++i) {
-      jpeg_read_scanlines(&cinfo, &r_line_1, 1);
-      // No soft scale need, set ratio as 1
-      row_func(d_line, r_line_1 + r_start_stride, NULL, d_width, 1);
-      d_line += d_stride;
+  d_size = (size_t) d_stride * d_height;
+
+  if (!clip && r_stride == d_stride && r_height == d_height &&
+      orientation == IMAGE_ORIENTATION_NORMAL &&
+      decode_parallel(&cinfo, stream, r_height, d_buffer, d_stride)) {
+    // Whole rows of the whole image are decoded on the thread pool
+  } else if (ur_width == d_width && r_height == d_height && r_start_stride == 0 &&
+      orientation == IMAGE_ORIENTATION_NORMAL) {
+    // No scaling left and the crop starts at the right x, read rows into d_buffer.
+    // A wider crop runs over the start of next row, it's overwritten later.
+    for (row = 0; row < r_height && (size_t) row * d_stride + r_stride <= d_size; row++) {
+      r_line = d_buffer + (size_t) row * d_stride;
+      jpeg_read_scanlines(&cinfo, &r_line, 1);
+    }
+    if (row < r_height) {
+      // The last rows don't have space to run over
+      r_buffer = malloc(r_stride);
+      if (r_buffer == NULL) { WTF_OOM; goto end; }
+      for (; row < r_height; row++) {
+        jpeg_read_scanlines(&cinfo, &r_buffer, 1);
+        memcpy(d_buffer + (size_t) row * d_stride, r_buffer, d_stride);
+      }
     }
   } else {
-    r_line_1 = malloc(r_stride);
-    r_line_2 = malloc(r_stride);
-    if (r_line_1 == NULL || r_line_2 == NULL) { WTF_OOM; goto end; }
-
-    // Read lines
-    uint32_t temp = soft_scale - 2;
-    uint32_t skip_start = temp / 2;
-    uint32_t skip_end = temp - skip_start;
-
-    d_line = d_buffer;
-    for (i = 0; i < d_height; ++i) {
-      jpeg_skip_scanlines(&cinfo, skip_start);
-
-      jpeg_read_scanlines(&cinfo, &r_line_1, 1);
-      jpeg_read_scanlines(&cinfo, &r_line_2, 1);
-      row_func(d_line, r_line_1 + r_start_stride,
-          r_line_2 + r_start_stride, d_width, soft_scale);
-
-      jpeg_skip_scanlines(&cinfo, skip_end);
+    resampler = resampler_new(resample, config, config, ur_width, r_height,
+        d_width, d_height, d_buffer, d_stride);
+    r_buffer = malloc((size_t) r_stride * 2);
+    if (resampler == NULL || r_buffer == NULL) { WTF_OOM; goto end; }
+    resampler_set_rows_kept(resampler, true);
+    if (orientation != IMAGE_ORIENTATION_NORMAL) {
+      // Rotate and flip while writing rows
+      orienter = orienter_new(orientation, config, 0, 0, d_width, d_height,
+          d_width, d_height, d_buffer, o_stride);
+      if (orienter == NULL) { goto end; }
+      resampler_set_orienter(resampler, orienter);
+    }
 
-      d_line += d_stride;
+    // Only read the lines the resampler needs
+    row = 0;
+    r_line = r_buffer;
+    while ((next_row = resampler_next_row(resampler)) < r_height) {
+      r_line = r_line == r_buffer ? r_buffer + r_stride : r_buffer;
+      if (gray_of_color || !cinfo.do_fancy_upsampling) {
+        // jpeg_skip_scanlines() loses rows if it only outputs Y of a color jpeg.
+        // Without fancy upsampling, rows after a skip are off by a row or two,
+        // and a progressive jpeg might never return. Skip before the first row is fine.
+        for (; row < next_row; row++) {
+          jpeg_read_scanlines(&cinfo, &r_line, 1);
+        }
+      } else if (next_row > row) {
+        jpeg_skip_scanlines(&cinfo, next_row - row);
+      }
+      jpeg_read_scanlines(&cinfo, &r_line, 1);
+      row = next_row + 1;
+      resampler_push_row(resampler, r_line + r_start_stride);
     }
   }
 
@@ -333,12 +800,227 @@ bool jpeg_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint3
   result = true;
 
 end:
-  free(r_line_1);
-  free(r_line_2);
+  free(r_buffer);
+  resampler_delete(&resampler);
+  orienter_delete(&orienter);
   if (d_buffer != NULL) {
     container->release_buffer(container, d_buffer);
   }
   jpeg_destroy_decompress(&cinfo);
 
   return result;
-}
\ No newline at end of file
+}
+
+bool jpeg_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32_t width,
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, __unused bool premultiply,
+    BufferContainer* container) {
+  return decode_area(NULL, stream, clip, x, y, width, height, config, ratio, resample,
+      orientation, quality, container);
+}
+
+// A growing block in memory to encode to. Unlike jpeg_mem_dest(), buffer
+// is the current block after every call, so it can be freed after an error.
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  uint8_t* buffer;
+  size_t capacity;
+} MemoryDestination;
+
+static void init_destination(j_compress_ptr cinfo) {
+  MemoryDestination* dest = (MemoryDestination*) cinfo->dest;
+
+  dest->buffer = malloc(dest->capacity);
+  if (dest->buffer == NULL) {
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+  }
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer = dest->capacity;
+}
+
+// The whole block is full when it's called
+static boolean empty_output_buffer(j_compress_ptr cinfo) {
+  MemoryDestination* dest = (MemoryDestination*) cinfo->dest;
+  uint8_t* buffer;
+
+  buffer = realloc(dest->buffer, dest->capacity * 2);
+  if (buffer == NULL) {
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 1);
+  }
+  dest->buffer = buffer;
+  dest->pub.next_output_byte = buffer + dest->capacity;
+  dest->pub.free_in_buffer = dest->capacity;
+  dest->capacity *= 2;
+
+  return TRUE;
+}
+
+static void term_destination(__unused j_compress_ptr cinfo) {}
+
+static void jpeg_memory_dest(j_compress_ptr cinfo, MemoryDestination* dest, size_t capacity) {
+  dest->pub.init_destination = init_destination;
+  dest->pub.empty_output_buffer = empty_output_buffer;
+  dest->pub.term_destination = term_destination;
+  dest->buffer = NULL;
+  dest->capacity = MAX(capacity, INPUT_BUFFER_SIZE);
+
+  cinfo->dest = &dest->pub;
+}
+
+// Decode the coefficients of a progressive JPEG and encode them again in
+// one baseline scan with a restart marker at every MCU row. The pixels of
+// it are the same, but rows can be decoded from the nearest marker.
+static bool transcode_coefficients(Stream* stream, uint8_t** coefficients, size_t* size) {
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct dst;
+  struct my_error_mgr jerr;
+  MemoryDestination dest;
+  jvirt_barray_ptr* arrays;
+  size_t size_hint = 0;
+  bool result = false;
+
+  // Destroyed at end even if an error comes before it's created
+  dst.mem = NULL;
+  dest.buffer = NULL;
+
+  // The baseline copy is about the size of the file
+  if (stream->size != NULL && stream->tell != NULL) {
+    size_hint = stream->size(stream) - stream->tell(stream);
+  }
+
+  // Init
+  src.err = jpeg_std_error(&jerr.pub);
+  dst.err = &jerr.pub;
+  jerr.pub.error_exit = my_error_exit;
+  if (setjmp(jerr.setjmp_buffer)) { LOGE(MSG("%s"), emsg); goto end; }
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&dst);
+  jpeg_stream_src(&src, stream);
+  jpeg_read_header(&src, TRUE);
+
+  // Single-scan Huffman JPEG is indexed as it is
+  if ((!jpeg_has_multiple_scans(&src) && !src.arith_code) ||
+      src.total_iMCU_rows < JPEG_INDEX_MIN_MCU_ROWS) {
+    goto end;
+  }
+
+  arrays = jpeg_read_coefficients(&src);
+  if (jerr.pub.num_warnings != 0) {
+    // libjpeg smooths blocks of a truncated progressive JPEG, a baseline one can't keep that
+    goto end;
+  }
+
+  jpeg_copy_critical_parameters(&src, &dst);
+  dst.optimize_coding = TRUE;
+  dst.restart_in_rows = 1;
+  jpeg_memory_dest(&dst, &dest, size_hint);
+  jpeg_write_coefficients(&dst, arrays);
+  jpeg_finish_compress(&dst);
+
+  // Give back the rest of the last growth
+  *size = dest.capacity - dest.pub.free_in_buffer;
+  *coefficients = realloc(dest.buffer, MAX(*size, 1));
+  if (*coefficients == NULL) {
+    *coefficients = dest.buffer;
+  }
+  result = true;
+
+end:
+  jpeg_destroy_compress(&dst);
+  jpeg_destroy_decompress(&src);
+  if (!result) {
+    free(dest.buffer);
+  }
+  return result;
+}
+
+// Index a baseline copy of the coefficients of stream, at its start
+static void index_coefficients(RegionIndex* index, Stream* stream) {
+  Stream* coefficients;
+
+  if (!transcode_coefficients(stream, &index->coefficients, &index->coefficients_size)) {
+    return;
+  }
+
+  coefficients = buffer_stream_wrap(index->coefficients, index->coefficients_size);
+  if (coefficients != NULL) {
+    index->index = jpeg_index_new(coefficients, false);
+    coefficients->close(&coefficients);
+  }
+  if (index->index == NULL) {
+    free(index->coefficients);
+    index->coefficients = NULL;
+  }
+}
+
+void* jpeg_new_index(Stream* stream) {
+  RegionIndex* index;
+
+  index = malloc(sizeof(RegionIndex));
+  if (index == NULL) { WTF_OOM; return NULL; }
+  index->coefficients = NULL;
+  index->coefficients_size = 0;
+  pthread_mutex_init(&index->lock, NULL);
+  index->requests = 0;
+
+  // A progressive or arithmetic JPEG is transcoded on its second region,
+  // a single one isn't worth the memory.
+  index->index = jpeg_index_new(stream, false);
+  return index;
+}
+
+bool jpeg_decode_region(void* index, Stream* stream, uint32_t x, uint32_t y, uint32_t width,
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, __unused bool premultiply,
+    BufferContainer* container) {
+  RegionIndex* region_index = index;
+  JpegIndex* jpeg_index;
+  uint8_t* data;
+  size_t size;
+  size_t position;
+  Stream* coefficients;
+  bool result;
+
+  pthread_mutex_lock(&region_index->lock);
+  if (region_index->index == NULL && region_index->requests < 2 &&
+      ++region_index->requests == 2 && stream->seek != NULL && stream->tell != NULL) {
+    // Other regions wait for it, they are faster after it
+    position = stream->tell(stream);
+    index_coefficients(region_index, stream);
+    stream_seek(stream, position);
+  }
+  jpeg_index = region_index->index;
+  data = region_index->coefficients;
+  size = region_index->coefficients_size;
+  pthread_mutex_unlock(&region_index->lock);
+
+  if (data == NULL) {
+    // Points are reached by seeking, decoded from the start without index
+    return decode_area(stream->seek != NULL ? jpeg_index : NULL, stream, true,
+        x, y, width, height, config, ratio, resample, orientation, quality, container);
+  }
+
+  // The baseline copy is entropy decoded from the nearest restart marker above
+  // the region, only its columns go through IDCT and color conversion. stream isn't read.
+  coefficients = buffer_stream_wrap(data, size);
+  if (coefficients == NULL) {
+    return false;
+  }
+  result = decode_area(jpeg_index, coefficients, true, x, y, width, height,
+      config, ratio, resample, orientation, quality, container);
+  coefficients->close(&coefficients);
+  return result;
+}
+
+void jpeg_delete_index(void* index) {
+  RegionIndex* region_index = index;
+
+  if (region_index == NULL) {
+    return;
+  }
+
+  jpeg_index_delete(&region_index->index);
+  free(region_index->coefficients);
+  pthread_mutex_destroy(&region_index->lock);
+  free(region_index);
+}
@@ -37,12 +37,21 @@ bool jpeg_is_magic(Stream* stream);
 
 const char* jpeg_get_description();
 
-StaticImage* jpeg_decode(Stream* stream, bool unused1, bool* animated);
+StaticImage* jpeg_decode(Stream* stream, bool unused1, int32_t quality, bool* animated);
 
 bool jpeg_decode_info(Stream* stream, ImageInfo* info);
 
 bool jpeg_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32_t width,
-    uint32_t height, int32_t config, uint32_t ratio, BufferContainer* container);
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container);
+
+void* jpeg_new_index(Stream* stream);
+
+bool jpeg_decode_region(void* index, Stream* stream, uint32_t x, uint32_t y, uint32_t width,
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container);
+
+void jpeg_delete_index(void* index);
 
 
 #endif // IMAGE_IMAGE_JPEG_H
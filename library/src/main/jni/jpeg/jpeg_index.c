@@ -0,0 +1,982 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <string.h>
+
+#include "jpeg_index.h"
+#include "image_utils.h"
+#include "../log.h"
+
+
+// Codes of at most LOOKAHEAD bits are decoded by one lookup
+#define LOOKAHEAD 9
+
+#define READER_BUFFER_SIZE 4096
+#define MAX_SEGMENT_SIZE 65535
+
+// The same as the buffer size of libjpeg stdio source
+#define INPUT_BUFFER_SIZE 4096
+// Stuffing doubles 0xFF bytes, then the padding and a marker
+#define OUTPUT_BUFFER_SIZE (2 * INPUT_BUFFER_SIZE + 16)
+
+#define MAX_BLOCKS_IN_MCU 10
+
+#define MARKER_SOI 0xD8
+#define MARKER_EOI 0xD9
+#define MARKER_RST0 0xD0
+#define MARKER_RST7 0xD7
+
+
+typedef struct {
+  // (length << 8) | symbol of codes of at most LOOKAHEAD bits, 0 for longer codes
+  uint16_t lookup[1 << LOOKAHEAD];
+  // The largest code of each length, -1 if none
+  int32_t maxcode[17];
+  // The index of the symbol of a code is code + valoffset[length]
+  int32_t valoffset[17];
+  uint8_t values[256];
+  uint16_t codes[256];
+  // 0 if the symbol isn't in the table
+  uint8_t sizes[256];
+  bool defined;
+} HuffTable;
+
+// Bytes of the stream, or destuffed bits of entropy-coded data
+typedef struct {
+  Stream* stream;
+  uint8_t buffer[READER_BUFFER_SIZE];
+  // The offset of buffer[0] in the stream
+  size_t start;
+  size_t position;
+  size_t size;
+
+  uint64_t bits_buffer;
+  uint32_t bits_left;
+  // Bytes put into bits_buffer, and the offset of the last 8 of them
+  size_t loaded;
+  size_t offsets[8];
+  // Loaded bytes before a marker or the end, zeros are loaded after them
+  size_t data_loaded;
+  bool end;
+} Reader;
+
+typedef struct {
+  uint8_t id;
+  uint8_t h;
+  uint8_t v;
+} Component;
+
+typedef struct {
+  Reader reader;
+  HuffTable dc_tables[4];
+  HuffTable ac_tables[4];
+  uint8_t segment[MAX_SEGMENT_SIZE];
+
+  Component components[JPEG_INDEX_MAX_COMPONENTS];
+  uint32_t component_count;
+  uint32_t width;
+
+  // Tables of the components in scan order
+  const HuffTable* dc[JPEG_INDEX_MAX_COMPONENTS];
+  const HuffTable* ac[JPEG_INDEX_MAX_COMPONENTS];
+
+  size_t header_capacity;
+  bool has_frame;
+} Builder;
+
+typedef struct {
+  JOCTET* buffer;
+  size_t size;
+  uint64_t bits_buffer;
+  uint32_t bits;
+} Writer;
+
+typedef enum {
+  SOURCE_HEADER,
+  SOURCE_LEAD,
+  SOURCE_DATA,
+  SOURCE_END,
+} SourceState;
+
+typedef struct {
+  struct jpeg_source_mgr pub;
+  Stream* stream;
+  size_t start;
+  const JpegIndexPoint* point;
+  SourceState state;
+
+  JOCTET* header;
+  size_t header_size;
+  JOCTET* lead;
+  size_t lead_size;
+
+  // Bits are moved to follow the lead row, restart markers are renumbered
+  bool shift;
+  Writer writer;
+  // Bits of the first byte used by the rows above
+  uint32_t skip_bits;
+  bool pending_ff;
+  // Copy bytes as they are after a marker which isn't a restart marker
+  bool copy;
+
+  JOCTET input[INPUT_BUFFER_SIZE];
+  JOCTET output[OUTPUT_BUFFER_SIZE];
+} IndexSource;
+
+
+// Read more bytes if all bytes in buffer are used, return false at the end
+static bool refill(Reader* reader) {
+  if (reader->position == reader->size) {
+    reader->start += reader->size;
+    reader->position = 0;
+    reader->size = reader->stream->read(reader->stream, reader->buffer, READER_BUFFER_SIZE);
+  }
+  return reader->size != 0;
+}
+
+static bool read_byte(Reader* reader, uint8_t* byte) {
+  if (!refill(reader)) {
+    return false;
+  }
+
+  *byte = reader->buffer[reader->position++];
+  return true;
+}
+
+static bool read_bytes(Reader* reader, uint8_t* dst, size_t size) {
+  size_t len;
+
+  while (size != 0) {
+    if (!refill(reader)) {
+      return false;
+    }
+    len = MIN(size, reader->size - reader->position);
+    memcpy(dst, reader->buffer + reader->position, len);
+    reader->position += len;
+    dst += len;
+    size -= len;
+  }
+
+  return true;
+}
+
+static inline size_t reader_tell(Reader* reader) {
+  return reader->start + reader->position;
+}
+
+// Fill bits_buffer to more than 56 bits, zeros after a marker
+static void fill_bits(Reader* reader) {
+  size_t offset;
+  uint8_t byte;
+  uint8_t next;
+
+  while (reader->bits_left <= 56) {
+    offset = reader_tell(reader);
+    byte = 0;
+    if (reader->position < reader->size && reader->buffer[reader->position] != 0xFF && !reader->end) {
+      // Most bytes
+      byte = reader->buffer[reader->position++];
+      reader->data_loaded = reader->loaded + 1;
+    } else if (!reader->end) {
+      if (!read_byte(reader, &byte)) {
+        reader->end = true;
+        byte = 0;
+      } else if (byte == 0xFF && (!read_byte(reader, &next) || next != 0x00)) {
+        reader->end = true;
+        byte = 0;
+      } else {
+        reader->data_loaded = reader->loaded + 1;
+      }
+    }
+
+    reader->bits_buffer = (reader->bits_buffer << 8) | byte;
+    reader->bits_left += 8;
+    reader->offsets[reader->loaded & 7] = offset;
+    reader->loaded++;
+  }
+}
+
+static inline uint32_t peek_bits(Reader* reader, uint32_t n) {
+  return (uint32_t) (reader->bits_buffer >> (reader->bits_left - n)) & ((1u << n) - 1);
+}
+
+static int decode_symbol(Reader* reader, const HuffTable* table) {
+  uint32_t entry;
+  uint32_t code;
+  uint32_t length;
+
+  if (reader->bits_left < 32) {
+    fill_bits(reader);
+  }
+
+  entry = table->lookup[peek_bits(reader, LOOKAHEAD)];
+  if (entry != 0) {
+    reader->bits_left -= entry >> 8;
+    return entry & 0xFF;
+  }
+
+  for (length = LOOKAHEAD + 1; length <= 16; length++) {
+    code = peek_bits(reader, length);
+    if ((int32_t) code <= table->maxcode[length]) {
+      reader->bits_left -= length;
+      return table->values[code + table->valoffset[length]];
+    }
+  }
+
+  // Bad code
+  return -1;
+}
+
+// Decode a block without storing it, only the DC predictor is kept
+static bool skip_block(Reader* reader, const HuffTable* dc, const HuffTable* ac, int32_t* predictor) {
+  uint32_t value;
+  uint32_t k;
+  int symbol;
+  int size;
+
+  // At least 16 bits are left after a symbol, enough for the value
+  symbol = decode_symbol(reader, dc);
+  if (symbol < 0 || symbol >= JPEG_INDEX_DC_CATEGORIES) {
+    return false;
+  }
+  if (symbol != 0) {
+    value = peek_bits(reader, (uint32_t) symbol);
+    reader->bits_left -= symbol;
+    *predictor += value < (1u << (symbol - 1)) ?
+        (int32_t) value - (1 << symbol) + 1 : (int32_t) value;
+  }
+
+  for (k = 1; k < 64; k++) {
+    symbol = decode_symbol(reader, ac);
+    if (symbol < 0) {
+      return false;
+    }
+    size = symbol & 15;
+    if (size != 0) {
+      k += symbol >> 4;
+      reader->bits_left -= size;
+    } else if (symbol == 0xF0) {
+      k += 15;
+    } else {
+      // EOB
+      break;
+    }
+  }
+
+  return true;
+}
+
+static bool build_table(HuffTable* table, const uint8_t* counts, const uint8_t* values, size_t count) {
+  uint32_t code = 0;
+  size_t index = 0;
+  uint32_t length;
+  uint32_t i;
+  uint32_t j;
+  uint8_t symbol;
+
+  memset(table->lookup, 0, sizeof(table->lookup));
+  memset(table->sizes, 0, sizeof(table->sizes));
+
+  for (length = 1; length <= 16; length++) {
+    table->valoffset[length] = (int32_t) index - (int32_t) code;
+    for (i = 0; i < counts[length - 1]; i++, index++, code++) {
+      symbol = values[index];
+      table->codes[symbol] = (uint16_t) code;
+      table->sizes[symbol] = (uint8_t) length;
+      if (length <= LOOKAHEAD) {
+        for (j = 0; j < 1u << (LOOKAHEAD - length); j++) {
+          table->lookup[(code << (LOOKAHEAD - length)) | j] = (uint16_t) ((length << 8) | symbol);
+        }
+      }
+    }
+    table->maxcode[length] = counts[length - 1] != 0 ? (int32_t) code - 1 : -1;
+    // The same check as libjpeg, no code is all ones
+    if (code >= 1u << length) {
+      return false;
+    }
+    code <<= 1;
+  }
+
+  memcpy(table->values, values, count);
+  table->defined = true;
+  return true;
+}
+
+static bool parse_dht(Builder* builder, const uint8_t* data, size_t size) {
+  HuffTable* table;
+  size_t count;
+  uint8_t type;
+
+  while (size != 0) {
+    if (size < 17) {
+      return false;
+    }
+    type = data[0];
+    if ((type >> 4) > 1 || (type & 15) > 3) {
+      return false;
+    }
+    count = 0;
+    for (size_t i = 1; i <= 16; i++) {
+      count += data[i];
+    }
+    if (count > 256 || size < 17 + count) {
+      return false;
+    }
+
+    table = (type >> 4) == 0 ? &builder->dc_tables[type & 15] : &builder->ac_tables[type & 15];
+    if (!build_table(table, data + 1, data + 17, count)) {
+      return false;
+    }
+
+    data += 17 + count;
+    size -= 17 + count;
+  }
+
+  return true;
+}
+
+static bool parse_sof(Builder* builder, JpegIndex* index, const uint8_t* data, size_t size) {
+  uint32_t count;
+
+  if (size < 6 || builder->has_frame) {
+    return false;
+  }
+  count = data[5];
+  // libjpeg takes 8-bit samples only
+  if (data[0] != 8 || count == 0 || count > JPEG_INDEX_MAX_COMPONENTS || size < 6 + 3 * count) {
+    return false;
+  }
+
+  // Zero height is defined by DNL later, leave it to libjpeg
+  index->height = ((uint32_t) data[1] << 8) | data[2];
+  builder->width = ((uint32_t) data[3] << 8) | data[4];
+  if (index->height == 0 || builder->width == 0) {
+    return false;
+  }
+
+  builder->component_count = count;
+  for (uint32_t i = 0; i < count; i++) {
+    builder->components[i].id = data[6 + 3 * i];
+    builder->components[i].h = data[7 + 3 * i] >> 4;
+    builder->components[i].v = data[7 + 3 * i] & 15;
+    if (builder->components[i].h < 1 || builder->components[i].h > 4 ||
+        builder->components[i].v < 1 || builder->components[i].v > 4) {
+      return false;
+    }
+  }
+
+  builder->has_frame = true;
+  return true;
+}
+
+static bool parse_sos(Builder* builder, JpegIndex* index, const uint8_t* data, size_t size) {
+  const Component* component;
+  uint32_t count;
+  uint32_t max_h = 1;
+  uint32_t max_v = 1;
+  uint32_t blocks = 0;
+  uint8_t tables;
+
+  if (size < 1 || !builder->has_frame) {
+    return false;
+  }
+  count = data[0];
+  // Only one scan of every component
+  if (count != builder->component_count || size < 4 + 2 * count) {
+    return false;
+  }
+  // Baseline, no spectral selection or successive approximation
+  if (data[1 + 2 * count] != 0 || data[2 + 2 * count] != 63 || data[3 + 2 * count] != 0) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < builder->component_count; i++) {
+    max_h = MAX(max_h, builder->components[i].h);
+    max_v = MAX(max_v, builder->components[i].v);
+  }
+
+  index->component_count = count;
+  for (uint32_t i = 0; i < count; i++) {
+    component = NULL;
+    for (uint32_t j = 0; j < builder->component_count; j++) {
+      if (builder->components[j].id == data[1 + 2 * i]) {
+        component = &builder->components[j];
+        break;
+      }
+    }
+    tables = data[2 + 2 * i];
+    if (component == NULL || (tables >> 4) > 3 || (tables & 15) > 3 ||
+        !builder->dc_tables[tables >> 4].defined || !builder->ac_tables[tables & 15].defined) {
+      return false;
+    }
+
+    builder->dc[i] = &builder->dc_tables[tables >> 4];
+    builder->ac[i] = &builder->ac_tables[tables & 15];
+    // A scan of one component has one block in an MCU
+    index->blocks[i] = count == 1 ? 1 : (uint32_t) component->h * component->v;
+    blocks += index->blocks[i];
+
+    for (uint32_t j = 0; j < JPEG_INDEX_DC_CATEGORIES; j++) {
+      index->dc_codes[i][j] = builder->dc[i]->codes[j];
+      index->dc_sizes[i][j] = builder->dc[i]->sizes[j];
+    }
+    index->eob_codes[i] = builder->ac[i]->codes[0];
+    index->eob_sizes[i] = builder->ac[i]->sizes[0];
+  }
+  if (blocks > MAX_BLOCKS_IN_MCU) {
+    return false;
+  }
+
+  if (count == 1) {
+    index->mcu_height = DCTSIZE;
+    index->mcus_per_row = (builder->width + DCTSIZE - 1) / DCTSIZE;
+  } else {
+    index->mcu_height = DCTSIZE * max_v;
+    index->mcus_per_row = (builder->width + DCTSIZE * max_h - 1) / (DCTSIZE * max_h);
+  }
+
+  return true;
+}
+
+static bool append_header(Builder* builder, JpegIndex* index, const uint8_t* data, size_t size) {
+  uint8_t* header;
+  size_t capacity;
+
+  if (index->header_size + size > builder->header_capacity) {
+    capacity = MAX(builder->header_capacity * 2, index->header_size + size);
+    header = realloc(index->header, capacity);
+    if (header == NULL) { WTF_OOM; return false; }
+    index->header = header;
+    builder->header_capacity = capacity;
+  }
+
+  memcpy(index->header + index->header_size, data, size);
+  index->header_size += size;
+  return true;
+}
+
+static void put_bits(Writer* writer, uint32_t value, uint32_t n) {
+  uint8_t byte;
+
+  writer->bits_buffer = (writer->bits_buffer << n) | (value & ((1u << n) - 1));
+  writer->bits += n;
+  while (writer->bits >= 8) {
+    writer->bits -= 8;
+    byte = (uint8_t) (writer->bits_buffer >> writer->bits);
+    writer->buffer[writer->size++] = byte;
+    if (byte == 0xFF) {
+      writer->buffer[writer->size++] = 0x00;
+    }
+  }
+}
+
+// Pad to a byte with ones, the same as libjpeg
+static void flush_bits(Writer* writer) {
+  if (writer->bits != 0) {
+    put_bits(writer, 0x7F, 8 - writer->bits);
+  }
+}
+
+/*
+ * An MCU row of flat blocks, the DC differences add up to the predictors of point.
+ * A difference must be in a DC category of the table, so the predictors are reached
+ * by steps of the largest categories. Only count bits if writer is NULL.
+ */
+static bool put_lead(const JpegIndex* index, const JpegIndexPoint* point, Writer* writer, size_t* bit_count) {
+  int32_t remaining[JPEG_INDEX_MAX_COMPONENTS];
+  uint32_t magnitude;
+  uint32_t category;
+  int32_t diff;
+
+  for (uint32_t c = 0; c < index->component_count; c++) {
+    remaining[c] = point->dc[c];
+  }
+
+  *bit_count = 0;
+  for (uint32_t m = 0; m < index->mcus_per_row; m++) {
+    for (uint32_t c = 0; c < index->component_count; c++) {
+      for (uint32_t b = 0; b < index->blocks[c]; b++) {
+        magnitude = (uint32_t) (remaining[c] < 0 ? -remaining[c] : remaining[c]);
+        category = 0;
+        while (category < JPEG_INDEX_DC_CATEGORIES - 1 && magnitude >> category != 0) {
+          category++;
+        }
+        while (category != 0 && index->dc_sizes[c][category] == 0) {
+          category--;
+        }
+        if (index->dc_sizes[c][category] == 0 || index->eob_sizes[c] == 0) {
+          return false;
+        }
+
+        diff = (int32_t) MIN(magnitude, (1u << category) - 1);
+        diff = remaining[c] < 0 ? -diff : diff;
+        remaining[c] -= diff;
+
+        *bit_count += index->dc_sizes[c][category] + category + index->eob_sizes[c];
+        if (writer != NULL) {
+          put_bits(writer, index->dc_codes[c][category], index->dc_sizes[c][category]);
+          if (category != 0) {
+            put_bits(writer, (uint32_t) (diff < 0 ? diff + (1 << category) - 1 : diff), category);
+          }
+          put_bits(writer, index->eob_codes[c], index->eob_sizes[c]);
+        }
+      }
+    }
+  }
+
+  for (uint32_t c = 0; c < index->component_count; c++) {
+    if (remaining[c] != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool add_point(JpegIndex* index, const JpegIndexPoint* point) {
+  size_t bit_count;
+
+  // Restart markers reset the predictors, no lead row
+  if (index->restart_interval == 0 && !put_lead(index, point, NULL, &bit_count)) {
+    return false;
+  }
+
+  index->points[index->point_count++] = *point;
+  return true;
+}
+
+// Record the state at the start of every MCU row but the first
+static void index_rows(Builder* builder, JpegIndex* index, uint32_t mcu_rows) {
+  Reader* reader = &builder->reader;
+  int32_t predictors[JPEG_INDEX_MAX_COMPONENTS] = { 0 };
+  JpegIndexPoint point;
+  size_t consumed;
+
+  for (uint32_t row = 1; row < mcu_rows; row++) {
+    for (uint32_t m = 0; m < index->mcus_per_row; m++) {
+      for (uint32_t c = 0; c < index->component_count; c++) {
+        for (uint32_t b = 0; b < index->blocks[c]; b++) {
+          if (!skip_block(reader, builder->dc[c], builder->ac[c], &predictors[c])) {
+            return;
+          }
+        }
+      }
+    }
+
+    // The next bit must be in a byte of data
+    consumed = reader->loaded * 8 - reader->bits_left;
+    if (consumed / 8 >= reader->data_loaded) {
+      return;
+    }
+
+    point.offset = reader->offsets[(consumed / 8) & 7];
+    point.bit = (uint8_t) (consumed % 8);
+    point.restart = 0;
+    point.y = row * index->mcu_height;
+    for (uint32_t c = 0; c < JPEG_INDEX_MAX_COMPONENTS; c++) {
+      if (c < index->component_count && (predictors[c] < INT16_MIN || predictors[c] > INT16_MAX)) {
+        return;
+      }
+      point.dc[c] = (int16_t) (c < index->component_count ? predictors[c] : 0);
+    }
+    add_point(index, &point);
+  }
+}
+
+// Record the restart markers at the start of MCU rows
+static void index_restarts(Builder* builder, JpegIndex* index, uint32_t mcu_rows) {
+  Reader* reader = &builder->reader;
+  const uint64_t mcu_count = (uint64_t) index->mcus_per_row * mcu_rows;
+  JpegIndexPoint point;
+  uint64_t mcu;
+  uint32_t restarts = 0;
+  const uint8_t* found;
+  uint8_t byte;
+
+  memset(&point, 0, sizeof(point));
+
+  for (;;) {
+    // Jump to the next 0xFF
+    if (!refill(reader)) {
+      return;
+    }
+    found = memchr(reader->buffer + reader->position, 0xFF, reader->size - reader->position);
+    if (found == NULL) {
+      reader->position = reader->size;
+      continue;
+    }
+    reader->position = found - reader->buffer + 1;
+
+    do {
+      if (!read_byte(reader, &byte)) {
+        return;
+      }
+    } while (byte == 0xFF);
+
+    if (byte == 0x00) {
+      // Stuffed
+      continue;
+    }
+    if (byte < MARKER_RST0 || byte > MARKER_RST7) {
+      // The end of the scan
+      return;
+    }
+
+    restarts++;
+    mcu = (uint64_t) restarts * index->restart_interval;
+    if (mcu >= mcu_count) {
+      return;
+    }
+    if (mcu % index->mcus_per_row == 0) {
+      point.offset = reader_tell(reader);
+      point.restart = (uint8_t) (restarts & 7);
+      point.y = (uint32_t) (mcu / index->mcus_per_row) * index->mcu_height;
+      add_point(index, &point);
+    }
+  }
+}
+
+JpegIndex* jpeg_index_new(Stream* stream, bool restarts_only) {
+  Builder* builder = NULL;
+  JpegIndex* index = NULL;
+  uint8_t bytes[4];
+  uint8_t marker;
+  size_t size;
+  uint32_t mcu_rows;
+  bool result = false;
+
+  builder = malloc(sizeof(Builder));
+  index = malloc(sizeof(JpegIndex));
+  if (builder == NULL || index == NULL) { WTF_OOM; goto end; }
+  memset(index, 0, sizeof(JpegIndex));
+  builder->reader.stream = stream;
+  builder->reader.start = 0;
+  builder->reader.position = 0;
+  builder->reader.size = 0;
+  builder->reader.bits_buffer = 0;
+  builder->reader.bits_left = 0;
+  builder->reader.loaded = 0;
+  builder->reader.data_loaded = 0;
+  builder->reader.end = false;
+  for (size_t i = 0; i < 4; i++) {
+    builder->dc_tables[i].defined = false;
+    builder->ac_tables[i].defined = false;
+  }
+  builder->header_capacity = 0;
+  builder->has_frame = false;
+
+  if (!read_bytes(&builder->reader, bytes, 2) || bytes[0] != 0xFF || bytes[1] != MARKER_SOI ||
+      !append_header(builder, index, bytes, 2)) {
+    goto end;
+  }
+
+  for (;;) {
+    // Skip bytes before the marker and fill bytes
+    do {
+      if (!read_bytes(&builder->reader, &marker, 1)) { goto end; }
+    } while (marker != 0xFF);
+    do {
+      if (!read_bytes(&builder->reader, &marker, 1)) { goto end; }
+    } while (marker == 0xFF);
+
+    if (!read_bytes(&builder->reader, bytes + 2, 2)) { goto end; }
+    size = ((size_t) bytes[2] << 8) | bytes[3];
+    if (size < 2 || !read_bytes(&builder->reader, builder->segment, size - 2)) { goto end; }
+    size -= 2;
+    bytes[0] = 0xFF;
+    bytes[1] = marker;
+
+    switch (marker) {
+      case 0xC0:
+      case 0xC1:
+        if (!parse_sof(builder, index, builder->segment, size)) { goto end; }
+        // Height is after the marker, the length and the precision
+        index->height_offset = index->header_size + 5;
+        break;
+      case 0xC4:
+        if (!parse_dht(builder, builder->segment, size)) { goto end; }
+        break;
+      case 0xDA:
+        if (!parse_sos(builder, index, builder->segment, size)) { goto end; }
+        break;
+      case 0xDD:
+        if (size < 2) { goto end; }
+        index->restart_interval = ((uint32_t) builder->segment[0] << 8) | builder->segment[1];
+        break;
+      case 0xDB:
+      // JFIF and Adobe tell libjpeg the color space
+      case 0xE0:
+      case 0xEE:
+        break;
+      case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+      case 0xC9: case 0xCA: case 0xCB: case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+        // Progressive, lossless, hierarchical or arithmetic
+        goto end;
+      default:
+        if ((marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE) {
+          // Other APPn and COM
+          continue;
+        }
+        goto end;
+    }
+
+    if (!append_header(builder, index, bytes, 4) ||
+        !append_header(builder, index, builder->segment, size)) {
+      goto end;
+    }
+    if (marker == 0xDA) {
+      break;
+    }
+  }
+
+  mcu_rows = (index->height + index->mcu_height - 1) / index->mcu_height;
+  if (mcu_rows < JPEG_INDEX_MIN_MCU_ROWS) {
+    goto end;
+  }
+
+  index->points = malloc(mcu_rows * sizeof(JpegIndexPoint));
+  if (index->points == NULL) { WTF_OOM; goto end; }
+
+  if (index->restart_interval == 0) {
+    if (restarts_only) {
+      goto end;
+    }
+    index_rows(builder, index, mcu_rows);
+  } else {
+    index_restarts(builder, index, mcu_rows);
+  }
+  result = index->point_count != 0;
+
+end:
+  free(builder);
+  if (!result) {
+    jpeg_index_delete(&index);
+  }
+  return index;
+}
+
+void jpeg_index_delete(JpegIndex** index) {
+  if (index == NULL || *index == NULL) {
+    return;
+  }
+
+  free((*index)->header);
+  free((*index)->points);
+  free(*index);
+  *index = NULL;
+}
+
+const JpegIndexPoint* jpeg_index_find(const JpegIndex* index, uint32_t y) {
+  size_t low = 0;
+  size_t high = index->point_count;
+  size_t middle;
+
+  // The first rows of a point need the row above it for upsampling,
+  // so it must be an MCU row above y
+  while (low < high) {
+    middle = low + (high - low) / 2;
+    if (index->points[middle].y + index->mcu_height <= y) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low != 0 ? &index->points[low - 1] : NULL;
+}
+
+// Move bits or copy bytes of input to output, return the size of output
+static size_t transform(IndexSource* src, const JOCTET* input, size_t size) {
+  Writer* writer = &src->writer;
+  const uint8_t restart = src->point->restart;
+  uint32_t n;
+  uint8_t byte;
+
+  writer->buffer = src->output;
+  writer->size = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    byte = input[i];
+
+    if (!src->shift || src->copy) {
+      if (src->pending_ff && byte >= MARKER_RST0 && byte <= MARKER_RST7) {
+        byte = (uint8_t) (MARKER_RST0 + ((byte - MARKER_RST0 - restart) & 7));
+      }
+      src->pending_ff = byte == 0xFF;
+      writer->buffer[writer->size++] = byte;
+      continue;
+    }
+
+    if (src->pending_ff) {
+      if (byte == 0xFF) {
+        // Fill byte
+        continue;
+      }
+      src->pending_ff = false;
+      if (byte != 0x00) {
+        // The end of the scan
+        flush_bits(writer);
+        writer->buffer[writer->size++] = 0xFF;
+        writer->buffer[writer->size++] = byte;
+        src->copy = true;
+        continue;
+      }
+      byte = 0xFF;
+    } else if (byte == 0xFF) {
+      src->pending_ff = true;
+      continue;
+    }
+
+    n = 8 - src->skip_bits;
+    src->skip_bits = 0;
+    put_bits(writer, byte, n);
+  }
+
+  return writer->size;
+}
+
+static void init_source(__unused j_decompress_ptr cinfo) {}
+
+static boolean fill_input_buffer(j_decompress_ptr cinfo) {
+  IndexSource* src = (IndexSource*) cinfo->src;
+  Stream* stream = src->stream;
+  size_t size;
+
+  switch (src->state) {
+    case SOURCE_HEADER:
+      src->pub.next_input_byte = src->header;
+      src->pub.bytes_in_buffer = src->header_size;
+      src->state = src->lead_size != 0 ? SOURCE_LEAD : SOURCE_DATA;
+      if (src->state == SOURCE_DATA && !stream_seek(stream, src->start + src->point->offset)) {
+        src->state = SOURCE_END;
+      }
+      return TRUE;
+
+    case SOURCE_LEAD:
+      src->pub.next_input_byte = src->lead;
+      src->pub.bytes_in_buffer = src->lead_size;
+      src->state = stream_seek(stream, src->start + src->point->offset) ? SOURCE_DATA : SOURCE_END;
+      return TRUE;
+
+    case SOURCE_DATA:
+      for (;;) {
+        size = stream->read(stream, src->input, INPUT_BUFFER_SIZE);
+        if (size == 0) {
+          break;
+        }
+        size = transform(src, src->input, size);
+        if (size != 0) {
+          src->pub.next_input_byte = src->output;
+          src->pub.bytes_in_buffer = size;
+          return TRUE;
+        }
+      }
+      src->state = SOURCE_END;
+      if (src->shift && !src->copy && src->writer.bits != 0) {
+        // The last bits
+        src->writer.buffer = src->output;
+        src->writer.size = 0;
+        flush_bits(&src->writer);
+        src->pub.next_input_byte = src->output;
+        src->pub.bytes_in_buffer = src->writer.size;
+        return TRUE;
+      }
+      // Fall through
+
+    case SOURCE_END:
+    default:
+      // Insert a fake EOI marker, the same as libjpeg stdio source
+      src->output[0] = (JOCTET) 0xFF;
+      src->output[1] = (JOCTET) JPEG_EOI;
+      src->pub.next_input_byte = src->output;
+      src->pub.bytes_in_buffer = 2;
+      return TRUE;
+  }
+}
+
+// Only markers after the scan are skipped, which is the end
+static void skip_input_data(j_decompress_ptr cinfo, long num_bytes) {
+  IndexSource* src = (IndexSource*) cinfo->src;
+
+  while (num_bytes > 0) {
+    if ((size_t) num_bytes <= src->pub.bytes_in_buffer) {
+      src->pub.next_input_byte += num_bytes;
+      src->pub.bytes_in_buffer -= num_bytes;
+      return;
+    }
+    num_bytes -= src->pub.bytes_in_buffer;
+    fill_input_buffer(cinfo);
+  }
+}
+
+static void term_source(__unused j_decompress_ptr cinfo) {}
+
+uint32_t jpeg_index_src(j_decompress_ptr cinfo, const JpegIndex* index,
+    const JpegIndexPoint* point, Stream* stream) {
+  IndexSource* src;
+  uint32_t first_row;
+  uint32_t height;
+  size_t bit_count;
+
+  src = (IndexSource*) (*cinfo->mem->alloc_small)(
+      (j_common_ptr) cinfo, JPOOL_PERMANENT, sizeof(IndexSource));
+
+  src->pub.init_source = init_source;
+  src->pub.fill_input_buffer = fill_input_buffer;
+  src->pub.skip_input_data = skip_input_data;
+  src->pub.resync_to_restart = jpeg_resync_to_restart;
+  src->pub.term_source = term_source;
+  src->pub.next_input_byte = NULL;
+  src->pub.bytes_in_buffer = 0;
+  src->stream = stream;
+  src->start = stream->tell(stream);
+  src->point = point;
+  src->state = SOURCE_HEADER;
+  src->shift = index->restart_interval == 0;
+  src->writer.bits_buffer = 0;
+  src->writer.bits = 0;
+  src->skip_bits = point->bit;
+  src->pending_ff = false;
+  src->copy = false;
+  src->lead = NULL;
+  src->lead_size = 0;
+
+  // Without restart markers, a lead row sets DC predictors
+  first_row = src->shift ? point->y - index->mcu_height : point->y;
+
+  // The same header, but only rows from first_row
+  src->header_size = index->header_size;
+  src->header = (*cinfo->mem->alloc_small)((j_common_ptr) cinfo, JPOOL_PERMANENT, index->header_size);
+  memcpy(src->header, index->header, index->header_size);
+  height = index->height - first_row;
+  src->header[index->height_offset] = (JOCTET) (height >> 8);
+  src->header[index->height_offset + 1] = (JOCTET) height;
+
+  if (src->shift) {
+    // Bits left in writer are put before the bits of stream
+    put_lead(index, point, NULL, &bit_count);
+    src->lead = (*cinfo->mem->alloc_large)((j_common_ptr) cinfo, JPOOL_PERMANENT, bit_count / 4 + 1);
+    src->writer.buffer = src->lead;
+    src->writer.size = 0;
+    put_lead(index, point, &src->writer, &bit_count);
+    src->lead_size = src->writer.size;
+  }
+
+  cinfo->src = &src->pub;
+
+  return first_row;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMAGE_JPEG_INDEX_H
+#define IMAGE_JPEG_INDEX_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "jpeglib.h"
+#include "stream.h"
+
+
+#define JPEG_INDEX_MAX_COMPONENTS 4
+
+// DC categories of 8-bit samples
+#define JPEG_INDEX_DC_CATEGORIES 12
+
+// Not worth an index if it can't skip a few MCU rows
+#define JPEG_INDEX_MIN_MCU_ROWS 4
+
+/**
+ * Where the entropy decoder is at the start of an MCU row.
+ */
+typedef struct {
+  // The byte with the next bit, from the start of the stream
+  size_t offset;
+  // Bits of that byte used by the rows above
+  uint8_t bit;
+  // Restart markers after offset are renumbered by subtracting it
+  uint8_t restart;
+  // The first image row of the MCU row
+  uint32_t y;
+  // DC predictors of the components in scan order
+  int16_t dc[JPEG_INDEX_MAX_COMPONENTS];
+} JpegIndexPoint;
+
+/**
+ * Entry points of a baseline JPEG, one per MCU row, or one per restart
+ * marker at the start of an MCU row if the JPEG has restart markers.
+ * Immutable once created, decodes on many threads can share it.
+ */
+typedef struct {
+  // SOI, tables, SOF, DRI and SOS, APPn other than JFIF and Adobe are dropped
+  uint8_t* header;
+  size_t header_size;
+  // The offset of the image height in SOF
+  size_t height_offset;
+  uint32_t height;
+
+  uint32_t mcu_height;
+  uint32_t mcus_per_row;
+  uint32_t restart_interval;
+
+  // Huffman codes of a lead MCU row which sets DC predictors, not for restart markers
+  uint32_t component_count;
+  uint32_t blocks[JPEG_INDEX_MAX_COMPONENTS];
+  uint16_t dc_codes[JPEG_INDEX_MAX_COMPONENTS][JPEG_INDEX_DC_CATEGORIES];
+  uint8_t dc_sizes[JPEG_INDEX_MAX_COMPONENTS][JPEG_INDEX_DC_CATEGORIES];
+  uint16_t eob_codes[JPEG_INDEX_MAX_COMPONENTS];
+  uint8_t eob_sizes[JPEG_INDEX_MAX_COMPONENTS];
+
+  JpegIndexPoint* points;
+  size_t point_count;
+} JpegIndex;
+
+
+/**
+ * Read the stream to the end of entropy-coded data and index it.
+ * Huffman codes are decoded, but not a single block is transformed.
+ *
+ * @param restarts_only Only index restart markers, NULL without them.
+ *                      Nothing is decoded, it's fast enough for every decode.
+ * @return NULL if the JPEG isn't a baseline one in one scan,
+ *         it's too small to benefit, or out of memory.
+ */
+JpegIndex* jpeg_index_new(Stream* stream, bool restarts_only);
+
+void jpeg_index_delete(JpegIndex** index);
+
+/**
+ * Find the last point far enough above row y, rows from there decode the
+ * same as from the start of the image.
+ *
+ * @return NULL if decoding from the start is as fast.
+ */
+const JpegIndexPoint* jpeg_index_find(const JpegIndex* index, uint32_t y);
+
+/**
+ * Let cinfo read a JPEG which starts at point. It's the header with the
+ * height cut, a lead MCU row if needed, then the bytes of stream from
+ * point on. The stream must be at the start of the indexed bytes and seekable.
+ *
+ * @return The row in the image of the first row of the new JPEG.
+ */
+uint32_t jpeg_index_src(j_decompress_ptr cinfo, const JpegIndex* index,
+    const JpegIndexPoint* point, Stream* stream);
+
+
+#endif // IMAGE_JPEG_INDEX_H
@@ -17,17 +17,34 @@
 #ifndef LOG_H
 #define LOG_H
 
-#include <android/log.h>
+#ifdef __ANDROID__
+#  include <android/log.h>
+#else
+#  include <stdio.h>
+#endif
 
 #include "utils.h"
 
 #define TAG "Image"
-#define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG ,__VA_ARGS__)
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, TAG ,__VA_ARGS__)
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG ,__VA_ARGS__)
-#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, TAG ,__VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG ,__VA_ARGS__)
-#define LOGF(...) __android_log_print(ANDROID_LOG_FATAL, TAG ,__VA_ARGS__)
+
+#ifdef __ANDROID__
+#  define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, TAG ,__VA_ARGS__)
+#  define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, TAG ,__VA_ARGS__)
+#  define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG ,__VA_ARGS__)
+#  define LOGW(...) __android_log_print(ANDROID_LOG_WARN, TAG ,__VA_ARGS__)
+#  define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG ,__VA_ARGS__)
+#  define LOGF(...) __android_log_print(ANDROID_LOG_FATAL, TAG ,__VA_ARGS__)
+#else
+// No logcat on host, print warnings and errors to stderr, drop the rest
+#  define LOG_STDERR(level, ...) \
+    (fprintf(stderr, "%s/%s: ", level, TAG), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+#  define LOGV(...) ((void) 0)
+#  define LOGD(...) ((void) 0)
+#  define LOGI(...) ((void) 0)
+#  define LOGW(...) LOG_STDERR("W", __VA_ARGS__)
+#  define LOGE(...) LOG_STDERR("E", __VA_ARGS__)
+#  define LOGF(...) LOG_STDERR("F", __VA_ARGS__)
+#endif
 
 #define FILE_LINE MAKESTRING(STRINGIZE, __LINE__ )
 #define MSG(msg) __FILE__ "(" FILE_LINE "): "msg
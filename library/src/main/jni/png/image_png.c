@@ -15,12 +15,14 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "image.h"
 #include "image_png.h"
 #include "image_utils.h"
 #include "image_decoder.h"
 #include "image_convert.h"
+#include "image_resample.h"
 #include "animated_image.h"
 #include "../log.h"
 
@@ -44,12 +46,27 @@ typedef struct {
   uint8_t* buffer;
 } PngFrame;
 
+// Skippable chunks are replaced with an empty chunk as they are read
+#define PNG_SOURCE_PENDING_SIZE 12
+
+typedef struct {
+  Stream* stream;
+  // Bytes handed to libpng
+  size_t position;
+  // Where the next chunk starts, SIZE_MAX if unknown
+  size_t next_chunk;
+  uint8_t pending[PNG_SOURCE_PENDING_SIZE];
+  size_t pending_offset;
+  size_t pending_size;
+} PngSource;
+
 typedef struct {
   PngFrame* frames;
   uint32_t frame_count;
   png_structp png_ptr;
   png_infop info_ptr;
   Stream* stream;
+  PngSource source;
 } PngData;
 
 
@@ -60,6 +77,9 @@ bool png_init(ImageLibrary* library) {
   library->decode = png_decode;
   library->decode_info = png_decode_info;
   library->decode_buffer = png_decode_buffer;
+  library->new_index = NULL;
+  library->decode_region = NULL;
+  library->delete_index = NULL;
   library->create = NULL;
   library->get_description = png_get_description;
 
@@ -109,10 +129,86 @@ static void png_skip_image(png_structrp png_ptr, png_infop info_ptr) {
 }
 
 
+// An empty private ancillary chunk "skIp" and its CRC, libpng ignores it
+static const uint8_t SKIPPED_CHUNK[PNG_SOURCE_PENDING_SIZE] = {
+    0x00, 0x00, 0x00, 0x00, 's', 'k', 'I', 'p', 0x6d, 0xf2, 0x71, 0xdf };
+
+// Ancillary chunks the decoders never use. Text and EXIF might be large.
+static bool is_skippable_chunk(const uint8_t* type) {
+  return memcmp(type, "tEXt", 4) == 0 || memcmp(type, "zTXt", 4) == 0 ||
+      memcmp(type, "iTXt", 4) == 0 || memcmp(type, "eXIf", 4) == 0 ||
+      memcmp(type, "iCCP", 4) == 0;
+}
+
+static void png_source_init(PngSource* source, Stream* stream) {
+  source->stream = stream;
+  source->position = 0;
+  // The first chunk is after the signature
+  source->next_chunk = 8;
+  source->pending_offset = 0;
+  source->pending_size = 0;
+}
+
+static void read_chunk_header(PngSource* source) {
+  Stream* stream = source->stream;
+  uint8_t* header = source->pending;
+  uint32_t length;
+  size_t read;
+
+  read = stream->read(stream, header, 8);
+  source->pending_offset = 0;
+  source->pending_size = read;
+  if (read != 8) {
+    // Let libpng find the error
+    source->next_chunk = SIZE_MAX;
+    return;
+  }
+
+  length = ((uint32_t) header[0] << 24) | ((uint32_t) header[1] << 16) |
+      ((uint32_t) header[2] << 8) | (uint32_t) header[3];
+  if (length > PNG_UINT_31_MAX) {
+    source->next_chunk = SIZE_MAX;
+    return;
+  }
+
+  if (length != 0 && is_skippable_chunk(header + 4) &&
+      stream_skip(stream, (size_t) length + 4) == (size_t) length + 4) {
+    // Data and CRC are skipped without reading them
+    memcpy(source->pending, SKIPPED_CHUNK, sizeof(SKIPPED_CHUNK));
+    source->pending_size = sizeof(SKIPPED_CHUNK);
+    source->next_chunk = source->position + sizeof(SKIPPED_CHUNK);
+  } else {
+    source->next_chunk = source->position + 8 + length + 4;
+  }
+}
+
 static void user_read_fn(png_structp png_ptr,
     png_bytep data, png_size_t length) {
-  Stream* stream = png_get_io_ptr(png_ptr);
-  stream->read(stream, data, length);
+  PngSource* source = png_get_io_ptr(png_ptr);
+  Stream* stream = source->stream;
+  size_t n;
+
+  while (length != 0) {
+    if (source->pending_size == 0 && source->position == source->next_chunk) {
+      read_chunk_header(source);
+    }
+
+    if (source->pending_size != 0) {
+      n = MIN(length, source->pending_size);
+      memcpy(data, source->pending + source->pending_offset, n);
+      source->pending_offset += n;
+      source->pending_size -= n;
+    } else {
+      n = stream->read(stream, data, MIN(length, source->next_chunk - source->position));
+      if (n == 0) {
+        break;
+      }
+    }
+
+    data += n;
+    length -= n;
+    source->position += n;
+  }
 }
 
 static void user_error_fn(__unused png_structp png_ptr,
@@ -189,7 +285,8 @@ static void blend(uint8_t* dst, uint32_t dst_width, uint32_t dst_height,
 }
 
 // Read pixels
-static void read_image(png_structp png_ptr, uint8_t* buffer, uint32_t width, uint32_t height) {
+static void read_image(png_structp png_ptr, uint8_t* buffer, uint32_t width, uint32_t height,
+    uint32_t depth) {
   uint32_t i;
   uint8_t** image = (png_bytepp) malloc(height * sizeof(png_bytep));
   if (image == NULL) {
@@ -197,7 +294,7 @@ static void read_image(png_structp png_ptr, uint8_t* buffer, uint32_t width, uin
   }
 
   for (i = 0; i < height; i++) {
-    *(image + i) = buffer + (width * i * 4);
+    *(image + i) = buffer + (width * i * depth);
   }
 
   png_read_image(png_ptr, image);
@@ -257,7 +354,7 @@ static void read_frame(png_structp png_ptr, png_infop info_ptr, PngFrame* frame,
   }
 
   // Read pixels
-  read_image(png_ptr, frame->buffer, frame->width, frame->height);
+  read_image(png_ptr, frame->buffer, frame->width, frame->height, 4);
 }
 
 static Stream* get_stream(AnimatedImage* image) {
@@ -419,13 +516,14 @@ static void recycle(AnimatedImage** image) {
   *image = NULL;
 }
 
-void* png_decode(Stream* stream, bool partially, bool* animated) {
+void* png_decode(Stream* stream, bool partially, __unused int32_t quality, bool* animated) {
   StaticImage* static_image = NULL;
   AnimatedImage* animated_image = NULL;
   PngData* png_data = NULL;
   PngFrame* frames = NULL;
   png_structp png_ptr = NULL;
   png_infop info_ptr = NULL;
+  PngSource source;
   bool apng;
   uint32_t width;
   uint32_t height;
@@ -434,6 +532,7 @@ void* png_decode(Stream* stream, bool partially, bool* animated) {
   uint32_t frame_count = 1;
   bool hide_first_frame = false;
   bool opaque;
+  bool gray;
   int i;
 
   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, &user_error_fn, &user_warn_fn);
@@ -459,7 +558,8 @@ void* png_decode(Stream* stream, bool partially, bool* animated) {
   }
 
   // Init
-  png_set_read_fn(png_ptr, stream, &user_read_fn);
+  png_source_init(&source, stream);
+  png_set_read_fn(png_ptr, &source, &user_read_fn);
   png_read_info(png_ptr, info_ptr);
 
   // Get info
@@ -488,20 +588,26 @@ void* png_decode(Stream* stream, bool partially, bool* animated) {
     return NULL;
   }
 
-  // Configure to ARGB
+  // Opaque gray png keeps one byte per pixel
+  gray = !apng && color_type == PNG_COLOR_TYPE_GRAY &&
+      !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS);
+
+  // Configure to ARGB, or gray
   png_set_expand(png_ptr);
   if (bit_depth == 16) {
     png_set_scale_16(png_ptr);
   }
-  if (color_type == PNG_COLOR_TYPE_GRAY ||
-      color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+  if (!gray && (color_type == PNG_COLOR_TYPE_GRAY ||
+      color_type == PNG_COLOR_TYPE_GRAY_ALPHA)) {
     png_set_gray_to_rgb(png_ptr);
   }
   if (color_type & PNG_COLOR_MASK_ALPHA) {
     opaque = false;
   } else {
     opaque = true;
-    png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+    if (!gray) {
+      png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+    }
   }
 
   if (apng) {
@@ -541,7 +647,7 @@ void* png_decode(Stream* stream, bool partially, bool* animated) {
 
     if (frame_count == 1) {
       // For one-frame apng, use StaticImage
-      static_image = static_image_new(width, height);
+      static_image = static_image_new(width, height, IMAGE_CONFIG_RGBA_8888);
       if (static_image == NULL) {
         png_error(png_ptr, OUT_OF_MEMORY);
         return NULL;
@@ -588,6 +694,9 @@ void* png_decode(Stream* stream, bool partially, bool* animated) {
         png_data->png_ptr = png_ptr;
         png_data->info_ptr = info_ptr;
         png_data->stream = stream;
+        // The source outlives this function
+        png_data->source = source;
+        png_set_read_fn(png_ptr, &png_data->source, &user_read_fn);
       } else {
         png_data->png_ptr = NULL;
         png_data->info_ptr = NULL;
@@ -598,14 +707,16 @@ void* png_decode(Stream* stream, bool partially, bool* animated) {
     }
   } else {
     // For png, use StaticImage
-    static_image = static_image_new(width, height);
+    static_image = static_image_new(width, height,
+        gray ? IMAGE_CONFIG_GRAY_8 : IMAGE_CONFIG_RGBA_8888);
     if (static_image == NULL) {
       png_error(png_ptr, OUT_OF_MEMORY);
       return NULL;
     }
 
     // Read pixel
-    read_image(png_ptr, static_image->buffer, width, height);
+    read_image(png_ptr, static_image->buffer, width, height,
+        get_depth_for_config(static_image->config));
 
     // End read
     png_read_end(png_ptr, info_ptr);
@@ -622,6 +733,7 @@ void* png_decode(Stream* stream, bool partially, bool* animated) {
 bool png_decode_info(Stream* stream, ImageInfo* info) {
   png_structp png_ptr = NULL;
   png_infop info_ptr = NULL;
+  PngSource source;
 
   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, &user_error_fn, &user_warn_fn);
   if (png_ptr == NULL) {
@@ -642,7 +754,8 @@ bool png_decode_info(Stream* stream, ImageInfo* info) {
   }
 
   // Init
-  png_set_read_fn(png_ptr, stream, &user_read_fn);
+  png_source_init(&source, stream);
+  png_set_read_fn(png_ptr, &source, &user_read_fn);
   png_read_info(png_ptr, info_ptr);
 
   // Assign
@@ -650,6 +763,7 @@ bool png_decode_info(Stream* stream, ImageInfo* info) {
   info->height = png_get_image_height(png_ptr, info_ptr);
   info->format = IMAGE_FORMAT_PNG;
   info->opaque = !(png_get_color_type(png_ptr, info_ptr) & PNG_COLOR_MASK_ALPHA);
+  info->orientation = IMAGE_ORIENTATION_NORMAL;
   if (png_get_valid(png_ptr, info_ptr, PNG_INFO_acTL)) {
     // APNG
     info->frame_count = png_get_num_frames(png_ptr, info_ptr);
@@ -667,10 +781,14 @@ bool png_decode_info(Stream* stream, ImageInfo* info) {
 }
 
 bool png_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32_t width,
-    uint32_t height, int32_t config, uint32_t ratio, BufferContainer* container) {
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, __unused int32_t quality, bool premultiply, BufferContainer* container) {
   png_structp png_ptr = NULL;
   png_infop info_ptr = NULL;
+  PngSource source;
   uint32_t i;
+  uint32_t row;
+  uint32_t next_row;
   bool result = false;
 
   uint32_t i_width;
@@ -678,27 +796,32 @@ bool png_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32
   uint8_t  i_color_type;
   uint8_t  i_bit_depth;
   bool     i_opaque;
-  const uint32_t i_components = 4; // Always rgba8888
+  // The config of rows libpng outputs, rgba8888 or gray8
+  int32_t  i_config;
+  uint32_t i_components;
 
   uint32_t d_width;
   uint32_t d_height;
   uint32_t d_stride;
+  size_t   d_size;
   bool     d_too_small;
+  bool     d_direct;
   uint32_t d_components;
+  // The stride of d_buffer, rows after orientation
+  uint32_t o_stride;
 
   int32_t  pass;
 
   uint32_t r_stride;
   uint32_t r_start_stride;
+  uint32_t r_count;
   uint8_t* r_buffer = NULL;
   // Don't free it
   uint8_t* r_line   = NULL;
-  uint8_t* r_line_1 = NULL;
-  uint8_t* r_line_2 = NULL;
   uint8_t* d_buffer = NULL;
-  uint8_t* d_line = NULL;
 
-  RowFunc row_func = NULL;
+  Resampler* resampler = NULL;
+  Orienter* orienter = NULL;
 
   // Prepare
   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, &user_error_fn, &user_warn_fn);
@@ -708,7 +831,8 @@ bool png_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32
   if (setjmp(png_jmpbuf(png_ptr))) { goto end; }
 
   // Init
-  png_set_read_fn(png_ptr, stream, &user_read_fn);
+  png_source_init(&source, stream);
+  png_set_read_fn(png_ptr, &source, &user_read_fn);
   png_read_info(png_ptr, info_ptr);
 
   // Get png info
@@ -723,40 +847,63 @@ bool png_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32
     x = 0; y = 0; width = i_width; height = i_height;
   }
 
+  i_opaque = !(i_color_type & PNG_COLOR_MASK_ALPHA);
+
+  // Resolve config
+  if (config == IMAGE_CONFIG_AUTO) {
+    config = (int32_t) (i_opaque ? IMAGE_CONFIG_RGB_565 : IMAGE_CONFIG_RGBA_8888);
+  } else if (!is_explicit_config(config)) {
+    LOGE("Invalid config: %d", config);
+    goto end;
+  }
+
   // Configure output
   png_set_expand(png_ptr);
   if (i_bit_depth == 16) {
     png_set_scale_16(png_ptr);
   }
-  if (i_color_type == PNG_COLOR_TYPE_GRAY ||
-      i_color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
-    png_set_gray_to_rgb(png_ptr);
-  }
-  if (!(i_color_type & PNG_COLOR_MASK_ALPHA)) {
-    i_opaque = true;
-    png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+  if (config == IMAGE_CONFIG_GRAY_8) {
+    // Let libpng output gray rows, BT.601 like libjpeg
+    if (i_color_type & PNG_COLOR_MASK_COLOR) {
+      png_set_rgb_to_gray_fixed(png_ptr, PNG_ERROR_ACTION_NONE, 29900, 58700);
+    }
+    png_set_strip_alpha(png_ptr);
+    i_config = IMAGE_CONFIG_GRAY_8;
   } else {
-    i_opaque = false;
+    if (i_color_type == PNG_COLOR_TYPE_GRAY ||
+        i_color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+      png_set_gray_to_rgb(png_ptr);
+    }
+    if (i_opaque) {
+      png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+    }
+    i_config = IMAGE_CONFIG_RGBA_8888;
   }
+  i_components = get_depth_for_config(i_config);
+  // Opaque rows need no premultiply, tRNS becomes alpha after png_set_expand()
+  premultiply = premultiply && config == IMAGE_CONFIG_RGBA_8888 &&
+      (!i_opaque || png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS));
   pass = png_set_interlace_handling(png_ptr);
 
-  // Resolve config
-  if (config == IMAGE_CONFIG_AUTO) {
-    config = (int32_t) (i_opaque ? IMAGE_CONFIG_RGB_565 : IMAGE_CONFIG_RGBA_8888);
-  } else if (!is_explicit_config(config)) {
-    LOGE("Invalid config: %d", config);
+  if (!is_valid_resample(resample)) {
+    LOGE("Invalid resample: %d", resample);
+    goto end;
+  }
+  if (!is_valid_orientation(orientation)) {
+    LOGE("Invalid orientation: %d", orientation);
     goto end;
   }
 
   // Fix width and height
-  width = floor_uint32_t(width, ratio);
-  height = floor_uint32_t(height, ratio);
-  d_width = width / ratio;
-  d_height = height / ratio;
+  resample_get_size(resample, ratio, &width, &height, &d_width, &d_height);
   d_too_small = d_width == 0 || d_height == 0;
 
-  // Create buffer
-  d_buffer = container->create_buffer(container, MAX(d_width, 1), MAX(d_height, 1), config);
+  // Create buffer, it's in the size after orientation
+  if (is_transposed_orientation(orientation)) {
+    d_buffer = container->create_buffer(container, MAX(d_height, 1), MAX(d_width, 1), config);
+  } else {
+    d_buffer = container->create_buffer(container, MAX(d_width, 1), MAX(d_height, 1), config);
+  }
   if (d_buffer == NULL) { goto end; }
 
   // Check image ratio too large
@@ -773,117 +920,130 @@ bool png_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32
   r_start_stride = x * i_components;
   r_stride = i_width * i_components;
 
-  // Row function
-  row_func = config == IMAGE_CONFIG_RGBA_8888 ? &RGBA8888_to_RGBA8888_row : &RGBA8888_to_RGB565_row;
+  d_size = (size_t) d_stride * d_height;
+  // Rows from libpng could go into d_buffer without scaling
+  d_direct = config == i_config && d_width == width && d_height == height && x == 0;
+
+  if (orientation != IMAGE_ORIENTATION_NORMAL) {
+    // Rotate and flip while the resampler writes rows
+    o_stride = (is_transposed_orientation(orientation) ? d_height : d_width) * d_components;
+    orienter = orienter_new(orientation, config, 0, 0, d_width, d_height,
+        d_width, d_height, d_buffer, o_stride);
+    if (orienter == NULL) { goto end; }
+    d_direct = false;
+  }
 
   // Read data
-  if (pass > 1) {
-    // Interlaced PNG, read all rows to r_buffer,
-    // then transfer them to d_buffer
+  if (pass > 1 && d_direct && width == i_width) {
+    // Interlaced PNG, every pass updates the rows in d_buffer
+    uint32_t remain_y = i_height - y - height;
+    while (--pass >= 0) {
+      png_skip_rows(png_ptr, y);
+      for (i = 0; i < height; ++i) {
+        png_read_row(png_ptr, d_buffer + (size_t) i * d_stride, NULL);
+        if (premultiply && pass == 0) {
+          // The row is complete after the last pass
+          premultiply_RGBA8888_row(d_buffer + (size_t) i * d_stride, d_width);
+        }
+      }
+      if (pass > 0) {
+        // Rows after the region are only needed by the next pass
+        png_skip_rows(png_ptr, remain_y);
+      }
+    }
+  } else if (pass > 1) {
+    // Interlaced PNG, passes need full rows kept, so read all needed rows
+    // to r_buffer, then transfer them to d_buffer
 
     uint32_t remain_y = i_height - y - height;
 
-    if (ratio == 1) {
-      r_buffer = malloc(r_stride * height);
-      if (r_buffer == NULL) { WTF_OOM; goto end; }
+    resampler = resampler_new(resample, i_config, config, width, height,
+        d_width, d_height, d_buffer, d_stride);
+    if (resampler == NULL) { goto end; }
+    resampler_set_premultiply(resampler, premultiply);
+    resampler_set_orienter(resampler, orienter);
 
-      // Read all rows to r_buffer
-      while (--pass >= 0) {
-        // Skip start lines
-        png_skip_rows(png_ptr, y);
-        // Read rows
-        r_line = r_buffer;
-        for (i = 0; i < height; ++i) {
-          png_read_row(png_ptr, r_line, NULL);
-          r_line += r_stride;
-        }
-        // Skip end lines
-        png_skip_rows(png_ptr, remain_y);
+    r_count = 0;
+    for (i = 0; i < height; ++i) {
+      if (resampler_is_row_needed(resampler, i)) {
+        ++r_count;
       }
+    }
+
+    r_buffer = malloc((size_t) r_stride * r_count);
+    if (r_buffer == NULL) { WTF_OOM; goto end; }
 
-      // r_buffer to d_buffer
-      d_line = d_buffer;
+    // Read all needed rows to r_buffer
+    while (--pass >= 0) {
+      // Skip start lines
+      png_skip_rows(png_ptr, y);
+      // Read rows
       r_line = r_buffer;
       for (i = 0; i < height; ++i) {
-        row_func(d_line, r_line + r_start_stride, NULL, d_width, 1);
-        d_line += d_stride;
-        r_line += r_stride;
-      }
-    } else {
-      r_buffer = malloc(r_stride * d_height * 2);
-      if (r_buffer == NULL) { WTF_OOM; goto end; }
-
-      uint32_t temp = ratio - 2;
-      uint32_t skip_start = temp / 2;
-      uint32_t skip_end = temp - skip_start;
-
-      // Read all rows to r_buffer
-      while (--pass >= 0) {
-        // Skip start lines
-        png_skip_rows(png_ptr, y);
-        // Read rows
-        r_line = r_buffer;
-        for (i = 0; i < d_height; ++i) {
-          png_skip_rows(png_ptr, skip_start);
+        if (resampler_is_row_needed(resampler, i)) {
           png_read_row(png_ptr, r_line, NULL);
           r_line += r_stride;
-          png_read_row(png_ptr, r_line, NULL);
-          r_line += r_stride;
-          png_skip_rows(png_ptr, skip_end);
+        } else {
+          png_read_row(png_ptr, NULL, NULL);
         }
-        // Skip end lines
-        png_skip_rows(png_ptr, remain_y);
       }
-
-      // r_buffer to d_buffer
-      d_line = d_buffer;
-      r_line = r_buffer;
-      for (i = 0; i < d_height; ++i) {
-        row_func(d_line, r_line + r_start_stride,
-            r_line + r_stride + r_start_stride, d_width, ratio);
-        d_line += d_stride;
-        r_line += r_stride * 2;
+      // Skip end lines, not after the last pass
+      if (pass > 0) {
+        png_skip_rows(png_ptr, remain_y);
       }
     }
-  } else if (ratio == 1) {
-    r_line_1 = malloc(r_stride);
-    if (r_line_1 == NULL) { WTF_OOM; goto end; }
 
+    // r_buffer to d_buffer, rows are asked in the same order
+    r_line = r_buffer;
+    while (resampler_next_row(resampler) < height) {
+      resampler_push_row(resampler, r_line + r_start_stride);
+      r_line += r_stride;
+    }
+  } else if (d_direct) {
     // Skip start lines
     png_skip_rows(png_ptr, y);
 
-    // Read lines
-    d_line = d_buffer;
-    for (i = 0; i < d_height; ++i) {
-      png_read_row(png_ptr, r_line_1, NULL);
-      row_func(d_line, r_line_1 + r_start_stride, NULL, d_width, 1);
-      d_line += d_stride;
+    // Read rows into d_buffer. A full row is wider than a region row,
+    // it runs over the start of next row, which is overwritten later.
+    for (i = 0; i < height && (size_t) i * d_stride + r_stride <= d_size; ++i) {
+      png_read_row(png_ptr, d_buffer + (size_t) i * d_stride, NULL);
+      if (premultiply) {
+        premultiply_RGBA8888_row(d_buffer + (size_t) i * d_stride, d_width);
+      }
+    }
+    if (i < height) {
+      // The last rows don't have space to run over
+      r_buffer = malloc(r_stride);
+      if (r_buffer == NULL) { WTF_OOM; goto end; }
+      for (; i < height; ++i) {
+        png_read_row(png_ptr, r_buffer, NULL);
+        memcpy(d_buffer + (size_t) i * d_stride, r_buffer, d_stride);
+        if (premultiply) {
+          premultiply_RGBA8888_row(d_buffer + (size_t) i * d_stride, d_width);
+        }
+      }
     }
   } else {
-    r_line_1 = malloc(r_stride);
-    r_line_2 = malloc(r_stride);
-    if (r_line_1 == NULL || r_line_2 == NULL) { WTF_OOM; goto end; }
+    resampler = resampler_new(resample, i_config, config, width, height,
+        d_width, d_height, d_buffer, d_stride);
+    r_buffer = malloc((size_t) r_stride * 2);
+    if (resampler == NULL || r_buffer == NULL) { WTF_OOM; goto end; }
+    resampler_set_rows_kept(resampler, true);
+    resampler_set_premultiply(resampler, premultiply);
+    resampler_set_orienter(resampler, orienter);
 
     // Skip start lines
     png_skip_rows(png_ptr, y);
 
-    // Read lines
-    uint32_t temp = ratio - 2;
-    uint32_t skip_start = temp / 2;
-    uint32_t skip_end = temp - skip_start;
-
-    d_line = d_buffer;
-    for (i = 0; i < d_height; ++i) {
-      png_skip_rows(png_ptr, skip_start);
-
-      png_read_row(png_ptr, r_line_1, NULL);
-      png_read_row(png_ptr, r_line_2, NULL);
-      row_func(d_line, r_line_1 + r_start_stride,
-          r_line_2 + r_start_stride, d_width, ratio);
-
-      png_skip_rows(png_ptr, skip_end);
-
-      d_line += d_stride;
+    // Only read the lines the resampler needs, into two lines by turns
+    row = 0;
+    r_line = r_buffer;
+    while ((next_row = resampler_next_row(resampler)) < height) {
+      png_skip_rows(png_ptr, next_row - row);
+      r_line = r_line == r_buffer ? r_buffer + r_stride : r_buffer;
+      png_read_row(png_ptr, r_line, NULL);
+      row = next_row + 1;
+      resampler_push_row(resampler, r_line + r_start_stride);
     }
   }
 
@@ -895,9 +1055,9 @@ bool png_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32
   result = true;
 
 end:
-  free(r_line_1);
-  free(r_line_2);
   free(r_buffer);
+  resampler_delete(&resampler);
+  orienter_delete(&orienter);
   if (d_buffer != NULL) {
     container->release_buffer(container, d_buffer);
   }
@@ -37,12 +37,13 @@ bool png_is_magic(Stream* stream);
 
 const char* png_get_description();
 
-void* png_decode(Stream* stream, bool partially, bool* animated);
+void* png_decode(Stream* stream, bool partially, int32_t quality, bool* animated);
 
 bool png_decode_info(Stream* stream, ImageInfo* info);
 
 bool png_decode_buffer(Stream* stream, bool clip, uint32_t x, uint32_t y, uint32_t width,
-    uint32_t height, int32_t config, uint32_t ratio, BufferContainer* container);
+    uint32_t height, int32_t config, float ratio, int32_t resample,
+    int32_t orientation, int32_t quality, bool premultiply, BufferContainer* container);
 
 
 #endif // IMAGE_IMAGE_PNG_H
@@ -19,7 +19,10 @@
 #include "com_hippo_image_NativeTest.h"
 #include "test_utils.h"
 #include "test_image_utils.h"
+#include "test_image_resample.h"
 #include "test_buffer.h"
+#include "test_byte_source.h"
+#include "test_source_cache.h"
 
 JNIEXPORT jint JNICALL Java_com_hippo_image_NativeTest_nativeTestNative(
     JNIEnv* env,
@@ -45,7 +48,10 @@ JNIEXPORT jint JNICALL Java_com_hippo_image_NativeTest_nativeTestNative(
   suite = suite_create("Native");
   suite_add_tcase(suite, utils_case());
   suite_add_tcase(suite, image_utils_case());
+  suite_add_tcase(suite, image_resample_case());
   suite_add_tcase(suite, buffer_case());
+  suite_add_tcase(suite, byte_source_case());
+  suite_add_tcase(suite, source_cache_case());
 
   runner = srunner_create(suite);
   srunner_set_xml(runner, c_log_file);
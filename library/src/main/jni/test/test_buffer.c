@@ -15,9 +15,18 @@
  */
 
 #include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 
 #include "test_buffer.h"
 #include "stream/buffer.h"
+#include "log.h"
+
+// Bytes streamed through a buffer in throughput cases
+#define THROUGHPUT_SIZE (16 * 1024 * 1024)
+#define THROUGHPUT_CAPACITY (64 * 1024)
+#define THROUGHPUT_CHUNK 3000
 
 START_TEST(test_buffer_new) {
     Buffer* buffer = buffer_new(8, false);
@@ -157,6 +166,207 @@ START_TEST(test_buffer_shrink) {
   }
 END_TEST
 
+START_TEST(test_buffer_ring_new) {
+    Buffer* buffer = buffer_new_ring(5);
+    ck_assert(buffer->ring);
+    ck_assert(!buffer->extendable);
+    ck_assert_int_eq(0, buffer->position);
+    ck_assert_int_eq(0, buffer->length);
+    ck_assert_int_eq(8, buffer->capacity);
+    buffer_close(&buffer);
+
+    buffer = buffer_new_ring(1);
+    ck_assert_int_eq(1, buffer->capacity);
+    buffer_close(&buffer);
+
+    ck_assert_ptr_null(buffer_new_ring(0));
+  }
+END_TEST
+
+START_TEST(test_buffer_ring_read_write) {
+    Buffer* buffer = buffer_new_ring(4);
+    unsigned char src[6] = { 0, 1, 2, 3, 4, 5 };
+    unsigned char dst[6];
+
+    ck_assert_int_eq(3, buffer_write(buffer, src, 3));
+    ck_assert_int_eq(2, buffer_read(buffer, dst, 2));
+    ck_assert_mem_eq(src, dst, 2);
+
+    // Wrap around, only 3 bytes are free
+    ck_assert_int_eq(3, buffer_write(buffer, src + 3, 3));
+    ck_assert_int_eq(2, buffer->position);
+    ck_assert_int_eq(6, buffer->length);
+    ck_assert_int_eq(4, buffer->capacity);
+    ck_assert_int_eq(0, buffer_write(buffer, src, 1));
+
+    ck_assert_int_eq(4, buffer_read(buffer, dst + 2, 6));
+    ck_assert_mem_eq(src, dst, 6);
+    ck_assert_int_eq(6, buffer->position);
+    ck_assert_int_eq(0, buffer_read(buffer, dst, 1));
+
+    buffer_close(&buffer);
+  }
+END_TEST
+
+START_TEST(test_buffer_ring_seek) {
+    Buffer* buffer = buffer_new_ring(4);
+    unsigned char src[6] = { 0, 1, 2, 3, 4, 5 };
+    unsigned char dst[6];
+
+    buffer_write(buffer, src, 4);
+    buffer_read(buffer, dst, 4);
+    ck_assert_int_eq(1, buffer_seek(buffer, 1));
+    buffer_read(buffer, dst, 4);
+
+    // Byte 0 and 1 are overwritten
+    buffer_write(buffer, src + 4, 2);
+    ck_assert_int_eq(2, buffer_seek(buffer, 0));
+    ck_assert_int_eq(4, buffer_read(buffer, dst, 6));
+    ck_assert_mem_eq(src + 2, dst, 4);
+
+    ck_assert_int_eq(6, buffer_seek(buffer, 7));
+
+    buffer_close(&buffer);
+  }
+END_TEST
+
+START_TEST(test_buffer_segment) {
+    Buffer* buffer = buffer_new(4, false);
+    unsigned char src[4] = { 0, 1, 2, 3 };
+    unsigned char* segment;
+    size_t size;
+
+    segment = buffer_get_write_segment(buffer, &size);
+    ck_assert_int_eq(4, size);
+    memcpy(segment, src, 3);
+    ck_assert_int_eq(3, buffer_commit_write(buffer, 3));
+    ck_assert_int_eq(3, buffer->length);
+
+    buffer_seek(buffer, 1);
+    segment = buffer_get_read_segment(buffer, &size);
+    ck_assert_int_eq(2, size);
+    ck_assert_mem_eq(src + 1, segment, 2);
+
+    ck_assert_int_eq(1, buffer_commit_write(buffer, 2));
+    buffer_close(&buffer);
+
+    buffer = buffer_new_ring(4);
+    buffer_write(buffer, src, 3);
+    buffer_seek(buffer, 2);
+
+    // Free space is split by the end of the memory block
+    segment = buffer_get_write_segment(buffer, &size);
+    ck_assert_int_eq(1, size);
+    *segment = src[3];
+    ck_assert_int_eq(1, buffer_commit_write(buffer, 1));
+    segment = buffer_get_write_segment(buffer, &size);
+    ck_assert_int_eq(2, size);
+    memcpy(segment, src, 2);
+    ck_assert_int_eq(2, buffer_commit_write(buffer, 2));
+    ck_assert_int_eq(6, buffer->length);
+
+    segment = buffer_get_read_segment(buffer, &size);
+    ck_assert_int_eq(2, size);
+    ck_assert_mem_eq(src + 2, segment, 2);
+    buffer_seek(buffer, 4);
+    segment = buffer_get_read_segment(buffer, &size);
+    ck_assert_int_eq(2, size);
+    ck_assert_mem_eq(src, segment, 2);
+
+    buffer_close(&buffer);
+  }
+END_TEST
+
+START_TEST(test_buffer_ring_shrink) {
+    Buffer* buffer = buffer_new_ring(4);
+    unsigned char src[6] = { 0, 1, 2, 3, 4, 5 };
+    unsigned char dst[3];
+
+    buffer_write(buffer, src, 4);
+    buffer_read(buffer, dst, 3);
+    buffer_write(buffer, src + 4, 2);
+    buffer_read(buffer, dst, 2);
+    buffer_shrink(buffer);
+
+    // Bytes stay at the same offset
+    ck_assert_int_eq(1, buffer->position);
+    ck_assert_int_eq(2, buffer->length);
+    ck_assert_int_eq(1, buffer_read(buffer, dst, 3));
+    ck_assert_int_eq(5, dst[0]);
+
+    buffer_close(&buffer);
+  }
+END_TEST
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Keep the buffer half full, like a stream reading ahead of its consumer.
+// Every byte is i % 251, sum is checked at the end.
+static void stream_through(Buffer* buffer, bool in_place) {
+  unsigned char chunk[THROUGHPUT_CHUNK];
+  unsigned char* segment;
+  size_t written = 0;
+  size_t read = 0;
+  size_t size;
+  size_t n;
+  uint64_t sum = 0;
+  uint64_t expected = 0;
+  double start = now_ms();
+
+  while (read < THROUGHPUT_SIZE) {
+    while (written < THROUGHPUT_SIZE &&
+        buffer->length - buffer->position < THROUGHPUT_CAPACITY / 2) {
+      for (n = 0; n < THROUGHPUT_CHUNK; n++) {
+        chunk[n] = (unsigned char) ((written + n) % 251);
+      }
+      n = MIN(THROUGHPUT_CHUNK, THROUGHPUT_SIZE - written);
+      if (in_place) {
+        segment = buffer_get_write_segment(buffer, &size);
+        size = MIN(size, n);
+        memcpy(segment, chunk, size);
+        written += buffer_commit_write(buffer, size);
+      } else {
+        if (buffer->capacity - buffer->length < n) {
+          buffer_shrink(buffer);
+        }
+        written += buffer_write(buffer, chunk, n);
+      }
+    }
+
+    n = buffer_read(buffer, chunk, THROUGHPUT_CHUNK / 3);
+    for (size = 0; size < n; size++) {
+      sum += chunk[size];
+    }
+    read += n;
+  }
+
+  for (n = 0; n < THROUGHPUT_SIZE; n++) {
+    expected += n % 251;
+  }
+  ck_assert_uint_eq(expected, sum);
+
+  LOGI("Buffer %s: %.1f MB/s", buffer->ring ? "ring" : "linear",
+      THROUGHPUT_SIZE / 1024.0 / 1024.0 / ((now_ms() - start) / 1000.0));
+}
+
+START_TEST(test_buffer_throughput_linear) {
+    Buffer* buffer = buffer_new(THROUGHPUT_CAPACITY, false);
+    stream_through(buffer, false);
+    buffer_close(&buffer);
+  }
+END_TEST
+
+START_TEST(test_buffer_throughput_ring) {
+    Buffer* buffer = buffer_new_ring(THROUGHPUT_CAPACITY);
+    stream_through(buffer, true);
+    buffer_close(&buffer);
+  }
+END_TEST
+
 TCase* buffer_case() {
   TCase* t_case = tcase_create("Buffer");
 
@@ -167,6 +377,13 @@ TCase* buffer_case() {
   tcase_add_test(t_case, test_buffer_write_extendable);
   tcase_add_test(t_case, test_buffer_seek);
   tcase_add_test(t_case, test_buffer_shrink);
+  tcase_add_test(t_case, test_buffer_ring_new);
+  tcase_add_test(t_case, test_buffer_ring_read_write);
+  tcase_add_test(t_case, test_buffer_ring_seek);
+  tcase_add_test(t_case, test_buffer_segment);
+  tcase_add_test(t_case, test_buffer_ring_shrink);
+  tcase_add_test(t_case, test_buffer_throughput_linear);
+  tcase_add_test(t_case, test_buffer_throughput_ring);
 
   return t_case;
 }
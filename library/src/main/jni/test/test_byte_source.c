@@ -0,0 +1,165 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test_byte_source.h"
+#include "stream/buffer_stream.h"
+#include "stream/byte_source.h"
+#include "utils.h"
+
+// Larger than the first few chunks of a stream with unknown size
+#define SOURCE_SIZE (100 * 1000)
+
+static uint8_t* new_data() {
+  uint8_t* data = malloc(SOURCE_SIZE);
+  for (size_t i = 0; i < SOURCE_SIZE; i++) {
+    data[i] = (uint8_t) (i * 31 + (i >> 8));
+  }
+  return data;
+}
+
+// Read a stream which doesn't know its size, so the bytes are kept in chunks
+static ByteSource* new_chunked_source(const uint8_t* data) {
+  Stream* stream = buffer_stream_wrap(data, SOURCE_SIZE);
+  ByteSource* source;
+
+  stream->size = NULL;
+  stream->tell = NULL;
+  source = byte_source_new_from_stream(stream, 0);
+  stream->close(&stream);
+
+  return source;
+}
+
+START_TEST(test_byte_source_read_chunked) {
+    uint8_t* data = new_data();
+    uint8_t* dst = malloc(SOURCE_SIZE);
+    ByteSource* source = new_chunked_source(data);
+    Stream* cursor;
+    size_t len = 0;
+    size_t n;
+
+    ck_assert_ptr_nonnull(source);
+    ck_assert_int_eq(SOURCE_SIZE, byte_source_get_size(source));
+
+    // Odd reads cross every chunk end
+    cursor = byte_source_open(source);
+    while ((n = cursor->read(cursor, dst + len, MIN(777, SOURCE_SIZE - len))) != 0) {
+      len += n;
+    }
+    ck_assert_int_eq(SOURCE_SIZE, len);
+    ck_assert_mem_eq(data, dst, SOURCE_SIZE);
+    ck_assert_int_eq(0, cursor->read(cursor, dst, 1));
+    cursor->close(&cursor);
+
+    byte_source_unref(&source);
+    ck_assert_ptr_null(source);
+    free(data);
+    free(dst);
+  }
+END_TEST
+
+START_TEST(test_byte_source_seek) {
+    const size_t positions[] = { 16383, 16384, 0, 50001, SOURCE_SIZE - 1, 1 };
+    uint8_t* data = new_data();
+    ByteSource* source = new_chunked_source(data);
+    Stream* cursor = byte_source_open(source);
+    uint8_t bytes[3];
+
+    for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+      size_t position = positions[i];
+      size_t len = MIN(sizeof(bytes), SOURCE_SIZE - position);
+      ck_assert(cursor->seek(cursor, position));
+      ck_assert_int_eq(position, cursor->tell(cursor));
+      ck_assert_int_eq(len, cursor->read(cursor, bytes, sizeof(bytes)));
+      ck_assert_mem_eq(data + position, bytes, len);
+    }
+
+    ck_assert(cursor->seek(cursor, SOURCE_SIZE));
+    ck_assert_int_eq(0, cursor->read(cursor, bytes, 1));
+    ck_assert(!cursor->seek(cursor, SOURCE_SIZE + 1));
+    ck_assert_int_eq(SOURCE_SIZE, cursor->size(cursor));
+
+    cursor->close(&cursor);
+    byte_source_unref(&source);
+    free(data);
+  }
+END_TEST
+
+START_TEST(test_byte_source_borrow) {
+    uint8_t* data = new_data();
+    ByteSource* source = new_chunked_source(data);
+    Stream* cursor = byte_source_open(source);
+    const uint8_t* bytes;
+    size_t len = 0;
+    size_t borrows = 0;
+    size_t n;
+
+    // At most a chunk at a time, in place
+    while ((bytes = cursor->borrow(cursor, SIZE_MAX, &n)), n != 0) {
+      ck_assert_mem_eq(data + len, bytes, n);
+      len += n;
+      borrows++;
+    }
+    ck_assert_int_eq(SOURCE_SIZE, len);
+    ck_assert_int_gt(borrows, 1);
+    cursor->close(&cursor);
+    byte_source_unref(&source);
+
+    // A wrapped block is lent as it is
+    source = byte_source_wrap(data, SOURCE_SIZE);
+    cursor = byte_source_open(source);
+    ck_assert(cursor->seek(cursor, 10));
+    bytes = cursor->borrow(cursor, SIZE_MAX, &n);
+    ck_assert_ptr_eq(data + 10, bytes);
+    ck_assert_int_eq(SOURCE_SIZE - 10, n);
+    cursor->close(&cursor);
+    byte_source_unref(&source);
+
+    free(data);
+  }
+END_TEST
+
+START_TEST(test_byte_source_ref) {
+    uint8_t* data = new_data();
+    ByteSource* source = new_chunked_source(data);
+    Stream* cursor = byte_source_open(source);
+    uint8_t byte;
+
+    // The cursor keeps the bytes
+    byte_source_unref(&source);
+    ck_assert(cursor->seek(cursor, SOURCE_SIZE - 1));
+    ck_assert_int_eq(1, cursor->read(cursor, &byte, 1));
+    ck_assert_int_eq(data[SOURCE_SIZE - 1], byte);
+    cursor->close(&cursor);
+
+    free(data);
+  }
+END_TEST
+
+TCase* byte_source_case() {
+  TCase* t_case = tcase_create("ByteSource");
+
+  tcase_add_test(t_case, test_byte_source_read_chunked);
+  tcase_add_test(t_case, test_byte_source_seek);
+  tcase_add_test(t_case, test_byte_source_borrow);
+  tcase_add_test(t_case, test_byte_source_ref);
+
+  return t_case;
+}
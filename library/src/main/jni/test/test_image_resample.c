@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test_image_resample.h"
+#include "image_decoder.h"
+#include "image_orientation.h"
+#include "image_resample.h"
+
+// Few source rows upscaled to more destination rows than a transposing
+// orienter keeps in its strip, so one push emits rows across the strip
+#define SRC_WIDTH 3
+#define SRC_HEIGHT 2
+#define DST_WIDTH 5
+#define DST_HEIGHT 40
+
+static void resample_rgba(int32_t orientation, uint8_t* dst, size_t dst_stride) {
+  uint8_t src[SRC_HEIGHT][SRC_WIDTH * 4];
+  Resampler* resampler;
+  Orienter* orienter = NULL;
+  uint32_t y;
+
+  for (uint32_t i = 0; i < sizeof(src); i++) {
+    ((uint8_t*) src)[i] = (uint8_t) (i * 37);
+  }
+
+  resampler = resampler_new(IMAGE_RESAMPLE_BILINEAR, IMAGE_CONFIG_RGBA_8888,
+      IMAGE_CONFIG_RGBA_8888, SRC_WIDTH, SRC_HEIGHT, DST_WIDTH, DST_HEIGHT, dst, dst_stride);
+  ck_assert(resampler != NULL);
+  if (orientation != IMAGE_ORIENTATION_NORMAL) {
+    orienter = orienter_new(orientation, IMAGE_CONFIG_RGBA_8888, 0, 0, DST_WIDTH, DST_HEIGHT,
+        DST_WIDTH, DST_HEIGHT, dst, dst_stride);
+    ck_assert(orienter != NULL);
+    resampler_set_orienter(resampler, orienter);
+  }
+
+  while ((y = resampler_next_row(resampler)) < SRC_HEIGHT) {
+    resampler_push_row(resampler, src[y]);
+  }
+
+  resampler_delete(&resampler);
+  orienter_delete(&orienter);
+}
+
+START_TEST(test_bilinear_upscale_rotate_90) {
+    const size_t stride = DST_WIDTH * 4;
+    const size_t rotated_stride = DST_HEIGHT * 4;
+    uint8_t* expected = malloc(DST_HEIGHT * stride);
+    uint8_t* rotated = malloc(DST_WIDTH * rotated_stride);
+
+    resample_rgba(IMAGE_ORIENTATION_NORMAL, expected, stride);
+    resample_rgba(IMAGE_ORIENTATION_ROTATE_90, rotated, rotated_stride);
+
+    // Unoriented (x, y) goes to (DST_HEIGHT - 1 - y, x)
+    for (uint32_t y = 0; y < DST_HEIGHT; y++) {
+      for (uint32_t x = 0; x < DST_WIDTH; x++) {
+        ck_assert_mem_eq(expected + y * stride + x * 4,
+            rotated + x * rotated_stride + (DST_HEIGHT - 1 - y) * 4, 4);
+      }
+    }
+
+    free(expected);
+    free(rotated);
+  }
+END_TEST
+
+TCase* image_resample_case() {
+  TCase* t_case = tcase_create("ImageResample");
+
+  tcase_add_test(t_case, test_bilinear_upscale_rotate_90);
+
+  return t_case;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "test_source_cache.h"
+#include "stream/byte_source.h"
+#include "stream/source_cache.h"
+
+#define ENTRY_SIZE 100
+
+static uint8_t BYTES[4][ENTRY_SIZE];
+
+static bool put(SourceCache* cache, const char* key, const uint8_t* bytes, size_t size) {
+  ByteSource* source = byte_source_wrap(bytes, size);
+  bool result = source_cache_put(cache, key, strlen(key), source);
+  byte_source_unref(&source);
+  return result;
+}
+
+static bool contains(SourceCache* cache, const char* key) {
+  return source_cache_contains(cache, key, strlen(key));
+}
+
+// Return true if key is cached with bytes
+static bool get_is(SourceCache* cache, const char* key, const uint8_t* bytes) {
+  ByteSource* source = source_cache_get(cache, key, strlen(key));
+  Stream* cursor;
+  const void* borrowed;
+  size_t n;
+
+  if (source == NULL) {
+    return false;
+  }
+  cursor = byte_source_open(source);
+  borrowed = cursor->borrow(cursor, SIZE_MAX, &n);
+  cursor->close(&cursor);
+  byte_source_unref(&source);
+
+  return borrowed == bytes;
+}
+
+START_TEST(test_source_cache_lru) {
+    SourceCache* cache = source_cache_new(3 * ENTRY_SIZE);
+    SourceCacheStats stats;
+
+    ck_assert(put(cache, "a", BYTES[0], ENTRY_SIZE));
+    ck_assert(put(cache, "b", BYTES[1], ENTRY_SIZE));
+    ck_assert(put(cache, "c", BYTES[2], ENTRY_SIZE));
+
+    // a is used, b is the least recently used now
+    ck_assert(get_is(cache, "a", BYTES[0]));
+    ck_assert(put(cache, "d", BYTES[3], ENTRY_SIZE));
+    ck_assert(contains(cache, "a"));
+    ck_assert(!contains(cache, "b"));
+    ck_assert(contains(cache, "c"));
+    ck_assert(contains(cache, "d"));
+
+    // contains() doesn't mark c, it goes next
+    ck_assert(contains(cache, "c"));
+    ck_assert(put(cache, "b", BYTES[1], ENTRY_SIZE));
+    ck_assert(!contains(cache, "c"));
+
+    ck_assert(!get_is(cache, "c", BYTES[2]));
+    source_cache_get_stats(cache, &stats);
+    ck_assert_int_eq(1, stats.hits);
+    ck_assert_int_eq(1, stats.misses);
+    ck_assert_int_eq(2, stats.evictions);
+    ck_assert_int_eq(3, stats.count);
+    ck_assert_int_eq(3 * ENTRY_SIZE, stats.size);
+
+    source_cache_delete(&cache);
+    ck_assert_ptr_null(cache);
+  }
+END_TEST
+
+START_TEST(test_source_cache_budget) {
+    SourceCache* cache = source_cache_new(2 * ENTRY_SIZE);
+    SourceCacheStats stats;
+
+    // Larger than the budget
+    ck_assert(!put(cache, "a", BYTES[0], 2 * ENTRY_SIZE + 1));
+    ck_assert(!contains(cache, "a"));
+
+    ck_assert(put(cache, "a", BYTES[0], ENTRY_SIZE));
+    ck_assert(put(cache, "b", BYTES[1], ENTRY_SIZE));
+    ck_assert(put(cache, "c", BYTES[2], 2 * ENTRY_SIZE));
+    ck_assert(!contains(cache, "a"));
+    ck_assert(!contains(cache, "b"));
+    ck_assert(contains(cache, "c"));
+
+    ck_assert(put(cache, "a", BYTES[0], ENTRY_SIZE));
+    source_cache_set_max_size(cache, ENTRY_SIZE);
+    ck_assert(contains(cache, "a"));
+    ck_assert(!contains(cache, "c"));
+
+    source_cache_trim(cache, 0);
+    source_cache_get_stats(cache, &stats);
+    ck_assert_int_eq(0, stats.count);
+    ck_assert_int_eq(0, stats.size);
+    ck_assert_int_eq(ENTRY_SIZE, stats.max_size);
+
+    // Nothing is cached without a budget
+    source_cache_set_max_size(cache, 0);
+    ck_assert(!put(cache, "a", BYTES[0], ENTRY_SIZE));
+
+    source_cache_delete(&cache);
+  }
+END_TEST
+
+START_TEST(test_source_cache_replace) {
+    SourceCache* cache = source_cache_new(4 * ENTRY_SIZE);
+    SourceCacheStats stats;
+
+    ck_assert(put(cache, "a", BYTES[0], ENTRY_SIZE));
+    ck_assert(put(cache, "a", BYTES[1], ENTRY_SIZE / 2));
+    ck_assert(get_is(cache, "a", BYTES[1]));
+    source_cache_get_stats(cache, &stats);
+    ck_assert_int_eq(1, stats.count);
+    ck_assert_int_eq(ENTRY_SIZE / 2, stats.size);
+    ck_assert_int_eq(0, stats.evictions);
+
+    // A source too large for the budget drops the old one too
+    ck_assert(!put(cache, "a", BYTES[2], 4 * ENTRY_SIZE + 1));
+    ck_assert(!contains(cache, "a"));
+
+    source_cache_delete(&cache);
+  }
+END_TEST
+
+START_TEST(test_source_cache_key) {
+    SourceCache* cache = source_cache_new(4 * ENTRY_SIZE);
+    char key[64];
+
+    // Every byte of the key counts
+    ck_assert(put(cache, "ab", BYTES[0], ENTRY_SIZE));
+    ck_assert(put(cache, "abc", BYTES[1], ENTRY_SIZE));
+    ck_assert(put(cache, "ba", BYTES[2], ENTRY_SIZE));
+    ck_assert(get_is(cache, "ab", BYTES[0]));
+    ck_assert(get_is(cache, "abc", BYTES[1]));
+    ck_assert(get_is(cache, "ba", BYTES[2]));
+    ck_assert(!contains(cache, "a"));
+
+    // The cache keeps its own copy of the key
+    strcpy(key, "https://example.com/1.jpg");
+    ck_assert(put(cache, key, BYTES[3], ENTRY_SIZE));
+    key[strlen(key) - 5] = '2';
+    ck_assert(!contains(cache, key));
+    ck_assert(get_is(cache, "https://example.com/1.jpg", BYTES[3]));
+
+    source_cache_delete(&cache);
+  }
+END_TEST
+
+TCase* source_cache_case() {
+  TCase* t_case = tcase_create("SourceCache");
+
+  tcase_add_test(t_case, test_source_cache_lru);
+  tcase_add_test(t_case, test_source_cache_budget);
+  tcase_add_test(t_case, test_source_cache_replace);
+  tcase_add_test(t_case, test_source_cache_key);
+
+  return t_case;
+}
@@ -26,4 +26,9 @@
 
 #define CLEAR(p, n) if ((p) != NULL) memset((p), 0, (n))
 
+// Bionic defines __unused, glibc doesn't
+#ifndef __unused
+#  define __unused __attribute__((__unused__))
+#endif
+
 #endif // UTILS_H